@@ -0,0 +1,28 @@
+#ifndef INTERFACE_METRICS_H
+#define INTERFACE_METRICS_H
+
+#include "Types.h"
+
+enum EMetricType
+{
+	EMetricType_Counter,
+	EMetricType_Gauge,
+	EMetricType_Histogram
+};
+
+/**
+* Metric registered via IServer::getMetric(). Metrics are owned by the server and
+* stay valid until shutdown, so callers should look them up once and keep the pointer.
+*/
+class IMetric
+{
+public:
+	//Counter or gauge
+	virtual void add(int64 val)=0;
+	//Gauge
+	virtual void set(int64 val)=0;
+	//Histogram. Buckets are latency buckets in seconds (10us to 10s)
+	virtual void observe(double val)=0;
+};
+
+#endif //INTERFACE_METRICS_H
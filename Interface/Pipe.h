@@ -44,6 +44,12 @@ public:
 	virtual void resetTransferedBytes(void)=0;
 
 	virtual _i64 getRealTransferredBytes() { return 0; }
+
+	/**
+	* Accounts (and throttles) bytes written to the underlying socket
+	* without this pipe, e.g. via sendfile
+	*/
+	virtual void addOutgoingBytes(size_t bytes) {}
 };
 
 #endif //IPIPE_H
@@ -18,6 +18,10 @@ public:
 	virtual bool addBytes(size_t n_bytes, bool wait)=0;
 	virtual void changeThrottleLimit(size_t bps, bool p_percent_max)=0;
 	virtual void changeThrottleUpdater(IPipeThrottlerUpdater* new_updater)=0;
+	//Bytes are also accounted (and possibly delayed) by the parent
+	virtual void setParent(IPipeThrottler* parent)=0;
+	//Bytes per second measured over the last second
+	virtual size_t getCurrentRate()=0;
 };
 
 
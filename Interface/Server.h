@@ -3,6 +3,7 @@
 
 #include <string>
 #include "Types.h"
+#include "Metrics.h"
 
 #define LL_DEBUG -1
 #define LL_INFO 0
@@ -82,6 +83,7 @@ public:
 
 	virtual int64 getTimeSeconds(void)=0;
 	virtual int64 getTimeMS(void)=0;
+	virtual int64 getTimeUS(void)=0;
 
 	virtual bool LoadDLL(const std::string &name)=0;
 	virtual bool UnloadDLL(const std::string &name)=0;
@@ -191,6 +193,9 @@ public:
 	virtual void setFailBit(size_t failbit)=0;
 	virtual void clearFailBit(size_t failbit)=0;
 	virtual size_t getFailBits(void)=0;
+
+	virtual IMetric* getMetric(const std::string& name, const std::string& help, EMetricType type)=0;
+	virtual std::string getMetricsText(void)=0;
 };
 
 #ifndef NO_INTERFACE
@@ -0,0 +1,212 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "Metrics.h"
+#include "Server.h"
+#include "Interface/Mutex.h"
+#include "stringtools.h"
+#include "common/atomic.h"
+
+namespace
+{
+	const double histogram_buckets[] = { 0.00001, 0.00005, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10 };
+	const size_t num_histogram_buckets = sizeof(histogram_buckets)/sizeof(histogram_buckets[0]);
+	//Histogram sums are kept as integer nanoseconds so they can be updated atomically
+	const double histogram_sum_scale = 1000000000.0;
+
+	using common::atomic_add;
+	using common::atomic_load;
+	using common::atomic_store;
+
+	std::string metricTypeStr(EMetricType type)
+	{
+		switch(type)
+		{
+		case EMetricType_Counter: return "counter";
+		case EMetricType_Gauge: return "gauge";
+		case EMetricType_Histogram: return "histogram";
+		default: return "untyped";
+		}
+	}
+
+	std::string labelsStr(const std::string& labels, const std::string& extra)
+	{
+		if(labels.empty() && extra.empty())
+		{
+			return std::string();
+		}
+		else if(labels.empty())
+		{
+			return "{"+extra+"}";
+		}
+		else if(extra.empty())
+		{
+			return "{"+labels+"}";
+		}
+		return "{"+labels+","+extra+"}";
+	}
+}
+
+Metric::Metric(EMetricType type)
+	: type(type), value(0), sum_ns(0)
+{
+	if(type==EMetricType_Histogram)
+	{
+		bucket_counts.resize(num_histogram_buckets+1);
+	}
+}
+
+Metric::~Metric()
+{
+}
+
+void Metric::add(int64 val)
+{
+	atomic_add(&value, val);
+}
+
+void Metric::set(int64 val)
+{
+	atomic_store(&value, val);
+}
+
+void Metric::observe(double val)
+{
+	if(bucket_counts.empty())
+	{
+		return;
+	}
+
+	size_t i;
+	for(i=0;i<num_histogram_buckets;++i)
+	{
+		if(val<=histogram_buckets[i])
+		{
+			break;
+		}
+	}
+
+	atomic_add(&bucket_counts[i], 1);
+	atomic_add(&value, 1);
+	atomic_add(&sum_ns, static_cast<int64>(val*histogram_sum_scale));
+}
+
+EMetricType Metric::getType()
+{
+	return type;
+}
+
+void Metric::writeText(const std::string& name, const std::string& labels, std::string& out)
+{
+	if(type!=EMetricType_Histogram)
+	{
+		out+=name+labelsStr(labels, std::string())+" "+convert(atomic_load(&value))+"\n";
+		return;
+	}
+
+	//Concurrent observations may make the buckets and the count disagree slightly.
+	//The count is derived from the buckets so that +Inf always matches it.
+	int64 cumulative=0;
+	for(size_t i=0;i<num_histogram_buckets;++i)
+	{
+		cumulative+=atomic_load(&bucket_counts[i]);
+		out+=name+"_bucket"+labelsStr(labels, "le=\""+convert(histogram_buckets[i])+"\"")+" "+convert(cumulative)+"\n";
+	}
+	cumulative+=atomic_load(&bucket_counts[num_histogram_buckets]);
+	out+=name+"_bucket"+labelsStr(labels, "le=\"+Inf\"")+" "+convert(cumulative)+"\n";
+	out+=name+"_sum"+labelsStr(labels, std::string())+" "+convert(atomic_load(&sum_ns)/histogram_sum_scale)+"\n";
+	out+=name+"_count"+labelsStr(labels, std::string())+" "+convert(cumulative)+"\n";
+}
+
+MetricsRegistry::MetricsRegistry()
+{
+	mutex=Server->createMutex();
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+	for(std::map<std::string, SMetricFamily>::iterator it=families.begin();it!=families.end();++it)
+	{
+		for(std::map<std::string, Metric*>::iterator it_m=it->second.metrics.begin();
+			it_m!=it->second.metrics.end();++it_m)
+		{
+			delete it_m->second;
+		}
+	}
+
+	Server->destroy(mutex);
+}
+
+IMetric* MetricsRegistry::getMetric(const std::string& name, const std::string& help, EMetricType type)
+{
+	std::string base_name=name;
+	std::string labels;
+
+	size_t label_start=name.find("{");
+	if(label_start!=std::string::npos
+		&& !name.empty()
+		&& name[name.size()-1]=='}')
+	{
+		base_name=name.substr(0, label_start);
+		labels=name.substr(label_start+1, name.size()-label_start-2);
+	}
+
+	IScopedLock lock(mutex);
+
+	std::map<std::string, SMetricFamily>::iterator it=families.find(base_name);
+	if(it==families.end())
+	{
+		SMetricFamily& family=families[base_name];
+		family.type=type;
+		family.help=help;
+		it=families.find(base_name);
+	}
+	else if(it->second.type!=type)
+	{
+		Server->Log("Metric \""+name+"\" registered with different types", LL_ERROR);
+	}
+
+	std::map<std::string, Metric*>::iterator it_m=it->second.metrics.find(labels);
+	if(it_m!=it->second.metrics.end())
+	{
+		return it_m->second;
+	}
+
+	Metric* metric=new Metric(it->second.type);
+	it->second.metrics[labels]=metric;
+	return metric;
+}
+
+std::string MetricsRegistry::getText()
+{
+	IScopedLock lock(mutex);
+
+	std::string ret;
+	for(std::map<std::string, SMetricFamily>::iterator it=families.begin();it!=families.end();++it)
+	{
+		ret+="# HELP "+it->first+" "+it->second.help+"\n";
+		ret+="# TYPE "+it->first+" "+metricTypeStr(it->second.type)+"\n";
+
+		for(std::map<std::string, Metric*>::iterator it_m=it->second.metrics.begin();
+			it_m!=it->second.metrics.end();++it_m)
+		{
+			it_m->second->writeText(it->first, it_m->first, ret);
+		}
+	}
+	return ret;
+}
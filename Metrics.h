@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Interface/Metrics.h"
+#include <string>
+#include <vector>
+#include <map>
+
+class IMutex;
+
+class Metric : public IMetric
+{
+public:
+	Metric(EMetricType type);
+	~Metric();
+
+	virtual void add(int64 val);
+	virtual void set(int64 val);
+	virtual void observe(double val);
+
+	EMetricType getType();
+
+	void writeText(const std::string& name, const std::string& labels, std::string& out);
+
+private:
+	EMetricType type;
+	volatile int64 value;
+	volatile int64 sum_ns;
+	std::vector<int64> bucket_counts;
+};
+
+class MetricsRegistry
+{
+public:
+	MetricsRegistry();
+	~MetricsRegistry();
+
+	IMetric* getMetric(const std::string& name, const std::string& help, EMetricType type);
+
+	std::string getText();
+
+private:
+	struct SMetricFamily
+	{
+		SMetricFamily()
+			: type(EMetricType_Counter) {}
+
+		EMetricType type;
+		std::string help;
+		std::map<std::string, Metric*> metrics;
+	};
+
+	std::map<std::string, SMetricFamily> families;
+
+	IMutex* mutex;
+};
@@ -20,21 +20,101 @@
 #include "Server.h"
 #include "Interface/Mutex.h"
 #include "stringtools.h"
+#include "common/atomic.h"
+#include <algorithm>
 
 #define DLOG(x) //x
 
+namespace
+{
+	//Bucket size in ms worth of the throttle limit
+	const int64 burst_ms = 500;
+	const int64 min_burst_bytes = 64*1024;
+	const int64 rate_window_ms = 1000;
+	//A child counts as active for the parent's fair share if it sent
+	//something in the current or the previous epoch
+	const int64 active_epoch_ms = 500;
+	//Active children are counted per epoch in one value (epoch in the high bits)
+	const int active_count_bits = 24;
+	const int64 active_count_mask = (static_cast<int64>(1)<<active_count_bits) - 1;
+
+	using common::atomic_add;
+	using common::atomic_cas;
+	using common::atomic_load;
+	using common::atomic_store;
+
+	int64 burst_bytes(size_t bps)
+	{
+		return (std::max)(static_cast<int64>(bps)*burst_ms/1000, min_burst_bytes);
+	}
+
+	void refill_bucket(volatile int64* tokens, volatile int64* last_refill, int64 ctime, int64 bps)
+	{
+		int64 last = atomic_load(last_refill);
+		int64 passed_time = ctime - last;
+		if(passed_time<=0)
+		{
+			return;
+		}
+
+		int64 max_tokens = burst_bytes(static_cast<size_t>(bps));
+		int64 add;
+		int64 new_last;
+		if(passed_time>max_tokens*1000/bps)
+		{
+			add = max_tokens;
+			new_last = ctime;
+		}
+		else
+		{
+			add = (bps*passed_time)/1000;
+			if(add<=0)
+			{
+				//Wait until at least one token can be added, so that slow
+				//limits are not rounded down to zero
+				return;
+			}
+			new_last = last + (std::max)((add*1000)/bps, static_cast<int64>(1));
+		}
+
+		if(atomic_cas(last_refill, last, new_last)!=last)
+		{
+			//Another thread refilled the bucket for this time
+			return;
+		}
+
+		int64 curr = atomic_load(tokens);
+		while(curr<max_tokens)
+		{
+			int64 prev = atomic_cas(tokens, curr, (std::min)(curr+add, max_tokens));
+			if(prev==curr)
+			{
+				break;
+			}
+			curr = prev;
+		}
+	}
+}
+
 PipeThrottler::PipeThrottler(size_t bps,
 	bool percent_max,
 	IPipeThrottlerUpdater* updater)
-	: throttle_bps(bps), percent_max(percent_max), curr_bytes(0),
-	lastresettime(0), updater(updater),
+	: throttle_bps(bps), percent_max(percent_max),
+	updater(updater),
 	throttle_state(ThrottleState_Probe),
 	lastprobetime(0), probe_bps(0),
 	throttle_percent(bps), last_probe_result(0),
-	probe_interval(10 * 60 * 1000)
+	probe_interval(10 * 60 * 1000),
+	tokens(burst_bytes(bps)), share_tokens(0), active_epoch(-1),
+	window_bytes(0), curr_rate(0), parent(NULL)
 {
 	mutex=Server->createMutex();
 	lastupdatetime=Server->getTimeMS();
+	last_refill=lastupdatetime;
+	share_last_refill=lastupdatetime;
+	window_start=lastupdatetime;
+	active_children[0]=0;
+	active_children[1]=0;
 	if(updater!=NULL)
 	{
 		update_time_interval = updater->getUpdateIntervalMs();
@@ -52,11 +132,125 @@ PipeThrottler::~PipeThrottler(void)
 
 bool PipeThrottler::addBytes(size_t new_bytes, bool wait)
 {
-	IScopedLock lock(mutex);
+	int64 ctime=Server->getTimeMS();
 
-	if(throttle_bps==0) return true;
+	int64 wait_ms = chargeBytes(new_bytes, ctime);
 
-	int64 ctime=Server->getTimeMS();
+	PipeThrottler* child = this;
+	for(PipeThrottler* curr=parent;curr!=NULL;child=curr, curr=curr->parent)
+	{
+		int64 parent_wait_ms = curr->chargeBytes(new_bytes, ctime);
+
+		//Bytes covered by the child's share of the parent limit do not wait
+		//for the debt other children caused by borrowing
+		if(!child->takeShareTokens(new_bytes, ctime, curr))
+		{
+			wait_ms = (std::max)(wait_ms, parent_wait_ms);
+		}
+	}
+
+	if(wait_ms<=0)
+	{
+		return true;
+	}
+
+	if(wait)
+	{
+		DLOG(Server->Log("Throttler: Sleeping for " + convert(wait_ms)+ "ms", LL_DEBUG));
+		Server->wait(static_cast<unsigned int>(wait_ms));
+	}
+
+	return false;
+}
+
+size_t PipeThrottler::currentLimit()
+{
+	if(percent_max && throttle_state == ThrottleState_Probe)
+	{
+		return 0;
+	}
+
+	return throttle_bps;
+}
+
+int64 PipeThrottler::chargeBytes(size_t new_bytes, int64 ctime)
+{
+	if(new_bytes>0)
+	{
+		atomic_add(&window_bytes, new_bytes);
+	}
+
+	if(ctime-atomic_load(&window_start)>=rate_window_ms)
+	{
+		updateRate(ctime);
+	}
+
+	size_t curr_throttle_bps = currentLimit();
+	if(curr_throttle_bps==0)
+	{
+		return 0;
+	}
+
+	refill_bucket(&tokens, &last_refill, ctime, static_cast<int64>(curr_throttle_bps));
+
+	int64 left = atomic_add(&tokens, -static_cast<int64>(new_bytes));
+	if(left>=0)
+	{
+		return 0;
+	}
+
+	//Time until the debt is paid back
+	return (-left*1000)/static_cast<int64>(curr_throttle_bps) + 1;
+}
+
+bool PipeThrottler::takeShareTokens(size_t new_bytes, int64 ctime, PipeThrottler* curr_parent)
+{
+	size_t parent_bps = curr_parent->currentLimit();
+	if(parent_bps==0)
+	{
+		return true;
+	}
+
+	int64 epoch = ctime/active_epoch_ms;
+	int64 prev_epoch = atomic_load(&active_epoch);
+	if(prev_epoch!=epoch
+		&& atomic_cas(&active_epoch, prev_epoch, epoch)==prev_epoch)
+	{
+		curr_parent->addActiveChild(epoch);
+	}
+
+	int64 share_bps = (std::max)(static_cast<int64>(parent_bps)/curr_parent->numActiveChildren(epoch), static_cast<int64>(1));
+	refill_bucket(&share_tokens, &share_last_refill, ctime, share_bps);
+
+	int64 left = atomic_add(&share_tokens, -static_cast<int64>(new_bytes));
+	if(left+static_cast<int64>(new_bytes)>0)
+	{
+		return true;
+	}
+
+	//Share is used up. The bytes are borrowed from the parent instead.
+	atomic_add(&share_tokens, new_bytes);
+	return false;
+}
+
+void PipeThrottler::updateRate(int64 ctime)
+{
+	int64 curr_window_start = atomic_load(&window_start);
+	int64 passed_time = ctime - curr_window_start;
+	if(passed_time<rate_window_ms
+		|| atomic_cas(&window_start, curr_window_start, ctime)!=curr_window_start)
+	{
+		//Not due yet or another thread updates the rate
+		return;
+	}
+
+	int64 curr_bytes = atomic_load(&window_bytes);
+	atomic_add(&window_bytes, -curr_bytes);
+
+	float bps = (curr_bytes * 1000.f) / passed_time;
+	curr_rate = static_cast<size_t>(bps + 0.5f);
+
+	IScopedLock lock(mutex);
 
 	if(updater.get() && update_time_interval>=0 &&
 		ctime-lastupdatetime>update_time_interval)
@@ -77,153 +271,124 @@ bool PipeThrottler::addBytes(size_t new_bytes, bool wait)
 		}
 
 		lastupdatetime = ctime;
-		if(throttle_bps==0) return true;
 	}
 
-	if (percent_max &&
-		throttle_state == ThrottleState_Throttle
+	if(!percent_max)
+	{
+		return;
+	}
+
+	if (throttle_state == ThrottleState_Throttle
 		&& ctime - lastprobetime > static_cast<int64>(probe_interval))
 	{
 		throttle_state = ThrottleState_Probe;
 		probe_bps = 0;
 		Server->Log("PROBE Starting probing for max speed");
 	}
-
-	if(ctime-lastresettime>1000)
+	else if (throttle_state == ThrottleState_Throttle
+		&& bps > 1.1f*last_probe_result)
+	{
+		Server->Log("PROBE Current speed per second at " + PrettyPrintSpeed(static_cast<size_t>(bps + 0.5f)) +
+			" 10% higher than max speed during probe at " + PrettyPrintSpeed(static_cast<size_t>(last_probe_result + 0.5f)) +
+			". Reprobing for max speed.", LL_DEBUG);
+		throttle_state = ThrottleState_Probe;
+		probe_bps = 0;
+	}
+	else if (throttle_state == ThrottleState_Probe)
 	{
-		if (percent_max && throttle_state == ThrottleState_Probe)
+		if (bps > 10 * 1024)
 		{
-			int64 passed_time = ctime - lastresettime;
-			float bps = (curr_bytes * 1000.f) / passed_time;
-			if (bps > 10 * 1024)
+			if (probe_bps == 0)
 			{
-				if (probe_bps == 0)
-				{
-					probe_bps = bps;
-				}
-				else
+				probe_bps = bps;
+			}
+			else
+			{
+				float new_probe_bps = 0.8f*probe_bps + 0.2f*bps;
+				float pdiff = new_probe_bps / probe_bps;
+				if (pdiff > 0.99f && pdiff < 1.01f)
 				{
-					float new_probe_bps = 0.8f*probe_bps + 0.2f*bps;
-					float pdiff = new_probe_bps / probe_bps;
-					if (pdiff > 0.99f && pdiff < 1.01f)
+					throttle_bps = static_cast<size_t>((static_cast<float>(throttle_percent) / 100)*new_probe_bps + 0.5f);
+					Server->Log("PROBE Probing finished at current speed " + PrettyPrintSpeed(static_cast<size_t>(bps + 0.5f))
+						+ " last avg " + PrettyPrintSpeed(static_cast<size_t>(probe_bps + 0.5f))
+						+ " curr avg " + PrettyPrintSpeed(static_cast<size_t>(new_probe_bps + 0.5f))
+						+ " pdiff " + convert(pdiff)
+						+ " throttling "+convert(throttle_percent)+"% to "+PrettyPrintSpeed(throttle_bps), LL_DEBUG);
+					lastprobetime = ctime;
+					throttle_state = ThrottleState_Throttle;
+					atomic_store(&last_refill, ctime);
+					atomic_store(&tokens, burst_bytes(throttle_bps));
+
+					if (last_probe_result != 0)
 					{
-						throttle_bps = static_cast<size_t>((static_cast<float>(throttle_percent) / 100)*new_probe_bps + 0.5f);
-						Server->Log("PROBE Probing finished at current speed " + PrettyPrintSpeed(static_cast<size_t>(bps + 0.5f))
-							+ " last avg " + PrettyPrintSpeed(static_cast<size_t>(probe_bps + 0.5f))
-							+ " curr avg " + PrettyPrintSpeed(static_cast<size_t>(new_probe_bps + 0.5f))
-							+ " pdiff " + convert(pdiff)
-							+ " throttling "+convert(throttle_percent)+"% to "+PrettyPrintSpeed(throttle_bps), LL_DEBUG);
-						lastprobetime = ctime;
-						throttle_state = ThrottleState_Throttle;
-						
-
-						if (last_probe_result != 0)
+						pdiff = last_probe_result / new_probe_bps;
+						Server->Log("PROBE Curr probe result " + PrettyPrintSpeed(static_cast<size_t>(new_probe_bps + 0.5f))
+							+ " last probe result " + PrettyPrintSpeed(static_cast<size_t>(last_probe_result + 0.5f))
+							+ " pdiff " + convert(pdiff), LL_DEBUG);
+						if (pdiff > 0.95f && pdiff < 1.05f
+							&& probe_interval < 60*60*1000 )
 						{
-							pdiff = last_probe_result / new_probe_bps;
-							Server->Log("PROBE Curr probe result " + PrettyPrintSpeed(static_cast<size_t>(new_probe_bps + 0.5f))
-								+ " last probe result " + PrettyPrintSpeed(static_cast<size_t>(last_probe_result + 0.5f))
-								+ " pdiff " + convert(pdiff), LL_DEBUG);
-							if (pdiff > 0.95f && pdiff < 1.05f
-								&& probe_interval < 60*60*1000 )
-							{
-								probe_interval += 10 * 60 * 1000;
-								Server->Log("PROBE New probe interval: " + PrettyPrintTime(probe_interval), LL_DEBUG);
-							}
+							probe_interval += 10 * 60 * 1000;
+							Server->Log("PROBE New probe interval: " + PrettyPrintTime(probe_interval), LL_DEBUG);
 						}
-						last_probe_result = new_probe_bps;
 					}
-					else
-					{
-						Server->Log("PROBE Probing at current speed " + PrettyPrintSpeed(static_cast<size_t>(bps + 0.5f))
-							+ " last avg " + PrettyPrintSpeed(static_cast<size_t>(probe_bps + 0.5f))
-							+ " curr avg " + PrettyPrintSpeed(static_cast<size_t>(new_probe_bps + 0.5f))
-							+ " pdiff " + convert(pdiff), LL_DEBUG);
-					}
-					probe_bps = new_probe_bps;
+					last_probe_result = new_probe_bps;
 				}
-			}
-			else
-			{
-				Server->Log("PROBE Discarding current speed of " + PrettyPrintSpeed(static_cast<size_t>(bps + 0.5f)) +
-					" during probing for max speed because it is too low", LL_DEBUG);
+				else
+				{
+					Server->Log("PROBE Probing at current speed " + PrettyPrintSpeed(static_cast<size_t>(bps + 0.5f))
+						+ " last avg " + PrettyPrintSpeed(static_cast<size_t>(probe_bps + 0.5f))
+						+ " curr avg " + PrettyPrintSpeed(static_cast<size_t>(new_probe_bps + 0.5f))
+						+ " pdiff " + convert(pdiff), LL_DEBUG);
+				}
+				probe_bps = new_probe_bps;
 			}
 		}
-
-		lastresettime=ctime;
-		curr_bytes=0;
-	}
-
-	curr_bytes += new_bytes;
-
-	if (percent_max && throttle_state == ThrottleState_Probe)
-	{
-		return true;
+		else
+		{
+			Server->Log("PROBE Discarding current speed of " + PrettyPrintSpeed(static_cast<size_t>(bps + 0.5f)) +
+				" during probing for max speed because it is too low", LL_DEBUG);
+		}
 	}
+}
 
-	int64 passed_time=ctime-lastresettime;
-
-	size_t maxRateTime=(size_t)(((_i64)curr_bytes*1000)/throttle_bps);
-	if(passed_time>0)
+void PipeThrottler::addActiveChild(int64 epoch)
+{
+	volatile int64* slot = &active_children[epoch & 1];
+	int64 curr = atomic_load(slot);
+	while(true)
 	{
-		size_t bps=(size_t)(((_i64)curr_bytes*1000)/passed_time);
-
-		if (throttle_state == ThrottleState_Throttle
-			&& curr_bytes > static_cast<size_t>(1.1f*last_probe_result+0.5f))
+		int64 new_val;
+		if((curr>>active_count_bits)==epoch)
 		{
-			Server->Log("PROBE Current speed per second at " + PrettyPrintSpeed(curr_bytes) +
-				" 10% higher than max speed during probe at " + PrettyPrintSpeed(static_cast<size_t>(last_probe_result + 0.5f)) +
-				". Reprobing for max speed.", LL_DEBUG);
-			throttle_state = ThrottleState_Probe;
-			probe_bps = 0;
-			return true;
-		}
-
-		if(bps>throttle_bps)
-		{		
-			unsigned int sleepTime=(unsigned int)(maxRateTime-passed_time);
-
-			if(sleepTime>0)
-			{
-				if(wait)
-				{
-					DLOG(Server->Log("Throttler: Sleeping for " + convert(sleepTime)+ "ms", LL_DEBUG));
-					Server->wait(sleepTime);
-
-					if(Server->getTimeMS()-lastresettime>1000)
-					{
-						curr_bytes=0;
-						lastresettime=Server->getTimeMS();
-					}
-				}
-
-				return false;
-			}
+			new_val = curr + 1;
 		}
-	}
-	else if(curr_bytes>=throttle_bps)
-	{
-		if (throttle_state == ThrottleState_Throttle
-			&& curr_bytes > static_cast<size_t>(1.1f*last_probe_result + 0.5f))
+		else
 		{
-			Server->Log("PROBE 2 Current speed per second at " + PrettyPrintSpeed(curr_bytes) +
-				" significantly higher than max speed during probe at " + PrettyPrintSpeed(static_cast<size_t>(last_probe_result + 0.5f)) +
-				". Reprobing for max speed.", LL_DEBUG);
-			throttle_state = ThrottleState_Probe;
-			probe_bps = 0;
-			return true;
+			new_val = (epoch<<active_count_bits) | 1;
 		}
 
-		if(wait)
+		int64 prev = atomic_cas(slot, curr, new_val);
+		if(prev==curr)
 		{
-			DLOG(Server->Log("Throttler: Sleeping for " + convert(maxRateTime)+ "ms", LL_DEBUG));
-			Server->wait(static_cast<unsigned int>(maxRateTime));
+			break;
 		}
-		curr_bytes=0;
-		lastresettime=Server->getTimeMS();
-		return false;
+		curr = prev;
 	}
+}
 
-	return true;
+int64 PipeThrottler::numActiveChildren(int64 epoch)
+{
+	int64 ret = 1;
+	for(int64 e=epoch-1;e<=epoch;++e)
+	{
+		int64 curr = atomic_load(&active_children[e & 1]);
+		if((curr>>active_count_bits)==e)
+		{
+			ret = (std::max)(ret, curr & active_count_mask);
+		}
+	}
+	return ret;
 }
 
 void PipeThrottler::changeThrottleLimit(size_t bps, bool p_percent_max)
@@ -248,3 +413,27 @@ void PipeThrottler::changeThrottleUpdater(IPipeThrottlerUpdater* new_updater)
 
 	updater.reset(new_updater);
 }
+
+void PipeThrottler::setParent(IPipeThrottler* new_parent)
+{
+	IScopedLock lock(mutex);
+
+	//There is only one implementation of IPipeThrottler
+	PipeThrottler* prev_parent = parent;
+	parent = static_cast<PipeThrottler*>(new_parent);
+
+	if(parent!=prev_parent)
+	{
+		//Register as active child with the new parent on the next write
+		atomic_store(&active_epoch, -1);
+	}
+}
+
+size_t PipeThrottler::getCurrentRate()
+{
+	if(Server->getTimeMS()-atomic_load(&window_start)>2*rate_window_ms)
+	{
+		return 0;
+	}
+	return curr_rate;
+}
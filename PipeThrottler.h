@@ -1,10 +1,20 @@
 #pragma once
 
 #include "Interface/PipeThrottler.h"
+#include "Interface/Types.h"
 #include <memory>
 
 class IMutex;
 
+/**
+* Token bucket throttler. Buckets are taken from and refilled with atomic
+* operations; the mutex is only taken once per second to update the
+* measured rate. Throttlers can be chained via setParent(). Every byte is
+* charged to all ancestors. A child has a share bucket filled with the
+* parent's limit divided by the number of currently active children.
+* Bytes covered by the share do not wait for the parent; other bytes
+* only go through if the parent has unused tokens.
+*/
 class PipeThrottler : public IPipeThrottler
 {
 public:
@@ -18,6 +28,10 @@ public:
 
 	virtual void changeThrottleUpdater(IPipeThrottlerUpdater* new_updater);
 
+	virtual void setParent(IPipeThrottler* new_parent);
+
+	virtual size_t getCurrentRate();
+
 private:
 	enum ThrottleState
 	{
@@ -25,11 +39,16 @@ private:
 		ThrottleState_Throttle
 	};
 
-	size_t throttle_bps;
+	size_t currentLimit();
+	int64 chargeBytes(size_t new_bytes, int64 ctime);
+	bool takeShareTokens(size_t new_bytes, int64 ctime, PipeThrottler* curr_parent);
+	void updateRate(int64 ctime);
+	void addActiveChild(int64 epoch);
+	int64 numActiveChildren(int64 epoch);
+
+	volatile size_t throttle_bps;
 	bool percent_max;
 	int64 update_time_interval;
-	size_t curr_bytes;
-	int64 lastresettime;
 	int64 lastupdatetime;
 	std::auto_ptr<IPipeThrottlerUpdater> updater;
 	ThrottleState throttle_state;
@@ -39,5 +58,19 @@ private:
 	float last_probe_result;
 	size_t probe_interval;
 
+	volatile int64 tokens;
+	volatile int64 last_refill;
+
+	volatile int64 share_tokens;
+	volatile int64 share_last_refill;
+	volatile int64 active_epoch;
+	volatile int64 active_children[2];
+
+	volatile int64 window_bytes;
+	volatile int64 window_start;
+	volatile size_t curr_rate;
+
+	PipeThrottler* parent;
+
 	IMutex *mutex;
-};
\ No newline at end of file
+};
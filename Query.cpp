@@ -44,6 +44,11 @@ IMutex* CQuery::active_mutex;
 std::vector<std::string> CQuery::active_queries;
 #endif
 
+namespace
+{
+	IMetric* busy_retries_metric=NULL;
+}
+
 CQuery::CQuery(const std::string &pStmt_str, sqlite3_stmt *prepared_statement, CDatabase *pDB)
 	: stmt_str(pStmt_str), cursor(NULL)
 {
@@ -76,6 +81,8 @@ void CQuery::init_mutex(void)
 #ifdef LOG_QUERIES
 	active_mutex=Server->createMutex();
 #endif
+	busy_retries_metric=Server->getMetric("urbackup_sqlite_busy_retries_total",
+		"Number of times a SQLite statement had to be retried because the database was busy or locked", EMetricType_Counter);
 }
 
 void CQuery::Bind(const std::string &str)
@@ -176,7 +183,10 @@ bool CQuery::Execute(int timeoutms)
 			{
 				break;
 			}
-			else if(!db->isInTransaction() && !transaction_lock)
+
+			busy_retries_metric->add(1);
+
+			if(!db->isInTransaction() && !transaction_lock)
 			{
 				sqlite3_reset(ps);
 				if(db->LockForTransaction())
@@ -203,6 +213,8 @@ bool CQuery::Execute(int timeoutms)
 		}
 		else if(err==SQLITE_LOCKED)
 		{
+			busy_retries_metric->add(1);
+
 			if(transaction_lock)
 			{
 				db->UnlockForTransaction();
@@ -389,7 +401,10 @@ int CQuery::step(db_single_result& res, int *timeoutms, int& tries, bool& transa
 			{
 				return SQLITE_ABORT;
 			}
-			else if(!db->isInTransaction() && !transaction_lock)
+
+			busy_retries_metric->add(1);
+
+			if(!db->isInTransaction() && !transaction_lock)
 			{
 				sqlite3_reset(ps);
 				reset=true;
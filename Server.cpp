@@ -57,6 +57,7 @@
 #include "PipeThrottler.h"
 #include "mt19937ar.h"
 #include "Query.h"
+#include "Metrics.h"
 
 
 
@@ -160,6 +161,14 @@ CServer::CServer()
 	startup_complete=false;
 	
 	log_mutex=createMutex();
+	log_write_mutex=createMutex();
+	log_cond=createCondition();
+	log_queue_size=0;
+	log_queue_dropped=0;
+	log_writer_running=false;
+	log_writer_stop=false;
+	log_time_cached=0;
+	log_time_buffer[0]=0;
 	action_mutex=createMutex();
 	requests_mutex=createMutex();
 	outputs_mutex=createMutex();
@@ -173,6 +182,8 @@ CServer::CServer()
 	startup_complete_cond=createCondition();
 	rnd_mutex=createMutex();
 
+	metrics=NULL;
+
 	initRandom(static_cast<unsigned int>(time(0)));
 	initRandom(getSecureRandomNumber());
 
@@ -194,6 +205,7 @@ CServer::CServer()
 
 void CServer::setup(void)
 {
+	metrics=new MetricsRegistry;
 	sessmgr=new CSessionMgr();
 	threadpool=new CThreadPool();
 
@@ -242,6 +254,8 @@ void CServer::destroyDatabases(THREAD_ID tid)
 
 CServer::~CServer()
 {
+	stopLogWriter();
+
 	if(getServerParameter("leak_check")!="true") //minimal cleanup
 	{
 		return;
@@ -324,6 +338,8 @@ CServer::~CServer()
 	Log("Destroying mutexes");
 	
 	destroy(log_mutex);
+	destroy(log_write_mutex);
+	destroy(log_cond);
 	destroy(action_mutex);
 	destroy(requests_mutex);
 	destroy(outputs_mutex);
@@ -336,6 +352,7 @@ CServer::~CServer()
 	destroy(startup_complete_mutex);
 	destroy(startup_complete_cond);
 	destroy(rnd_mutex);
+	delete metrics;
 #ifndef NO_SQLITE
 	CDatabase::destroyMutex();
 #endif
@@ -376,60 +393,91 @@ void CServer::setServerParameter(const std::string &key, const std::string &valu
 	server_params[key]=value;
 }
 
+namespace
+{
+	const size_t log_queue_batch=1000;
+	const size_t log_queue_max=100000;
+	const int log_flush_interval_ms=500;
+
+	class LogWriterThread : public IThread
+	{
+	public:
+		LogWriterThread(CServer* server)
+			: server(server) {}
+
+		void operator()(void)
+		{
+			server->runLogWriter();
+			delete this;
+		}
+
+	private:
+		CServer* server;
+	};
+}
+
 void CServer::Log( const std::string &pStr, int LogLevel)
 {
 	if( loglevel <=LogLevel )
 	{
 		IScopedLock lock(log_mutex);
 
-		time_t rawtime;		
-		char buffer [100];
-		time ( &rawtime );
-#ifdef _WIN32
-		struct tm  timeinfo;
-		localtime_s(&timeinfo, &rawtime);
-		strftime (buffer,100,"%Y-%m-%d %X: ",&timeinfo);
-#else
-		struct tm *timeinfo;
-		timeinfo = localtime ( &rawtime );
-		strftime (buffer,100,"%Y-%m-%d %X: ",timeinfo);
-#endif	
-
-		if(log_console_time)
+		if(has_circular_log_buffer)
 		{
-			std::cout << buffer;
+			logToCircularBuffer(pStr, LogLevel);
 		}
 
-		if( LogLevel==LL_ERROR )
-		{
-			std::cout << "ERROR: " << pStr << std::endl;
-			if(logfile_a)
-				logfile << buffer << "ERROR: " << pStr << std::endl;
-		}
-		else if( LogLevel==LL_WARNING )
+		if(log_writer_running)
 		{
-			std::cout << "WARNING: " << pStr << std::endl;
-			if(logfile_a)
-				logfile<< buffer << "WARNING: " << pStr << std::endl;
-		}
-		else
-		{
-			std::cout << pStr << std::endl;		
-			if(logfile_a)
-				logfile << buffer << pStr << std::endl;
+			if(LogLevel<LL_ERROR
+				&& log_queue_size>=log_queue_max)
+			{
+				//Writer cannot keep up. Give it some time, but never block forever
+				log_cond->wait(&lock, 1000);
+
+				if(log_queue_size>=log_queue_max)
+				{
+					++log_queue_dropped;
+					return;
+				}
+			}
+
+			if(log_queue_size>=log_queue.size())
+			{
+				log_queue.resize(log_queue_size+1);
+			}
+
+			SLogQueueEntry& entry = log_queue[log_queue_size];
+			entry.loglevel=LogLevel;
+			entry.time=time(NULL);
+			entry.msg=pStr;
+			++log_queue_size;
+
+			if(LogLevel>=LL_ERROR)
+			{
+				//Errors are written before returning, so they are not lost if the process crashes
+				writeLogQueue(lock);
+			}
+			else if(log_queue_size==log_queue_batch)
+			{
+				log_cond->notify_all();
+			}
+			return;
 		}
-		
+
+		lock.relock(NULL);
+
+		IScopedLock write_lock(log_write_mutex);
+
+		writeLogEntry(LogLevel, time(NULL), pStr);
+
+		std::cout.flush();
+
 		if(logfile_a)
 		{
 			logfile.flush();
 
 			rotateLogfile();
-
-		}
-
-		if(has_circular_log_buffer)
-		{
-			logToCircularBuffer(pStr, LogLevel);
 		}
 	}
 	else if(has_circular_log_buffer)
@@ -440,6 +488,151 @@ void CServer::Log( const std::string &pStr, int LogLevel)
 	}
 }
 
+void CServer::writeLogEntry(int LogLevel, time_t logtime, const std::string &pStr)
+{
+	if(logtime!=log_time_cached
+		|| log_time_buffer[0]==0)
+	{
+#ifdef _WIN32
+		struct tm  timeinfo;
+		localtime_s(&timeinfo, &logtime);
+		strftime (log_time_buffer,100,"%Y-%m-%d %X: ",&timeinfo);
+#else
+		struct tm timeinfo;
+		localtime_r(&logtime, &timeinfo);
+		strftime (log_time_buffer,100,"%Y-%m-%d %X: ",&timeinfo);
+#endif
+		log_time_cached=logtime;
+	}
+
+	if(log_console_time)
+	{
+		std::cout << log_time_buffer;
+	}
+
+	if( LogLevel==LL_ERROR )
+	{
+		std::cout << "ERROR: " << pStr << "\n";
+		if(logfile_a)
+			logfile << log_time_buffer << "ERROR: " << pStr << "\n";
+	}
+	else if( LogLevel==LL_WARNING )
+	{
+		std::cout << "WARNING: " << pStr << "\n";
+		if(logfile_a)
+			logfile<< log_time_buffer << "WARNING: " << pStr << "\n";
+	}
+	else
+	{
+		std::cout << pStr << "\n";
+		if(logfile_a)
+			logfile << log_time_buffer << pStr << "\n";
+	}
+}
+
+void CServer::startLogWriter()
+{
+	IScopedLock lock(log_mutex);
+
+	if(log_writer_running)
+	{
+		return;
+	}
+
+	log_writer_running=true;
+	log_writer_stop=false;
+
+	createThread(new LogWriterThread(this), "log writer");
+}
+
+void CServer::stopLogWriter()
+{
+	IScopedLock lock(log_mutex);
+
+	if(!log_writer_running)
+	{
+		return;
+	}
+
+	log_writer_stop=true;
+	log_cond->notify_all();
+
+	while(log_writer_running)
+	{
+		log_cond->wait(&lock);
+	}
+}
+
+void CServer::runLogWriter()
+{
+	IScopedLock lock(log_mutex);
+
+	while(true)
+	{
+		if(log_queue_size==0
+			&& log_queue_dropped==0)
+		{
+			if(log_writer_stop)
+			{
+				break;
+			}
+
+			log_cond->wait(&lock, log_flush_interval_ms);
+			continue;
+		}
+
+		writeLogQueue(lock);
+
+		lock.relock(log_mutex);
+	}
+
+	log_writer_running=false;
+	log_cond->notify_all();
+}
+
+void CServer::writeLogQueue(IScopedLock& lock)
+{
+	//Lock order is log_write_mutex, then log_mutex. Whoever holds log_write_mutex
+	//writes everything queued so far, which keeps the messages in order.
+	lock.relock(NULL);
+
+	IScopedLock write_lock(log_write_mutex);
+
+	lock.relock(log_mutex);
+
+	//Swap out the pending messages so producers can continue while we do the I/O.
+	//Both vectors keep their capacity (and the strings in them) to avoid allocations.
+	log_queue.swap(log_write_queue);
+	size_t num_entries=log_queue_size;
+	log_queue_size=0;
+	size_t num_dropped=log_queue_dropped;
+	log_queue_dropped=0;
+
+	log_cond->notify_all();
+
+	lock.relock(NULL);
+
+	if(num_dropped>0)
+	{
+		writeLogEntry(LL_WARNING, time(NULL), "Dropped "+convert(num_dropped)+" log messages because the log writer could not keep up");
+	}
+
+	for(size_t i=0;i<num_entries;++i)
+	{
+		const SLogQueueEntry& entry = log_write_queue[i];
+		writeLogEntry(entry.loglevel, entry.time, entry.msg);
+	}
+
+	std::cout.flush();
+
+	if(logfile_a)
+	{
+		logfile.flush();
+
+		rotateLogfile();
+	}
+}
+
 void CServer::rotateLogfile()
 {
 	if(static_cast<size_t>(logfile.tellp())>log_rotation_size)
@@ -462,7 +655,7 @@ void CServer::rotateLogfile()
 
 void CServer::setLogFile(const std::string &plf, std::string chown_user)
 {
-	IScopedLock lock(log_mutex);
+	IScopedLock lock(log_write_mutex);
 	if(logfile_a)
 	{
 		logfile.close();
@@ -663,6 +856,37 @@ int64 CServer::getTimeMS(void)
 #endif
 }
 
+int64 CServer::getTimeUS(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER counter;
+	if(!QueryPerformanceFrequency(&freq)
+		|| !QueryPerformanceCounter(&counter))
+	{
+		return getTimeMS()*1000;
+	}
+	return (counter.QuadPart/freq.QuadPart)*1000000
+		+ ((counter.QuadPart%freq.QuadPart)*1000000)/freq.QuadPart;
+#else
+#ifdef __APPLE__
+	clock_serv_t cclock;
+	mach_timespec_t mts;
+	host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+	clock_get_time(cclock, &mts);
+	mach_port_deallocate(mach_task_self(), cclock);
+	return static_cast<int64>(mts.tv_sec) * 1000000 + mts.tv_nsec / 1000;
+#else
+	timespec tp;
+	if(clock_gettime(CLOCK_MONOTONIC, &tp)!=0)
+	{
+		return getTimeMS()*1000;
+	}
+	return static_cast<int64>(tp.tv_sec)*1000000+tp.tv_nsec/1000;
+#endif //__APPLE__
+#endif
+}
+
 bool CServer::WriteRaw(THREAD_ID tid, const char *buf, size_t bsize, bool cached)
 {
 	bool ret=true;
@@ -2029,3 +2253,13 @@ void CServer::setLogConsoleTime(bool b)
 {
 	log_console_time = b;
 }
+
+IMetric* CServer::getMetric(const std::string& name, const std::string& help, EMetricType type)
+{
+	return metrics->getMetric(name, help, type);
+}
+
+std::string CServer::getMetricsText(void)
+{
+	return metrics->getText();
+}
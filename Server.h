@@ -15,6 +15,7 @@
 #include <vector>
 #include <fstream>
 #include <memory>
+#include <time.h>
 
 typedef void(*LOADACTIONS)(IServer*);
 typedef void(*UNLOADACTIONS)(void);
@@ -32,6 +33,7 @@ class CSessionMgr;
 class CServiceAcceptor;
 class CThreadPool;
 class IOutputStream;
+class MetricsRegistry;
 
 struct SDatabase
 {
@@ -56,6 +58,13 @@ private:
 };
 
 
+struct SLogQueueEntry
+{
+	int loglevel;
+	time_t time;
+	std::string msg;
+};
+
 class CServer : public IServer
 {
 public:
@@ -88,6 +97,7 @@ public:
 
 	virtual int64 getTimeSeconds(void);
 	virtual int64 getTimeMS(void);
+	virtual int64 getTimeUS(void);
 
 	virtual bool LoadDLL(const std::string &name);
 	virtual bool UnloadDLL(const std::string &name);
@@ -196,6 +206,9 @@ public:
 	virtual void clearFailBit(size_t failbit);
 	virtual size_t getFailBits(void);
 
+	virtual IMetric* getMetric(const std::string& name, const std::string& help, EMetricType type);
+	virtual std::string getMetricsText(void);
+
 	virtual void clearDatabases(THREAD_ID tid);
 
 	void setLogRotationFilesize(size_t filesize);
@@ -204,6 +217,12 @@ public:
 
 	void setLogConsoleTime(bool b);
 
+	void startLogWriter();
+
+	void stopLogWriter();
+
+	void runLogWriter();
+
 private:
 
 	void logToCircularBuffer(const std::string& msg, int loglevel);
@@ -213,12 +232,17 @@ private:
 
 	void rotateLogfile();
 
+	void writeLogEntry(int LogLevel, time_t logtime, const std::string &pStr);
+	void writeLogQueue(IScopedLock& lock);
+
 
 	int loglevel;
 	bool logfile_a;
 	std::fstream logfile;
 
 	IMutex* log_mutex;
+	IMutex* log_write_mutex;
+	ICondition* log_cond;
 	IMutex* action_mutex;
 	IMutex* requests_mutex;
 	IMutex* outputs_mutex;
@@ -299,6 +323,18 @@ private:
 	bool log_console_time;
 
 	size_t log_rotation_files;
+
+	MetricsRegistry* metrics;
+
+	std::vector<SLogQueueEntry> log_queue;
+	size_t log_queue_size;
+	size_t log_queue_dropped;
+	std::vector<SLogQueueEntry> log_write_queue;
+	bool log_writer_running;
+	bool log_writer_stop;
+
+	time_t log_time_cached;
+	char log_time_buffer[100];
 };
 
 #ifndef DEF_SERVER
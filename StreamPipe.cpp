@@ -33,6 +33,10 @@ CStreamPipe::CStreamPipe( SOCKET pSocket)
 {
 	s=pSocket;
 	has_error=false;
+	received_bytes_metric=Server->getMetric("urbackup_pipe_bytes_total{pipe=\"socket\",direction=\"received\"}",
+		"Number of bytes transferred per pipe type", EMetricType_Counter);
+	sent_bytes_metric=Server->getMetric("urbackup_pipe_bytes_total{pipe=\"socket\",direction=\"sent\"}",
+		"Number of bytes transferred per pipe type", EMetricType_Counter);
 }
 
 CStreamPipe::~CStreamPipe()
@@ -274,10 +278,20 @@ void CStreamPipe::shutdown(void)
 #endif
 }
 
+void CStreamPipe::addOutgoingBytes(size_t bytes)
+{
+	doThrottle(bytes, true, true);
+}
+
 bool CStreamPipe::doThrottle(size_t new_bytes, bool outgoing, bool wait)
 {
 	transfered_bytes+=new_bytes;
 
+	if(new_bytes>0)
+	{
+		(outgoing ? sent_bytes_metric : received_bytes_metric)->add(new_bytes);
+	}
+
 	if(outgoing)
 	{
 		bool b=true;
@@ -1,4 +1,5 @@
 #include "Interface/Pipe.h"
+#include "Interface/Metrics.h"
 #include "socket_header.h"
 #include <vector>
 
@@ -33,12 +34,17 @@ public:
 
 	virtual bool Flush( int timeoutms=-1 );
 
+	virtual void addOutgoingBytes(size_t bytes);
+
 private:
 	SOCKET s;
 	bool doThrottle(size_t new_bytes, bool outgoing, bool wait);
 
 	_i64 transfered_bytes;
 
+	IMetric* received_bytes_metric;
+	IMetric* sent_bytes_metric;
+
 	bool has_error;
 
 	std::vector<IPipeThrottler*> incoming_throttlers;
@@ -0,0 +1,66 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#pragma once
+#include "../Interface/Types.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+namespace common
+{
+#ifdef _WIN32
+	//Returns the new value
+	inline int64 atomic_add(volatile int64* val, int64 add)
+	{
+		return _InterlockedExchangeAdd64(val, add) + add;
+	}
+
+	//Returns the previous value
+	inline int64 atomic_cas(volatile int64* val, int64 expected, int64 desired)
+	{
+		return _InterlockedCompareExchange64(val, desired, expected);
+	}
+#else
+	inline int64 atomic_add(volatile int64* val, int64 add)
+	{
+		return __sync_add_and_fetch(val, add);
+	}
+
+	inline int64 atomic_cas(volatile int64* val, int64 expected, int64 desired)
+	{
+		return __sync_val_compare_and_swap(val, expected, desired);
+	}
+#endif
+
+	inline int64 atomic_load(volatile int64* val)
+	{
+		return atomic_add(val, 0);
+	}
+
+	inline void atomic_store(volatile int64* val, int64 desired)
+	{
+		int64 curr = atomic_load(val);
+		int64 prev;
+		while((prev=atomic_cas(val, curr, desired))!=curr)
+		{
+			curr = prev;
+		}
+	}
+}
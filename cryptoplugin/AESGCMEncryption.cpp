@@ -77,7 +77,12 @@ void AESGCMEncryption::flush()
 std::string AESGCMEncryption::get()
 {
 	std::string ret;
+	get(ret);
+	return ret;
+}
 
+void AESGCMEncryption::get(std::string& ret)
+{
 	size_t iv_add = iv_done ? 0 : m_IV.size();
 
 	size_t max_retrievable;
@@ -117,7 +122,8 @@ std::string AESGCMEncryption::get()
 
 	if(add_end_marker)	
 	{
-		//The rest is already zero
+		//ret may be a reused buffer, so the zeros have to be written explicitly
+		memset(&ret[ret.size()-end_marker_zeros-1], 0, end_marker_zeros);
 		ret[ret.size()-1]=1;
 		end_marker_state=0;
 		overhead_size+=end_marker_zeros+1;
@@ -126,8 +132,6 @@ std::string AESGCMEncryption::get()
 		VLOG(Server->Log("New message. Size: "+convert(message_size), LL_DEBUG));
 		message_size=0;
 	}
-
-	return ret;
 }
 
 void AESGCMEncryption::decEndMarkers( size_t n )
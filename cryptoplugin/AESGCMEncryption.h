@@ -14,6 +14,8 @@ public:
 
 	virtual std::string get();
 
+	virtual void get(std::string& ret);
+
 	virtual int64 getOverheadBytes();
 
 private:
@@ -46,6 +46,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <poll.h>
 #endif
 #include <assert.h>
 
@@ -58,10 +59,11 @@
 #define stat64 stat
 #define fstat64 fstat
 
+//BSD sendfile takes the file first, then the socket
 #if defined(__FreeBSD__)
-#define sendfile64(a, b, c, d, e) sendfile(a, b, c, d, NULL, e, 0)
+#define sendfile64(a, b, c, d, e) sendfile(b, a, c, d, NULL, e, 0)
 #else
-#define sendfile64(a, b, c, d, e) sendfile(a, b, c, e, NULL, 0)
+#define sendfile64(a, b, c, d, e) sendfile(b, a, c, e, NULL, 0)
 #endif
 
 #endif
@@ -1074,7 +1076,15 @@ bool CClientThread::ProcessPacket(CRData *data)
 					    next_checkpoint=curr_filesize;
 				}
 
-				if((clientpipe!=NULL || with_hashes) && foffset>0)
+				//Plain LAN connections send the file content directly from the page cache.
+				//Compressed/encrypted pipes and hashed transfers need the data in user space.
+#ifdef __linux__
+				bool zero_copy = has_socket && !with_hashes;
+#else
+				bool zero_copy = false;
+#endif
+
+				if(!zero_copy && foffset>0)
 				{
 					if(lseek64(hFile, foffset, SEEK_SET)!=foffset)
 					{
@@ -1115,7 +1125,7 @@ bool CClientThread::ProcessPacket(CRData *data)
 							if (next_checkpoint>curr_filesize)
 								next_checkpoint = curr_filesize;
 
-							if (clientpipe != NULL || with_hashes)
+							if (!zero_copy)
 							{
 								off64_t rc = lseek64(hFile, foffset, SEEK_SET);
 
@@ -1142,7 +1152,7 @@ bool CClientThread::ProcessPacket(CRData *data)
 						}
 					}
 				
-					size_t count=(std::min)((size_t)s_bsize, (size_t)(next_checkpoint-foffset));
+					size_t count=(std::min)((size_t)(zero_copy ? SENDFILESIZE : s_bsize), (size_t)(next_checkpoint-foffset));
 
 					if (has_file_extents)
 					{
@@ -1152,8 +1162,20 @@ bool CClientThread::ProcessPacket(CRData *data)
 						}
 					}
 
-					if( clientpipe==NULL && !with_hashes && count>0 )
+					if( zero_copy && count>0 )
 					{
+						pollfd conn[1];
+						conn[0].fd=int_socket;
+						conn[0].events=POLLOUT;
+						conn[0].revents=0;
+						if(poll(conn, 1, SEND_TIMEOUT)<=0)
+						{
+							Log("Error: Timeout or error while waiting to send file data. Errno: "+convert(errno), LL_DEBUG);
+							CloseHandle(hFile);
+							return false;
+						}
+
+						errno=0;
 						#if defined(__APPLE__) || defined(__FreeBSD__)
 						ssize_t rc=sendfile64(int_socket, hFile, foffset, count, reinterpret_cast<off_t*>(&count));
 						if(rc==0)
@@ -1164,25 +1186,43 @@ bool CClientThread::ProcessPacket(CRData *data)
 						#else			
 						ssize_t rc=sendfile64(int_socket, hFile, &foffset, count);
 						#endif
-						if(rc<0)
+						if(rc<0 && (errno==EINVAL || errno==ENOSYS) )
+						{
+							Log("sendfile not supported for file \""+filename+"\". Falling back to buffered send.", LL_DEBUG);
+							zero_copy=false;
+							if(lseek64(hFile, foffset, SEEK_SET)!=foffset)
+							{
+								Log("Error: Seeking in file failed (5044)", LL_ERROR);
+								CloseHandle(hFile);
+								return false;
+							}
+							continue;
+						}
+						else if(rc<0)
 						{
 							Log("Error: Reading and sending from file failed. Errno: "+convert(errno), LL_DEBUG);
 							FileServ::callErrorCallback(o_filename, filename, foffset, "code: " + convert(errno));
 							CloseHandle(hFile);
 							return false;
 						}
+						else if(rc>0)
+						{
+							clientpipe->addOutgoingBytes(rc);
+						}
 						else if(rc==0 && foffset<filesize && errno == 0) //other process made the file smaller
 						{
 							memset(buf.data(), 0, s_bsize);
 							while(foffset<filesize)
 							{
-								rc=SendInt(buf.data(), (std::min)((size_t)s_bsize, (size_t)(next_checkpoint-foffset)));
+								size_t tosend = (std::min)((size_t)s_bsize, (size_t)(filesize-foffset));
+								rc=SendInt(buf.data(), tosend);
 								if(rc==SOCKET_ERROR)
 								{
 									Log("Error: Sending data failed");
 									CloseHandle(hFile);
 									return false;
 								}
+								foffset+=tosend;
 							}
 						}
 					}
@@ -10,6 +10,7 @@ const _i32 BUFFERSIZE=1024;
 const _i32 NBUFFERS=32;
 const _i32 READSIZE=32768;
 const _i32 SENDSIZE=16384;
+const _i32 SENDFILESIZE=1024*1024;
 const uchar VERSION=36;
 const _i32 WINDOW_SIZE=512*1024; // 128 kbyte
 
@@ -905,7 +905,6 @@ _u32 VHDFile::Write(const char *buffer, _u32 bsize, bool *has_error)
 	size_t remaining=blocksize-blockoffset;
 	size_t towrite=bsize;
 	size_t bufferoffset=0;
-	bool firstw=true;
 
 	while(true)
 	{
@@ -965,23 +964,16 @@ _u32 VHDFile::Write(const char *buffer, _u32 bsize, bool *has_error)
 			return 0;
 		}
 
-		while( blockoffset<blocksize )
 		{
-			size_t wantwrite=(std::min)((size_t)sector_size, towrite);
-			if(remaining<wantwrite)
-				wantwrite=remaining;
-			if(firstw && blockoffset%sector_size!=0 && wantwrite>sector_size-blockoffset%sector_size )
-			{
-				wantwrite=sector_size-blockoffset%sector_size;
-				firstw=false;
-			}
-			else
+			//Data in this block is contiguous in the file. Mark its sectors and write it at once
+			size_t wantwrite=(std::min)(remaining, towrite);
+
+			for(size_t sector_offset=blockoffset;sector_offset<blockoffset+wantwrite;
+				sector_offset=(sector_offset/sector_size+1)*sector_size)
 			{
-				firstw=false;
+				setBitmapBit((unsigned int)sector_offset, true);
 			}
 
-			setBitmapBit((unsigned int)blockoffset, true);
-
 			_u32 rc=file->Write(&buffer[bufferoffset], (_u32)wantwrite);
 			if(rc!=wantwrite)
 			{
@@ -995,14 +987,6 @@ _u32 VHDFile::Write(const char *buffer, _u32 bsize, bool *has_error)
 			blockoffset+=wantwrite;
 			remaining-=wantwrite;
 			towrite-=wantwrite;
-			if(towrite==0)
-			{
-				break;
-			}
-			if(remaining==0)
-			{
-				break;
-			}
 		}
 
 		if(!fast_mode)
@@ -66,6 +66,17 @@ namespace
 void init_mutex_selthread(void);
 void destroy_mutex_selthread(void);
 
+namespace
+{
+	void drain_log_writer(void)
+	{
+		if(Server!=NULL)
+		{
+			Server->stopLogWriter();
+		}
+	}
+}
+
 #ifndef _WIN32
 void termination_handler(int signum)
 {
@@ -525,6 +536,9 @@ int main_fkt(int argc, char *argv[])
 		}
 	}
 
+	Server->startLogWriter();
+	atexit(drain_log_writer);
+
 	Server->LoadStaticPlugins();
 	
 	CLoadbalancerClient *lbs=NULL;
@@ -604,6 +618,7 @@ int main_fkt(int argc, char *argv[])
 
 	Server->Log("Deleting server...");
 	delete Server;
+	Server=NULL;
 	
 	sqlite3_free(sqlite3_temp_directory);
 
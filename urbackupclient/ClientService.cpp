@@ -2487,6 +2487,31 @@ void ClientConnector::downloadImage(str_map params)
 		{
 			offset="&offset="+params["offset"];
 		}
+
+		bool get_hashes = params["hashes"] == "1";
+		if (channel_pipes[i].restore_version > 1)
+		{
+			if (get_hashes)
+			{
+				offset += "&hashes=1";
+			}
+			if (params.find("delta_bitmap") != params.end())
+			{
+				offset += "&delta_bitmap=" + params["delta_bitmap"];
+			}
+		}
+		else if (get_hashes)
+		{
+			Server->Log("Server does not support delta image restore", LL_DEBUG);
+			if (i + 1 < channel_pipes.size())
+			{
+				continue;
+			}
+			imgsize = -1;
+			pipe->Write((char*)&imgsize, sizeof(_i64), (int)receive_timeouttime);
+			return;
+		}
+
 		sendChannelPacket(channel_pipes[i], "DOWNLOAD IMAGE with_used_bytes=1&img_id=" 
 			+ params["img_id"] + "&time=" + params["time"] + "&mbr=" + params["mbr"] + offset);
 		
@@ -2496,7 +2521,13 @@ void ClientConnector::downloadImage(str_map params)
 		IPipe *c = channel_pipes[i].pipe;
 		c->Read((char*)&imgsize, sizeof(_i64), 60000);
 		Server->Log("Imagesize "+convert(imgsize), LL_DEBUG);
-		if(imgsize==-1)
+		if(imgsize==-1 && get_hashes)
+		{
+			Server->Log("No image hashes available for delta restore", LL_DEBUG);
+			pipe->Write((char*)&imgsize, sizeof(_i64), (int)receive_timeouttime);
+			return;
+		}
+		else if(imgsize==-1)
 		{
 			Server->Log("Error reading size", LL_ERROR);
 			if(i+1<channel_pipes.size())
@@ -2524,9 +2555,9 @@ void ClientConnector::downloadImage(str_map params)
 		char buf[c_buffer_size];
 		_i64 read=0;
 
-		if(params["mbr"]=="true")
+		if(params["mbr"]=="true" || get_hashes)
 		{
-			Server->Log("Downloading MBR...", LL_DEBUG);
+			Server->Log(get_hashes ? "Downloading image hashes..." : "Downloading MBR...", LL_DEBUG);
 			while(read<imgsize)
 			{
 				size_t c_read=c->Read(buf, c_buffer_size, 60000);
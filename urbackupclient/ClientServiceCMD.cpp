@@ -271,6 +271,11 @@ void ClientConnector::CMD_START_INCR_FILEBACKUP(const std::string &cmd)
 		flags |= flag_with_proper_symlinks;
 	}
 
+	if(params.find("binary_filelist")!=params.end())
+	{
+		flags |= flag_binary_filelist;
+	}
+
 	if(end_to_end_file_backup_verification_enabled)
 	{
 		flags |= flag_end_to_end_verification;
@@ -444,6 +449,11 @@ void ClientConnector::CMD_START_FULL_FILEBACKUP(const std::string &cmd)
 		flags |= flag_with_proper_symlinks;
 	}
 
+	if(params.find("binary_filelist")!=params.end())
+	{
+		flags |= flag_binary_filelist;
+	}
+
 	if(end_to_end_file_backup_verification_enabled)
 	{
 		flags |= flag_end_to_end_verification;
@@ -2456,7 +2466,7 @@ void ClientConnector::CMD_CAPA(const std::string &cmd)
 	tcpstack.Send(pipe, "FILE=2&FILE2=1&IMAGE=1&UPDATE=1&MBR=1&FILESRV=3&SET_SETTINGS=1&IMAGE_VER=1&CLIENTUPDATE=2&ASYNC_INDEX=1"
 		"&CLIENT_VERSION_STR="+EscapeParamString((client_version_str))+"&OS_VERSION_STR="+EscapeParamString(os_version_str)+
 		"&ALL_VOLUMES="+EscapeParamString(win_volumes)+"&ETA=1&CDP=0&ALL_NONUSB_VOLUMES="+EscapeParamString(win_nonusb_volumes)+"&EFI=1"
-		"&FILE_META=1&SELECT_SHA=1&PHASH=1&RESTORE="+restore+"&CLIENT_BITMAP=1&CMD=1&SYMBIT=1&WTOKENS=1&OS_SIMPLE=windows"+ send_prev_cbitmap+
+		"&FILE_META=1&SELECT_SHA=1&PHASH=1&RESTORE="+restore+"&CLIENT_BITMAP=1&CMD=1&SYMBIT=1&WTOKENS=1&BIN_FILELIST=1&OS_SIMPLE=windows"+ send_prev_cbitmap+
 		conn_metered);
 #else
 
@@ -2472,7 +2482,7 @@ void ClientConnector::CMD_CAPA(const std::string &cmd)
 	std::string os_version_str=get_lin_os_version();
 	tcpstack.Send(pipe, "FILE=2&FILE2=1&FILESRV=3&SET_SETTINGS=1&CLIENTUPDATE=2&ASYNC_INDEX=1"
 		"&CLIENT_VERSION_STR="+EscapeParamString((client_version_str))+"&OS_VERSION_STR="+EscapeParamString(os_version_str)
-		+"&ETA=1&CPD=0&FILE_META=1&SELECT_SHA=1&PHASH=1&RESTORE="+restore+"&CMD=1&SYMBIT=1&WTOKENS=1&OS_SIMPLE="+os_simple);
+		+"&ETA=1&CPD=0&FILE_META=1&SELECT_SHA=1&PHASH=1&RESTORE="+restore+"&CMD=1&SYMBIT=1&WTOKENS=1&BIN_FILELIST=1&OS_SIMPLE="+os_simple);
 #endif
 }
 
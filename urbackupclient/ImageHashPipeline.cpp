@@ -0,0 +1,235 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ImageHashPipeline.h"
+#include "ClientSend.h"
+#include "../Interface/Server.h"
+#include "../urbackupcommon/sha2/sha2.h"
+#include "../urbackupcommon/os_functions.h"
+#include <memory.h>
+#include <algorithm>
+
+namespace
+{
+	const size_t c_max_hash_workers = 8;
+}
+
+ImageHashPipeline::ImageHashPipeline(ClientSend* clientSend, unsigned int blocksize, size_t nworkers)
+	: clientSend(clientSend), blocksize(blocksize), zeroblockbuf(blocksize),
+	mutex(Server->createMutex()), work_cond(Server->createCondition()), done_cond(Server->createCondition()),
+	curr_job(NULL), pending_bufs(0), do_exit(false)
+{
+	if (nworkers == 0)
+	{
+		nworkers = 1;
+	}
+
+	for (size_t i = 0; i < nworkers; ++i)
+	{
+		workers.push_back(new HashWorker(this));
+		worker_tickets.push_back(Server->getThreadPool()->execute(workers[i], "image hash"));
+	}
+}
+
+ImageHashPipeline::~ImageHashPipeline()
+{
+	{
+		IScopedLock lock(mutex.get());
+		do_exit = true;
+		work_cond->notify_all();
+	}
+
+	Server->getThreadPool()->waitFor(worker_tickets);
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		delete workers[i];
+	}
+
+	if (curr_job != NULL)
+	{
+		send_queue.push_back(curr_job);
+	}
+
+	for (size_t i = 0; i < send_queue.size(); ++i)
+	{
+		for (size_t j = 0; j < send_queue[i]->bufs.size(); ++j)
+		{
+			clientSend->freeBuffer(send_queue[i]->bufs[j]);
+		}
+		delete send_queue[i];
+	}
+}
+
+void ImageHashPipeline::addBlock(char * buf)
+{
+	if (curr_job == NULL)
+	{
+		curr_job = new SHashJob;
+		curr_job->done = false;
+	}
+
+	curr_job->bufs.push_back(buf);
+
+	IScopedLock lock(mutex.get());
+	++pending_bufs;
+}
+
+void ImageHashPipeline::finishVhdBlock(int64 hash_start, int64 nextblock)
+{
+	if (curr_job == NULL)
+	{
+		curr_job = new SHashJob;
+		curr_job->done = false;
+	}
+
+	curr_job->hash_start = hash_start;
+	curr_job->nextblock = nextblock;
+
+	IScopedLock lock(mutex.get());
+	send_queue.push_back(curr_job);
+	hash_queue.push_back(curr_job);
+	curr_job = NULL;
+	work_cond->notify_one();
+}
+
+bool ImageHashPipeline::sendNext(bool wait, int64& nextblock, unsigned char * dig)
+{
+	SHashJob* job;
+	{
+		IScopedLock lock(mutex.get());
+
+		if (send_queue.empty())
+		{
+			return false;
+		}
+
+		while (!send_queue.front()->done)
+		{
+			if (!wait)
+			{
+				return false;
+			}
+
+			done_cond->wait(&lock);
+		}
+
+		job = send_queue.front();
+		send_queue.pop_front();
+		pending_bufs -= job->bufs.size();
+	}
+
+	for (size_t i = 0; i < job->bufs.size(); ++i)
+	{
+		clientSend->sendBuffer(job->bufs[i], sizeof(int64) + blocksize, false);
+	}
+
+	char* cb = clientSend->getBuffer();
+	int64 bs = -126;
+	memcpy(cb, &bs, sizeof(int64));
+	memcpy(cb + sizeof(int64), &job->nextblock, sizeof(int64));
+	memcpy(cb + 2 * sizeof(int64), job->dig, sizeof(job->dig));
+	clientSend->sendBuffer(cb, 2 * sizeof(int64) + sizeof(job->dig), true);
+
+	nextblock = job->nextblock;
+	memcpy(dig, job->dig, sizeof(job->dig));
+
+	delete job;
+
+	return true;
+}
+
+size_t ImageHashPipeline::getPendingBuffers()
+{
+	IScopedLock lock(mutex.get());
+	return pending_bufs;
+}
+
+size_t ImageHashPipeline::defaultNumWorkers()
+{
+	size_t ncpus = static_cast<size_t>(os_get_num_cpus());
+	//Leave one core for reading and sending
+	if (ncpus > 1)
+	{
+		--ncpus;
+	}
+	return (std::min)((std::max)(ncpus, static_cast<size_t>(1)), c_max_hash_workers);
+}
+
+void ImageHashPipeline::hashJob(SHashJob * job)
+{
+	sha256_ctx shactx;
+	sha256_init(&shactx);
+
+	size_t idx = 0;
+	for (int64 block = job->hash_start; block < job->nextblock; ++block)
+	{
+		int64 buf_block = -1;
+		if (idx < job->bufs.size())
+		{
+			memcpy(&buf_block, job->bufs[idx], sizeof(int64));
+		}
+
+		if (buf_block == block)
+		{
+			sha256_update(&shactx, reinterpret_cast<unsigned char*>(job->bufs[idx]) + sizeof(int64), blocksize);
+			++idx;
+		}
+		else
+		{
+			sha256_update(&shactx, &zeroblockbuf[0], blocksize);
+		}
+	}
+
+	sha256_final(&shactx, job->dig);
+}
+
+ImageHashPipeline::HashWorker::HashWorker(ImageHashPipeline * pipeline)
+	: pipeline(pipeline)
+{
+}
+
+void ImageHashPipeline::HashWorker::operator()()
+{
+	while (true)
+	{
+		SHashJob* job;
+		{
+			IScopedLock lock(pipeline->mutex.get());
+			while (pipeline->hash_queue.empty()
+				&& !pipeline->do_exit)
+			{
+				pipeline->work_cond->wait(&lock);
+			}
+
+			if (pipeline->do_exit)
+			{
+				return;
+			}
+
+			job = pipeline->hash_queue.front();
+			pipeline->hash_queue.pop_front();
+		}
+
+		pipeline->hashJob(job);
+
+		IScopedLock lock(pipeline->mutex.get());
+		job->done = true;
+		pipeline->done_cond->notify_all();
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../Interface/Thread.h"
+#include "../Interface/ThreadPool.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "../Interface/Types.h"
+#include <vector>
+#include <deque>
+#include <memory>
+
+class ClientSend;
+
+/**
+* Hashes the VHD blocks of a full image backup on several worker threads.
+* The image reader adds the blocks of one VHD block and closes it with
+* finishVhdBlock(). Finished VHD blocks are sent in order via ClientSend:
+* first the data blocks, then the checksum record the server verifies.
+*/
+class ImageHashPipeline
+{
+public:
+	ImageHashPipeline(ClientSend* clientSend, unsigned int blocksize, size_t nworkers);
+	~ImageHashPipeline();
+
+	//buf is a ClientSend buffer with the block position in front of the data
+	void addBlock(char* buf);
+	void finishVhdBlock(int64 hash_start, int64 nextblock);
+
+	//Sends the next VHD block if its hash is done (or waits for it)
+	bool sendNext(bool wait, int64& nextblock, unsigned char* dig);
+
+	size_t getPendingBuffers();
+
+	static size_t defaultNumWorkers();
+
+private:
+	struct SHashJob
+	{
+		int64 hash_start;
+		int64 nextblock;
+		std::vector<char*> bufs;
+		unsigned char dig[32];
+		bool done;
+	};
+
+	class HashWorker : public IThread
+	{
+	public:
+		HashWorker(ImageHashPipeline* pipeline);
+		void operator()();
+	private:
+		ImageHashPipeline* pipeline;
+	};
+
+	void hashJob(SHashJob* job);
+
+	ClientSend* clientSend;
+	unsigned int blocksize;
+	std::vector<unsigned char> zeroblockbuf;
+
+	std::auto_ptr<IMutex> mutex;
+	std::auto_ptr<ICondition> work_cond;
+	std::auto_ptr<ICondition> done_cond;
+	std::deque<SHashJob*> hash_queue;
+	std::deque<SHashJob*> send_queue;
+	SHashJob* curr_job;
+	size_t pending_bufs;
+	bool do_exit;
+
+	std::vector<HashWorker*> workers;
+	std::vector<THREADPOOL_TICKET> worker_tickets;
+};
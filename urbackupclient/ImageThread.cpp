@@ -30,6 +30,7 @@
 #include "ClientService.h"
 #include "ImageThread.h"
 #include "ClientSend.h"
+#include "ImageHashPipeline.h"
 #include "client.h"
 
 #include <memory.h>
@@ -122,6 +123,30 @@ void ImageThread::createShadowData(str_map & other_vols, CWData & shadow_data)
 
 const unsigned int c_vhdblocksize=(1024*1024/2);
 const unsigned int c_hashsize=32;
+//Data buffers held back until their VHD block is hashed (ClientSend has 2000)
+const size_t c_max_pending_hash_bufs=1000;
+
+namespace
+{
+	void sendHashedVhdBlocks(ImageHashPipeline& hash_pipeline, bool wait, size_t max_pending_bufs,
+		std::auto_ptr<IFile>& hdat_img, const std::string& hdat_vol, int r_shadow_id, unsigned int vhdblocks)
+	{
+		int64 nextblock;
+		unsigned char dig[c_hashsize];
+		while (hash_pipeline.sendNext(wait || hash_pipeline.getPendingBuffers()>max_pending_bufs, nextblock, dig))
+		{
+			if (hdat_img.get() != NULL
+				&& IndexThread::getShadowId(hdat_vol, hdat_img.get())==r_shadow_id)
+			{
+				hdat_img->Write(sizeof(int) + ((nextblock-1) / vhdblocks)*c_hashsize, reinterpret_cast<char*>(dig), c_hashsize);
+			}
+			else
+			{
+				hdat_img.reset();
+			}
+		}
+	}
+}
 
 bool ImageThread::sendFullImageThread(void)
 {
@@ -186,10 +211,14 @@ bool ImageThread::sendFullImageThread(void)
 				hdat_vol = image_inf->image_letter;
 				hdat_img.reset(openHdatF(image_inf->image_letter, true));
 
+#ifdef _WIN32
 				if (hdat_vol.size()==1)
 				{
 					hdat_vol += ":";
 				}
+#else
+				IndexThread::normalizeVolume(hdat_vol);
+#endif
 
 				if (hdat_img.get() != NULL)
 				{
@@ -234,7 +263,6 @@ bool ImageThread::sendFullImageThread(void)
 			int64 blockcnt=fs->calculateUsedSpace()/blocksize;
 			int64 ncurrblocks=0;
 			sha256_ctx shactx;
-			unsigned char *zeroblockbuf=NULL;
 			unsigned int vhdblocks=c_vhdblocksize/blocksize;
 			CWData shadow_data;
 			createShadowData(other_vols, shadow_data);
@@ -242,8 +270,6 @@ bool ImageThread::sendFullImageThread(void)
 			if(with_checksum)
 			{
 				sha256_init(&shactx);
-				zeroblockbuf=new unsigned char[blocksize];
-				memset(zeroblockbuf, 0, blocksize);
 			}
 
 			if(image_inf->startpos<0)
@@ -306,6 +332,13 @@ bool ImageThread::sendFullImageThread(void)
 			clientSend=new ClientSend(pipe, blocksize+sizeof(int64), 2000);
 			THREADPOOL_TICKET send_ticket=Server->getThreadPool()->execute(clientSend, "full image transfer");
 
+			std::auto_ptr<ImageHashPipeline> hash_pipeline;
+			int64 hash_start=-1;
+			if(with_checksum)
+			{
+				hash_pipeline.reset(new ImageHashPipeline(clientSend, blocksize, ImageHashPipeline::defaultNumWorkers()));
+			}
+
 			unsigned int needed_bufs=64;
 			int64 last_hash_block=-1;
 			std::vector<char*> bufs;
@@ -340,16 +373,14 @@ bool ImageThread::sendFullImageThread(void)
 								last_hash_block=(j/vhdblocks)*vhdblocks-1;								
 							}
 
-							for(int64 k=last_hash_block+1;k<j;++k)
+							if(hash_start<0)
 							{
-								sha256_update(&shactx, zeroblockbuf, blocksize);
+								hash_start=last_hash_block+1;
 							}
 
 							memcpy(bufs[idx], &secs[idx], sizeof(int64) );
-							sha256_update(&shactx, (unsigned char*)bufs[idx]+sizeof(int64), blocksize);
-							clientSend->sendBuffer(bufs[idx], sizeof(int64)+blocksize, false);
+							hash_pipeline->addBlock(bufs[idx]);
 							++idx;
-							notify_cs=true;
 							last_hash_block=j;
 						}
 
@@ -357,35 +388,18 @@ bool ImageThread::sendFullImageThread(void)
 						{
 							if(last_hash_block>=j+1-vhdblocks )
 							{
-								for(int64 k=last_hash_block;k<j;++k)
+								if(hash_start<0)
 								{
-									sha256_update(&shactx, zeroblockbuf, blocksize);
-								}
-
-								unsigned char dig[c_hashsize];
-								sha256_final(&shactx, dig);							
-								char* cb=clientSend->getBuffer();
-								int64 bs=-126;
-								int64 nextblock=j+1;
-								memcpy(cb, &bs, sizeof(int64) );
-								memcpy(cb+sizeof(int64), &nextblock, sizeof(int64));
-								memcpy(cb+2*sizeof(int64), dig, c_hashsize);
-								clientSend->sendBuffer(cb, 2*sizeof(int64)+c_hashsize, false);
-								notify_cs=true;
-
-								if (hdat_img.get() != NULL
-									&& IndexThread::getShadowId(hdat_vol, hdat_img.get())==r_shadow_id)
-								{
-									hdat_img->Write(sizeof(int) + (j / vhdblocks)*c_hashsize, reinterpret_cast<char*>(dig), c_hashsize);
-								}
-								else
-								{
-									hdat_img.reset();
+									hash_start=last_hash_block+1;
 								}
+								hash_pipeline->finishVhdBlock(hash_start, j+1);
 							}
-							sha256_init(&shactx);
+							hash_start=-1;
 						}
 					}
+
+					sendHashedVhdBlocks(*hash_pipeline, false, c_max_pending_hash_bufs,
+						hdat_img, hdat_vol, r_shadow_id, vhdblocks);
 				}
 				else
 				{
@@ -425,6 +439,16 @@ bool ImageThread::sendFullImageThread(void)
 				}
 			}
 
+			if(hash_pipeline.get()!=NULL)
+			{
+				if(run)
+				{
+					sendHashedVhdBlocks(*hash_pipeline, true, 0,
+						hdat_img, hdat_vol, r_shadow_id, vhdblocks);
+				}
+				hash_pipeline.reset();
+			}
+
 			for(size_t i=0;i<bufs.size();++i)
 			{
 				clientSend->freeBuffer(bufs[i]);
@@ -573,10 +597,14 @@ bool ImageThread::sendIncrImageThread(void)
 				hdat_vol = image_inf->image_letter;
 				hdat_img.reset(openHdatF(image_inf->image_letter, true));
 
+#ifdef _WIN32
 				if (hdat_vol.size() == 1)
 				{
 					hdat_vol += ":";
 				}
+#else
+				IndexThread::normalizeVolume(hdat_vol);
+#endif
 
 				if (hdat_img.get() != NULL)
 				{
@@ -1231,7 +1259,11 @@ std::string ImageThread::hdatFn(std::string volume)
 		return std::string();
 	}
 
+#ifdef _WIN32
 	return volume + os_file_sep() + "System Volume Information\\urbhdat_img.dat";
+#else
+	return "urbackup/hdat_img_" + conv_filename(volume) + ".dat";
+#endif
 }
 
 IFsFile* ImageThread::openHdatF(std::string volume, bool share)
@@ -1260,7 +1292,8 @@ IFsFile* ImageThread::openHdatF(std::string volume, bool share)
 
 	return Server->openFileFromHandle(hfile, volume + os_file_sep() + "System Volume Information\\urbhdat_img.dat");
 #else
-	return NULL;
+	//Only finishing change block tracking creates the file
+	return Server->openFile(hdatFn(volume), share ? MODE_RW : MODE_RW_CREATE);
 #endif
 }
 
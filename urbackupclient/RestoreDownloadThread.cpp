@@ -27,12 +27,16 @@ namespace
 	const size_t max_queue_size = 500;
 	const size_t queue_items_full = 1;
 	const size_t queue_items_chunked = 4;
+	//Round trip costs of a file compared to data bytes when balancing the download streams
+	const int64 queue_file_overhead_bytes = 64 * 1024;
 }
 
-RestoreDownloadThread::RestoreDownloadThread( FileClient& fc, FileClientChunked& fc_chunked, const std::string& client_token, str_map& metadata_path_mapping)
-	: fc(fc), fc_chunked(fc_chunked), queue_size(0), all_downloads_ok(true),
+RestoreDownloadThread::RestoreDownloadThread( FileClient& fc, FileClientChunked& fc_chunked, const std::string& client_token,
+	str_map& metadata_path_mapping, IMutex* metadata_path_mapping_mutex)
+	: fc(fc), fc_chunked(fc_chunked), queue_size(0), queued_bytes(0), all_downloads_ok(true),
 	mutex(Server->createMutex()), cond(Server->createCondition()), skipping(false), is_offline(false),
-	client_token(client_token), metadata_path_mapping(metadata_path_mapping)
+	client_token(client_token), metadata_path_mapping(metadata_path_mapping),
+	metadata_path_mapping_mutex(metadata_path_mapping_mutex)
 {
 
 }
@@ -99,6 +103,9 @@ void RestoreDownloadThread::operator()()
 			delete curr.patch_dl_files.orig_file;
 			ScopedDeleteFile del_3(curr.patch_dl_files.chunkhashes);
 
+			IScopedLock lock(mutex.get());
+			queued_bytes -= queueCost(curr);
+
 			continue;
 		}
 
@@ -113,22 +120,14 @@ void RestoreDownloadThread::operator()()
 			ret = load_file_patch(curr);
 		}
 
+		IScopedLock lock(mutex.get());
+		queued_bytes -= queueCost(curr);
+
 		if(!ret)
 		{
-			IScopedLock lock(mutex.get());
 			is_offline=true;
 		}
 	}
-
-	if(!is_offline && !skipping)
-	{
-		_u32 rc = fc.InformMetadataStreamEnd(client_token, 3);
-
-		if(rc!=ERR_SUCCESS)
-		{
-			Server->Log("Error informing client about metadata stream end. Errorcode: "+fc.getErrorString(rc)+" ("+convert(rc)+")", LL_ERROR);
-		}
-	}
 }
 
 void RestoreDownloadThread::addToQueueFull( size_t id, const std::string &remotefn, const std::string &destfn,
@@ -154,6 +153,7 @@ void RestoreDownloadThread::addToQueueFull( size_t id, const std::string &remote
 	cond->notify_one();
 
 	queue_size+=queue_items_full;
+	queued_bytes+=queueCost(ni);
 	sleepQueue(lock);
 }
 
@@ -178,6 +178,7 @@ void RestoreDownloadThread::addToQueueChunked( size_t id, const std::string &rem
 	cond->notify_one();
 
 	queue_size+=queue_items_chunked;
+	queued_bytes+=queueCost(ni);
 	sleepQueue(lock);
 }
 
@@ -226,18 +227,20 @@ bool RestoreDownloadThread::load_file( SQueueItem todl )
 				todl.destfn=old_destfn+"_"+convert(idx);
 				++idx;
 
+				//renamed_files and rename_queue are read by the scheduler from the main thread
 				IScopedLock lock(mutex.get());
 				dest_f.reset(Server->openFile(os_file_prefix(todl.destfn), MODE_WRITE));
 
 				if (dest_f.get() != NULL)
 				{
 					renamed_files.insert(todl.destfn);
+					rename_queue.push_back(std::make_pair(todl.destfn, old_destfn));
 				}
 			}
 
 			if (dest_f.get() != NULL)
 			{
-				rename_queue.push_back(std::make_pair(todl.destfn, old_destfn));
+				IScopedLock path_mapping_lock(metadata_path_mapping_mutex);
 				metadata_path_mapping[old_destfn] = todl.destfn;
 			}
 		}
@@ -466,6 +469,24 @@ bool RestoreDownloadThread::hasError()
     return !download_nok_ids.empty();
 }
 
+bool RestoreDownloadThread::isStopped()
+{
+	IScopedLock lock(mutex.get());
+	return is_offline || skipping;
+}
+
+int64 RestoreDownloadThread::getQueuedBytes()
+{
+	IScopedLock lock(mutex.get());
+	return queued_bytes;
+}
+
+bool RestoreDownloadThread::isQueueFull()
+{
+	IScopedLock lock(mutex.get());
+	return queue_size>max_queue_size;
+}
+
 void RestoreDownloadThread::sleepQueue(IScopedLock& lock)
 {
 	while(queue_size>max_queue_size)
@@ -476,8 +497,24 @@ void RestoreDownloadThread::sleepQueue(IScopedLock& lock)
 	}
 }
 
+int64 RestoreDownloadThread::queueCost(const SQueueItem& item)
+{
+	if (item.action != EQueueAction_Fileclient)
+	{
+		return 0;
+	}
+
+	if (item.metadata_only || item.predicted_filesize<0)
+	{
+		return queue_file_overhead_bytes;
+	}
+
+	return item.predicted_filesize + queue_file_overhead_bytes;
+}
+
 std::vector<std::pair<std::string, std::string> > RestoreDownloadThread::getRenameQueue()
 {
+	IScopedLock lock(mutex.get());
 	return rename_queue;
 }
 
@@ -487,3 +524,190 @@ bool RestoreDownloadThread::isRenamedFile(const std::string & fn)
 	return renamed_files.find(fn) != renamed_files.end();
 }
 
+
+RestoreDownloadScheduler::RestoreDownloadScheduler(const std::string& client_token, str_map& metadata_path_mapping)
+	: client_token(client_token), metadata_path_mapping(metadata_path_mapping),
+	metadata_path_mapping_mutex(Server->createMutex()), finished(false)
+{
+}
+
+RestoreDownloadScheduler::~RestoreDownloadScheduler()
+{
+	if (!finished)
+	{
+		queueStop();
+		Server->getThreadPool()->waitFor(tickets);
+	}
+
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		delete streams[i].thread;
+		delete streams[i].fc_chunked;
+		if (streams[i].owns_fc)
+		{
+			delete streams[i].fc;
+		}
+	}
+}
+
+void RestoreDownloadScheduler::addStream(FileClient* fc, bool owns_fc, FileClientChunked* fc_chunked)
+{
+	SDownloadStream stream;
+	stream.fc = fc;
+	stream.owns_fc = owns_fc;
+	stream.fc_chunked = fc_chunked;
+	stream.thread = new RestoreDownloadThread(*fc, *fc_chunked, client_token,
+		metadata_path_mapping, metadata_path_mapping_mutex.get());
+
+	streams.push_back(stream);
+	tickets.push_back(Server->getThreadPool()->execute(stream.thread, "file restore download"));
+}
+
+size_t RestoreDownloadScheduler::numStreams()
+{
+	return streams.size();
+}
+
+void RestoreDownloadScheduler::addToQueueFull(size_t id, const std::string & remotefn, const std::string & destfn,
+	_i64 predicted_filesize, const FileMetadata & metadata, bool is_script, bool metadata_only, size_t folder_items, IFsFile * orig_file)
+{
+	selectStream()->addToQueueFull(id, remotefn, destfn, predicted_filesize, metadata, is_script, metadata_only, folder_items, orig_file);
+}
+
+void RestoreDownloadScheduler::addToQueueChunked(size_t id, const std::string & remotefn, const std::string & destfn,
+	_i64 predicted_filesize, const FileMetadata & metadata, bool is_script, IFsFile * orig_file, IFile * chunkhashes)
+{
+	selectStream()->addToQueueChunked(id, remotefn, destfn, predicted_filesize, metadata, is_script, orig_file, chunkhashes);
+}
+
+void RestoreDownloadScheduler::queueSkip()
+{
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		streams[i].thread->queueSkip();
+	}
+}
+
+void RestoreDownloadScheduler::queueStop()
+{
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		streams[i].thread->queueStop();
+	}
+}
+
+bool RestoreDownloadScheduler::waitFor(int timems)
+{
+	if (finished)
+	{
+		return true;
+	}
+
+	if (!Server->getThreadPool()->waitFor(tickets, timems))
+	{
+		return false;
+	}
+
+	finished = true;
+
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		if (streams[i].thread->isStopped())
+		{
+			return true;
+		}
+	}
+
+	if (!streams.empty())
+	{
+		FileClient& fc = *streams[0].fc;
+		_u32 rc = fc.InformMetadataStreamEnd(client_token, 3);
+
+		if (rc != ERR_SUCCESS)
+		{
+			Server->Log("Error informing client about metadata stream end. Errorcode: " + fc.getErrorString(rc) + " (" + convert(rc) + ")", LL_ERROR);
+		}
+	}
+
+	return true;
+}
+
+bool RestoreDownloadScheduler::hasError()
+{
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		if (streams[i].thread->hasError())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<std::pair<std::string, std::string> > RestoreDownloadScheduler::getRenameQueue()
+{
+	std::vector<std::pair<std::string, std::string> > ret;
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		std::vector<std::pair<std::string, std::string> > rename_queue = streams[i].thread->getRenameQueue();
+		ret.insert(ret.end(), rename_queue.begin(), rename_queue.end());
+	}
+	return ret;
+}
+
+bool RestoreDownloadScheduler::isRenamedFile(const std::string & fn)
+{
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		if (streams[i].thread->isRenamedFile(fn))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+int64 RestoreDownloadScheduler::getReceivedDataBytes(bool with_sparse)
+{
+	int64 ret = 0;
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		ret += streams[i].fc->getReceivedDataBytes(with_sparse)
+			+ streams[i].fc_chunked->getReceivedDataBytes(with_sparse);
+	}
+	return ret;
+}
+
+int64 RestoreDownloadScheduler::getTransferredBytes()
+{
+	int64 ret = 0;
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		ret += streams[i].fc->getTransferredBytes()
+			+ streams[i].fc_chunked->getTransferredBytes();
+	}
+	return ret;
+}
+
+RestoreDownloadThread* RestoreDownloadScheduler::selectStream()
+{
+	//Least queued bytes, preferring streams which would not block on a full queue
+	RestoreDownloadThread* ret = NULL;
+	bool ret_full = true;
+	int64 ret_bytes = 0;
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		bool full = streams[i].thread->isQueueFull();
+		int64 bytes = streams[i].thread->getQueuedBytes();
+
+		if (ret == NULL
+			|| (ret_full && !full)
+			|| (full == ret_full && bytes < ret_bytes))
+		{
+			ret = streams[i].thread;
+			ret_full = full;
+			ret_bytes = bytes;
+		}
+	}
+	return ret;
+}
@@ -5,8 +5,10 @@
 #include "../Interface/Mutex.h"
 #include "../Interface/Condition.h"
 #include "../urbackupcommon/file_metadata.h"
+#include "../Interface/ThreadPool.h"
 #include <memory>
 #include <set>
+#include <vector>
 
 namespace
 {
@@ -59,7 +61,8 @@ namespace
 class RestoreDownloadThread : public IThread, public FileClient::QueueCallback, public FileClientChunked::QueueCallback
 {
 public:
-	RestoreDownloadThread(FileClient& fc, FileClientChunked& fc_chunked, const std::string& client_token, str_map& metadata_path_mapping);
+	RestoreDownloadThread(FileClient& fc, FileClientChunked& fc_chunked, const std::string& client_token,
+		str_map& metadata_path_mapping, IMutex* metadata_path_mapping_mutex);
 
 	void operator()();
 
@@ -91,6 +94,12 @@ public:
 
     bool hasError();
 
+	bool isStopped();
+
+	int64 getQueuedBytes();
+
+	bool isQueueFull();
+
 	std::vector<std::pair<std::string, std::string> > getRenameQueue();
 
 	bool isRenamedFile(const std::string& fn);
@@ -99,11 +108,14 @@ private:
 
 	void sleepQueue(IScopedLock& lock);
 
+	int64 queueCost(const SQueueItem& item);
+
 	FileClient& fc;
 	FileClientChunked& fc_chunked;
 
 	std::deque<SQueueItem> dl_queue;
 	size_t queue_size;
+	int64 queued_bytes;
 
 	bool all_downloads_ok;
 	std::vector<size_t> download_nok_ids;
@@ -118,5 +130,66 @@ private:
 
 	std::vector<std::pair<std::string, std::string> > rename_queue;
 	str_map& metadata_path_mapping;
+	IMutex* metadata_path_mapping_mutex;
 	std::set<std::string> renamed_files;
 };
+
+/**
+* Spreads the restore queue over several download threads, each with
+* its own file server connections. Many small files are then requested
+* in parallel instead of one after another and big files do not block the
+* remaining files. Each item goes to the stream with the least queued bytes.
+*/
+class RestoreDownloadScheduler
+{
+public:
+	RestoreDownloadScheduler(const std::string& client_token, str_map& metadata_path_mapping);
+	~RestoreDownloadScheduler();
+
+	//Starts a download thread. fc is deleted at the end if owns_fc is set, fc_chunked always
+	void addStream(FileClient* fc, bool owns_fc, FileClientChunked* fc_chunked);
+
+	size_t numStreams();
+
+	void addToQueueFull(size_t id, const std::string &remotefn, const std::string &destfn,
+		_i64 predicted_filesize, const FileMetadata& metadata, bool is_script, bool metadata_only, size_t folder_items, IFsFile* orig_file);
+
+	void addToQueueChunked(size_t id, const std::string &remotefn, const std::string &destfn,
+		_i64 predicted_filesize, const FileMetadata& metadata, bool is_script, IFsFile* orig_file, IFile* chunkhashes);
+
+	void queueSkip();
+
+	void queueStop();
+
+	//Informs the server about the metadata stream end once all streams are done
+	bool waitFor(int timems);
+
+	bool hasError();
+
+	std::vector<std::pair<std::string, std::string> > getRenameQueue();
+
+	bool isRenamedFile(const std::string& fn);
+
+	int64 getReceivedDataBytes(bool with_sparse);
+
+	int64 getTransferredBytes();
+
+private:
+	struct SDownloadStream
+	{
+		FileClient* fc;
+		bool owns_fc;
+		FileClientChunked* fc_chunked;
+		RestoreDownloadThread* thread;
+	};
+
+	RestoreDownloadThread* selectStream();
+
+	const std::string& client_token;
+	str_map& metadata_path_mapping;
+	std::auto_ptr<IMutex> metadata_path_mapping_mutex;
+
+	std::vector<SDownloadStream> streams;
+	std::vector<THREADPOOL_TICKET> tickets;
+	bool finished;
+};
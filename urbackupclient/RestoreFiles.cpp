@@ -47,6 +47,9 @@ namespace
 	const int64 restore_flag_open_all_files_first = 1 << 4;
 	const int64 restore_flag_reboot_overwrite_all = 1 << 5;
 
+	//Parallel file server connections used to download the restored files
+	const size_t restore_download_streams = 4;
+
 	class RestoreUpdaterThread : public IThread
 	{
 	public:
@@ -933,8 +936,34 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 	std::string share_path;
 	std::string server_path = "clientdl";
 
-	std::auto_ptr<RestoreDownloadThread> restore_download(new RestoreDownloadThread(fc, *fc_chunked, client_token, metadata_path_mapping));
-    THREADPOOL_TICKET restore_download_ticket = Server->getThreadPool()->execute(restore_download.get(), "file restore download");
+	std::auto_ptr<RestoreDownloadScheduler> restore_download(new RestoreDownloadScheduler(client_token, metadata_path_mapping));
+	restore_download->addStream(&fc, false, fc_chunked.release());
+
+	size_t download_streams = single_file ? 1 : restore_download_streams;
+	while (restore_download->numStreams() < download_streams)
+	{
+		std::auto_ptr<FileClient> stream_fc(new FileClient(false, client_token, 3,
+			true, this, NULL));
+
+		if (!connectFileClient(*stream_fc))
+		{
+			log("Connecting additional restore download stream failed. Using " + convert(restore_download->numStreams()) + " stream(s).", LL_WARNING);
+			break;
+		}
+
+		std::auto_ptr<FileClientChunked> stream_fc_chunked = createFcChunked();
+
+		if (stream_fc_chunked.get() == NULL)
+		{
+			log("Connecting additional restore download stream failed. Using " + convert(restore_download->numStreams()) + " stream(s).", LL_WARNING);
+			break;
+		}
+
+		stream_fc->setProgressLogCallback(this);
+		stream_fc_chunked->setProgressLogCallback(this);
+
+		restore_download->addStream(stream_fc.release(), true, stream_fc_chunked.release());
+	}
 
 	std::string curr_files_dir;
 	std::vector<SFileAndHash> curr_files;
@@ -1082,12 +1111,12 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 					}
 					else
 					{
-						int64 done_bytes = fc.getReceivedDataBytes(true) + fc_chunked->getReceivedDataBytes(true) + skipped_bytes;
+						int64 done_bytes = restore_download->getReceivedDataBytes(true) + skipped_bytes;
 						int pcdone = (std::min)(100,(int)(((float)done_bytes)/((float)total_size/100.f)+0.5f));
 						restore_updater.update_pc(pcdone, total_size, done_bytes);
 					}
 
-					calculateDownloadSpeed(fc, fc_chunked.get());
+					calculateDownloadSpeed(restore_download->getTransferredBytes());
 				}
 
 				if(!data.isdir || data.name!="..")
@@ -1694,7 +1723,7 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
 
     restore_download->queueStop();
 
-    while(!Server->getThreadPool()->waitFor(restore_download_ticket, 1000))
+    while(!restore_download->waitFor(1000))
     {
         if(total_size==0)
         {
@@ -1702,12 +1731,12 @@ bool RestoreFiles::downloadFiles(FileClient& fc, int64 total_size, ScopedRestore
         }
         else
         {
-			int64 done_bytes = fc.getReceivedDataBytes(true) + fc_chunked->getReceivedDataBytes(true) + skipped_bytes;
+			int64 done_bytes = restore_download->getReceivedDataBytes(true) + skipped_bytes;
             int pcdone = (std::min)(100,(int)(((float)done_bytes)/((float)total_size/100.f)+0.5f));
 			restore_updater.update_pc(pcdone, total_size, done_bytes);
         }
 
-		calculateDownloadSpeed(fc, fc_chunked.get());
+		calculateDownloadSpeed(restore_download->getTransferredBytes());
     }
 
 #ifdef _WIN32
@@ -1805,7 +1834,7 @@ void RestoreFiles::restore_failed(client::FileMetadataDownloadThread& metadata_t
 	ClientConnector::restoreDone(log_id, status_id, restore_id, false, server_token);
 }
 
-bool RestoreFiles::removeFiles( std::string restore_path, std::string share_path, RestoreDownloadThread* restore_download,
+bool RestoreFiles::removeFiles( std::string restore_path, std::string share_path, RestoreDownloadScheduler* restore_download,
 	std::stack<std::vector<std::string> > &folder_files, std::vector<std::string> &deletion_queue, bool& has_include_exclude,
 	const std::vector<int64>& tids, ClientDAO* clientdao, tokens::TokenCache& cache)
 {
@@ -2001,7 +2030,7 @@ bool RestoreFiles::renameFilesOnRestart( std::vector<std::pair<std::string, std:
 #endif
 }
 
-void RestoreFiles::calculateDownloadSpeed(FileClient & fc, FileClientChunked * fc_chunked)
+void RestoreFiles::calculateDownloadSpeed(int64 transferred_bytes)
 {
 	int64 ctime = Server->getTimeMS();
 	if (speed_set_time == 0)
@@ -2011,7 +2040,7 @@ void RestoreFiles::calculateDownloadSpeed(FileClient & fc, FileClientChunked * f
 
 	if (ctime - speed_set_time>10000)
 	{
-		int64 received_data_bytes = fc.getTransferredBytes() + (fc_chunked != NULL ? fc_chunked->getTransferredBytes() : 0);
+		int64 received_data_bytes = transferred_bytes;
 
 		int64 new_bytes = received_data_bytes - last_speed_received_bytes;
 		int64 passed_time = ctime - speed_set_time;
@@ -11,7 +11,7 @@
 #include <memory>
 #include <stack>
 
-class RestoreDownloadThread;
+class RestoreDownloadScheduler;
 
 namespace
 {
@@ -81,7 +81,7 @@ private:
 
 	bool downloadFiles(FileClient& fc, int64 total_size, ScopedRestoreUpdater& restore_updater, std::map<std::string, IFsFile*>& open_files);
 
-	bool removeFiles( std::string restore_path, std::string share_path, RestoreDownloadThread* restore_download, 
+	bool removeFiles( std::string restore_path, std::string share_path, RestoreDownloadScheduler* restore_download, 
 		std::stack<std::vector<std::string> > &folder_files, std::vector<std::string> &deletion_queue, bool& has_include_exclude,
 		const std::vector<int64>& tids, ClientDAO* clientdao, tokens::TokenCache& cache);
 
@@ -95,7 +95,7 @@ private:
 
 	std::auto_ptr<FileClientChunked> createFcChunked();
 
-	void calculateDownloadSpeed(FileClient & fc, FileClientChunked * fc_chunked);
+	void calculateDownloadSpeed(int64 transferred_bytes);
 
 	bool createDirectoryWin(const std::string& dir);
 
@@ -1493,6 +1493,20 @@ void IndexThread::indexDirs(bool full_backup, bool simultaneous_other)
 				if (!onlyref)
 				{
 					past_refs.push_back(scd->ref);
+
+					if (scd->ref != NULL
+						&& scd->ref->cbt)
+					{
+						scd->ref->cbt = finishCbt(scd->ref->target, -1, scd->ref->volpath, false);
+					}
+				}
+
+				if (scd->ref != NULL
+					&& !scd->ref->cbt
+					&& !disableCbt(scd->ref->target))
+				{
+					VSSLog("Error disabling change block tracking of \"" + scd->ref->target + "\"...", LL_ERROR);
+					index_error = true;
 				}
 #endif
 
@@ -1685,6 +1699,24 @@ void IndexThread::indexDirs(bool full_backup, bool simultaneous_other)
 				index_error = true;
 			}
 		}
+
+		std::string filelist_bin_fn = "urbackup/data/filelist_bin.ub";
+		if (index_group != c_group_default)
+		{
+			filelist_bin_fn = "urbackup/data/filelist_bin_" + convert(index_group) + ".ub";
+		}
+
+		if (FileExists(filelist_bin_fn)
+			&& !removeFile(filelist_bin_fn))
+		{
+			VSSLog("Error deleting file " + filelist_bin_fn + ". " + os_last_error_str(), LL_ERROR);
+		}
+	}
+
+	if (with_binary_filelist
+		&& !index_error)
+	{
+		writeBinaryFilelist(filelist_dest_fn);
 	}
 
 	for (size_t i = 0; i < backup_dirs.size(); ++i)
@@ -1711,6 +1743,43 @@ void IndexThread::indexDirs(bool full_backup, bool simultaneous_other)
 	changed_dirs.clear();
 }
 
+void IndexThread::writeBinaryFilelist(const std::string& filelist_dest_fn)
+{
+	std::string filelist_bin_fn = "urbackup/data/filelist_bin.ub";
+	if (index_group != c_group_default)
+	{
+		filelist_bin_fn = "urbackup/data/filelist_bin_" + convert(index_group) + ".ub";
+	}
+
+	std::string filelist_bin_new_fn = "urbackup/data/filelist_bin_new_" + convert(index_group) + ".ub";
+
+	//The text file list is kept to continue from it during the next indexing run.
+	//If the binary copy cannot be written the server loads the text file list
+	bool ok;
+	{
+		std::auto_ptr<IFile> filelist_f(Server->openFile(filelist_dest_fn, MODE_READ_SEQUENTIAL));
+		std::auto_ptr<IFile> filelist_bin_f(Server->openFile(filelist_bin_new_fn, MODE_WRITE));
+		ok = filelist_f.get() != NULL
+			&& filelist_bin_f.get() != NULL
+			&& convertFileListToBinary(filelist_f.get(), filelist_bin_f.get());
+	}
+
+	if (ok)
+	{
+#ifndef _DEBUG
+		change_file_permissions_admin_only(filelist_bin_new_fn);
+#endif
+		IScopedLock lock(filelist_mutex);
+		ok = moveFile(filelist_bin_new_fn, filelist_bin_fn);
+	}
+
+	if (!ok)
+	{
+		VSSLog("Error writing binary file list " + filelist_bin_fn + ". Sending text file list instead. " + os_last_error_str(), LL_WARNING);
+		removeFile(filelist_bin_new_fn);
+	}
+}
+
 void IndexThread::resetFileEntries(void)
 {
 	db->Write("DELETE FROM files WHERE tgroup=0 OR tgroup="+convert(index_group+1));
@@ -5195,7 +5264,233 @@ namespace
 	}
 }
 
-#endif
+#else //_WIN32
+
+#define LIN_CBT_BLOCKSIZE (512 * 1024)
+#define DATTOBD_COW_MAGIC 4776
+#define DATTOBD_COW_CLEAN 0
+#define DATTOBD_COW_HEADER_SIZE 4096
+#define DATTOBD_COW_BLOCK_SIZE 4096
+
+namespace
+{
+	void markChanged(Bitmap& bitmap, int64 nblocks, int64 start, int64 len)
+	{
+		if (len <= 0)
+		{
+			return;
+		}
+
+		for (int64 i = start / LIN_CBT_BLOCKSIZE; i <= (start + len - 1) / LIN_CBT_BLOCKSIZE && i < nblocks; ++i)
+		{
+			bitmap.set(static_cast<size_t>(i), true);
+		}
+	}
+
+	//Reads the block index of a dattobd cow file left over after
+	//"dbdctl transition-to-snapshot". A non-zero mapping means the
+	//4KiB block was changed while the device was in incremental mode.
+	bool readDattobdCbt(const std::string& fn, int64 volume_size, Bitmap& bitmap, int64 nblocks)
+	{
+		std::auto_ptr<IFsFile> f(Server->openFile(fn, MODE_READ));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error opening dattobd cow file " + fn + ". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		_u32 header[2];
+		if (f->Read(0, reinterpret_cast<char*>(header), sizeof(header)) != sizeof(header))
+		{
+			Server->Log("Error reading header of dattobd cow file " + fn, LL_ERROR);
+			return false;
+		}
+
+		if (little_endian(header[0]) != DATTOBD_COW_MAGIC)
+		{
+			Server->Log("File " + fn + " is not a dattobd cow file", LL_ERROR);
+			return false;
+		}
+
+		if ((little_endian(header[1]) & (1 << DATTOBD_COW_CLEAN)) == 0)
+		{
+			Server->Log("Dattobd cow file " + fn + " was not closed cleanly", LL_ERROR);
+			return false;
+		}
+
+		int64 total_blocks = volume_size / DATTOBD_COW_BLOCK_SIZE + (volume_size%DATTOBD_COW_BLOCK_SIZE == 0 ? 0 : 1);
+
+		std::vector<uint64> mappings(8192);
+
+		//The index is mostly sparse. Skip reading the holes.
+		f->resetSparseExtentIter();
+		IFsFile::SSparseExtent hole = f->nextSparseExtent();
+
+		for (int64 i = 0; i < total_blocks; i += mappings.size())
+		{
+			_u32 toread = static_cast<_u32>((std::min)(static_cast<int64>(mappings.size()), total_blocks - i)*sizeof(uint64));
+			int64 pos = DATTOBD_COW_HEADER_SIZE + i * sizeof(uint64);
+
+			while (hole.offset != -1
+				&& hole.offset + hole.size <= pos)
+			{
+				hole = f->nextSparseExtent();
+			}
+
+			if (hole.offset != -1
+				&& hole.offset <= pos
+				&& hole.offset + hole.size >= pos + toread)
+			{
+				continue;
+			}
+
+			bool has_read_error = false;
+			if (f->Read(pos, reinterpret_cast<char*>(mappings.data()), toread, &has_read_error) != toread
+				|| has_read_error)
+			{
+				Server->Log("Error reading index of dattobd cow file " + fn + ". " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+
+			for (size_t j = 0; j < toread / sizeof(uint64); ++j)
+			{
+				if (mappings[j] != 0)
+				{
+					markChanged(bitmap, nblocks, (i + j)*DATTOBD_COW_BLOCK_SIZE, DATTOBD_COW_BLOCK_SIZE);
+				}
+			}
+		}
+
+		return true;
+	}
+
+	//Reads the output of "era_invalidate --written-since" (dm-era)
+	bool readEraCbt(const std::string& fn, int64 era_blocksize, Bitmap& bitmap, int64 nblocks)
+	{
+		if (era_blocksize <= 0)
+		{
+			Server->Log("No dm-era block size given (CBT_BLOCKSIZE)", LL_ERROR);
+			return false;
+		}
+
+		std::auto_ptr<IFile> f(Server->openFile(fn, MODE_READ));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error opening dm-era block list " + fn + ". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		std::string data = f->Read(static_cast<_u32>(f->Size()));
+		if (static_cast<_i64>(data.size()) != f->Size())
+		{
+			Server->Log("Error reading dm-era block list " + fn, LL_ERROR);
+			return false;
+		}
+
+		bool has_blocks = false;
+		size_t pos = 0;
+		while ((pos = data.find('<', pos)) != std::string::npos)
+		{
+			size_t end = data.find('>', pos);
+			if (end == std::string::npos)
+			{
+				break;
+			}
+
+			std::string tag = data.substr(pos + 1, end - pos - 1);
+			if (next(tag, 0, "blocks"))
+			{
+				has_blocks = true;
+			}
+			else if (next(tag, 0, "block "))
+			{
+				int64 block = os_atoi64(getbetween("block=\"", "\"", tag));
+				markChanged(bitmap, nblocks, block*era_blocksize, era_blocksize);
+			}
+			else if (next(tag, 0, "range "))
+			{
+				int64 begin = os_atoi64(getbetween("begin=\"", "\"", tag));
+				int64 end = os_atoi64(getbetween("end=\"", "\"", tag));
+				//Include the end block in case the range is inclusive
+				markChanged(bitmap, nblocks, begin*era_blocksize, (end - begin + 1)*era_blocksize);
+			}
+
+			pos = end + 1;
+		}
+
+		if (!has_blocks)
+		{
+			Server->Log("No block list found in dm-era output " + fn, LL_ERROR);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool readMergeLinCbtBitmap(const std::string& fn, Bitmap& bitmap)
+	{
+		if (!FileExists(fn))
+		{
+			return true;
+		}
+
+		std::auto_ptr<IFile> f(Server->openFile(fn, MODE_READ));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error opening " + fn + ". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		std::string data = f->Read(static_cast<_u32>(f->Size()));
+		if (static_cast<_i64>(data.size()) != f->Size())
+		{
+			Server->Log("Error reading " + fn, LL_ERROR);
+			return false;
+		}
+
+		char* raw = bitmap.raw();
+		for (size_t i = 0; i < data.size() && i < bitmap.rawSize(); ++i)
+		{
+			raw[i] |= data[i];
+		}
+
+		return true;
+	}
+
+	bool saveMergeLinCbtBitmap(const std::string& fn, Bitmap& bitmap)
+	{
+		if (!readMergeLinCbtBitmap(fn, bitmap))
+		{
+			return false;
+		}
+
+		std::auto_ptr<IFile> f(Server->openFile(fn + ".new", MODE_WRITE));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error creating file " + fn + ".new. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		if (f->Write(bitmap.raw(), static_cast<_u32>(bitmap.rawSize())) != bitmap.rawSize())
+		{
+			Server->Log("Error writing bitmap. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		f->Sync();
+		f.reset();
+
+		if (!os_rename_file(fn + ".new", fn))
+		{
+			Server->Log("Error renaming " + fn + ".new to " + fn + ". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		return true;
+	}
+}
+
+#endif //_WIN32
 
 bool IndexThread::prepareCbt(std::string volume)
 {
@@ -5285,6 +5580,12 @@ bool IndexThread::normalizeVolume(std::string & volume)
 	{
 		volume = volume.substr(0, volume.size() - 1);
 	}
+#else
+	if (volume.size() > 1
+		&& volume[volume.size() - 1] == '/')
+	{
+		volume = volume.substr(0, volume.size() - 1);
+	}
 #endif
 
 	return true;
@@ -5710,7 +6011,137 @@ bool IndexThread::finishCbt(std::string volume, int shadow_id, std::string snap_
 
 	return true;
 #else
-	return false;
+	if (!normalizeVolume(volume))
+	{
+		return false;
+	}
+
+	SCRef* ref = NULL;
+	for (size_t i = 0; i < sc_refs.size(); ++i)
+	{
+		if (sc_refs[i]->volpath == snap_volume
+			&& !sc_refs[i]->cbt_format.empty())
+		{
+			ref = sc_refs[i];
+			break;
+		}
+	}
+
+	if (ref == NULL)
+	{
+		VSSLog("No change block tracking information for snapshot " + snap_volume, LL_ERROR);
+		return false;
+	}
+
+	ScopedDeleteFn delete_cbt_file(ref->cbt_file);
+	std::string cbt_file = ref->cbt_file;
+	ref->cbt_file.clear();
+
+	int64 nblocks = ref->cbt_volume_size / LIN_CBT_BLOCKSIZE + (ref->cbt_volume_size%LIN_CBT_BLOCKSIZE == 0 ? 0 : 1);
+	Bitmap bitmap(static_cast<size_t>(nblocks));
+
+	if (cbt_file.empty())
+	{
+		VSSLog("Change block tracking started on volume " + volume + ". All blocks are changed.", LL_INFO);
+		for (int64 i = 0; i < nblocks; ++i)
+		{
+			bitmap.set(static_cast<size_t>(i), true);
+		}
+	}
+	else if (ref->cbt_format == "dattobd")
+	{
+		if (!readDattobdCbt(cbt_file, ref->cbt_volume_size, bitmap, nblocks))
+		{
+			return false;
+		}
+	}
+	else if (ref->cbt_format == "era")
+	{
+		if (!readEraCbt(cbt_file, ref->cbt_blocksize, bitmap, nblocks))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		VSSLog("Unknown change block tracking format \"" + ref->cbt_format + "\"", LL_ERROR);
+		return false;
+	}
+
+	std::string pending_fn = "urbackup/hdat_img_" + conv_filename(volume) + ".cbt";
+
+	if (!for_image_backup)
+	{
+		//Only image backups use the changed blocks. Keep them until the next one.
+		if (!saveMergeLinCbtBitmap(pending_fn, bitmap))
+		{
+			VSSLog("Error saving CBT bitmap for image backup", LL_ERROR);
+			return false;
+		}
+		return true;
+	}
+
+	if (!readMergeLinCbtBitmap(pending_fn, bitmap))
+	{
+		VSSLog("Error reading last bitmap data for CBT for image backup", LL_ERROR);
+		return false;
+	}
+
+	std::auto_ptr<IFsFile> hdat_img(ImageThread::openHdatF(volume, false));
+
+	if (hdat_img.get() == NULL)
+	{
+		std::string errmsg;
+		int64 err = os_last_error(errmsg);
+		VSSLog("Cannot open image hash data file for change block tracking. " + errmsg + " (code: " + convert(err) + ")", LL_ERROR);
+		return false;
+	}
+
+	if (!hdat_img->Resize(sizeof(shadow_id) + nblocks * SHA256_DIGEST_SIZE))
+	{
+		VSSLog("Error resizing image hash data file. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	char zero_sha[SHA256_DIGEST_SIZE] = {};
+
+	VSSLog("Zeroing image hash data of volume " + volume + "...", LL_DEBUG);
+
+	int64 changed_bytes = 0;
+	for (int64 i = 0; i < nblocks; ++i)
+	{
+		if (bitmap.get(static_cast<size_t>(i)))
+		{
+			if (hdat_img->Write(sizeof(shadow_id) + i*SHA256_DIGEST_SIZE, zero_sha, SHA256_DIGEST_SIZE) != SHA256_DIGEST_SIZE)
+			{
+				std::string errmsg;
+				int64 err = os_last_error(errmsg);
+				VSSLog("Error zeroing image hash data. " + errmsg + " (code: " + convert(err) + ")", LL_ERROR);
+				return false;
+			}
+
+			changed_bytes += LIN_CBT_BLOCKSIZE;
+		}
+	}
+
+	if (hdat_img->Write(0, reinterpret_cast<char*>(&shadow_id), sizeof(shadow_id)) != sizeof(shadow_id))
+	{
+		VSSLog("Error writing shadow id", LL_ERROR);
+		return false;
+	}
+
+	{
+		IScopedLock lock(cbt_shadow_id_mutex);
+		cbt_shadow_ids[strlower(volume)] = shadow_id;
+	}
+
+	hdat_img->Sync();
+
+	Server->deleteFile(pending_fn);
+
+	VSSLog("Change block tracking reports " + PrettyPrintBytes(changed_bytes) + " have changed on volume " + volume, LL_INFO);
+
+	return true;
 #endif
 }
 
@@ -5746,7 +6177,21 @@ bool IndexThread::disableCbt(std::string volume)
 	return !FileExists("urbackup\\hdat_file_" + conv_filename(volume) + ".dat")
 		&& !FileExists(ImageThread::hdatFn(volume));
 #else
-	return true;
+	if (!normalizeVolume(volume))
+	{
+		return true;
+	}
+
+	Server->deleteFile("urbackup/hdat_img_" + conv_filename(volume) + ".cbt");
+
+	std::string hdat_fn = ImageThread::hdatFn(volume);
+	if (FileExists(hdat_fn))
+	{
+		Server->Log("Disabling CBT on volume \"" + volume + "\"", LL_DEBUG);
+		Server->deleteFile(hdat_fn);
+	}
+
+	return !FileExists(hdat_fn);
 #endif
 }
 
@@ -5920,6 +6365,7 @@ void IndexThread::setFlags( unsigned int flags )
 	with_orig_path = (flags & flag_with_orig_path)>0;
 	with_sequence = (flags & flag_with_sequence)>0;
 	with_proper_symlinks = (flags & flag_with_proper_symlinks)>0;
+	with_binary_filelist = (flags & flag_binary_filelist)>0;
 }
 
 bool IndexThread::getAbsSymlinkTarget( const std::string& symlink, const std::string& orig_path,
@@ -6336,12 +6782,41 @@ bool IndexThread::start_shadowcopy_lin( SCDirs * dir, std::string &wpath, bool f
 		{
 			snapshot_target = line.substr(9);
 		}
+		else if(next(line, 0, "CBT_FORMAT="))
+		{
+			dir->ref->cbt_format = line.substr(11);
+		}
+		else if(next(line, 0, "CBT_FILE="))
+		{
+			dir->ref->cbt_file = line.substr(9);
+		}
+		else if(next(line, 0, "CBT_SIZE="))
+		{
+			dir->ref->cbt_volume_size = os_atoi64(line.substr(9));
+		}
+		else if(next(line, 0, "CBT_BLOCKSIZE="))
+		{
+			dir->ref->cbt_blocksize = os_atoi64(line.substr(14));
+		}
 		else
 		{
 			VSSLog(line, LL_INFO);
 		}
 	}
 
+	if(!dir->ref->cbt_format.empty())
+	{
+		dir->ref->cbt = dir->ref->cbt_volume_size>0
+			&& cbtIsEnabled(std::string(), wpath);
+
+		if(!dir->ref->cbt
+			&& !dir->ref->cbt_file.empty())
+		{
+			Server->deleteFile(dir->ref->cbt_file);
+			dir->ref->cbt_file.clear();
+		}
+	}
+
 	if(snapshot_target.empty())
 	{
 		VSSLog("Could not find snapshot target. Please include a snapshot target output in the script (e.g. echo SNAPSHOT=/mnt/snap/xxxx)", LL_ERROR);
@@ -6480,6 +6955,11 @@ void IndexThread::addScRefs(VSS_ID ssetid, std::vector<SCRef*>& out)
 
 void IndexThread::openCbtHdatFile(SCRef* ref, const std::string& sharename, const std::string & volume)
 {
+#ifndef _WIN32
+	//Linux change block tracking is only used for image backups
+	return;
+#endif
+
 	if (ref!=NULL
 		&& ref->cbt)
 	{
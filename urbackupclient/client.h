@@ -60,6 +60,7 @@ const unsigned int flag_calc_checksums = 8;
 const unsigned int flag_with_orig_path = 16;
 const unsigned int flag_with_sequence = 32;
 const unsigned int flag_with_proper_symlinks = 64;
+const unsigned int flag_binary_filelist = 128;
 
 const uint64 change_indicator_symlink_bit = 0x4000000000000000ULL;
 const uint64 change_indicator_special_bit = 0x2000000000000000ULL;
@@ -86,11 +87,20 @@ struct SCRef
 	SCRef(void): ok(false), dontincrement(false), cbt(false), for_imagebackup(false), with_writers(false) {
 #ifdef _WIN32
 		backupcom = NULL;
+#else
+		cbt_volume_size = -1;
+		cbt_blocksize = 0;
 #endif
 	}
 
 #ifdef _WIN32
 	IVssBackupComponents *backupcom;
+#else
+	//Changed block information reported by the snapshot script
+	std::string cbt_format;
+	std::string cbt_file;
+	int64 cbt_volume_size;
+	int64 cbt_blocksize;
 #endif
 	VSS_ID ssetid;
 	VSS_ID volid;
@@ -445,6 +455,8 @@ private:
 
 	void resetFileEntries(void);
 
+	void writeBinaryFilelist(const std::string& filelist_dest_fn);
+
 	static void addFileExceptions(std::vector<std::string>& exclude_dirs);
 
 	static void addHardExcludes(std::vector<std::string>& exclude_dirs);
@@ -618,6 +630,7 @@ private:
 	bool with_orig_path;
 	bool with_sequence;
 	bool with_proper_symlinks;
+	bool with_binary_filelist;
 
 	int64 last_tmp_update_time;
 
@@ -41,6 +41,7 @@
 #include "../fileservplugin/packet_ids.h"
 #include <memory>
 #include "../cryptoplugin/ICryptoFactory.h"
+#include "../urbackupcommon/sha2/sha2.h"
 
 #ifdef _WIN32
 const std::string pw_file="pw.txt";
@@ -457,6 +458,9 @@ std::vector<SFileBackup> getFileBackups(std::string clientname, int *ec)
 
 volatile bool restore_retry_ok=false;
 
+//Bitmap of 512KiB blocks which are already up to date on the restore target
+std::string restore_delta_bitmap;
+
 enum EDownloadResult
 {
 	EDownloadResult_Ok = 0,
@@ -520,6 +524,11 @@ EDownloadResult downloadImage(int img_id, std::string img_time, std::string outf
 		s_offset="&offset="+convert(offset);
 	}
 
+	if(!mbr && !restore_delta_bitmap.empty())
+	{
+		s_offset+="&delta_bitmap="+base64_encode_dash(restore_delta_bitmap);
+	}
+
 	tcpstack.Send(client_pipe.get(), "DOWNLOAD IMAGE#pw="+pw+"&img_id="+convert(img_id)+"&time="+img_time+"&mbr="+convert(mbr)+s_offset);
 
 	std::string restore_out=outfile;
@@ -723,6 +732,110 @@ EDownloadResult downloadImage(int img_id, std::string img_time, std::string outf
 	return EDownloadResult_Ok;
 }
 
+bool downloadImageHashes(int img_id, std::string img_time, std::string& hashes)
+{
+	std::string pw=getFile(pw_file);
+	CTCPStack tcpstack;
+
+	std::auto_ptr<IPipe> client_pipe(Server->ConnectStream("localhost", 35623, 60000));
+	if(client_pipe.get()==NULL)
+	{
+		Server->Log("Error connecting to client service -1", LL_ERROR);
+		return false;
+	}
+
+	tcpstack.Send(client_pipe.get(), "DOWNLOAD IMAGE#pw="+pw+"&img_id="+convert(img_id)+"&time="+img_time+"&mbr=false&hashes=1");
+
+	_i64 hashsize=-1;
+	if(client_pipe->Read((char*)&hashsize, sizeof(_i64), 60000)!=sizeof(_i64)
+		|| hashsize<=0)
+	{
+		return false;
+	}
+
+	hashes.resize(static_cast<size_t>(hashsize));
+	size_t read=0;
+	while(read<hashes.size())
+	{
+		size_t r=client_pipe->Read(&hashes[read], hashes.size()-read, 180000);
+		if(r==0)
+		{
+			Server->Log("Read Timeout while downloading image hashes", LL_ERROR);
+			return false;
+		}
+		read+=r;
+	}
+
+	return true;
+}
+
+//Hashes the restore target in the same 512KiB blocks as the image hash file
+//and marks the blocks that already have the right content, so that only
+//changed blocks have to be downloaded
+bool buildDeltaBitmap(int img_id, std::string img_time, std::string outfile)
+{
+	restore_delta_bitmap.clear();
+
+	std::string hashes;
+	if(!downloadImageHashes(img_id, img_time, hashes))
+	{
+		Server->Log("Image hashes not available. Restoring all blocks.", LL_WARNING);
+		return false;
+	}
+
+	std::auto_ptr<IFile> dev(Server->openFile(outfile, MODE_READ));
+	if(dev.get()==NULL)
+	{
+		Server->Log("Could not open \""+outfile+"\" for reading. Restoring all blocks.", LL_WARNING);
+		return false;
+	}
+
+	const _u32 c_hash_blocksize=512*1024;
+	size_t nblocks=hashes.size()/SHA256_DIGEST_SIZE;
+	int64 dev_size=dev->Size();
+
+	Server->Log("Comparing "+convert(nblocks)+" blocks on \""+outfile+"\" with image...", LL_INFO);
+
+	std::string bitmap((nblocks+7)/8, 0);
+	std::vector<char> buf(c_hash_blocksize);
+	size_t unchanged=0;
+	for(size_t i=0;i<nblocks;++i)
+	{
+		int64 pos=static_cast<int64>(i)*c_hash_blocksize;
+		if(pos+c_hash_blocksize>dev_size)
+		{
+			break;
+		}
+
+		bool has_read_error=false;
+		_u32 r=dev->Read(pos, buf.data(), c_hash_blocksize, &has_read_error);
+		if(r!=c_hash_blocksize || has_read_error)
+		{
+			Server->Log("Error reading from \""+outfile+"\" at position "+convert(pos)+". Downloading rest of image.", LL_WARNING);
+			break;
+		}
+
+		unsigned char dig[SHA256_DIGEST_SIZE];
+		sha256(reinterpret_cast<unsigned char*>(buf.data()), c_hash_blocksize, dig);
+
+		if(memcmp(dig, &hashes[i*SHA256_DIGEST_SIZE], SHA256_DIGEST_SIZE)==0)
+		{
+			bitmap[i/8]|=(1<<(i%8));
+			++unchanged;
+		}
+	}
+
+	Server->Log(convert(unchanged)+" of "+convert(nblocks)+" blocks are unchanged ("
+		+PrettyPrintBytes(static_cast<int64>(unchanged)*c_hash_blocksize)+")", LL_INFO);
+
+	if(unchanged>0)
+	{
+		restore_delta_bitmap=bitmap;
+	}
+
+	return true;
+}
+
 int downloadFiles(int backupid, std::string backup_time)
 {
 	std::string pw=getFile(pw_file);
@@ -1053,7 +1166,7 @@ void do_restore(void)
 		Server->Log("get_backupimages(restore_name)", LL_INFO);
 		Server->Log("get_file_backups(restore_name)", LL_INFO);
 		Server->Log("download_mbr(restore_img_id,restore_time,restore_out)", LL_INFO);
-		Server->Log("download_image(restore_img_id,restore_time,restore_out)", LL_INFO);
+		Server->Log("download_image(restore_img_id,restore_time,restore_out[,restore_delta])", LL_INFO);
 		Server->Log("download_files(restore_backupid,restore_time,restore_out)", LL_INFO);
 		Server->Log("download_progress(mbr_filename,out_device)", LL_INFO);
 		exit(0);
@@ -1149,6 +1262,11 @@ void do_restore(void)
 		if(cmd=="download_mbr")
 			mbr=true;
 
+		if(!mbr && Server->getServerParameter("restore_delta")=="1")
+		{
+			buildDeltaBitmap(atoi(Server->getServerParameter("restore_img_id").c_str()), Server->getServerParameter("restore_time"), Server->getServerParameter("restore_out"));
+		}
+
 		int ec=downloadImage(atoi(Server->getServerParameter("restore_img_id").c_str()), Server->getServerParameter("restore_time"), Server->getServerParameter("restore_out"), mbr);
 		exit(ec);
 	}
@@ -1201,6 +1319,10 @@ public:
 
 	void operator()(void)
 	{
+		if(Server->getServerParameter("restore_delta")=="1")
+		{
+			buildDeltaBitmap(img_id, img_time, outfile);
+		}
 		rc=downloadImage(img_id, img_time, outfile, false, -1, 0, &imgsize, &output_file_size);
 		done=true;
 	}
@@ -355,6 +355,11 @@ DLLEXPORT void LoadActions(IServer* pServer)
 		change_file_permissions_admin_only("urbackup/data/filelist.ub");
 	}
 
+	if(FileExists("urbackup/data/filelist_bin.ub"))
+	{
+		change_file_permissions_admin_only("urbackup/data/filelist_bin.ub");
+	}
+
 #ifdef _WIN32
 	change_file_permissions_admin_only("urbackup");
 #endif
@@ -44,6 +44,10 @@ CompressedPipe2::CompressedPipe2(IPipe *cs, int compression_level)
 	comp_buffer.resize(4096);
 	input_buffer.resize(16384);
 	destroy_cs=false;
+	received_bytes_metric=Server->getMetric("urbackup_pipe_bytes_total{pipe=\"compressed\",direction=\"received\"}",
+		"Number of bytes transferred per pipe type", EMetricType_Counter);
+	sent_bytes_metric=Server->getMetric("urbackup_pipe_bytes_total{pipe=\"compressed\",direction=\"sent\"}",
+		"Number of bytes transferred per pipe type", EMetricType_Counter);
 
 	memset(&inf_stream, 0, sizeof(z_stream));
 	memset(&def_stream, 0, sizeof(z_stream));
@@ -157,6 +161,7 @@ size_t CompressedPipe2::ProcessToBuffer(char *buffer, size_t bsize, bool fromLas
 		assert(bsize >= inf_stream.avail_out);
 		size_t used = bsize - inf_stream.avail_out;
 		uncompressed_received_bytes+=used;
+		received_bytes_metric->add(used);
 
 		VLOG(Server->Log("rc=" + convert(rc) + " used=" + convert(used) + " avail_in = " + convert(inf_stream.avail_in) + " avail_out = " + convert(inf_stream.avail_out), LL_DEBUG));
 
@@ -195,6 +200,7 @@ size_t CompressedPipe2::ProcessToBuffer(char *buffer, size_t bsize, bool fromLas
 	size_t used = bsize - inf_stream.avail_out;
 	VLOG(Server->Log("rc=" + convert(rc) + " used=" + convert(used)+" avail_in = " + convert(inf_stream.avail_in) + " avail_out = " + convert(inf_stream.avail_out), LL_DEBUG));
 	uncompressed_received_bytes+=used;
+	received_bytes_metric->add(used);
 
 	if(rc!=Z_OK && rc!=Z_STREAM_END && rc != Z_BUF_ERROR /*Needs more input*/)
 	{
@@ -262,6 +268,7 @@ bool CompressedPipe2::Write(const char *buffer, size_t bsize, int timeoutms, boo
 
 		bsize-=cbsize;
 		uncompressed_sent_bytes+=cbsize;
+		sent_bytes_metric->add(cbsize);
 
 		bool has_next = bsize>0;
 		bool curr_flush = has_next ? false : flush;
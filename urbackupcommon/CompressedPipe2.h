@@ -2,6 +2,7 @@
 
 #include "../Interface/Pipe.h"
 #include "../Interface/Types.h"
+#include "../Interface/Metrics.h"
 #include <vector>
 #include <memory>
 #include <zlib.h>
@@ -73,6 +74,9 @@ private:
 	int64 sent_flushes;
 	int64 last_send_time;
 
+	IMetric* received_bytes_metric;
+	IMetric* sent_bytes_metric;
+
 	bool destroy_cs;
 	bool has_error;
 	
@@ -192,11 +192,11 @@ bool InternetServicePipe2::Write( const char *buffer, size_t bsize, int timeoutm
 		last_flush_time=Server->getTimeMS();
 	}
 
-	std::string tosend = enc->get();
+	enc->get(write_buf);
 
-	if(!tosend.empty())
+	if(!write_buf.empty())
 	{
-		return cs->Write(tosend, timeoutms, flush);
+		return cs->Write(write_buf, timeoutms, flush);
 	}
 	else
 	{
@@ -82,6 +82,7 @@ private:
 
 	size_t curr_write_chunk_size;
 	int64 last_flush_time;
+	std::string write_buf;
 
 	std::auto_ptr<IMutex> read_mutex;
 	std::auto_ptr<IMutex> write_mutex;
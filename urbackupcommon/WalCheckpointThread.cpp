@@ -21,18 +21,46 @@
 #include "../Interface/File.h"
 #include "../Interface/Server.h"
 #include "../Interface/Database.h"
+#include "../Interface/Metrics.h"
 #include "../stringtools.h"
 #include <memory>
+#include <algorithm>
 
 IMutex* WalCheckpointThread::mutex = NULL;
 ICondition* WalCheckpointThread::cond = NULL;
 std::set<std::string> WalCheckpointThread::locked_dbs;
 std::set<std::string> WalCheckpointThread::tolock_dbs;
 
+namespace
+{
+	//Passive checkpoints are sized to cover about this many seconds of WAL growth
+	const int64 checkpoint_step_seconds = 10;
+	//Smallest passive checkpoint step as fraction of passive_checkpoint_size
+	const int64 min_step_divisor = 10;
+	//Percent of time passive checkpoints may keep the disk busy
+	const int64 checkpoint_duty_percent = 25;
+	//How long a full checkpoint waits for readers to release old WAL frames
+	const int64 max_full_checkpoint_defer_ms = 10 * 60 * 1000;
+	const int min_wait_ms = 1000;
+	const int max_wait_ms = 10000;
+}
+
 WalCheckpointThread::WalCheckpointThread(int64 passive_checkpoint_size, int64 full_checkpoint_size, const std::string& db_fn, DATABASE_ID db_id, std::string db_name)
-	: last_checkpoint_wal_size(0), passive_checkpoint_size(passive_checkpoint_size),
+	: last_checkpoint_wal_size(0), last_wal_size(0), last_wal_size_time(0), wal_growth_rate(0),
+	pinned_since(0), next_checkpoint_time(0), passive_checkpoint_size(passive_checkpoint_size),
 	full_checkpoint_size(full_checkpoint_size), db_fn(db_fn), db_id(db_id), cannot_open(false), db_name(db_name)
 {
+	std::string labels = "{db=\"" + ExtractFileName(db_fn) + "\"";
+	passive_latency_metric = Server->getMetric("urbackup_wal_checkpoint_seconds" + labels + ",mode=\"passive\"}",
+		"Duration of WAL checkpoints", EMetricType_Histogram);
+	full_latency_metric = Server->getMetric("urbackup_wal_checkpoint_seconds" + labels + ",mode=\"truncate\"}",
+		"Duration of WAL checkpoints", EMetricType_Histogram);
+	wal_size_metric = Server->getMetric("urbackup_wal_size_bytes" + labels + "}",
+		"Size of the database WAL file", EMetricType_Gauge);
+	growth_rate_metric = Server->getMetric("urbackup_wal_growth_bytes_per_second" + labels + "}",
+		"Rate the database WAL file grows by", EMetricType_Gauge);
+	pinned_metric = Server->getMetric("urbackup_wal_pinned_seconds" + labels + "}",
+		"Time readers have kept WAL frames from being checkpointed", EMetricType_Gauge);
 }
 
 void WalCheckpointThread::checkpoint(bool init)
@@ -48,6 +76,10 @@ void WalCheckpointThread::checkpoint(bool init)
 		cannot_open = false;
 
 		int64 wal_size = wal_file->Size();
+		wal_file.reset();
+
+		int64 now = Server->getTimeMS();
+		update_growth_rate(wal_size, now);
 
 		if (init
 			&& wal_size < full_checkpoint_size
@@ -58,36 +90,40 @@ void WalCheckpointThread::checkpoint(bool init)
 
 		if (wal_size > full_checkpoint_size)
 		{
-			wal_file.reset();
+			//Truncating while readers still use old frames blocks writers until they are done,
+			//so wait for a passive checkpoint to get through first (up to a limit)
+			bool force = wal_size > 2 * full_checkpoint_size
+				|| (pinned_since != 0 && now - pinned_since > max_full_checkpoint_defer_ms);
 
-			passive_checkpoint();
+			if (!force && now < next_checkpoint_time)
+			{
+				return;
+			}
+
+			bool complete = passive_checkpoint();
+
+			if (!complete && !force)
+			{
+				Server->Log("Deferring full WAL checkpoint of " + db_fn + ". Readers are still using the WAL (since "
+					+ convert((Server->getTimeMS() - pinned_since) / 1000) + "s)", LL_DEBUG);
+				return;
+			}
 
 			sync_database();
 
 			Server->Log("Files WAL file "+ db_fn + "-wal greater than "+PrettyPrintBytes(full_checkpoint_size)+". Doing full WAL checkpoint...", LL_INFO);
 
-			IDatabase* db = Server->getDatabase(Server->getThreadID(), db_id);
-			db->lockForSingleUse();
-			if (db_name.empty())
-			{
-				db->Write("PRAGMA wal_checkpoint(TRUNCATE)");
-			}
-			else
-			{
-				db->Write("PRAGMA " + db_name + ".wal_checkpoint(TRUNCATE)");
-			}
-			db->unlockForSingleUse();
+			full_checkpoint();
 
 			Server->Log("Full checkpoint of "+ db_fn + "-wal done.", LL_INFO);
 
 			last_checkpoint_wal_size = 0;
 		}
-		else if (wal_size - last_checkpoint_wal_size > passive_checkpoint_size)
+		else if (wal_size - last_checkpoint_wal_size > passive_step_size()
+			&& now >= next_checkpoint_time)
 		{
 			last_checkpoint_wal_size = wal_size;
 
-			wal_file.reset();
-
 			passive_checkpoint();
 		}
 		else if (wal_size < last_checkpoint_wal_size)
@@ -110,7 +146,7 @@ void WalCheckpointThread::operator()()
 	bool init = true;
 	while(true)
 	{
-		waitAndLockForBackup();
+		waitAndLockForBackup(next_wait_time());
 		checkpoint(init);
 		init = false;
 	}
@@ -153,11 +189,11 @@ void WalCheckpointThread::destroy_mutex()
 	Server->destroy(cond);
 }
 
-void WalCheckpointThread::waitAndLockForBackup()
+void WalCheckpointThread::waitAndLockForBackup(int waitms)
 {
 	IScopedLock lock(mutex);
 
-	cond->wait(&lock, 10000);
+	cond->wait(&lock, waitms);
 
 	bool locked_db = false;
 	while (tolock_dbs.find(db_fn)!= tolock_dbs.end())
@@ -208,15 +244,108 @@ void WalCheckpointThread::sync_database()
 	}
 }
 
-void WalCheckpointThread::passive_checkpoint()
+bool WalCheckpointThread::passive_checkpoint()
 {
 	ScopedBackgroundPrio background_prio;
 
 	Server->Log("Starting passive WAL checkpoint of "+db_fn+"...", LL_DEBUG);
+	int64 starttime = Server->getTimeMS();
 	IDatabase* db = Server->getDatabase(Server->getThreadID(), db_id);
-	db_results res = db->Read("PRAGMA wal_checkpoint(PASSIVE)");
-	if (!res.empty())
+	db_results res;
+	if (db_name.empty())
+	{
+		res = db->Read("PRAGMA wal_checkpoint(PASSIVE)");
+	}
+	else
 	{
-		Server->Log("Passive WAL checkpoint of " + db_fn + " completed busy=" + res[0]["busy"] + " checkpointed=" + res[0]["checkpointed"] + " log=" + res[0]["log"], LL_DEBUG);
+		res = db->Read("PRAGMA " + db_name + ".wal_checkpoint(PASSIVE)");
+	}
+	int64 passed = Server->getTimeMS() - starttime;
+
+	passive_latency_metric->observe(passed / 1000.0);
+
+	//A slow checkpoint means the disk is busy. Back off proportionally.
+	next_checkpoint_time = starttime + passed + passed * (100 - checkpoint_duty_percent) / checkpoint_duty_percent;
+
+	if (res.empty())
+	{
+		return false;
+	}
+
+	Server->Log("Passive WAL checkpoint of " + db_fn + " completed busy=" + res[0]["busy"] + " checkpointed=" + res[0]["checkpointed"] + " log=" + res[0]["log"]
+		+ " in " + convert(passed) + "ms", LL_DEBUG);
+
+	if (watoi64(res[0]["checkpointed"]) < watoi64(res[0]["log"]))
+	{
+		//Frames still needed by a reader's snapshot
+		if (pinned_since == 0)
+		{
+			pinned_since = starttime;
+		}
+		pinned_metric->set((Server->getTimeMS() - pinned_since) / 1000);
+		return false;
 	}
+
+	pinned_since = 0;
+	pinned_metric->set(0);
+	return true;
+}
+
+void WalCheckpointThread::full_checkpoint()
+{
+	int64 starttime = Server->getTimeMS();
+
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), db_id);
+	db->lockForSingleUse();
+	if (db_name.empty())
+	{
+		db->Write("PRAGMA wal_checkpoint(TRUNCATE)");
+	}
+	else
+	{
+		db->Write("PRAGMA " + db_name + ".wal_checkpoint(TRUNCATE)");
+	}
+	db->unlockForSingleUse();
+
+	full_latency_metric->observe((Server->getTimeMS() - starttime) / 1000.0);
+
+	pinned_since = 0;
+	pinned_metric->set(0);
+}
+
+void WalCheckpointThread::update_growth_rate(int64 wal_size, int64 now)
+{
+	if (last_wal_size_time != 0
+		&& now > last_wal_size_time)
+	{
+		int64 grown = (std::max)(static_cast<int64>(0), wal_size - last_wal_size);
+		double rate = grown*1000.0 / (now - last_wal_size_time);
+		wal_growth_rate = wal_growth_rate*0.7 + rate*0.3;
+	}
+
+	last_wal_size = wal_size;
+	last_wal_size_time = now;
+
+	wal_size_metric->set(wal_size);
+	growth_rate_metric->set(static_cast<int64>(wal_growth_rate));
+}
+
+int64 WalCheckpointThread::passive_step_size()
+{
+	int64 step = static_cast<int64>(wal_growth_rate*checkpoint_step_seconds);
+	return (std::min)(passive_checkpoint_size,
+		(std::max)(passive_checkpoint_size / min_step_divisor, step));
+}
+
+int WalCheckpointThread::next_wait_time()
+{
+	if (wal_growth_rate < 1)
+	{
+		return max_wait_ms;
+	}
+
+	//Look again about when the next step is due
+	int64 waitms = static_cast<int64>(passive_step_size()*1000 / wal_growth_rate);
+	return static_cast<int>((std::max)(static_cast<int64>(min_wait_ms),
+		(std::min)(static_cast<int64>(max_wait_ms), waitms)));
 }
@@ -7,6 +7,7 @@
 #include <memory>
 
 class IFile;
+class IMetric;
 
 class WalCheckpointThread : public IThread
 {
@@ -25,14 +26,32 @@ public:
 
 private:
 
-	void waitAndLockForBackup();
+	void waitAndLockForBackup(int waitms);
 
 	void sync_database();
 
-	void passive_checkpoint();
+	bool passive_checkpoint();
+
+	void full_checkpoint();
+
+	void update_growth_rate(int64 wal_size, int64 now);
+
+	int64 passive_step_size();
+
+	int next_wait_time();
 
 	int64 last_checkpoint_wal_size;
 
+	int64 last_wal_size;
+	int64 last_wal_size_time;
+	//Bytes per second the WAL grew by (exponentially weighted)
+	double wal_growth_rate;
+	//Time since readers keep frames from being checkpointed (0 if not)
+	int64 pinned_since;
+	//Passive checkpoints do not start before this time, so they use at most a
+	//fraction of the available I/O
+	int64 next_checkpoint_time;
+
 	int64 passive_checkpoint_size;
 	int64 full_checkpoint_size;
 	std::string db_fn;
@@ -44,6 +63,12 @@ private:
 
 	std::auto_ptr<IFile> db_file; //must not be closed
 
+	IMetric* passive_latency_metric;
+	IMetric* full_latency_metric;
+	IMetric* wal_size_metric;
+	IMetric* growth_rate_metric;
+	IMetric* pinned_metric;
+
 	static IMutex* mutex;
 	static ICondition* cond;
 	static std::set<std::string> tolock_dbs;
@@ -66,6 +66,7 @@ FileClientChunked::FileClientChunked(IPipe *pipe, bool del_pipe, CTCPStack *stac
 	: pipe(pipe), destroy_pipe(del_pipe), stack(stack), transferred_bytes(0), reconnection_callback(reconnection_callback),
 	  nofreespace_callback(nofreespace_callback), reconnection_timeout(300000), identity(identity), received_data_bytes(0),
 	  parent(prev), queue_only(false), queue_callback(NULL), remote_filesize(-1), ofb_pipe(NULL), hashfilesize(-1), did_queue_fc(false), queued_chunks(0),
+	  rtt_probe_starttime(0), srtt(0), chunk_rate_starttime(0), chunk_rate_done(0), chunk_rate(0),
 	  last_transferred_bytes(0), last_progress_log(0), progress_log_callback(NULL), reconnected(false), needs_flush(false),
 	  real_transferred_bytes(0), queue_next(false), sparse_bytes(0)
 {
@@ -82,7 +83,8 @@ FileClientChunked::FileClientChunked(IPipe *pipe, bool del_pipe, CTCPStack *stac
 
 FileClientChunked::FileClientChunked(void)
 	: pipe(NULL), stack(NULL), destroy_pipe(false), transferred_bytes(0), reconnection_callback(NULL), reconnection_timeout(300000), received_data_bytes(0),
-	  parent(NULL), remote_filesize(-1), ofb_pipe(NULL), hashfilesize(-1), did_queue_fc(false), queued_chunks(0), last_transferred_bytes(0), last_progress_log(0),
+	  parent(NULL), remote_filesize(-1), ofb_pipe(NULL), hashfilesize(-1), did_queue_fc(false), queued_chunks(0),
+	  rtt_probe_starttime(0), srtt(0), chunk_rate_starttime(0), chunk_rate_done(0), chunk_rate(0), last_transferred_bytes(0), last_progress_log(0),
 	  progress_log_callback(NULL), reconnected(false), real_transferred_bytes(0), queue_next(false), sparse_bytes(0)
 {
 	has_error=true;
@@ -278,15 +280,10 @@ _u32 FileClientChunked::GetFile(std::string remotefn, _i64& filesize_out, int64
 		num_total_chunks=0;
 	}
 
-	size_t queued_chunks_low = c_queued_chunks_low;
-
-	if(queue_only)
-	{
-		queued_chunks_low = c_max_queued_chunks;
-	}
-
 	do
 	{
+		size_t queued_chunks_low = queue_only ? c_max_queued_chunks : queuedChunksLow();
+
 		if(queuedChunks()<queued_chunks_low && remote_filesize!=-1 && next_chunk<num_total_chunks)
 		{		
 			while(queuedChunks()<c_max_queued_chunks && next_chunk<num_total_chunks)
@@ -2074,6 +2071,10 @@ void FileClientChunked::incrQueuedChunks()
 	}
 	else
 	{
+		if(queued_chunks==0 && rtt_probe_starttime==0)
+		{
+			rtt_probe_starttime = Server->getTimeMS();
+		}
 		++queued_chunks;
 	}
 }
@@ -2087,6 +2088,29 @@ void FileClientChunked::decrQueuedChunks()
 	else
 	{
 		--queued_chunks;
+
+		int64 ctime = Server->getTimeMS();
+
+		if(rtt_probe_starttime!=0)
+		{
+			int64 rtt_sample = ctime - rtt_probe_starttime;
+			srtt = srtt==0 ? rtt_sample : (7*srtt + rtt_sample)/8;
+			rtt_probe_starttime = 0;
+		}
+
+		if(chunk_rate_starttime==0)
+		{
+			chunk_rate_starttime = ctime;
+		}
+
+		++chunk_rate_done;
+
+		if(ctime-chunk_rate_starttime>=1000)
+		{
+			chunk_rate = static_cast<unsigned int>((chunk_rate_done*1000)/(ctime-chunk_rate_starttime));
+			chunk_rate_starttime = ctime;
+			chunk_rate_done = 0;
+		}
 	}
 }
 
@@ -2099,6 +2123,31 @@ void FileClientChunked::resetQueuedChunks()
 	else
 	{
 		queued_chunks = 0;
+		rtt_probe_starttime = 0;
+	}
+}
+
+unsigned int FileClientChunked::queuedChunksLow()
+{
+	if(parent)
+	{
+		return parent->queuedChunksLow();
+	}
+	else
+	{
+		//Keep about two round trips worth of chunk requests in flight (bandwidth-delay product),
+		//so that requests for the next queued files are sent before the current ones are answered
+		int64 bdp_chunks = (static_cast<int64>(chunk_rate)*srtt*2)/1000;
+
+		if(bdp_chunks<c_queued_chunks_low)
+		{
+			return c_queued_chunks_low;
+		}
+		else if(bdp_chunks>c_queued_chunks_low_max)
+		{
+			return c_queued_chunks_low_max;
+		}
+		return static_cast<unsigned int>(bdp_chunks);
 	}
 }
 
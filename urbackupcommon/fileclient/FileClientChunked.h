@@ -16,6 +16,7 @@ class CTCPStack;
 
 const unsigned int c_max_queued_chunks=1000;
 const unsigned int c_queued_chunks_low=100;
+const unsigned int c_queued_chunks_low_max=c_max_queued_chunks-c_queued_chunks_low;
 
 enum EChunkedState
 {
@@ -146,6 +147,7 @@ private:
 	void incrQueuedChunks();
 	void decrQueuedChunks();
 	void resetQueuedChunks();
+	unsigned int queuedChunksLow();
 
 	void addReceivedBytes(size_t bytes);
 
@@ -199,6 +201,11 @@ private:
 	_i64 curr_output_fsize;
 	int64 starttime;
 	unsigned int queued_chunks;
+	int64 rtt_probe_starttime;
+	int64 srtt;
+	int64 chunk_rate_starttime;
+	unsigned int chunk_rate_done;
+	unsigned int chunk_rate;
 
 	EChunkedState state;
 	char curr_id;
@@ -19,6 +19,55 @@
 #include "filelist_utils.h"
 #include "../Interface/Server.h"
 #include "../stringtools.h"
+#include <string.h>
+
+namespace
+{
+	const size_t binary_buffer_size = 32768;
+	//Upper bound for name and extra parameter lengths in binary file lists
+	const uint64 binary_max_field_size = 64*1024*1024;
+
+	void append_varint(std::string& buf, uint64 val)
+	{
+		while(val>=0x80)
+		{
+			buf+=static_cast<char>((val & 0x7F) | 0x80);
+			val>>=7;
+		}
+		buf+=static_cast<char>(val);
+	}
+
+	EBinaryRecord read_varint(const char* buf, size_t bsize, size_t& pos, size_t& needed, uint64& val)
+	{
+		val=0;
+		for(unsigned int shift=0;shift<64;shift+=7)
+		{
+			if(pos>=bsize)
+			{
+				needed=pos+1;
+				return EBinaryRecord_Incomplete;
+			}
+
+			unsigned char ch=static_cast<unsigned char>(buf[pos++]);
+			val|=static_cast<uint64>(ch & 0x7F)<<shift;
+			if((ch & 0x80)==0)
+			{
+				return EBinaryRecord_Entry;
+			}
+		}
+		return EBinaryRecord_Error;
+	}
+
+	uint64 zigzag_encode(int64 val)
+	{
+		return (static_cast<uint64>(val)<<1) ^ static_cast<uint64>(val>>63);
+	}
+
+	int64 zigzag_decode(uint64 val)
+	{
+		return static_cast<int64>(val>>1) ^ -static_cast<int64>(val & 1);
+	}
+}
 
 void writeFileRepeat(IFile *f, const char *buf, size_t bsize)
 {
@@ -142,8 +191,205 @@ void writeFileItem(IFile* f, SFile cf, std::string extra)
 }
 
 
+EBinaryRecord decodeBinaryFileListRecord(const char* buf, size_t bsize, size_t& consumed, size_t& needed,
+	SFile& data, std::string* raw_extra)
+{
+	consumed=0;
+	if(bsize==0)
+	{
+		needed=1;
+		return EBinaryRecord_Incomplete;
+	}
+
+	char type=buf[0];
+	if(type=='u')
+	{
+		data.isdir=true;
+		data.name="..";
+		data.size=0;
+		data.last_modified=0;
+		if(raw_extra!=NULL)
+		{
+			raw_extra->clear();
+		}
+		consumed=1;
+		return EBinaryRecord_Entry;
+	}
+	else if(type=='e')
+	{
+		consumed=1;
+		return EBinaryRecord_End;
+	}
+	else if(type!='f' && type!='d')
+	{
+		return EBinaryRecord_Error;
+	}
+
+	size_t pos=1;
+	uint64 name_size;
+	EBinaryRecord rc=read_varint(buf, bsize, pos, needed, name_size);
+	if(rc!=EBinaryRecord_Entry)
+	{
+		return rc;
+	}
+	if(name_size>binary_max_field_size)
+	{
+		return EBinaryRecord_Error;
+	}
+	if(bsize-pos<name_size)
+	{
+		needed=pos+static_cast<size_t>(name_size);
+		return EBinaryRecord_Incomplete;
+	}
+	size_t name_pos=pos;
+	pos+=static_cast<size_t>(name_size);
+
+	uint64 size;
+	uint64 last_modified;
+	uint64 extra_size;
+	if((rc=read_varint(buf, bsize, pos, needed, size))!=EBinaryRecord_Entry
+		|| (rc=read_varint(buf, bsize, pos, needed, last_modified))!=EBinaryRecord_Entry
+		|| (rc=read_varint(buf, bsize, pos, needed, extra_size))!=EBinaryRecord_Entry)
+	{
+		return rc;
+	}
+	if(extra_size>binary_max_field_size)
+	{
+		return EBinaryRecord_Error;
+	}
+	if(bsize-pos<extra_size)
+	{
+		needed=pos+static_cast<size_t>(extra_size);
+		return EBinaryRecord_Incomplete;
+	}
+
+	data.isdir=(type=='d');
+	data.name.assign(buf+name_pos, static_cast<size_t>(name_size));
+	data.size=zigzag_decode(size);
+	data.last_modified=zigzag_decode(last_modified);
+	if(raw_extra!=NULL)
+	{
+		raw_extra->assign(buf+pos, static_cast<size_t>(extra_size));
+	}
+
+	consumed=pos+static_cast<size_t>(extra_size);
+	return EBinaryRecord_Entry;
+}
+
+BinaryFileListWriter::BinaryFileListWriter(IFile* f)
+	: f(f)
+{
+}
+
+void BinaryFileListWriter::writeHeader()
+{
+	buf.append(filelist_binary_magic, filelist_binary_magic_size);
+	buf+=filelist_binary_version;
+}
+
+void BinaryFileListWriter::writeItem(const SFile& cf, const std::string& raw_extra)
+{
+	if(cf.isdir && cf.name=="..")
+	{
+		buf+='u';
+	}
+	else
+	{
+		buf+=cf.isdir ? 'd' : 'f';
+
+		append_varint(buf, cf.name.size());
+		buf+=cf.name;
+		append_varint(buf, zigzag_encode(cf.isdir ? 0 : cf.size));
+		append_varint(buf, zigzag_encode(cf.last_modified));
+		append_varint(buf, raw_extra.size());
+		buf+=raw_extra;
+	}
+
+	if(buf.size()>=binary_buffer_size)
+	{
+		flush();
+	}
+}
+
+void BinaryFileListWriter::finalize()
+{
+	buf+='e';
+	flush();
+}
+
+void BinaryFileListWriter::flush()
+{
+	if(!buf.empty())
+	{
+		writeFileRepeat(f, buf);
+		buf.clear();
+	}
+}
+
+bool convertFileListToBinary(IFile* in, IFile* out)
+{
+	BinaryFileListWriter writer(out);
+	writer.writeHeader();
+
+	FileListParser parser;
+	SFile data;
+	std::vector<char> buffer(binary_buffer_size);
+	bool has_read_error=false;
+	_u32 read;
+	in->Seek(0);
+	while((read=in->Read(buffer.data(), static_cast<_u32>(buffer.size()), &has_read_error))>0)
+	{
+		if(has_read_error)
+		{
+			break;
+		}
+
+		size_t off=0;
+		while(off<read)
+		{
+			if(parser.nextEntry(buffer.data(), read, off, data, NULL))
+			{
+				writer.writeItem(data, parser.getRawExtra());
+			}
+		}
+
+		if(parser.isBinary())
+		{
+			Server->Log("File list "+in->getFilename()+" already is a binary file list", LL_ERROR);
+			return false;
+		}
+	}
+
+	if(has_read_error)
+	{
+		Server->Log("Error reading from file list "+in->getFilename()+". "+os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	writer.finalize();
+
+	return true;
+}
+
 bool FileListParser::nextEntry( char ch, SFile &data, std::map<std::string, std::string>* extra )
 {
+	if(at_start)
+	{
+		at_start=false;
+		if(ch==filelist_binary_magic[0])
+		{
+			state=ParseState_BinaryHeader;
+			bin_record.clear();
+		}
+	}
+
+	if(state==ParseState_BinaryHeader
+		|| state==ParseState_BinaryRecord
+		|| state==ParseState_BinaryEnd)
+	{
+		return nextBinaryEntry(ch, data, extra);
+	}
+
 	++pos;
 	switch(state)
 	{
@@ -174,7 +420,8 @@ bool FileListParser::nextEntry( char ch, SFile &data, std::map<std::string, std:
 			data.name="..";
 			data.last_modified=0;
 			data.size = 0;
-			reset();
+			resetEntry();
+			raw_extra.clear();
 			if(extra!=NULL)
 			{
 				extra->clear();
@@ -203,7 +450,8 @@ bool FileListParser::nextEntry( char ch, SFile &data, std::map<std::string, std:
 
 				if(ch=='\n')
 				{
-					reset();
+					resetEntry();
+					raw_extra.clear();
 					if(extra!=NULL)
 					{
 						extra->clear();
@@ -221,7 +469,8 @@ bool FileListParser::nextEntry( char ch, SFile &data, std::map<std::string, std:
 				data.last_modified=0;
 				data.size = 0;
 
-				reset();
+				resetEntry();
+				raw_extra.clear();
 				if(extra!=NULL)
 				{
 					extra->clear();
@@ -282,7 +531,8 @@ bool FileListParser::nextEntry( char ch, SFile &data, std::map<std::string, std:
 			data.last_modified=os_atoi64(t_name);
 			if(ch=='\n')
 			{
-				reset();
+				resetEntry();
+				raw_extra.clear();
 				if(extra!=NULL)
 				{
 					extra->clear();
@@ -303,28 +553,201 @@ bool FileListParser::nextEntry( char ch, SFile &data, std::map<std::string, std:
 		}
 		else
 		{
+			raw_extra=t_name;
 			if(extra!=NULL)
 			{
 				extra->clear();
-				ParseParamStrHttp(t_name, extra, false);
+				ParseParamStrHttp(raw_extra, extra, false);
 			}
-			reset();
+			resetEntry();
 			return true;
 		}
 		break;
+	case ParseState_BinaryHeader:
+	case ParseState_BinaryRecord:
+	case ParseState_BinaryEnd:
+		//Handled by nextBinaryEntry() above
+		break;
 	}
 	return false;
 }
 
-void FileListParser::reset( void )
+bool FileListParser::nextEntry(const char* buf, size_t bsize, size_t& off, SFile &data, std::map<std::string, std::string>* extra)
+{
+	if(state==ParseState_BinaryEnd)
+	{
+		off=bsize;
+		return false;
+	}
+
+	if(state==ParseState_BinaryRecord
+		&& bin_record.empty()
+		&& off<bsize)
+	{
+		//Decode directly from the block if the record is complete
+		size_t consumed;
+		EBinaryRecord rc=decodeBinaryFileListRecord(buf+off, bsize-off, consumed, bin_needed, data, &raw_extra);
+		if(rc==EBinaryRecord_Entry)
+		{
+			off+=consumed;
+			if(extra!=NULL)
+			{
+				extra->clear();
+				ParseParamStrHttp(raw_extra, extra, false);
+			}
+			return true;
+		}
+		else if(rc==EBinaryRecord_Incomplete)
+		{
+			bin_record.assign(buf+off, bsize-off);
+		}
+		else if(rc==EBinaryRecord_End)
+		{
+			state=ParseState_BinaryEnd;
+		}
+		else
+		{
+			Server->Log("Error parsing binary file list. Invalid record.", LL_ERROR);
+			state=ParseState_BinaryEnd;
+			has_error=true;
+		}
+		off=bsize;
+		return false;
+	}
+
+	while(off<bsize)
+	{
+		if(nextEntry(buf[off++], data, extra))
+		{
+			return true;
+		}
+
+		if(state==ParseState_BinaryRecord
+			&& bin_record.empty())
+		{
+			return nextEntry(buf, bsize, off, data, extra);
+		}
+	}
+
+	return false;
+}
+
+bool FileListParser::nextBinaryEntry(char ch, SFile &data, std::map<std::string, std::string>* extra)
+{
+	if(state==ParseState_BinaryEnd)
+	{
+		return false;
+	}
+
+	bin_record+=ch;
+
+	if(state==ParseState_BinaryHeader)
+	{
+		if(bin_record.size()<filelist_binary_magic_size+1)
+		{
+			return false;
+		}
+
+		if(memcmp(bin_record.data(), filelist_binary_magic, filelist_binary_magic_size)!=0
+			|| bin_record[filelist_binary_magic_size]!=filelist_binary_version)
+		{
+			Server->Log("Error parsing binary file list. Invalid header or unknown version.", LL_ERROR);
+			state=ParseState_BinaryEnd;
+			has_error=true;
+			return false;
+		}
+
+		bin_record.clear();
+		bin_needed=1;
+		state=ParseState_BinaryRecord;
+		return false;
+	}
+
+	if(bin_record.size()<bin_needed)
+	{
+		return false;
+	}
+
+	return finishBinaryEntry(data, extra);
+}
+
+bool FileListParser::finishBinaryEntry(SFile &data, std::map<std::string, std::string>* extra)
+{
+	size_t consumed;
+	EBinaryRecord rc=decodeBinaryFileListRecord(bin_record.data(), bin_record.size(), consumed, bin_needed, data, &raw_extra);
+	if(rc==EBinaryRecord_Entry)
+	{
+		bin_record.clear();
+		bin_needed=1;
+		if(extra!=NULL)
+		{
+			extra->clear();
+			ParseParamStrHttp(raw_extra, extra, false);
+		}
+		return true;
+	}
+	else if(rc==EBinaryRecord_End)
+	{
+		state=ParseState_BinaryEnd;
+	}
+	else if(rc==EBinaryRecord_Error)
+	{
+		Server->Log("Error parsing binary file list. Invalid record.", LL_ERROR);
+		state=ParseState_BinaryEnd;
+		has_error=true;
+	}
+	return false;
+}
+
+bool FileListParser::isBinary()
+{
+	return state==ParseState_BinaryHeader
+		|| state==ParseState_BinaryRecord
+		|| state==ParseState_BinaryEnd;
+}
+
+bool FileListParser::hasError(bool at_end)
+{
+	if(has_error)
+	{
+		return true;
+	}
+
+	if(at_end
+		&& (state==ParseState_BinaryHeader
+			|| state==ParseState_BinaryRecord))
+	{
+		Server->Log("Binary file list is truncated. End record is missing.", LL_ERROR);
+		return true;
+	}
+
+	return false;
+}
+
+const std::string& FileListParser::getRawExtra()
+{
+	return raw_extra;
+}
+
+void FileListParser::resetEntry( void )
 {
 	t_name="";
 	state=ParseState_Type;
 	pos = 0;
 }
 
+void FileListParser::reset( void )
+{
+	resetEntry();
+	at_start=true;
+	raw_extra.clear();
+	bin_record.clear();
+	bin_needed=0;
+	has_error=false;
+}
+
 FileListParser::FileListParser()
-	: state(ParseState_Type), pos(0)
+	: state(ParseState_Type), pos(0), at_start(true), bin_needed(0), has_error(false)
 {
 
 }
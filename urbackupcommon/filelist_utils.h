@@ -3,6 +3,8 @@
 #include "../Interface/File.h"
 #include "../urbackupcommon/os_functions.h"
 #include "file_metadata.h"
+#include <string>
+#include <vector>
 
 void writeFileRepeat(IFile *f, const std::string &str);
 
@@ -11,6 +13,52 @@ std::string escapeListName( const std::string& listname );
 void writeFileItem(IFile* f, SFile cf, size_t* written=NULL, size_t* change_identicator_off=NULL);
 void writeFileItem(IFile* f, SFile cf, std::string extra);
 
+/**
+* Binary file list format. Starts with the magic and a version byte. Each
+* record starts with a type byte ('f', 'd' or 'u'). File and directory
+* records continue with the name (varint length and bytes), size and last
+* modification time (zig-zag varints) and the extra parameters (varint
+* length and bytes, same encoding as in the text format).
+* The last record is an end record ('e'), so a truncated list can be told
+* apart from a complete one.
+*/
+const char filelist_binary_magic[] = "UBFL";
+const size_t filelist_binary_magic_size = 4;
+const char filelist_binary_version = 1;
+
+enum EBinaryRecord
+{
+	EBinaryRecord_Error = -1,
+	EBinaryRecord_Incomplete = 0,
+	EBinaryRecord_Entry = 1,
+	EBinaryRecord_End = 2
+};
+
+//Decodes one binary file list record. If incomplete, needed is set to the
+//minimum number of bytes required to continue
+EBinaryRecord decodeBinaryFileListRecord(const char* buf, size_t bsize, size_t& consumed, size_t& needed,
+	SFile& data, std::string* raw_extra);
+
+class BinaryFileListWriter
+{
+public:
+	BinaryFileListWriter(IFile* f);
+
+	void writeHeader();
+
+	void writeItem(const SFile& cf, const std::string& raw_extra=std::string());
+
+	void finalize();
+
+private:
+	void flush();
+
+	IFile* f;
+	std::string buf;
+};
+
+bool convertFileListToBinary(IFile* in, IFile* out);
+
 
 class FileListParser
 {
@@ -21,8 +69,27 @@ public:
 
 	bool nextEntry(char ch, SFile &data, std::map<std::string, std::string>* extra);
 
+	//Parses from a block of data starting at off. Advances off past the
+	//consumed data and returns true if an entry was completed
+	bool nextEntry(const char* buf, size_t bsize, size_t& off, SFile &data, std::map<std::string, std::string>* extra);
+
+	bool isBinary();
+
+	//Returns true if the list contained invalid data. With at_end set, a
+	//binary list without end record is an error as well
+	bool hasError(bool at_end=false);
+
+	//Unparsed extra parameters of the last entry
+	const std::string& getRawExtra();
+
 private:
 
+	void resetEntry();
+
+	bool nextBinaryEntry(char ch, SFile &data, std::map<std::string, std::string>* extra);
+
+	bool finishBinaryEntry(SFile &data, std::map<std::string, std::string>* extra);
+
 	enum ParseState
 	{
 		ParseState_Type,
@@ -33,10 +100,18 @@ private:
 		ParseState_NameFinish,
 		ParseState_Filesize,
 		ParseState_ModifiedTime,
-		ParseState_ExtraParams
+		ParseState_ExtraParams,
+		ParseState_BinaryHeader,
+		ParseState_BinaryRecord,
+		ParseState_BinaryEnd
 	};
 
 	ParseState state;
 	std::string t_name;
 	int64 pos;
+	bool at_start;
+	std::string raw_extra;
+	std::string bin_record;
+	size_t bin_needed;
+	bool has_error;
 };
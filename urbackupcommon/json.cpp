@@ -22,6 +22,47 @@
 
 namespace JSON
 {
+	namespace
+	{
+		const size_t flush_size=32*1024;
+
+		void append_escaped(std::string& r, const std::string& t)
+		{
+			for(size_t i=0;i<t.size();++i)
+			{
+				if(t[i]=='\\')
+				{
+					r+="\\\\";
+				}
+				else if(t[i]=='"')
+				{
+					r+="\\\"";
+				}
+				else if(t[i]=='\n')
+				{
+					r+="\\n";
+				}
+				else if(t[i]=='\r')
+				{
+					r+="\\r";
+				}
+				else if(t[i]>=0 && t[i]<32)
+				{
+					std::string hex = byteToHex(static_cast<unsigned char>(t[i]));
+					if(hex.size()<2)
+					{
+						hex="0"+hex;
+					}
+					r+="\\u00"+hex;
+				}
+				else
+				{
+					r+=t[i];
+				}
+			}
+		}
+	}
+
 	//---------------Array-------------------
 	Array::Array(void)
 	{
@@ -120,7 +161,7 @@ namespace JSON
 		return r;
 	}
 
-	const std::map<std::string, Value>& Object::get_data()
+	const std::map<std::string, Value>& Object::get_data() const
 	{
 		return data;
 	}
@@ -331,38 +372,7 @@ namespace JSON
     std::string Value::escape(const std::string &t) const
 	{
 		std::string r;
-		for(size_t i=0;i<t.size();++i)
-		{
-			if(t[i]=='\\')
-			{
-				r+="\\\\";
-			}
-			else if(t[i]=='"')
-			{
-				r+="\\\"";
-			}
-			else if(t[i]=='\n')
-			{
-				r+="\\n";
-			}
-			else if(t[i]=='\r')
-			{
-				r+="\\r";
-			}
-			else if(t[i]>=0 && t[i]<32)
-			{
-				std::string hex = byteToHex(static_cast<unsigned char>(t[i]));
-				if(hex.size()<2)
-				{
-					hex="0"+hex;
-				}
-				r+="\\u00"+hex;
-			}
-			else
-			{
-				r+=t[i];
-			}
-		}
+		append_escaped(r, t);
 		return r;
 	}
 
@@ -524,4 +534,121 @@ namespace JSON
 	{
 		return data_type;
 	}
+
+	//---------------Writer-------------------
+	Writer::Writer(THREAD_ID tid)
+		: tid(tid), after_key(false)
+	{
+	}
+
+	Writer::~Writer()
+	{
+		flush();
+	}
+
+	void Writer::separator()
+	{
+		if(after_key)
+		{
+			after_key=false;
+			return;
+		}
+
+		if(!has_elements.empty())
+		{
+			if(has_elements.back())
+			{
+				buffer+=",";
+			}
+			has_elements.back()=true;
+		}
+	}
+
+	void Writer::beginObject()
+	{
+		separator();
+		buffer+="{";
+		has_elements.push_back(false);
+	}
+
+	void Writer::endObject()
+	{
+		has_elements.pop_back();
+		buffer+="}";
+	}
+
+	void Writer::beginArray()
+	{
+		separator();
+		buffer+="[";
+		has_elements.push_back(false);
+	}
+
+	void Writer::endArray()
+	{
+		has_elements.pop_back();
+		buffer+="]";
+
+		if(buffer.size()>=flush_size)
+		{
+			flush();
+		}
+	}
+
+	void Writer::key(const std::string& key)
+	{
+		separator();
+		buffer+="\"";
+		append_escaped(buffer, key);
+		buffer+="\":";
+		after_key=true;
+	}
+
+	void Writer::value(const std::string& val)
+	{
+		separator();
+		buffer+="\"";
+		append_escaped(buffer, val);
+		buffer+="\"";
+
+		if(buffer.size()>=flush_size)
+		{
+			flush();
+		}
+	}
+
+	void Writer::value(const char* val)
+	{
+		value(std::string(val));
+	}
+
+	void Writer::value(const Value& val)
+	{
+		separator();
+		buffer+=val.stringify(true);
+
+		if(buffer.size()>=flush_size)
+		{
+			flush();
+		}
+	}
+
+	void Writer::members(const Object& obj)
+	{
+		const std::map<std::string, Value>& data=obj.get_data();
+		for(std::map<std::string, Value>::const_iterator it=data.begin();it!=data.end();++it)
+		{
+			key(it->first);
+			value(it->second);
+		}
+	}
+
+	void Writer::flush()
+	{
+		if(!buffer.empty())
+		{
+			Server->WriteRaw(tid, buffer.data(), buffer.size(), false);
+			buffer.clear();
+		}
+	}
 }
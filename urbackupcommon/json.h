@@ -39,7 +39,7 @@ namespace JSON
 
         std::string stringify(bool compressed) const;
 
-		const std::map<std::string, Value>& get_data();
+		const std::map<std::string, Value>& get_data() const;
 
 	private:
 		std::map<std::string, Value> data;
@@ -126,4 +126,39 @@ namespace JSON
 		void *data;
 		Value_type data_type;
 	};
+
+	/**
+	* Writes JSON directly to the output of a web interface request (uncached)
+	* instead of building a tree of Values first. Output is buffered and sent in blocks.
+	*/
+	class Writer
+	{
+	public:
+		Writer(THREAD_ID tid);
+		~Writer();
+
+		void beginObject();
+		void endObject();
+		void beginArray();
+		void endArray();
+
+		void key(const std::string& key);
+
+		void value(const std::string& val);
+		void value(const char* val);
+		void value(const Value& val);
+
+		//Writes the members of obj into the currently open object
+		void members(const Object& obj);
+
+		void flush();
+
+	private:
+		void separator();
+
+		THREAD_ID tid;
+		std::string buffer;
+		std::vector<bool> has_elements;
+		bool after_key;
+	};
 }
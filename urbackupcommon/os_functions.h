@@ -115,10 +115,17 @@ bool copy_file(const std::string &src, const std::string &dst, bool flush = fals
 class IFile;
 bool copy_file(IFile *fsrc, IFile *fdst, std::string* error_str = NULL);
 
+class IFsFile;
+//Shares the data of a range of fsrc with fdst (FICLONERANGE). Offsets and size usually need to be file system block aligned
+bool os_clone_file_range(IFsFile *fsrc, int64 src_offset, IFsFile *fdst, int64 dst_offset, int64 size);
+
 bool os_path_absolute(const std::string& path);
 
 bool os_sync(const std::string& path);
 
+//Number of online CPUs, at least one
+int os_get_num_cpus();
+
 enum EFileType
 {
 	EFileType_File = 1,
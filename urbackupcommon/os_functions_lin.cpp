@@ -848,6 +848,32 @@ bool copy_file(IFile *fsrc, IFile *fdst, std::string* error_str)
 		return true;
 	}
 }
+
+bool os_clone_file_range(IFsFile *fsrc, int64 src_offset, IFsFile *fdst, int64 dst_offset, int64 size)
+{
+#ifdef __linux__
+	struct os_file_clone_range
+	{
+		int64 src_fd;
+		uint64 src_offset;
+		uint64 src_length;
+		uint64 dest_offset;
+	};
+
+#define OS_FICLONERANGE _IOW (0x94, 13, struct os_file_clone_range)
+
+	os_file_clone_range clone_range;
+	clone_range.src_fd = fsrc->getOsHandle();
+	clone_range.src_offset = src_offset;
+	clone_range.src_length = size;
+	clone_range.dest_offset = dst_offset;
+
+	return ioctl(fdst->getOsHandle(), OS_FICLONERANGE, &clone_range)==0;
+#else
+	errno = EOPNOTSUPP;
+	return false;
+#endif
+}
 #endif //OS_FUNC_NO_SERVER
 
 SFile getFileMetadataWin( const std::string &path, bool with_usn)
@@ -1188,3 +1214,9 @@ bool os_sync(const std::string & path)
 #endif
 }
 
+int os_get_num_cpus()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n>0 ? static_cast<int>(n) : 1;
+}
+
@@ -1305,6 +1305,12 @@ bool copy_file(IFile *fsrc, IFile *fdst, std::string* error_str)
 	}
 }
 
+bool os_clone_file_range(IFsFile *fsrc, int64 src_offset, IFsFile *fdst, int64 dst_offset, int64 size)
+{
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return false;
+}
+
 #endif
 
 bool os_path_absolute(const std::string& path)
@@ -1358,6 +1364,13 @@ bool os_sync(const std::string & path)
 	return b == TRUE;
 }
 
+int os_get_num_cpus()
+{
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	return (std::max)(static_cast<int>(system_info.dwNumberOfProcessors), 1);
+}
+
 std::string os_last_error_str()
 {
 	std::string msg;
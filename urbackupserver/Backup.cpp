@@ -28,6 +28,7 @@
 #include "server_status.h"
 #include "server_cleanup.h"
 #include "LogReport.h"
+#include "../Interface/PipeThrottler.h"
 
 extern IUrlFactory *url_fak;
 
@@ -61,7 +62,18 @@ Backup::Backup(ClientMain* client_main, int clientid, std::string clientname, st
 	log_backup(true), has_early_error(false), should_backoff(true), db(NULL), status_id(0), has_timeout_error(false),
 	server_token(server_token), details(details), num_issues(0), stop_backup_running(true), scheduled(scheduled)
 {
-	
+	//No own limit. Shares the client limit fairly with other running backups of the client.
+	job_throttler=Server->createPipeThrottler(0, false);
+}
+
+Backup::~Backup()
+{
+	Server->destroy(job_throttler);
+}
+
+size_t Backup::getCurrentRate()
+{
+	return job_throttler->getCurrentRate();
 }
 
 void Backup::operator()()
@@ -122,7 +134,7 @@ void Backup::operator()()
 
 	if (stop_backup_running)
 	{
-		client_main->stopBackupRunning(is_file_backup);
+		client_main->stopBackupRunning(this, is_file_backup);
 	}
 
 	if(!has_early_error && log_action!=LogAction_NoLogging)
@@ -10,6 +10,7 @@ class IDatabase;
 class ServerSettings;
 class ClientMain;
 class ServerBackupDao;
+class IPipeThrottler;
 
 struct SBackup
 {
@@ -41,7 +42,7 @@ public:
 	Backup(ClientMain* client_main, int clientid, std::string clientname,
 		std::string clientsubname, LogAction log_action, bool is_file_backup, bool is_incremental,
 		std::string server_token, std::string details, bool scheduled);
-	virtual ~Backup() {}
+	virtual ~Backup();
 
 	virtual void operator()();
 
@@ -81,6 +82,9 @@ public:
 		return logid;
 	}
 
+	//Bytes per second this backup currently transfers
+	size_t getCurrentRate();
+
 	bool isScheduled()
 	{
 		return scheduled;
@@ -128,4 +132,7 @@ protected:
 	std::string server_token;
 
 	bool stop_backup_running;
+
+	//Throttles the connections of this backup below the client throttler
+	IPipeThrottler* job_throttler;
 };
\ No newline at end of file
@@ -0,0 +1,300 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2017 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "BackupScheduler.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Pipe.h"
+#include "../stringtools.h"
+#include <algorithm>
+
+IMutex* BackupScheduler::mutex=NULL;
+std::map<Backup*, BackupScheduler::SPending> BackupScheduler::pending;
+std::map<Backup*, BackupScheduler::SRunning> BackupScheduler::running;
+
+namespace
+{
+	//Client threads re-check their queue at least every five minutes
+	const int64 pending_timeout_ms = 6*60*1000;
+	const int64 wakeup_interval_ms = 10*1000;
+	const float max_slot_cost = 4.f;
+
+	bool priority_greater(const std::pair<double, Backup*>& a, const std::pair<double, Backup*>& b)
+	{
+		return a.first > b.first;
+	}
+}
+
+void BackupScheduler::init_mutex()
+{
+	mutex=Server->createMutex();
+}
+
+void BackupScheduler::destroy_mutex()
+{
+	Server->destroy(mutex);
+}
+
+bool BackupScheduler::admit(Backup* backup, const SJob& job, const SBudget& budget, IPipe* wakeup_pipe)
+{
+	IScopedLock lock(mutex);
+
+	int64 now = Server->getTimeMS();
+
+	for(std::map<Backup*, SPending>::iterator it=pending.begin();it!=pending.end();)
+	{
+		if(it->first!=backup && now-it->second.last_seen>pending_timeout_ms)
+		{
+			std::map<Backup*, SPending>::iterator del_it = it++;
+			pending.erase(del_it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if(!job.scheduled)
+	{
+		//Manually started backups are not delayed
+		pending.erase(backup);
+		SRunning new_running = { job, slotCost(job, meanRate()) };
+		running[backup] = new_running;
+		return true;
+	}
+
+	std::map<Backup*, SPending>::iterator it_self = pending.find(backup);
+	if(it_self==pending.end())
+	{
+		SPending new_pending = { job, wakeup_pipe, now, 0 };
+		it_self = pending.insert(std::make_pair(backup, new_pending)).first;
+	}
+	else
+	{
+		it_self->second.job = job;
+		it_self->second.wakeup_pipe = wakeup_pipe;
+		it_self->second.last_seen = now;
+	}
+
+	std::vector<std::pair<double, Backup*> > order;
+	order.reserve(pending.size());
+	for(std::map<Backup*, SPending>::iterator it=pending.begin();it!=pending.end();++it)
+	{
+		order.push_back(std::make_pair(priority(it->second.job), it->first));
+	}
+	std::stable_sort(order.begin(), order.end(), priority_greater);
+
+	int64 mean_rate = meanRate();
+	SResources avail = available(budget);
+
+	for(size_t i=0;i<order.size();++i)
+	{
+		SPending& curr = pending[order[i].second];
+		//A backup more expensive than the whole budget runs once everything else is done
+		float slot_cost = (std::min)(slotCost(curr.job, mean_rate), static_cast<float>((std::max)(budget.slots, 1)));
+
+		if(!fits(avail, curr.job, slot_cost))
+		{
+			if(order[i].second!=backup)
+			{
+				Server->Log("Backup of client "+convert(job.clientid)+" waits for backup of client "+convert(curr.job.clientid)+
+					" (higher priority, not enough resources available)", LL_DEBUG);
+			}
+			return false;
+		}
+
+		if(order[i].second==backup)
+		{
+			SRunning new_running = { job, slot_cost };
+			running[backup] = new_running;
+			pending.erase(backup);
+			return true;
+		}
+
+		//Higher priority backup that fits. Keep its resources free and
+		//make sure its client thread notices
+		reserve(avail, curr.job, slot_cost);
+		wakeup(curr, now);
+	}
+
+	return false;
+}
+
+void BackupScheduler::withdraw(Backup* backup)
+{
+	IScopedLock lock(mutex);
+	pending.erase(backup);
+}
+
+void BackupScheduler::release(Backup* backup)
+{
+	IScopedLock lock(mutex);
+
+	running.erase(backup);
+
+	int64 now = Server->getTimeMS();
+	for(std::map<Backup*, SPending>::iterator it=pending.begin();it!=pending.end();++it)
+	{
+		wakeup(it->second, now);
+	}
+}
+
+double BackupScheduler::priority(const SJob& job)
+{
+	double overdue;
+	if(job.staleness<0)
+	{
+		overdue = 2.0;
+	}
+	else if(job.interval>0)
+	{
+		overdue = static_cast<double>(job.staleness)/job.interval;
+	}
+	else
+	{
+		overdue = 1.0;
+	}
+
+	//One hour of predicted backup time weighs as much as being overdue by one interval
+	return overdue + job.predicted_duration/3600.0;
+}
+
+int64 BackupScheduler::predictedRate(const SJob& job)
+{
+	if(job.predicted_bytes<=0
+		|| job.predicted_duration<=0)
+	{
+		return -1;
+	}
+
+	return job.predicted_bytes/(std::max)(job.predicted_duration, static_cast<int64>(60));
+}
+
+float BackupScheduler::slotCost(const SJob& job, int64 mean_rate)
+{
+	int64 rate = predictedRate(job);
+	if(rate<0 || mean_rate<=0)
+	{
+		return 1.f;
+	}
+
+	float cost = static_cast<float>(rate)/mean_rate;
+	return (std::min)((std::max)(cost, 1.f), max_slot_cost);
+}
+
+int64 BackupScheduler::meanRate()
+{
+	int64 sum=0;
+	int64 n=0;
+	for(std::map<Backup*, SRunning>::iterator it=running.begin();it!=running.end();++it)
+	{
+		int64 rate = predictedRate(it->second.job);
+		if(rate>=0)
+		{
+			sum+=rate;
+			++n;
+		}
+	}
+	for(std::map<Backup*, SPending>::iterator it=pending.begin();it!=pending.end();++it)
+	{
+		int64 rate = predictedRate(it->second.job);
+		if(rate>=0)
+		{
+			sum+=rate;
+			++n;
+		}
+	}
+
+	return n>0 ? sum/n : -1;
+}
+
+BackupScheduler::SResources BackupScheduler::available(const SBudget& budget)
+{
+	SResources ret;
+	ret.slots = static_cast<float>((std::max)(budget.slots, 1));
+	ret.net_local = budget.net_local;
+	ret.net_internet = budget.net_internet;
+	ret.has_local = false;
+	ret.has_internet = false;
+
+	for(std::map<Backup*, SRunning>::iterator it=running.begin();it!=running.end();++it)
+	{
+		reserve(ret, it->second.job, it->second.slot_cost);
+	}
+
+	return ret;
+}
+
+bool BackupScheduler::fits(const SResources& avail, const SJob& job, float slot_cost)
+{
+	if(avail.slots<slot_cost)
+	{
+		return false;
+	}
+
+	int64 rate = predictedRate(job);
+	if(rate<=0)
+	{
+		return true;
+	}
+
+	//The first backup on a link is always allowed
+	if(job.internet)
+	{
+		return avail.net_internet<=0 || !avail.has_internet
+			|| avail.net_internet>=rate;
+	}
+	else
+	{
+		return avail.net_local<=0 || !avail.has_local
+			|| avail.net_local>=rate;
+	}
+}
+
+void BackupScheduler::reserve(SResources& avail, const SJob& job, float slot_cost)
+{
+	avail.slots-=slot_cost;
+
+	int64 rate = (std::max)(predictedRate(job), static_cast<int64>(0));
+	if(job.internet)
+	{
+		avail.has_internet=true;
+		if(avail.net_internet>0)
+		{
+			avail.net_internet=(std::max)(avail.net_internet-rate, static_cast<int64>(1));
+		}
+	}
+	else
+	{
+		avail.has_local=true;
+		if(avail.net_local>0)
+		{
+			avail.net_local=(std::max)(avail.net_local-rate, static_cast<int64>(1));
+		}
+	}
+}
+
+void BackupScheduler::wakeup(SPending& curr, int64 now)
+{
+	if(curr.wakeup_pipe!=NULL
+		&& now-curr.last_wakeup>wakeup_interval_ms)
+	{
+		curr.last_wakeup = now;
+		curr.wakeup_pipe->Write("WAKEUP");
+	}
+}
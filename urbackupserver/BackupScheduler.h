@@ -0,0 +1,99 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include <map>
+#include <vector>
+
+class IMutex;
+class IPipe;
+class Backup;
+
+/**
+* Global admission control for backups. Client threads register the
+* backups they want to start; the scheduler orders them by how overdue
+* they are and by their predicted duration (long backups first, so they
+* do not end up running alone at the end of the backup window) and only
+* admits a backup if its predicted resource cost fits into what is left
+* of the budget.
+*/
+class BackupScheduler
+{
+public:
+	struct SJob
+	{
+		SJob()
+			: clientid(0), file(true), internet(false), scheduled(true),
+			  staleness(-1), interval(0), predicted_duration(0), predicted_bytes(0)
+		{}
+
+		int clientid;
+		bool file;
+		bool internet;
+		bool scheduled;
+		//Seconds since the last backup of the same kind (-1 if there is none)
+		int64 staleness;
+		//Configured backup interval in seconds
+		int64 interval;
+		//Predicted from previous backups, 0 if unknown
+		int64 predicted_duration;
+		int64 predicted_bytes;
+	};
+
+	struct SBudget
+	{
+		SBudget()
+			: slots(1), net_local(-1), net_internet(-1)
+		{}
+
+		int slots;
+		//Bytes/s, <=0 if there is no limit
+		int64 net_local;
+		int64 net_internet;
+	};
+
+	static void init_mutex();
+	static void destroy_mutex();
+
+	static bool admit(Backup* backup, const SJob& job, const SBudget& budget, IPipe* wakeup_pipe);
+
+	static void withdraw(Backup* backup);
+
+	static void release(Backup* backup);
+
+private:
+	struct SPending
+	{
+		SJob job;
+		IPipe* wakeup_pipe;
+		int64 last_seen;
+		int64 last_wakeup;
+	};
+
+	struct SRunning
+	{
+		SJob job;
+		float slot_cost;
+	};
+
+	struct SResources
+	{
+		float slots;
+		int64 net_local;
+		int64 net_internet;
+		bool has_local;
+		bool has_internet;
+	};
+
+	static double priority(const SJob& job);
+	static int64 predictedRate(const SJob& job);
+	static float slotCost(const SJob& job, int64 mean_rate);
+	static int64 meanRate();
+	static SResources available(const SBudget& budget);
+	static bool fits(const SResources& avail, const SJob& job, float slot_cost);
+	static void reserve(SResources& avail, const SJob& job, float slot_cost);
+	static void wakeup(SPending& pending, int64 now);
+
+	static IMutex* mutex;
+	static std::map<Backup*, SPending> pending;
+	static std::map<Backup*, SRunning> running;
+};
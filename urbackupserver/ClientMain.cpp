@@ -63,6 +63,7 @@
 #include "ThrottleUpdater.h"
 #include "../fileservplugin/IFileServ.h"
 #include "DataplanDb.h"
+#include "BackupScheduler.h"
 
 extern IUrlFactory *url_fak;
 extern ICryptoFactory *crypto_fak;
@@ -308,11 +309,6 @@ void ClientMain::operator ()(void)
 		}
 	}
 
-	if(server_settings->getSettings()->computername.empty() || !clientsubname.empty())
-	{
-		server_settings->getSettings()->computername=clientname;
-	}
-
 	if(server_settings->getImageFileFormat()==image_file_format_cowraw)
 	{
 		curr_image_version = curr_image_version & c_image_cowraw_bit;
@@ -813,7 +809,7 @@ void ClientMain::operator ()(void)
 
 							ServerStatus::addRunningJob(clientmainname);
 							if(ServerStatus::numRunningJobs(clientmainname)<=server_settings->getSettings()->max_running_jobs_per_client
-								&& isBackupsRunningOkay(filebackup, true))
+								&& startBackupRunning(backup_queue[i]))
 							{
 								std::string tname = "backup main";
 								if (filebackup)
@@ -841,6 +837,18 @@ void ClientMain::operator ()(void)
 						break;
 					}
 				}
+
+				//Backups that cannot start now must not keep holding back other clients' backups
+				bool client_jobs_full = ServerStatus::numRunningJobs(clientmainname)>=server_settings->getSettings()->max_running_jobs_per_client;
+				for(size_t i=0;i<backup_queue.size();++i)
+				{
+					if( backup_queue[i].ticket==ILLEGAL_THREADPOOL_TICKET
+						&& backup_queue[i].backup->isScheduled()
+						&& (client_jobs_full || !inBackupWindow(backup_queue[i].backup)) )
+					{
+						BackupScheduler::withdraw(backup_queue[i].backup);
+					}
+				}
 			}
 		}
 
@@ -969,6 +977,10 @@ void ClientMain::operator ()(void)
 			Server->getThreadPool()->waitFor(backup_queue[i].ticket);
 			ServerStatus::subRunningJob(clientmainname);
 		}
+		else
+		{
+			BackupScheduler::withdraw(backup_queue[i].backup);
+		}
 
 		delete backup_queue[i].backup;
 	}
@@ -1548,6 +1560,11 @@ bool ClientMain::updateCapabilities(void)
 		{
 			protocol_versions.wtokens_version = watoi(it->second);
 		}
+		it = params.find("BIN_FILELIST");
+		if (it != params.end())
+		{
+			protocol_versions.filelist_bin_version = watoi(it->second);
+		}
 		it=params.find("RESTORE");
 		if(it!=params.end())
 		{
@@ -2083,8 +2100,69 @@ bool ClientMain::isBackupsRunningOkay(bool file, bool incr)
 	}
 }
 
-void ClientMain::stopBackupRunning(bool file)
+bool ClientMain::startBackupRunning(const SRunningBackup& backup)
+{
+	BackupScheduler::SJob job;
+	job.clientid = clientid;
+	job.file = backup.backup->isFileBackup();
+	job.internet = internet_connection;
+	job.scheduled = backup.backup->isScheduled();
+
+	bool incr = backup.backup->isIncrementalBackup();
+	ServerBackupDao::SScheduleInfo schedule_info;
+	ServerBackupDao::SDuration duration;
+	if (job.file)
+	{
+		job.interval = incr ? server_settings->getUpdateFreqFileIncr() : server_settings->getUpdateFreqFileFull();
+		schedule_info = backup_dao->getFileBackupScheduleInfo(clientid, backup.group, incr ? 1 : 0);
+		duration = FileBackup::interpolateDurations(incr ? backup_dao->getLastIncrementalDurations(clientid)
+			: backup_dao->getLastFullDurations(clientid));
+	}
+	else
+	{
+		job.interval = incr ? server_settings->getUpdateFreqImageIncr() : server_settings->getUpdateFreqImageFull();
+		schedule_info = backup_dao->getImageBackupScheduleInfo(clientid, backup.letter, incr ? 1 : 0);
+		duration = FileBackup::interpolateDurations(backup_dao->getLastImageDurations(clientid, backup.letter, incr ? 1 : 0));
+	}
+
+	if (schedule_info.exists)
+	{
+		job.staleness = schedule_info.age;
+		job.predicted_bytes = (std::max)(schedule_info.size_bytes, static_cast<int64>(0));
+	}
+	job.predicted_duration = (std::max)(duration.duration, static_cast<int64>(0));
+
+	BackupScheduler::SBudget budget;
+	budget.slots = server_settings->getSettings()->max_sim_backups;
+	budget.net_local = server_settings->getGlobalLocalSpeed();
+	budget.net_internet = server_settings->getGlobalInternetSpeed();
+
+	IScopedLock lock(running_backup_mutex);
+	if (running_backups >= server_settings->getSettings()->max_sim_backups
+		|| !running_backups_allowed)
+	{
+		BackupScheduler::withdraw(backup.backup);
+		return false;
+	}
+
+	if (!BackupScheduler::admit(backup.backup, job, budget, pipe))
+	{
+		return false;
+	}
+
+	++running_backups;
+	if (job.file)
+	{
+		++running_file_backups;
+	}
+
+	return true;
+}
+
+void ClientMain::stopBackupRunning(Backup* backup, bool file)
 {
+	BackupScheduler::release(backup);
+
 	IScopedLock lock(running_backup_mutex);
 	if (running_backups == 0)
 	{
@@ -2137,6 +2215,36 @@ IPipeThrottler *ClientMain::getThrottler(int speed_bps)
 	return client_throttler;
 }
 
+IPipeThrottler* ClientMain::getClientThrottler(ServerSettings* server_settings, IPipeThrottler* job_throttler)
+{
+	int speed;
+	IPipeThrottler* class_throttler;
+	if(internet_connection)
+	{
+		speed=server_settings->getInternetSpeed();
+		class_throttler=BackupServer::getGlobalInternetThrottler(server_settings->getGlobalInternetSpeed());
+	}
+	else
+	{
+		speed=server_settings->getLocalSpeed();
+		class_throttler=BackupServer::getGlobalLocalThrottler(server_settings->getGlobalLocalSpeed());
+	}
+
+	//Bytes are charged to the job, the client, the network class (internet or local)
+	//and the global throttler. Each level shares its limit between its active children
+	//and lets them borrow what idle children leave unused.
+	IPipeThrottler* throttler = getThrottler(speed);
+	throttler->setParent(class_throttler);
+
+	if(job_throttler==NULL)
+	{
+		return throttler;
+	}
+
+	job_throttler->setParent(throttler);
+	return job_throttler;
+}
+
 void ClientMain::updateClientAccessKey()
 {
 	std::string access_key = ServerSettings::generateRandomAuthKey(32);
@@ -2257,7 +2365,7 @@ bool ClientMain::inBackupWindow(Backup * backup)
 	}
 }
 
-IPipe *ClientMain::getClientCommandConnection(int timeoutms, std::string* clientaddr)
+IPipe *ClientMain::getClientCommandConnection(int timeoutms, std::string* clientaddr, IPipeThrottler* job_throttler)
 {
 	std::string curr_clientname = (clientname);
 	if(!clientsubname.empty())
@@ -2274,46 +2382,28 @@ IPipe *ClientMain::getClientCommandConnection(int timeoutms, std::string* client
 	if(internet_connection)
 	{
 		IPipe *ret=InternetServiceConnector::getConnection(curr_clientname, SERVICE_COMMANDS, timeoutms);
-		if(server_settings!=NULL && ret!=NULL)
+		IPipeThrottler* throttler;
+		if(server_settings!=NULL && ret!=NULL
+			&& (throttler=getClientThrottler(server_settings, job_throttler))!=NULL)
 		{
-			int internet_speed=server_settings->getInternetSpeed();
-			if(internet_speed!=0
-				&& internet_speed!=-1)
-			{
-				ret->addThrottler(getThrottler(internet_speed));
-			}
-			int global_internet_speed=server_settings->getGlobalInternetSpeed();
-			if(global_internet_speed!=0
-				&& global_internet_speed!=-1)
-			{
-				ret->addThrottler(BackupServer::getGlobalInternetThrottler(global_internet_speed));
-			}
+			ret->addThrottler(throttler);
 		}
 		return ret;
 	}
 	else
 	{
 		IPipe *ret=Server->ConnectStream(inet_ntoa(getClientaddr().sin_addr), serviceport, timeoutms);
-		if(server_settings!=NULL && ret!=NULL)
+		IPipeThrottler* throttler;
+		if(server_settings!=NULL && ret!=NULL
+			&& (throttler=getClientThrottler(server_settings, job_throttler))!=NULL)
 		{
-			int local_speed=server_settings->getLocalSpeed();
-			if(local_speed!=0
-				&& local_speed!=-1)
-			{
-				ret->addThrottler(getThrottler(local_speed));
-			}
-			int global_local_speed=server_settings->getGlobalLocalSpeed();
-			if(global_local_speed!=0
-				&& global_local_speed!=-1)
-			{
-				ret->addThrottler(BackupServer::getGlobalLocalThrottler(global_local_speed));
-			}
+			ret->addThrottler(throttler);
 		}
 		return ret;
 	}
 }
 
-_u32 ClientMain::getClientFilesrvConnection(FileClient *fc, ServerSettings* server_settings, int timeoutms)
+_u32 ClientMain::getClientFilesrvConnection(FileClient *fc, ServerSettings* server_settings, int timeoutms, IPipeThrottler* job_throttler)
 {
 	std::string curr_clientname = (clientname);
 	if(!clientsubname.empty())
@@ -2328,20 +2418,11 @@ _u32 ClientMain::getClientFilesrvConnection(FileClient *fc, ServerSettings* serv
 
 		_u32 ret=fc->Connect(cp);
 
-		if(server_settings!=NULL)
+		IPipeThrottler* throttler;
+		if(server_settings!=NULL
+			&& (throttler=getClientThrottler(server_settings, job_throttler))!=NULL)
 		{
-			int internet_speed=server_settings->getInternetSpeed();
-			if(internet_speed!=0
-				&& internet_speed!=-1)
-			{
-				fc->addThrottler(getThrottler(internet_speed));
-			}
-			int global_internet_speed=server_settings->getGlobalInternetSpeed();
-			if(global_internet_speed!=0
-				&& global_internet_speed!=-1)
-			{
-				fc->addThrottler(BackupServer::getGlobalInternetThrottler(global_internet_speed));
-			}
+			fc->addThrottler(throttler);
 		}
 
 		fc->setReconnectionTimeout(c_internet_fileclient_timeout);
@@ -2353,27 +2434,18 @@ _u32 ClientMain::getClientFilesrvConnection(FileClient *fc, ServerSettings* serv
 		sockaddr_in addr=getClientaddr();
 		_u32 ret=fc->Connect(&addr);
 
-		if(server_settings!=NULL)
+		IPipeThrottler* throttler;
+		if(server_settings!=NULL
+			&& (throttler=getClientThrottler(server_settings, job_throttler))!=NULL)
 		{
-			int local_speed=server_settings->getLocalSpeed();
-			if(local_speed!=0
-				&& local_speed!=-1)
-			{
-				fc->addThrottler(getThrottler(local_speed));
-			}
-			int global_local_speed=server_settings->getGlobalLocalSpeed();
-			if(global_local_speed!=0
-				&& global_local_speed!=-1)
-			{
-				fc->addThrottler(BackupServer::getGlobalLocalThrottler(global_local_speed));
-			}
+			fc->addThrottler(throttler);
 		}
 
 		return ret;
 	}
 }
 
-bool ClientMain::getClientChunkedFilesrvConnection(std::auto_ptr<FileClientChunked>& fc_chunked, ServerSettings* server_settings, int timeoutms)
+bool ClientMain::getClientChunkedFilesrvConnection(std::auto_ptr<FileClientChunked>& fc_chunked, ServerSettings* server_settings, int timeoutms, IPipeThrottler* job_throttler)
 {
 	std::string curr_clientname = (clientname);
 	if(!clientsubname.empty())
@@ -2413,38 +2485,10 @@ bool ClientMain::getClientChunkedFilesrvConnection(std::auto_ptr<FileClientChunk
 
 	if(fc_chunked->getPipe()!=NULL && server_settings!=NULL)
 	{
-		int speed;
-		if(internet_connection)
-		{
-			speed=server_settings->getInternetSpeed();
-		}
-		else
-		{
-			speed=server_settings->getLocalSpeed();
-		}
-		if(speed!=0
-			&& speed!=-1)
+		IPipeThrottler* throttler = getClientThrottler(server_settings, job_throttler);
+		if(throttler!=NULL)
 		{
-			fc_chunked->addThrottler(getThrottler(speed));
-		}
-
-		if(internet_connection)
-		{
-			int global_speed=server_settings->getGlobalInternetSpeed();
-			if(global_speed!=0
-				&& global_speed!=-1)
-			{
-				fc_chunked->addThrottler(BackupServer::getGlobalInternetThrottler(global_speed));
-			}
-		}
-		else
-		{
-			int global_speed=server_settings->getGlobalLocalSpeed();
-			if(global_speed!=0
-				&& global_speed!=-1)
-			{
-				fc_chunked->addThrottler(BackupServer::getGlobalLocalThrottler(global_speed));
-			}
+			fc_chunked->addThrottler(throttler);
 		}
 	}
 
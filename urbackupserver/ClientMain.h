@@ -47,7 +47,7 @@ struct SProtocolVersions
 				efi_version(0), file_meta(0), select_sha_version(0),
 				client_bitmap_version(0), cmd_version(0),
 				symbit_version(0), phash_version(0),
-				wtokens_version(0)
+				wtokens_version(0), filelist_bin_version(0)
 			{
 
 			}
@@ -69,6 +69,7 @@ struct SProtocolVersions
 	int symbit_version;
 	int phash_version;
 	int wtokens_version;
+	int filelist_bin_version;
 	std::string os_simple;
 };
 
@@ -161,7 +162,7 @@ public:
 	static int getNumberOfRunningFileBackups(void);
 	static int getClientID(IDatabase *db, const std::string &clientname, ServerSettings *server_settings, bool *new_client, std::string* authkey=NULL);
 
-	IPipe *getClientCommandConnection(int timeoutms=10000, std::string* clientaddr=NULL);
+	IPipe *getClientCommandConnection(int timeoutms=10000, std::string* clientaddr=NULL, IPipeThrottler* job_throttler=NULL);
 
 	virtual IPipe * new_fileclient_connection(void);
 
@@ -175,9 +176,9 @@ public:
 	
 	virtual void log_progress( const std::string& fn, int64 total, int64 downloaded, int64 speed_bps );
 
-	_u32 getClientFilesrvConnection(FileClient *fc, ServerSettings* server_settings, int timeoutms=10000);
+	_u32 getClientFilesrvConnection(FileClient *fc, ServerSettings* server_settings, int timeoutms=10000, IPipeThrottler* job_throttler=NULL);
 
-	bool getClientChunkedFilesrvConnection(std::auto_ptr<FileClientChunked>& fc_chunked, ServerSettings* server_settings, int timeoutms=10000);
+	bool getClientChunkedFilesrvConnection(std::auto_ptr<FileClientChunked>& fc_chunked, ServerSettings* server_settings, int timeoutms=10000, IPipeThrottler* job_throttler=NULL);
 
 	bool isOnInternetConnection()
 	{
@@ -204,7 +205,7 @@ public:
 
 	static bool run_script(std::string name, const std::string& params, logid_t logid);
 
-	void stopBackupRunning(bool file);
+	void stopBackupRunning(Backup* backup, bool file);
 
 	void updateClientAddress(const std::string& address_data);
 
@@ -262,8 +263,10 @@ private:
 	void checkClientVersion(void);
 	bool sendFile(IPipe *cc, IFile *f, int timeout);
 	bool isBackupsRunningOkay(bool file, bool incr=false);	
+	bool startBackupRunning(const SRunningBackup& backup);
 	bool updateCapabilities(void);
 	IPipeThrottler *getThrottler(int speed_bps);
+	IPipeThrottler* getClientThrottler(ServerSettings* server_settings, IPipeThrottler* job_throttler);
 	bool inBackupWindow(Backup* backup);
 	void updateClientAccessKey();
 	bool isDataplanOkay(bool file);
@@ -180,6 +180,11 @@ bool FileBackup::request_filelist_construct(bool full, bool resume, int group,
 	{
 		start_backup_cmd += "&with_permissions=1&with_scripts=1&with_orig_path=1&with_sequence=1&with_proper_symlinks=1";
 		start_backup_cmd += "&status_id=" + convert(status_id);
+
+		if (client_main->getProtocolVersions().filelist_bin_version > 0)
+		{
+			start_backup_cmd += "&binary_filelist=1";
+		}
 	}
 
 	bool phash = false;
@@ -563,6 +568,40 @@ std::string FileBackup::clientlistName(int ref_backupid)
 	return "urbackup/clientlist_b_" + convert(ref_backupid) + ".ub";
 }
 
+std::string FileBackup::filelistName(bool binary)
+{
+	std::string name = binary ? "filelist_bin" : "filelist";
+	if (group > 0)
+	{
+		return "urbackup/" + name + "_" + convert(group) + ".ub";
+	}
+	return "urbackup/" + name + ".ub";
+}
+
+_u32 FileBackup::getFilelist(FileClient& fc, IFsFile* tmp_filelist, bool hashed_transfer)
+{
+	//Clients which support it send a binary copy of the file list
+	if (client_main->getProtocolVersions().filelist_bin_version > 0)
+	{
+		_u32 rc = fc.GetFile(filelistName(true), tmp_filelist, hashed_transfer, false, 0, false, 0);
+		if (rc != ERR_CANNOT_OPEN_FILE)
+		{
+			return rc;
+		}
+
+		//Client could not write the binary file list
+		ServerLogger::Log(logid, "Binary file list of " + clientname + " not available. Loading text file list...", LL_INFO);
+
+		if (!tmp_filelist->Resize(0)
+			|| !tmp_filelist->Seek(0))
+		{
+			return ERR_ERROR;
+		}
+	}
+
+	return fc.GetFile(filelistName(false), tmp_filelist, hashed_transfer, false, 0, false, 0);
+}
+
 void FileBackup::createHashThreads(bool use_reflink, bool ignore_hash_mismatches)
 {
 	assert(bsh==NULL);
@@ -1069,6 +1108,14 @@ std::string FileBackup::systemErrorInfo()
 
 bool FileBackup::link_file(const std::string &fn, const std::string &short_fn, const std::string &curr_path,
 	const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata)
+{
+	return link_file(local_hash.get(), backuppath, backuppath_hashes, backupid, clientid, logid,
+		fn, short_fn, os_path, sha2, filesize, add_sql, metadata);
+}
+
+bool FileBackup::link_file(BackupServerHash* local_hash, const std::string& backuppath, const std::string& backuppath_hashes,
+	int backupid, int clientid, logid_t logid, const std::string &fn, const std::string &short_fn,
+	const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata)
 {
 	std::string os_curr_path=convertToOSPathFromFileClient(os_path+"/"+short_fn);
 	std::string os_curr_hash_path=convertToOSPathFromFileClient(os_path+"/"+escape_metadata_fn(short_fn));
@@ -2028,7 +2075,7 @@ bool FileBackup::startFileMetadataDownloadThread()
 		std::auto_ptr<FileClient> fc_metadata_stream(new FileClient(false, identity, client_main->getProtocolVersions().filesrv_protocol_version,
 			client_main->isOnInternetConnection(), client_main, use_tmpfiles?NULL:client_main));
 
-		_u32 rc=client_main->getClientFilesrvConnection(fc_metadata_stream.get(), server_settings.get(), 10000);
+		_u32 rc=client_main->getClientFilesrvConnection(fc_metadata_stream.get(), server_settings.get(), 10000, job_throttler);
 		if(rc!=ERR_CONNECTED)
 		{
 			ServerLogger::Log(logid, "Backup of "+clientname+" failed - CONNECT error (for metadata stream)", LL_ERROR);
@@ -2086,7 +2133,7 @@ bool FileBackup::stopFileMetadataDownloadThread(bool stopped, size_t expected_em
 				std::auto_ptr<FileClient> fc_metadata_stream_end(new FileClient(false, identity, client_main->getProtocolVersions().filesrv_protocol_version,
 					client_main->isOnInternetConnection(), client_main, use_tmpfiles ? NULL : client_main));
 
-				_u32 rc = client_main->getClientFilesrvConnection(fc_metadata_stream_end.get(), server_settings.get(), 10000);
+				_u32 rc = client_main->getClientFilesrvConnection(fc_metadata_stream_end.get(), server_settings.get(), 10000, job_throttler);
 				if (rc == ERR_CONNECTED)
 				{
 					fc_metadata_stream_end->InformMetadataStreamEnd(server_token, 0);
@@ -2237,7 +2284,7 @@ bool FileBackup::startPhashDownloadThread(const std::string& async_id)
 	std::auto_ptr<FileClient> fc_phash_stream(new FileClient(false, identity, client_main->getProtocolVersions().filesrv_protocol_version,
 		client_main->isOnInternetConnection(), client_main, use_tmpfiles ? NULL : client_main));
 
-	_u32 rc = client_main->getClientFilesrvConnection(fc_phash_stream.get(), server_settings.get(), 10000);
+	_u32 rc = client_main->getClientFilesrvConnection(fc_phash_stream.get(), server_settings.get(), 10000, job_throttler);
 	if (rc != ERR_CONNECTED)
 	{
 		ServerLogger::Log(logid, "Full Backup of " + clientname + " failed - CONNECT error (for metadata stream)", LL_ERROR);
@@ -2287,7 +2334,7 @@ bool FileBackup::stopPhashDownloadThread()
 			std::auto_ptr<FileClient> fc_phash_stream_end(new FileClient(false, identity, client_main->getProtocolVersions().filesrv_protocol_version,
 				client_main->isOnInternetConnection(), client_main, use_tmpfiles ? NULL : client_main));
 
-			_u32 rc = client_main->getClientFilesrvConnection(fc_phash_stream_end.get(), server_settings.get(), 10000);
+			_u32 rc = client_main->getClientFilesrvConnection(fc_phash_stream_end.get(), server_settings.get(), 10000, job_throttler);
 			if (rc == ERR_CONNECTED)
 			{
 				fc_phash_stream_end->InformMetadataStreamEnd(server_token, 0);
@@ -2325,7 +2372,7 @@ void FileBackup::save_debug_data(const std::string& rfn, const std::string& loca
 	FileClient fc(false, identity, client_main->getProtocolVersions().filesrv_protocol_version,
 		client_main->isOnInternetConnection(), client_main, use_tmpfiles?NULL:client_main);
 
-	_u32 rc=client_main->getClientFilesrvConnection(&fc, server_settings.get(), 10000);
+	_u32 rc=client_main->getClientFilesrvConnection(&fc, server_settings.get(), 10000, job_throttler);
 	if(rc!=ERR_CONNECTED)
 	{
 		ServerLogger::Log(logid, "Cannot connect to retrieve file that failed to verify - CONNECT error", LL_ERROR);
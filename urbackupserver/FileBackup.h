@@ -69,6 +69,12 @@ public:
 
 	static std::string convertToOSPathFromFileClient(std::string path);
 
+	static ServerBackupDao::SDuration interpolateDurations(const std::vector<ServerBackupDao::SDuration>& durations);
+
+	static bool link_file(BackupServerHash* local_hash, const std::string& backuppath, const std::string& backuppath_hashes,
+		int backupid, int clientid, logid_t logid, const std::string &fn, const std::string &short_fn,
+		const std::string &os_path, const std::string& sha2, _i64 filesize, bool add_sql, FileMetadata& metadata);
+
 	static std::string fixFilenameForOS(std::string fn, std::set<std::string>& samedir_filenames, const std::string& curr_path, bool log_warnings, logid_t logid, std::map<std::string, std::string>& filepath_corrections);
 
 	virtual void log_progress(const std::string& fn, int64 total, int64 downloaded, int64 speed_bps);
@@ -78,7 +84,6 @@ protected:
 
 	virtual bool doFileBackup() = 0;
 
-	ServerBackupDao::SDuration interpolateDurations(const std::vector<ServerBackupDao::SDuration>& durations);
 	bool request_filelist_construct(bool full, bool resume, int group,
 		bool with_token, bool& no_backup_dirs, bool& connect_fail, const std::string& clientsubname);
 	bool wait_for_async(const std::string& async_id, int64 timeout_time=10*60*1000);
@@ -86,6 +91,9 @@ protected:
 	void logVssLogdata(int64 vss_duration_s);
 	bool getTokenFile(FileClient &fc, bool hashed_transfer, bool request);
 	std::string clientlistName(int ref_backupid);
+
+	std::string filelistName(bool binary);
+	_u32 getFilelist(FileClient& fc, IFsFile* tmp_filelist, bool hashed_transfer);
 	void createHashThreads(bool use_reflink, bool ignore_hash_mismatches);
 	void destroyHashThreads();
 	_i64 getIncrementalSize(IFile *f, const std::vector<size_t> &diffs, bool& backup_with_components, bool all=false);
@@ -41,6 +41,12 @@ bool FileIndex::do_shutdown=false;
 bool FileIndex::do_flush=false;
 bool FileIndex::do_accept = true;
 
+namespace
+{
+	IMetric* cache_hits_metric=NULL;
+	IMetric* cache_misses_metric=NULL;
+}
+
 
 void FileIndex::operator()(void)
 {
@@ -150,14 +156,18 @@ int64 FileIndex::get_with_cache(const FileIndex::SIndexKey& key)
 		int64 ret;
 		if(get_from_cache(key, *active_cache_buffer, ret))
 		{
+			cache_hits_metric->add(1);
 			return ret;
 		}
 
 		if(get_from_cache(key, *other_cache_buffer, ret))
 		{
+			cache_hits_metric->add(1);
 			return ret;
 		}
 
+		cache_misses_metric->add(1);
+
 	}
 
 	return get_any_client(key);
@@ -171,13 +181,17 @@ int64 FileIndex::get_with_cache_prefer_client(const SIndexKey& key)
 		int64 ret;
 		if(get_from_cache_prefer_client(key, *active_cache_buffer, ret))
 		{
+			cache_hits_metric->add(1);
 			return ret;
 		}
 
 		if(get_from_cache_prefer_client(key, *other_cache_buffer, ret))
 		{
+			cache_hits_metric->add(1);
 			return ret;
 		}
+
+		cache_misses_metric->add(1);
 	}
 
 	return get_prefer_client(key);
@@ -230,18 +244,30 @@ int64 FileIndex::get_with_cache_exact( const SIndexKey& key )
 		int64 ret;
 		if(get_from_cache_exact(key, *active_cache_buffer, ret))
 		{
+			cache_hits_metric->add(1);
 			return ret;
 		}
 
 		if(get_from_cache_exact(key, *other_cache_buffer, ret))
 		{
+			cache_hits_metric->add(1);
 			return ret;
 		}
+
+		cache_misses_metric->add(1);
 	}
 
 	return get(key);
 }
 
+void FileIndex::init_metrics()
+{
+	cache_hits_metric=Server->getMetric("urbackup_file_index_cache_lookups_total{result=\"hit\"}",
+		"Number of file index lookups by whether they were answered from the write cache", EMetricType_Counter);
+	cache_misses_metric=Server->getMetric("urbackup_file_index_cache_lookups_total{result=\"miss\"}",
+		"Number of file index lookups by whether they were answered from the write cache", EMetricType_Counter);
+}
+
 void FileIndex::shutdown()
 {
 	IScopedLock lock(mutex);
@@ -134,6 +134,8 @@ public:
 
 	void operator()(void);
 
+	static void init_metrics();
+
 	static void shutdown();
 
 	static void flush();
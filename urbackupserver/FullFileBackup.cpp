@@ -120,7 +120,7 @@ bool FullFileBackup::doFileBackup()
 	std::string identity = client_main->getIdentity();
 	FileClient fc(false, identity, client_main->getProtocolVersions().filesrv_protocol_version,
 		client_main->isOnInternetConnection(), client_main, use_tmpfiles?NULL:client_main);
-	_u32 rc=client_main->getClientFilesrvConnection(&fc, server_settings.get(), 10000);
+	_u32 rc=client_main->getClientFilesrvConnection(&fc, server_settings.get(), 10000, job_throttler);
 	if(rc!=ERR_CONNECTED)
 	{
 		ServerLogger::Log(logid, "Full Backup of "+clientname+" failed - CONNECT error", LL_ERROR);
@@ -142,7 +142,7 @@ bool FullFileBackup::doFileBackup()
 
 	int64 full_backup_starttime=Server->getTimeMS();
 
-	rc=fc.GetFile(group>0?("urbackup/filelist_"+convert(group)+".ub"):"urbackup/filelist.ub", tmp_filelist, hashed_transfer, false, 0, false, 0);
+	rc=getFilelist(fc, tmp_filelist, hashed_transfer);
 	if(rc!=ERR_SUCCESS)
 	{
 		ServerLogger::Log(logid, "Error getting filelist of "+clientname+". Errorcode: "+fc.getErrorString(rc)+" ("+convert(rc)+")", LL_ERROR);
@@ -220,7 +220,7 @@ bool FullFileBackup::doFileBackup()
 	std::auto_ptr<ServerDownloadThread> server_download(new ServerDownloadThread(fc, NULL, backuppath,
 		backuppath_hashes, last_backuppath, last_backuppath_complete,
 		hashed_transfer, save_incomplete_files, clientid, clientname, clientsubname,
-		use_tmpfiles, tmpfile_path, server_token, use_reflink,
+		use_tmpfiles, tmpfile_path, server_token, use_reflink, use_snapshots,
 		backupid, false, hashpipe_prepare, client_main, client_main->getProtocolVersions().filesrv_protocol_version,
 		0, logid, with_hashes, shares_without_snapshot, with_sparse_hashing, metadata_download_thread.get(),
 		backup_with_components));
@@ -257,10 +257,11 @@ bool FullFileBackup::doFileBackup()
 			break;
 		}
 
-		for(size_t i=0;i<read;++i)
+		size_t buffer_off=0;
+		while(buffer_off<read)
 		{
 			std::map<std::string, std::string> extra_params;
-			bool b=list_parser.nextEntry(buffer[i], cf, &extra_params);
+			bool b=list_parser.nextEntry(buffer, read, buffer_off, cf, &extra_params);
 			if(b)
 			{
 				FileMetadata metadata;
@@ -299,7 +300,7 @@ bool FullFileBackup::doFileBackup()
 						}
 						else
 						{
-							int64 done_bytes = fc.getReceivedDataBytes(true) + linked_bytes;
+							int64 done_bytes = fc.getReceivedDataBytes(true) + linked_bytes + server_download->getLinkedBytes();
 							ServerStatus::setProcessDoneBytes(clientname, status_id, done_bytes);
 							ServerStatus::setProcessPcDone(clientname, status_id,
 								(std::min)(100, (int)(((float)done_bytes) / ((float)files_size / 100.f) + 0.5f)));
@@ -311,7 +312,7 @@ bool FullFileBackup::doFileBackup()
 
 					if (ctime - last_eta_update > eta_update_intervall)
 					{
-						calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, NULL, linked_bytes, last_eta_received_bytes, eta_estimated_speed, files_size);
+						calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, NULL, linked_bytes + server_download->getLinkedBytes(), last_eta_received_bytes, eta_estimated_speed, files_size);
 					}
 
 					calculateDownloadSpeed(ctime, fc, NULL);
@@ -592,6 +593,13 @@ bool FullFileBackup::doFileBackup()
 		ServerLogger::Log(logid, "Error reading from file " + tmp_filelist->getFilename() + ". " + os_last_error_str(), LL_ERROR);
 		disk_error = true;
 	}
+	else if (!r_offline
+		&& !c_has_error
+		&& list_parser.hasError(true))
+	{
+		ServerLogger::Log(logid, "File list of " + clientname + " is corrupt", LL_ERROR);
+		c_has_error = true;
+	}
 
 	stopPhashDownloadThread();
 
@@ -608,7 +616,7 @@ bool FullFileBackup::doFileBackup()
 		}
 		else
 		{
-			int64 done_bytes = fc.getReceivedDataBytes(true) + linked_bytes;
+			int64 done_bytes = fc.getReceivedDataBytes(true) + linked_bytes + server_download->getLinkedBytes();
 			ServerStatus::setProcessDoneBytes(clientname, status_id, done_bytes);
 			ServerStatus::setProcessPcDone(clientname, status_id,
 				(std::min)(100,(int)(((float)done_bytes)/((float)files_size/100.f)+0.5f)));
@@ -620,7 +628,7 @@ bool FullFileBackup::doFileBackup()
 		int64 ctime = Server->getTimeMS();
 		if(ctime-last_eta_update>eta_update_intervall)
 		{
-			calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, NULL, linked_bytes, last_eta_received_bytes, eta_estimated_speed, files_size);
+			calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, NULL, linked_bytes + server_download->getLinkedBytes(), last_eta_received_bytes, eta_estimated_speed, files_size);
 		}
 
 		calculateDownloadSpeed(ctime, fc, NULL);
@@ -628,6 +636,8 @@ bool FullFileBackup::doFileBackup()
 
 	addFilePathCorrections(server_download->getFilePathCorrections());
 
+	linked_bytes += server_download->getLinkedBytes();
+
 	ServerStatus::setProcessSpeed(clientname, status_id, 0);
 
 	if(server_download->isOffline() && !r_offline)
@@ -707,9 +717,10 @@ bool FullFileBackup::doFileBackup()
 			break;
 		}
 
-		for(size_t i=0;i<read;++i)
+		size_t buffer_off=0;
+		while(buffer_off<read)
 		{
-			bool b=list_parser.nextEntry(buffer[i], cf, NULL);
+			bool b=list_parser.nextEntry(buffer, read, buffer_off, cf, NULL);
 			if(b)
 			{
 				if(cf.isdir)
@@ -50,7 +50,7 @@ namespace
 IncrFileBackup::IncrFileBackup( ClientMain* client_main, int clientid, std::string clientname, std::string clientsubname, LogAction log_action,
 	int group, bool use_tmpfiles, std::string tmpfile_path, bool use_reflink, bool use_snapshots, std::string server_token, std::string details, bool scheduled)
 	: FileBackup(client_main, clientid, clientname, clientsubname, log_action, true, group, use_tmpfiles, tmpfile_path, use_reflink, use_snapshots, server_token, details, scheduled), 
-	intra_file_diffs(intra_file_diffs), hash_existing_mutex(NULL), filesdao(NULL), link_dao(NULL), link_journal_dao(NULL)
+	intra_file_diffs(intra_file_diffs), hash_existing_mutex(NULL), filesdao(NULL), last_filesdao(NULL), link_dao(NULL), link_journal_dao(NULL)
 {
 
 }
@@ -59,6 +59,7 @@ bool IncrFileBackup::doFileBackup()
 {
 	ScopedFreeObjRef<ServerFilesDao*> free_filesdao(filesdao);
 	filesdao = new ServerFilesDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES));
+	last_filesdao = filesdao;
 	ScopedFreeObjRef<ServerLinkDao*> free_link_dao(link_dao);
 	ScopedFreeObjRef<ServerLinkJournalDao*> free_link_journal_dao(link_journal_dao);
 
@@ -168,7 +169,7 @@ bool IncrFileBackup::doFileBackup()
 	std::auto_ptr<FileClientChunked> fc_chunked;
 	if(intra_file_diffs)
 	{
-		if(client_main->getClientChunkedFilesrvConnection(fc_chunked, server_settings.get(), 10000))
+		if(client_main->getClientChunkedFilesrvConnection(fc_chunked, server_settings.get(), 10000, job_throttler))
 		{
 			fc_chunked->setProgressLogCallback(this);
 			fc_chunked->setDestroyPipe(true);
@@ -188,7 +189,7 @@ bool IncrFileBackup::doFileBackup()
 			return false;
 		}
 	}
-	_u32 rc=client_main->getClientFilesrvConnection(&fc, server_settings.get(), 10000);
+	_u32 rc=client_main->getClientFilesrvConnection(&fc, server_settings.get(), 10000, job_throttler);
 	if(rc!=ERR_CONNECTED)
 	{
 		ServerLogger::Log(logid, "Incremental Backup of "+clientname+" failed - CONNECT error -2", LL_ERROR);
@@ -211,7 +212,7 @@ bool IncrFileBackup::doFileBackup()
 	int64 incr_backup_starttime=Server->getTimeMS();
 	int64 incr_backup_stoptime=0;
 
-	rc=fc.GetFile(group>0?("urbackup/filelist_"+convert(group)+".ub"):"urbackup/filelist.ub", tmp_filelist, hashed_transfer, false, 0, false, 0);
+	rc=getFilelist(fc, tmp_filelist, hashed_transfer);
 	if(rc!=ERR_SUCCESS)
 	{
 		ServerLogger::Log(logid, "Error getting filelist of "+clientname+". Errorcode: "+fc.getErrorString(rc)+" ("+convert(rc)+")", LL_ERROR);
@@ -357,9 +358,10 @@ bool IncrFileBackup::doFileBackup()
 	if (copy_last_file_entries)
 	{
 		ServerLogger::Log(logid, clientname + ": Indexing file entries from last backup...", LL_INFO);
-		copy_last_file_entries = copy_last_file_entries && filesdao->createTemporaryLastFilesTable();
-		copy_last_file_entries = copy_last_file_entries && filesdao->copyToTemporaryLastFilesTable(last.backupid);
-		filesdao->createTemporaryLastFilesTableIndex();
+		last_filesdao = &filesdao->forBackup(last.backupid, clientid);
+		copy_last_file_entries = copy_last_file_entries && last_filesdao->createTemporaryLastFilesTable();
+		copy_last_file_entries = copy_last_file_entries && last_filesdao->copyToTemporaryLastFilesTable(last.backupid);
+		last_filesdao->createTemporaryLastFilesTableIndex();
 	}
 
 	if(copy_last_file_entries && resumed_full)
@@ -382,7 +384,7 @@ bool IncrFileBackup::doFileBackup()
 	std::auto_ptr<ServerDownloadThread> server_download(new ServerDownloadThread(fc, fc_chunked.get(), backuppath,
 		backuppath_hashes, last_backuppath, last_backuppath_complete,
 		hashed_transfer, intra_file_diffs, clientid, clientname, clientsubname,
-		use_tmpfiles, tmpfile_path, server_token, use_reflink,
+		use_tmpfiles, tmpfile_path, server_token, use_reflink, use_snapshots,
 		backupid, r_incremental, hashpipe_prepare, client_main, client_main->getProtocolVersions().filesrv_protocol_version,
 		incremental_num, logid, with_hashes, shares_without_snapshot, with_sparse_hashing, metadata_download_thread.get(),
 		backup_with_components));
@@ -454,10 +456,11 @@ bool IncrFileBackup::doFileBackup()
 
 		filelist_currpos+=read;
 
-		for(size_t i=0;i<read;++i)
+		size_t buffer_off=0;
+		while(buffer_off<read)
 		{
 			std::map<std::string, std::string> extra_params;
-			bool b=list_parser.nextEntry(buffer[i], cf, &extra_params);
+			bool b=list_parser.nextEntry(buffer, read, buffer_off, cf, &extra_params);
 			if(b)
 			{
 				std::string osspecific_name;
@@ -548,7 +551,7 @@ bool IncrFileBackup::doFileBackup()
 						else
 						{
 							int64 done_bytes = fc.getReceivedDataBytes(true)
-								+ (fc_chunked.get() ? fc_chunked->getReceivedDataBytes(true) : 0) + linked_bytes;
+								+ (fc_chunked.get() ? fc_chunked->getReceivedDataBytes(true) : 0) + linked_bytes + server_download->getLinkedBytes();
 							ServerStatus::setProcessDoneBytes(clientname, status_id, done_bytes);
 							ServerStatus::setProcessPcDone(clientname, status_id,
 								(std::min)(100, (int)(((float)done_bytes) / ((float)files_size / 100.f) + 0.5f)));
@@ -560,7 +563,7 @@ bool IncrFileBackup::doFileBackup()
 
 					if (ctime - last_eta_update > eta_update_intervall)
 					{
-						calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, fc_chunked.get(), linked_bytes, last_eta_received_bytes, eta_estimated_speed, files_size);
+						calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, fc_chunked.get(), linked_bytes + server_download->getLinkedBytes(), last_eta_received_bytes, eta_estimated_speed, files_size);
 					}
 
 					calculateDownloadSpeed(ctime, fc, fc_chunked.get());
@@ -642,7 +645,7 @@ bool IncrFileBackup::doFileBackup()
 
 									if (copy_last_file_entries)
 									{
-										std::vector<ServerFilesDao::SFileEntry> file_entries = filesdao->getFileEntriesFromTemporaryTableGlob(escape_glob_sql(srcpath) + os_file_sep() + "*");
+										std::vector<ServerFilesDao::SFileEntry> file_entries = last_filesdao->getFileEntriesFromTemporaryTableGlob(escape_glob_sql(srcpath) + os_file_sep() + "*");
 										for (size_t i = 0; i < file_entries.size(); ++i)
 										{
 											if (file_entries[i].fullpath.size() > srcpath.size())
@@ -1154,7 +1157,7 @@ bool IncrFileBackup::doFileBackup()
 
 					if(copy_curr_file_entry)
 					{
-						ServerFilesDao::SFileEntry fileEntry = filesdao->getFileEntryFromTemporaryTable(srcpath);
+						ServerFilesDao::SFileEntry fileEntry = last_filesdao->getFileEntryFromTemporaryTable(srcpath);
 
 						if (fileEntry.exists)
 						{
@@ -1199,6 +1202,12 @@ bool IncrFileBackup::doFileBackup()
 		ServerLogger::Log(logid, "Error reading from file " + tmp_filelist->getFilename() + ". " + os_last_error_str(), LL_ERROR);
 		disk_error = true;
 	}
+	else if (!c_has_error
+		&& list_parser.hasError(true))
+	{
+		ServerLogger::Log(logid, "File list of " + clientname + " is corrupt", LL_ERROR);
+		c_has_error = true;
+	}
 
 	stopPhashDownloadThread();
 
@@ -1215,7 +1224,7 @@ bool IncrFileBackup::doFileBackup()
 		else
 		{
 			int64 done_bytes = fc.getReceivedDataBytes(true)
-				+ (fc_chunked.get() ? fc_chunked->getReceivedDataBytes(true) : 0) + linked_bytes;
+				+ (fc_chunked.get() ? fc_chunked->getReceivedDataBytes(true) : 0) + linked_bytes + server_download->getLinkedBytes();
 			ServerStatus::setProcessDoneBytes(clientname, status_id, done_bytes);
 			ServerStatus::setProcessPcDone(clientname, status_id,
 				(std::min)(100,(int)(((float)done_bytes)/((float)files_size/100.f)+0.5f)) );
@@ -1227,7 +1236,7 @@ bool IncrFileBackup::doFileBackup()
 		int64 ctime = Server->getTimeMS();
 		if(ctime-last_eta_update>eta_update_intervall)
 		{
-			calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, fc_chunked.get(), linked_bytes, last_eta_received_bytes, eta_estimated_speed, files_size);
+			calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, fc_chunked.get(), linked_bytes + server_download->getLinkedBytes(), last_eta_received_bytes, eta_estimated_speed, files_size);
 		}
 
 		calculateDownloadSpeed(ctime, fc, fc_chunked.get());
@@ -1235,6 +1244,8 @@ bool IncrFileBackup::doFileBackup()
 
 	addFilePathCorrections(server_download->getFilePathCorrections());
 
+	linked_bytes += server_download->getLinkedBytes();
+
 	ServerStatus::setProcessSpeed(clientname, status_id, 0);
 
 	if(server_download->isOffline() && !r_offline)
@@ -1323,10 +1334,11 @@ bool IncrFileBackup::doFileBackup()
 			{
 				break;
 			}
-			for(size_t i=0;i<read;++i)
+			size_t buffer_off=0;
+			while(buffer_off<read)
 			{
 				str_map extra_params;
-				bool b=list_parser.nextEntry(buffer[i], cf, &extra_params);
+				bool b=list_parser.nextEntry(buffer, read, buffer_off, cf, &extra_params);
 				if(b)
 				{
 					if(cf.isdir)
@@ -1449,8 +1461,8 @@ bool IncrFileBackup::doFileBackup()
 
 		if (copy_last_file_entries)
 		{
-			filesdao->dropTemporaryLastFilesTableIndex();
-			filesdao->dropTemporaryLastFilesTable();
+			last_filesdao->dropTemporaryLastFilesTableIndex();
+			last_filesdao->dropTemporaryLastFilesTable();
 		}
 	}
 
@@ -1855,7 +1867,7 @@ void IncrFileBackup::addFileEntrySQLWithExisting( const std::string &fp, const s
 
 		if (entryid != 0)
 		{
-			ServerFilesDao::SFindFileEntry fentry = filesdao->getFileEntry(entryid);
+			ServerFilesDao::SFindFileEntry fentry = filesdao->forEntry(entryid).getFileEntry(entryid);
 			if (!fentry.exists)
 			{
 				Server->Log("File entry in database with id=" + convert(entryid) 
@@ -32,6 +32,8 @@ protected:
 	IMutex* hash_existing_mutex;
 
 	ServerFilesDao* filesdao;
+	//Shard of filesdao with the file entries of the last backup
+	ServerFilesDao* last_filesdao;
 	ServerLinkDao* link_dao;
 	ServerLinkJournalDao* link_journal_dao;
 };
\ No newline at end of file
@@ -35,6 +35,7 @@ MDB_env *LMDBFileIndex::env=NULL;
 ISharedMutex* LMDBFileIndex::mutex=NULL;
 LMDBFileIndex* LMDBFileIndex::fileindex=NULL;
 THREADPOOL_TICKET LMDBFileIndex::fileindex_ticket = ILLEGAL_THREADPOOL_TICKET;
+IMetric* LMDBFileIndex::lookup_latency_metric=NULL;
 
 
 const size_t c_initial_map_size=1*1024*1024;
@@ -56,6 +57,13 @@ void LMDBFileIndex::shutdownFileIndex()
 	Server->getThreadPool()->waitFor(fileindex_ticket);
 }
 
+void LMDBFileIndex::initMetrics()
+{
+	init_metrics();
+	lookup_latency_metric = Server->getMetric("urbackup_lmdb_lookup_seconds",
+		"Latency of file index lookups in the LMDB database", EMetricType_Histogram);
+}
+
 
 LMDBFileIndex::LMDBFileIndex(bool no_sync)
 	: _has_error(false), txn(NULL), map_size(c_initial_map_size), it_cursor(NULL), no_sync(no_sync)
@@ -145,18 +153,18 @@ void LMDBFileIndex::create(get_data_callback_t get_data_callback, void *userdata
 			{
 				if(last_prev_entry==0)
 				{
-					filesdao.setPrevEntry(id, last_id);
+					filesdao.forEntry(last_id).setPrevEntry(id, last_id);
 				}
 
 				if(next_entry==0
 					&& (last_prev_entry==0 || last_prev_entry==id) )
 				{
-					filesdao.setNextEntry(last_id, id);
+					filesdao.forEntry(id).setNextEntry(last_id, id);
 				}
 
 				if(pointed_to)
 				{
-					filesdao.setPointedTo(0, id);
+					filesdao.forEntry(id).setPointedTo(0, id);
 				}
 
 				last=key;
@@ -169,7 +177,7 @@ void LMDBFileIndex::create(get_data_callback_t get_data_callback, void *userdata
 			{
 				if(!pointed_to)
 				{
-					filesdao.setPointedTo(1, id);
+					filesdao.forEntry(id).setPointedTo(1, id);
 				}
 			}
 			
@@ -213,6 +221,8 @@ void LMDBFileIndex::create(get_data_callback_t get_data_callback, void *userdata
 
 int64 LMDBFileIndex::get(const LMDBFileIndex::SIndexKey& key)
 {
+	int64 starttime = Server->getTimeUS();
+
 	begin_txn(MDB_RDONLY);
 
 	MDB_val mdb_tkey;
@@ -242,6 +252,8 @@ int64 LMDBFileIndex::get(const LMDBFileIndex::SIndexKey& key)
 
 	abort_transaction();
 
+	lookup_latency_metric->observe((Server->getTimeUS() - starttime) / 1000000.0);
+
 	return ret;
 }
 
@@ -569,6 +581,8 @@ size_t LMDBFileIndex::get_map_size()
 
 int64 LMDBFileIndex::get_any_client( const SIndexKey& key )
 {
+	int64 starttime = Server->getTimeUS();
+
 	begin_txn(MDB_RDONLY);
 
 	MDB_cursor* cursor;
@@ -609,6 +623,8 @@ int64 LMDBFileIndex::get_any_client( const SIndexKey& key )
 
 	abort_transaction();
 
+	lookup_latency_metric->observe((Server->getTimeUS() - starttime) / 1000000.0);
+
 	return ret;
 }
 
@@ -622,6 +638,8 @@ void LMDBFileIndex::abort_transaction()
 
 std::map<int, int64> LMDBFileIndex::get_all_clients( const SIndexKey& key )
 {
+	int64 starttime = Server->getTimeUS();
+
 	begin_txn(MDB_RDONLY);
 
 	MDB_cursor* cursor;
@@ -666,11 +684,15 @@ std::map<int, int64> LMDBFileIndex::get_all_clients( const SIndexKey& key )
 
 	abort_transaction();
 
+	lookup_latency_metric->observe((Server->getTimeUS() - starttime) / 1000000.0);
+
 	return ret;
 }
 
 int64 LMDBFileIndex::get_prefer_client( const SIndexKey& key )
 {
+	int64 starttime = Server->getTimeUS();
+
 	begin_txn(MDB_RDONLY);
 
 	MDB_cursor* cursor;
@@ -719,6 +741,8 @@ int64 LMDBFileIndex::get_prefer_client( const SIndexKey& key )
 
 	abort_transaction();
 
+	lookup_latency_metric->observe((Server->getTimeUS() - starttime) / 1000000.0);
+
 	return ret;
 }
 
@@ -3,6 +3,7 @@
 #include "lmdb/lmdb.h"
 #include "FileIndex.h"
 #include "../Interface/SharedMutex.h"
+#include "../Interface/Metrics.h"
 #include <memory>
 
 class LMDBFileIndex : public FileIndex
@@ -10,6 +11,7 @@ class LMDBFileIndex : public FileIndex
 public:
 	static void initFileIndex();
 	static void shutdownFileIndex();
+	static void initMetrics();
 
 	LMDBFileIndex(bool no_sync=false);
 
@@ -86,5 +88,7 @@ private:
 	static LMDBFileIndex* fileindex;
 	static THREADPOOL_TICKET fileindex_ticket;
 
+	static IMetric* lookup_latency_metric;
+
 	bool no_sync;
 };
\ No newline at end of file
@@ -32,6 +32,8 @@
 #include "../urbackupcommon/os_functions.h"
 #include "server.h"
 #include "FileMetadataDownloadThread.h"
+#include "server_hash.h"
+#include "../common/atomic.h"
 
 namespace
 {
@@ -40,19 +42,22 @@ namespace
 	const size_t queue_items_chunked = 4;
 
 	const char* tmpfile_dirname = ".b68xO+K9SCOF35cLk4Bf9Q";
+
+	using common::atomic_add;
+	using common::atomic_load;
 }
 
 ServerDownloadThread::ServerDownloadThread( FileClient& fc, FileClientChunked* fc_chunked, const std::string& backuppath, const std::string& backuppath_hashes, const std::string& last_backuppath, const std::string& last_backuppath_complete, bool hashed_transfer, bool save_incomplete_file, int clientid,
-	const std::string& clientname, const std::string& clientsubname, bool use_tmpfiles, const std::string& tmpfile_path, const std::string& server_token, bool use_reflink, int backupid, bool r_incremental, IPipe* hashpipe_prepare, ClientMain* client_main,
+	const std::string& clientname, const std::string& clientsubname, bool use_tmpfiles, const std::string& tmpfile_path, const std::string& server_token, bool use_reflink, bool use_snapshots, int backupid, bool r_incremental, IPipe* hashpipe_prepare, ClientMain* client_main,
 	int filesrv_protocol_version, int incremental_num, logid_t logid, bool with_hashes, const std::vector<std::string>& shares_without_snapshot, bool with_sparse_hashing, server::FileMetadataDownloadThread* file_metadata_download, bool sc_failure_fatal)
 	: fc(fc), fc_chunked(fc_chunked), backuppath(backuppath), backuppath_hashes(backuppath_hashes), 
 	last_backuppath(last_backuppath), last_backuppath_complete(last_backuppath_complete), hashed_transfer(hashed_transfer), save_incomplete_file(save_incomplete_file), clientid(clientid),
 	clientname(clientname), clientsubname(clientsubname),
-	use_tmpfiles(use_tmpfiles), tmpfile_path(tmpfile_path), server_token(server_token), use_reflink(use_reflink), backupid(backupid), r_incremental(r_incremental), hashpipe_prepare(hashpipe_prepare), max_ok_id(0),
+	use_tmpfiles(use_tmpfiles), tmpfile_path(tmpfile_path), server_token(server_token), use_reflink(use_reflink), use_snapshots(use_snapshots), backupid(backupid), r_incremental(r_incremental), hashpipe_prepare(hashpipe_prepare), max_ok_id(0),
 	is_offline(false), client_main(client_main), filesrv_protocol_version(filesrv_protocol_version), skipping(false), queue_size(0),
 	all_downloads_ok(true), incremental_num(incremental_num), logid(logid), has_timeout(false), with_hashes(with_hashes), with_metadata(client_main->getProtocolVersions().file_meta>0), shares_without_snapshot(shares_without_snapshot),
 	with_sparse_hashing(with_sparse_hashing), exp_backoff(false), num_embedded_metadata_files(0), file_metadata_download(file_metadata_download), num_issues(0), last_snap_num_issues(0), has_disk_error(false), sc_failure_fatal(sc_failure_fatal),
-	tmpfile_num(0)
+	tmpfile_num(0), num_linked_before_download(0), linked_bytes(0)
 {
 	mutex = Server->createMutex();
 	cond = Server->createCondition();
@@ -85,6 +90,12 @@ void ServerDownloadThread::operator()( void )
 		fc.setQueueCallback(this);
 	}
 
+	if(with_metadata)
+	{
+		local_hash.reset(new BackupServerHash(NULL, clientid, use_snapshots, use_reflink, use_tmpfiles, logid, use_snapshots));
+		local_hash->setupDatabase();
+	}
+
 	while(true)
 	{
 		SQueueItem curr;
@@ -94,6 +105,12 @@ void ServerDownloadThread::operator()( void )
 			{
 				cond->wait(&lock);
 			}
+		}
+
+		link_queued_files();
+
+		{
+			IScopedLock lock(mutex);
 			curr = dl_queue.front();
 			dl_queue.pop_front();
 
@@ -244,6 +261,17 @@ void ServerDownloadThread::operator()( void )
 		}
 	}
 
+	if(local_hash.get()!=NULL)
+	{
+		local_hash->deinitDatabase();
+		local_hash.reset();
+	}
+
+	if(num_linked_before_download>0)
+	{
+		ServerLogger::Log(logid, "Linked "+convert(num_linked_before_download)+" queued files with already existing content instead of downloading them", LL_DEBUG);
+	}
+
 	download_nok_ids.finalize();
 	download_partial_ids.finalize();
 }
@@ -706,6 +734,103 @@ bool ServerDownloadThread::link_or_copy_file(const SQueueItem& todl)
 }
 
 
+void ServerDownloadThread::link_queued_files()
+{
+	if(local_hash.get()==NULL
+		|| is_offline
+		|| skipping)
+	{
+		return;
+	}
+
+	//Only this thread dequeues or prepares queue items, so the snapshot stays valid
+	//while the index lookup and the linking run without holding the queue mutex
+	std::vector<SQueueItem> candidates;
+	{
+		IScopedLock lock(mutex);
+		for(std::deque<SQueueItem>::iterator it=dl_queue.begin();it!=dl_queue.end();++it)
+		{
+			if(it->action!=EQueueAction_Fileclient
+				|| it->queued
+				|| it->link_checked)
+			{
+				continue;
+			}
+
+			it->link_checked=true;
+
+			if(!it->sha_dig.empty()
+				&& !it->is_script
+				&& !it->metadata_only
+				&& !it->script_end
+				&& !it->patch_dl_files.prepared
+				&& it->predicted_filesize>=link_file_min_size)
+			{
+				candidates.push_back(*it);
+			}
+		}
+	}
+
+	if(candidates.empty())
+	{
+		return;
+	}
+
+	//Another backup (e.g. of a cloned client) or an earlier file in this backup
+	//may have stored the content since the file was queued
+	std::map<std::pair<std::string, _i64>, bool> known_hashes;
+	for(size_t i=0;i<candidates.size();++i)
+	{
+		known_hashes[std::make_pair(candidates[i].sha_dig, candidates[i].predicted_filesize)]=false;
+	}
+
+	local_hash->findKnownFileHashes(known_hashes);
+
+	std::set<size_t> linked_ids;
+	for(size_t i=0;i<candidates.size();++i)
+	{
+		SQueueItem& todl = candidates[i];
+		if(!known_hashes[std::make_pair(todl.sha_dig, todl.predicted_filesize)])
+		{
+			continue;
+		}
+
+		FileMetadata metadata = todl.metadata;
+		if(FileBackup::link_file(local_hash.get(), backuppath, backuppath_hashes, backupid, clientid, logid,
+			todl.fn, todl.short_fn, todl.os_path, todl.sha_dig, todl.predicted_filesize, true, metadata))
+		{
+			linked_ids.insert(todl.id);
+			++num_linked_before_download;
+			atomic_add(&linked_bytes, todl.predicted_filesize);
+		}
+	}
+
+	if(linked_ids.empty())
+	{
+		return;
+	}
+
+	IScopedLock lock(mutex);
+	for(std::deque<SQueueItem>::iterator it=dl_queue.begin();it!=dl_queue.end();++it)
+	{
+		if(it->action!=EQueueAction_Fileclient
+			|| linked_ids.find(it->id)==linked_ids.end())
+		{
+			continue;
+		}
+
+		if(it->fileclient==EFileClient_Chunked)
+		{
+			it->fileclient = EFileClient_Full;
+			it->switched = true;
+			queue_size -= queue_items_chunked - queue_items_full;
+		}
+
+		it->metadata_only = true;
+		it->predicted_filesize = 0;
+	}
+}
+
 bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 {
 	std::string cfn=todl.curr_path+"/"+todl.fn;
@@ -1038,6 +1163,11 @@ size_t ServerDownloadThread::getMaxOkId()
 	return max_ok_id;
 }
 
+int64 ServerDownloadThread::getLinkedBytes()
+{
+	return atomic_load(&linked_bytes);
+}
+
 std::string ServerDownloadThread::getQueuedFileFull(FileClient::MetadataQueue& metadata, size_t& folder_items, bool& finish_script, int64& file_id)
 {
 	IScopedLock lock(mutex);
@@ -19,6 +19,7 @@
 
 class FileClient;
 class FileClientChunked;
+class BackupServerHash;
 
 namespace server {
 	class FileMetadataDownloadThread;
@@ -65,7 +66,8 @@ namespace
 			folder_items(0),
 			script_end(false),
 			switched(false),
-			write_metadata(false)
+			write_metadata(false),
+			link_checked(false)
 		{
 		}
 
@@ -89,6 +91,7 @@ namespace
 		std::string sha_dig;
 		unsigned int script_random;
 		bool switched;
+		bool link_checked;
 	};
 	
 	
@@ -142,7 +145,7 @@ class ServerDownloadThread : public IThread, public FileClient::QueueCallback, p
 public:
 	ServerDownloadThread(FileClient& fc, FileClientChunked* fc_chunked, const std::string& backuppath, const std::string& backuppath_hashes, const std::string& last_backuppath, const std::string& last_backuppath_complete, bool hashed_transfer, bool save_incomplete_file, int clientid,
 		const std::string& clientname, const std::string& clientsubname,
-		bool use_tmpfiles, const std::string& tmpfile_path, const std::string& server_token, bool use_reflink, int backupid, bool r_incremental, IPipe* hashpipe_prepare, ClientMain* client_main,
+		bool use_tmpfiles, const std::string& tmpfile_path, const std::string& server_token, bool use_reflink, bool use_snapshots, int backupid, bool r_incremental, IPipe* hashpipe_prepare, ClientMain* client_main,
 		int filesrv_protocol_version, int incremental_num, logid_t logid, bool with_hashes, const std::vector<std::string>& shares_without_snapshot,
 		bool with_sparse_hashing, server::FileMetadataDownloadThread* file_metadata_download, bool sc_failure_fatal);
 
@@ -181,6 +184,8 @@ public:
 
 	size_t getMaxOkId();
 
+	int64 getLinkedBytes();
+
 	bool isOffline();
 
 	void hashFile(std::string dstpath, std::string hashpath, IFile *fd, IFile *hashoutput, std::string old_file, int64 t_filesize,
@@ -228,6 +233,7 @@ private:
 
 	
 	bool link_or_copy_file(const SQueueItem& todl);
+	void link_queued_files();
 
 	size_t insertFullQueueEarliest(const SQueueItem& ni, bool after_switched);
 	bool hasFullQueuedAfter(std::deque<SQueueItem>::iterator it);
@@ -256,6 +262,7 @@ private:
 	const std::string& tmpfile_path;
 	const std::string& server_token;
 	bool use_reflink;
+	bool use_snapshots;
 	int backupid;
 	bool r_incremental;
 	IPipe* hashpipe_prepare;
@@ -303,4 +310,7 @@ private:
 	bool sc_failure_fatal;
 
 	size_t tmpfile_num;
+	std::auto_ptr<BackupServerHash> local_hash;
+	size_t num_linked_before_download;
+	volatile int64 linked_bytes;
 };
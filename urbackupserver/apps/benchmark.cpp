@@ -0,0 +1,678 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2017 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "benchmark.h"
+#include "app.h"
+#include "../../stringtools.h"
+#include "../../urbackupcommon/os_functions.h"
+#include "../../urbackupcommon/chunk_hasher.h"
+#include "../../urbackupcommon/TreeHash.h"
+#include "../../urbackupcommon/filelist_utils.h"
+#include "../../urbackupcommon/CompressedPipe2.h"
+#include "../../urbackupcommon/json.h"
+#include "../ChunkPatcher.h"
+#include "../LMDBFileIndex.h"
+#include "../treediff/TreeDiff.h"
+#ifdef STATIC_PLUGIN
+#include "../../fsimageplugin/CompressedFile.h"
+#endif
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include <memory.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/**
+* Micro benchmarks for the hot parts of the backup data path. Every benchmark
+* runs on deterministic synthetic data (fixed PRNG seed), so numbers from two
+* builds are comparable. Results are printed as one JSON object per line.
+*
+* Parameters:
+*   benchmark_size_mb     Amount of data per iteration (default 64)
+*   benchmark_iterations  Number of iterations (default 5)
+*   benchmark_filter      Only run benchmarks whose name contains this string
+*   benchmark_output      Additionally append results to this file
+*/
+
+namespace
+{
+	const size_t bench_blocksize = 512*1024;
+	const size_t pipe_msgsize = 64*1024;
+
+	class BenchRandom
+	{
+	public:
+		BenchRandom(uint64 seed)
+			: state(seed) {}
+
+		uint64 next()
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		}
+
+	private:
+		uint64 state;
+	};
+
+	//Half random, half compressible data in 64KiB runs
+	void fill_data(BenchRandom& rnd, char* buf, size_t bsize)
+	{
+		const size_t run_size = 64*1024;
+		for(size_t off=0;off<bsize;off+=run_size)
+		{
+			size_t csize = (std::min)(run_size, bsize-off);
+			if(rnd.next()%2==0)
+			{
+				for(size_t i=0;i+sizeof(uint64)<=csize;i+=sizeof(uint64))
+				{
+					uint64 r = rnd.next();
+					memcpy(buf+off+i, &r, sizeof(r));
+				}
+			}
+			else
+			{
+				const char pattern[] = "UrBackup benchmark data - compressible run ";
+				for(size_t i=0;i<csize;++i)
+				{
+					buf[off+i] = pattern[i%(sizeof(pattern)-1)];
+				}
+			}
+		}
+	}
+
+	class BenchResult
+	{
+	public:
+		BenchResult(const std::string& name)
+			: name(name), bytes(0), ops(0), elapsed_us(0) {}
+
+		void add(int64 op_bytes, int64 op_us)
+		{
+			bytes+=op_bytes;
+			++ops;
+			elapsed_us+=op_us;
+			latencies_us.push_back(op_us);
+		}
+
+		JSON::Object toJson()
+		{
+			std::sort(latencies_us.begin(), latencies_us.end());
+
+			JSON::Object ret;
+			ret.set("name", name);
+			ret.set("bytes", bytes);
+			ret.set("ops", ops);
+			double seconds = elapsed_us/1000000.0;
+			ret.set("seconds", seconds);
+			if(seconds>0)
+			{
+				ret.set("throughput_mb_s", bytes/(1024.0*1024.0)/seconds);
+				ret.set("ops_per_s", ops/seconds);
+			}
+			if(!latencies_us.empty())
+			{
+				ret.set("p50_us", latencies_us[latencies_us.size()/2]);
+				ret.set("p99_us", latencies_us[(std::min)(latencies_us.size()-1, latencies_us.size()*99/100)]);
+				ret.set("max_us", latencies_us[latencies_us.size()-1]);
+			}
+			ret.set("max_rss_kb", max_rss_kb());
+			return ret;
+		}
+
+	private:
+		static int64 max_rss_kb()
+		{
+#ifndef _WIN32
+			rusage usage;
+			if(getrusage(RUSAGE_SELF, &usage)==0)
+			{
+				return usage.ru_maxrss;
+			}
+#endif
+			return -1;
+		}
+
+		std::string name;
+		int64 bytes;
+		int64 ops;
+		int64 elapsed_us;
+		std::vector<int64> latencies_us;
+	};
+
+	class BenchmarkRunner
+	{
+	public:
+		BenchmarkRunner()
+			: size(64*1024*1024), iterations(5), has_error(false)
+		{
+			std::string s_size = Server->getServerParameter("benchmark_size_mb");
+			if(!s_size.empty())
+			{
+				size = watoi64(s_size)*1024*1024;
+			}
+			std::string s_iterations = Server->getServerParameter("benchmark_iterations");
+			if(!s_iterations.empty())
+			{
+				iterations = watoi(s_iterations);
+			}
+			filter = Server->getServerParameter("benchmark_filter");
+
+			std::string output_fn = Server->getServerParameter("benchmark_output");
+			if(!output_fn.empty())
+			{
+				output.reset(Server->openFile(output_fn, MODE_APPEND));
+				if(output.get()==NULL)
+				{
+					Server->Log("Cannot open benchmark output file \""+output_fn+"\". "+os_last_error_str(), LL_ERROR);
+					has_error=true;
+				}
+			}
+
+			if(size<static_cast<int64>(bench_blocksize) || iterations<=0)
+			{
+				Server->Log("Invalid benchmark size or iteration count", LL_ERROR);
+				has_error=true;
+			}
+		}
+
+		bool run()
+		{
+			if(has_error)
+			{
+				return false;
+			}
+
+			if(enabled("chunk_hash")) run_chunk_hash();
+			if(enabled("tree_hash")) run_tree_hash();
+			if(enabled("chunk_patch")) run_chunk_patch();
+#ifdef STATIC_PLUGIN
+			if(enabled("compressed_file")) run_compressed_file();
+#endif
+			if(enabled("lmdb")) run_lmdb();
+			if(enabled("filelist_parse") || enabled("tree_diff")) run_filelist();
+			if(enabled("compressed_pipe")) run_compressed_pipe();
+
+			return !has_error;
+		}
+
+	private:
+		bool enabled(const std::string& name)
+		{
+			return filter.empty() || name.find(filter)!=std::string::npos;
+		}
+
+		void report(BenchResult& res)
+		{
+			std::string line = res.toJson().stringify(true);
+			std::cout << line << std::endl;
+			if(output.get()!=NULL)
+			{
+				output->Write(line+"\n");
+			}
+		}
+
+		void fail(const std::string& msg)
+		{
+			Server->Log(msg, LL_ERROR);
+			has_error=true;
+		}
+
+		IFsFile* create_data_file()
+		{
+			IFsFile* f = Server->openTemporaryFile();
+			if(f==NULL)
+			{
+				fail("Cannot open temporary file. "+os_last_error_str());
+				return NULL;
+			}
+
+			BenchRandom rnd(1);
+			std::vector<char> buf(bench_blocksize);
+			for(int64 pos=0;pos<size;pos+=bench_blocksize)
+			{
+				_u32 towrite = static_cast<_u32>((std::min)(static_cast<int64>(bench_blocksize), size-pos));
+				fill_data(rnd, buf.data(), towrite);
+				if(f->Write(buf.data(), towrite)!=towrite)
+				{
+					fail("Error writing benchmark data. "+os_last_error_str());
+					break;
+				}
+			}
+			return f;
+		}
+
+		void run_chunk_hash()
+		{
+			std::auto_ptr<IFsFile> data(create_data_file());
+			ScopedDeleteFile del_data(data.get());
+			if(data.get()==NULL) return;
+
+			BenchResult res("chunk_hash");
+			for(int i=0;i<iterations && !has_error;++i)
+			{
+				std::auto_ptr<IFsFile> hashoutput(Server->openTemporaryFile());
+				ScopedDeleteFile del_hashoutput(hashoutput.get());
+				if(hashoutput.get()==NULL)
+				{
+					fail("Cannot open hash output file. "+os_last_error_str());
+					return;
+				}
+
+				int64 starttime = Server->getTimeUS();
+				if(!build_chunk_hashs(data.get(), hashoutput.get(), NULL, NULL, false))
+				{
+					fail("Building chunk hashes failed");
+					return;
+				}
+				res.add(size, Server->getTimeUS()-starttime);
+			}
+			report(res);
+		}
+
+		void run_tree_hash()
+		{
+			BenchRandom rnd(2);
+			std::vector<char> buf(bench_blocksize);
+			fill_data(rnd, buf.data(), buf.size());
+
+			BenchResult res("tree_hash");
+			for(int i=0;i<iterations;++i)
+			{
+				TreeHash treehash(NULL);
+				for(int64 pos=0;pos<size;pos+=bench_blocksize)
+				{
+					int64 starttime = Server->getTimeUS();
+					treehash.hash(buf.data(), static_cast<_u32>(buf.size()));
+					res.add(buf.size(), Server->getTimeUS()-starttime);
+				}
+				treehash.finalize();
+			}
+			report(res);
+		}
+
+		class PatchCallback : public IChunkPatcherCallback
+		{
+		public:
+			PatchCallback()
+				: pos(0) {}
+
+			virtual void next_chunk_patcher_bytes(const char *buf, size_t bsize, bool changed, bool* is_sparse)
+			{
+				pos+=bsize;
+			}
+
+			virtual void next_sparse_extent_bytes(const char *buf, size_t bsize)
+			{
+			}
+
+			virtual int64 chunk_patcher_pos()
+			{
+				return pos;
+			}
+
+			int64 pos;
+		};
+
+		void run_chunk_patch()
+		{
+			std::auto_ptr<IFsFile> data(create_data_file());
+			ScopedDeleteFile del_data(data.get());
+			if(data.get()==NULL) return;
+
+			std::auto_ptr<IFsFile> patch(Server->openTemporaryFile());
+			ScopedDeleteFile del_patch(patch.get());
+			if(patch.get()==NULL)
+			{
+				fail("Cannot open patch file. "+os_last_error_str());
+				return;
+			}
+
+			//One changed 4KiB block per MiB
+			BenchRandom rnd(3);
+			int64 patch_filesize = little_endian(size);
+			patch->Write(reinterpret_cast<char*>(&patch_filesize), sizeof(patch_filesize));
+			std::vector<char> patch_data(4096);
+			for(int64 pos=0;pos+static_cast<int64>(patch_data.size())<=size;pos+=1024*1024)
+			{
+				fill_data(rnd, patch_data.data(), patch_data.size());
+				int64 patch_off = little_endian(pos);
+				unsigned int patch_size = little_endian(static_cast<unsigned int>(patch_data.size()));
+				patch->Write(reinterpret_cast<char*>(&patch_off), sizeof(patch_off));
+				patch->Write(reinterpret_cast<char*>(&patch_size), sizeof(patch_size));
+				patch->Write(patch_data.data(), static_cast<_u32>(patch_data.size()));
+			}
+
+			BenchResult res("chunk_patch");
+			for(int i=0;i<iterations;++i)
+			{
+				ChunkPatcher chunk_patcher;
+				PatchCallback callback;
+				chunk_patcher.setCallback(&callback);
+				chunk_patcher.setRequireUnchanged(false);
+
+				int64 starttime = Server->getTimeUS();
+				if(!chunk_patcher.ApplyPatch(data.get(), patch.get(), NULL))
+				{
+					fail("Applying patch failed");
+					return;
+				}
+				res.add(callback.pos, Server->getTimeUS()-starttime);
+			}
+			report(res);
+		}
+
+#ifdef STATIC_PLUGIN
+		void run_compressed_file()
+		{
+			BenchRandom rnd(4);
+			std::vector<char> buf(bench_blocksize);
+
+			BenchResult res_write("compressed_file_write");
+			BenchResult res_read("compressed_file_read");
+			for(int i=0;i<iterations && !has_error;++i)
+			{
+				std::string fn;
+				{
+					IFsFile* backing = Server->openTemporaryFile();
+					if(backing==NULL)
+					{
+						fail("Cannot open compressed file. "+os_last_error_str());
+						return;
+					}
+					fn = backing->getFilename();
+
+					CompressedFile compressed(backing, false, false);
+					for(int64 pos=0;pos<size;pos+=bench_blocksize)
+					{
+						fill_data(rnd, buf.data(), buf.size());
+						int64 starttime = Server->getTimeUS();
+						compressed.Write(buf.data(), static_cast<_u32>(buf.size()));
+						res_write.add(buf.size(), Server->getTimeUS()-starttime);
+					}
+
+					int64 starttime = Server->getTimeUS();
+					if(!compressed.finish() || compressed.hasError())
+					{
+						fail("Error writing compressed file");
+					}
+					res_write.add(0, Server->getTimeUS()-starttime);
+				}
+
+				if(!has_error)
+				{
+					IFile* backing = Server->openFile(fn, MODE_READ);
+					if(backing==NULL)
+					{
+						fail("Cannot reopen compressed file. "+os_last_error_str());
+					}
+					else
+					{
+						CompressedFile compressed(backing, true, true);
+						for(int64 pos=0;pos<size;pos+=bench_blocksize)
+						{
+							int64 starttime = Server->getTimeUS();
+							_u32 read = compressed.Read(buf.data(), static_cast<_u32>(buf.size()));
+							res_read.add(read, Server->getTimeUS()-starttime);
+						}
+						if(compressed.hasError())
+						{
+							fail("Error reading compressed file");
+						}
+					}
+				}
+
+				Server->deleteFile(fn);
+			}
+			report(res_write);
+			report(res_read);
+		}
+#endif
+
+		void run_lmdb()
+		{
+			if(FileExists("urbackup/fileindex/backup_server_files_index.lmdb"))
+			{
+				fail("There is a file index in the working directory. Not running LMDB benchmark on it.");
+				return;
+			}
+
+			size_t nkeys = static_cast<size_t>(size/1024);
+
+			BenchResult res_put("lmdb_put");
+			BenchResult res_get("lmdb_get");
+			{
+				LMDBFileIndex fileindex(true);
+				if(fileindex.has_error())
+				{
+					fail("Error creating file index");
+					delete_file_index();
+					return;
+				}
+
+				for(int i=0;i<iterations;++i)
+				{
+					BenchRandom rnd(5);
+					char hash[bytes_in_index];
+					fileindex.start_transaction();
+					for(size_t j=0;j<nkeys;++j)
+					{
+						uint64 r[2] = { rnd.next(), rnd.next() };
+						memcpy(hash, r, sizeof(hash));
+						int64 starttime = Server->getTimeUS();
+						fileindex.put(FileIndex::SIndexKey(hash, static_cast<int64>(r[0]%(1024*1024)), i), j+1);
+						if((j+1)%10000==0)
+						{
+							fileindex.commit_transaction();
+							fileindex.start_transaction();
+						}
+						res_put.add(sizeof(FileIndex::SIndexKey), Server->getTimeUS()-starttime);
+					}
+					fileindex.commit_transaction();
+
+					rnd = BenchRandom(5);
+					for(size_t j=0;j<nkeys;++j)
+					{
+						uint64 r[2] = { rnd.next(), rnd.next() };
+						memcpy(hash, r, sizeof(hash));
+						int64 starttime = Server->getTimeUS();
+						int64 val = fileindex.get(FileIndex::SIndexKey(hash, static_cast<int64>(r[0]%(1024*1024)), i));
+						res_get.add(sizeof(FileIndex::SIndexKey), Server->getTimeUS()-starttime);
+						if(val!=static_cast<int64>(j+1))
+						{
+							fail("Unexpected value in file index");
+							break;
+						}
+					}
+				}
+
+				fileindex.destroy_env();
+			}
+
+			delete_file_index();
+
+			report(res_put);
+			report(res_get);
+		}
+
+		bool write_filelist(IFile* f, size_t nfiles, uint64 seed, int modify_every)
+		{
+			BenchRandom rnd(seed);
+			const size_t files_per_dir = 100;
+			for(size_t i=0;i<nfiles;)
+			{
+				SFile dir;
+				dir.name = "dir"+convert(i/files_per_dir);
+				dir.isdir=true;
+				dir.last_modified=1000;
+				writeFileItem(f, dir);
+
+				for(size_t j=0;j<files_per_dir && i<nfiles;++j,++i)
+				{
+					SFile file;
+					file.name = "file "+convert(j)+".dat";
+					file.size = rnd.next()%(10*1024*1024);
+					file.last_modified = 1000+rnd.next()%1000;
+					if(modify_every>0 && i%modify_every==0)
+					{
+						file.last_modified+=1;
+					}
+					writeFileItem(f, file);
+				}
+
+				SFile dir_up;
+				dir_up.name="..";
+				dir_up.isdir=true;
+				writeFileItem(f, dir_up);
+			}
+			return true;
+		}
+
+		void run_filelist()
+		{
+			size_t nfiles = static_cast<size_t>(size/1024);
+
+			std::auto_ptr<IFsFile> list1(Server->openTemporaryFile());
+			ScopedDeleteFile del_list1(list1.get());
+			std::auto_ptr<IFsFile> list2(Server->openTemporaryFile());
+			ScopedDeleteFile del_list2(list2.get());
+			if(list1.get()==NULL || list2.get()==NULL)
+			{
+				fail("Cannot open file list. "+os_last_error_str());
+				return;
+			}
+
+			write_filelist(list1.get(), nfiles, 6, 0);
+			write_filelist(list2.get(), nfiles, 6, 100);
+
+			if(enabled("filelist_parse"))
+			{
+				std::string data = readToString(list1.get());
+
+				BenchResult res("filelist_parse");
+				for(int i=0;i<iterations;++i)
+				{
+					FileListParser parser;
+					SFile entry;
+					int64 starttime = Server->getTimeUS();
+					size_t nentries=0;
+					for(size_t j=0;j<data.size();++j)
+					{
+						if(parser.nextEntry(data[j], entry, NULL))
+						{
+							++nentries;
+						}
+					}
+					res.add(data.size(), Server->getTimeUS()-starttime);
+					if(nentries==0)
+					{
+						fail("No file list entries parsed");
+						return;
+					}
+				}
+				report(res);
+			}
+
+			if(enabled("tree_diff"))
+			{
+				BenchResult res("tree_diff");
+				for(int i=0;i<iterations;++i)
+				{
+					bool error=false;
+					std::vector<size_t> deleted_ids;
+					std::vector<size_t> modified_inplace_ids;
+					std::vector<size_t> deleted_inplace_ids;
+					std::vector<size_t> dir_diffs;
+					int64 starttime = Server->getTimeUS();
+					std::vector<size_t> diffs = TreeDiff::diffTrees(list1->getFilename(), list2->getFilename(), error,
+						&deleted_ids, NULL, &modified_inplace_ids, dir_diffs, &deleted_inplace_ids, false, false);
+					res.add(list1->Size()+list2->Size(), Server->getTimeUS()-starttime);
+					if(error)
+					{
+						fail("Error diffing file lists");
+						return;
+					}
+				}
+				report(res);
+			}
+		}
+
+		void run_compressed_pipe()
+		{
+			BenchRandom rnd(7);
+			std::vector<char> buf(pipe_msgsize);
+			std::vector<char> rbuf(pipe_msgsize);
+
+			IPipe* mem_pipe = Server->createMemoryPipe();
+			std::auto_ptr<CompressedPipe2> writer(new CompressedPipe2(mem_pipe, 6));
+			std::auto_ptr<CompressedPipe2> reader(new CompressedPipe2(mem_pipe, 6));
+			reader->destroyBackendPipeOnDelete(true);
+
+			BenchResult res("compressed_pipe");
+			for(int i=0;i<iterations && !has_error;++i)
+			{
+				for(int64 pos=0;pos<size;pos+=pipe_msgsize)
+				{
+					fill_data(rnd, buf.data(), buf.size());
+
+					int64 starttime = Server->getTimeUS();
+					if(!writer->Write(buf.data(), buf.size()))
+					{
+						fail("Error writing to compressed pipe");
+						break;
+					}
+
+					size_t read=0;
+					while(read<rbuf.size())
+					{
+						size_t r = reader->Read(rbuf.data()+read, rbuf.size()-read, 10000);
+						if(r==0)
+						{
+							break;
+						}
+						read+=r;
+					}
+					res.add(buf.size(), Server->getTimeUS()-starttime);
+
+					if(read!=rbuf.size() || memcmp(buf.data(), rbuf.data(), buf.size())!=0)
+					{
+						fail("Data read from compressed pipe differs");
+						break;
+					}
+				}
+			}
+			report(res);
+		}
+
+		int64 size;
+		int iterations;
+		std::string filter;
+		std::auto_ptr<IFile> output;
+		bool has_error;
+	};
+}
+
+int benchmark_data_path()
+{
+	BenchmarkRunner runner;
+	return runner.run() ? 0 : 1;
+}
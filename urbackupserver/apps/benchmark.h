@@ -0,0 +1,3 @@
+#pragma once
+
+int benchmark_data_path();
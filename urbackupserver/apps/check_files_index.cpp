@@ -100,7 +100,7 @@ int check_files_index()
 		int64 prev_entryid=0;
 		while(entryid!=0)
 		{
-			ServerFilesDao::SFindFileEntry fileentry = filesdao.getFileEntry(entryid);
+			ServerFilesDao::SFindFileEntry fileentry = filesdao.forEntry(entryid).getFileEntry(entryid);
 			
 			//Server->Log("Current entry id="+convert(fileentry.id));
 
@@ -164,7 +164,7 @@ int check_files_index()
 			prev_entryid = 0;
 			while(entryid!=0)
 			{
-				ServerFilesDao::SFindFileEntry fileentry = filesdao.getFileEntry(entryid);
+				ServerFilesDao::SFindFileEntry fileentry = filesdao.forEntry(entryid).getFileEntry(entryid);
 
 				if(fileentry.id == id)
 				{
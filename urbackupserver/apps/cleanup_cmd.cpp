@@ -24,6 +24,7 @@
 #include "../server.h"
 #include "../serverinterface/helper.h"
 #include "../create_files_index.h"
+#include "../files_db_shards.h"
 
 extern SStartupStatus startup_status;
 
@@ -162,6 +163,11 @@ int vacuum_databases()
 	dbs.push_back(URBACKUPDB_SERVER_LINKS);
 	dbs.push_back(URBACKUPDB_SERVER_LINK_JOURNAL);
 
+	for (size_t i = 1; i < files_db_shard_count(); ++i)
+	{
+		dbs.push_back(files_db_shard_dbid(i));
+	}
+
 	for (size_t i = 0; i < dbs.size(); ++i)
 	{
 		IDatabase *db = Server->getDatabase(Server->getThreadID(), dbs[i]);
@@ -18,6 +18,7 @@
 
 #include "app.h"
 #include "../../stringtools.h"
+#include "../files_db_shards.h"
 
 int repair_cmd(void)
 {
@@ -30,6 +31,11 @@ int repair_cmd(void)
 	dbs.push_back(URBACKUPDB_SERVER_LINKS);
 	dbs.push_back(URBACKUPDB_SERVER_LINK_JOURNAL);
 
+	for (size_t i = 1; i < files_db_shard_count(); ++i)
+	{
+		dbs.push_back(files_db_shard_dbid(i));
+	}
+
 	for (size_t i = 0; i < dbs.size(); ++i)
 	{
 		IDatabase *db = Server->getDatabase(Server->getThreadID(), dbs[i]);
@@ -64,6 +70,13 @@ int repair_cmd(void)
 		Server->deleteFile("urbackup/backup_server" + db_names[i] + ".db-shm");
 	}
 
+	for (size_t i = 1; i < files_db_shard_count(); ++i)
+	{
+		Server->deleteFile("urbackup/" + files_db_shard_filename(i));
+		Server->deleteFile("urbackup/" + files_db_shard_filename(i) + "-wal");
+		Server->deleteFile("urbackup/" + files_db_shard_filename(i) + "-shm");
+	}
+
 	for (size_t i = 0; i < dbs.size(); ++i)
 	{
 		IDatabase *db = Server->getDatabase(Server->getThreadID(), dbs[i]);
@@ -771,6 +771,63 @@ int action_decompress_file(std::vector<std::string> args)
 	return run_real_main(real_args);
 }
 
+int action_benchmark(std::vector<std::string> args)
+{
+	TCLAP::CmdLine cmd("Benchmark backup data path (hashing, patching, compression, file index, file lists)", ' ', cmdline_version);
+
+	TCLAP::ValueArg<std::string> workdir_arg("d", "workdir",
+		"Directory for temporary benchmark data",
+		false, "urbackup_benchmark", "path", cmd);
+
+	TCLAP::ValueArg<int> size_arg("s", "size",
+		"Amount of data per iteration in MiB",
+		false, 64, "MiB", cmd);
+
+	TCLAP::ValueArg<int> iterations_arg("i", "iterations",
+		"Number of iterations per benchmark",
+		false, 5, "number", cmd);
+
+	TCLAP::ValueArg<std::string> filter_arg("f", "filter",
+		"Only run benchmarks whose name contains this string",
+		false, "", "name", cmd);
+
+	TCLAP::ValueArg<std::string> output_arg("o", "output",
+		"Append results (one JSON object per line) to this file",
+		false, "", "path", cmd);
+
+	std::vector<std::string> real_args;
+	real_args.push_back(args[0]);
+
+	cmd.parse(args);
+
+	std::string workdir = make_absolute(workdir_arg.getValue());
+	os_create_dir(workdir);
+
+	real_args.push_back("--no-server");
+	real_args.push_back("--workingdir");
+	real_args.push_back(workdir);
+	real_args.push_back("--loglevel");
+	real_args.push_back("warn");
+	real_args.push_back("--app");
+	real_args.push_back("benchmark");
+	real_args.push_back("--benchmark_size_mb");
+	real_args.push_back(convert(size_arg.getValue()));
+	real_args.push_back("--benchmark_iterations");
+	real_args.push_back(convert(iterations_arg.getValue()));
+	if(!filter_arg.getValue().empty())
+	{
+		real_args.push_back("--benchmark_filter");
+		real_args.push_back(filter_arg.getValue());
+	}
+	if(!output_arg.getValue().empty())
+	{
+		real_args.push_back("--benchmark_output");
+		real_args.push_back(make_absolute(output_arg.getValue()));
+	}
+
+	return run_real_main(real_args);
+}
+
 #ifndef _WIN32
 int action_mount_vhd(std::vector<std::string> args)
 {
@@ -1021,6 +1078,9 @@ void action_help(std::string cmd)
 	std::cout << "\t" << cmd << " assemble" << std::endl;
 	std::cout << "\t\t" "Assemble VHD(Z) volumes into one disk VHD file" << std::endl;
 	std::cout << std::endl;
+	std::cout << "\t" << cmd << " benchmark" << std::endl;
+	std::cout << "\t\t" "Benchmark backup data path" << std::endl;
+	std::cout << std::endl;
 }
 
 int main(int argc, char* argv[])
@@ -1057,6 +1117,8 @@ int main(int argc, char* argv[])
 #endif
 	actions.push_back("assemble");
 	action_funs.push_back(action_assemble);
+	actions.push_back("benchmark");
+	action_funs.push_back(action_benchmark);
 	actions.push_back("internal");
 	action_funs.push_back(action_internal);
 
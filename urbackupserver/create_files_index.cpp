@@ -21,6 +21,7 @@
 #include "../Interface/DatabaseCursor.h"
 #include "../Interface/File.h"
 #include "database.h"
+#include "files_db_shards.h"
 #include "server_settings.h"
 #include "LMDBFileIndex.h"
 #include "../stringtools.h"
@@ -34,12 +35,33 @@ const size_t sqlite_data_allocation_chunk_size = 50 * 1024 * 1024; //50MB
 
 struct SCallbackData
 {
-	IDatabaseCursor* cur;
+	//One cursor per files database shard. The next row is
+	//the smallest of the current rows of all cursors.
+	std::vector<IDatabaseCursor*> curs;
+	std::vector<db_single_result> rows;
+	std::vector<bool> has_row;
 	int64 pos;
 	int64 max_pos;
 	SStartupStatus* status;
 };
 
+//Same order as ORDER BY shahash ASC, filesize ASC, clientid ASC, created DESC
+bool entry_less(db_single_result& a, db_single_result& b)
+{
+	int c = a["shahash"].compare(b["shahash"]);
+	if (c != 0) return c < 0;
+
+	int64 filesize_a = watoi64(a["filesize"]);
+	int64 filesize_b = watoi64(b["filesize"]);
+	if (filesize_a != filesize_b) return filesize_a < filesize_b;
+
+	int clientid_a = watoi(a["clientid"]);
+	int clientid_b = watoi(b["clientid"]);
+	if (clientid_a != clientid_b) return clientid_a < clientid_b;
+
+	return watoi64(a["created"]) > watoi64(b["created"]);
+}
+
 db_results create_callback(size_t n_done, size_t n_rows, void *userdata)
 {
 	SCallbackData *data=(SCallbackData*)userdata;
@@ -61,11 +83,26 @@ db_results create_callback(size_t n_done, size_t n_rows, void *userdata)
 	}
 	
 	db_results ret;
-	db_single_result res;
-	
-	if(data->cur->next(res))
+
+	size_t min_idx = std::string::npos;
+	for (size_t i = 0; i < data->curs.size(); ++i)
+	{
+		if (!data->has_row[i])
+		{
+			continue;
+		}
+
+		if (min_idx == std::string::npos
+			|| entry_less(data->rows[i], data->rows[min_idx]))
+		{
+			min_idx = i;
+		}
+	}
+
+	if (min_idx != std::string::npos)
 	{
-		ret.push_back(res);
+		ret.push_back(data->rows[min_idx]);
+		data->has_row[min_idx] = data->curs[min_idx]->next(data->rows[min_idx]);
 	}
 	
 	return ret;
@@ -143,12 +180,21 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 	
 	Server->Log("Getting number of files...", LL_INFO);
 	
-	db_results res = db->Read("SELECT COUNT(*) AS c FROM files");
-	
+	std::vector<IDatabase*> files_dbs;
+	files_dbs.push_back(db);
+	for (size_t i = 1; i < files_db_shard_count(); ++i)
+	{
+		files_dbs.push_back(Server->getDatabase(Server->getThreadID(), files_db_shard_dbid(i)));
+	}
+
 	int64 n_files = 0;
-	if(!res.empty())
+	for (size_t i = 0; i < files_dbs.size(); ++i)
 	{
-		n_files=watoi64(res[0]["c"]);
+		db_results res = files_dbs[i]->Read("SELECT COUNT(*) AS c FROM files");
+		if (!res.empty())
+		{
+			n_files += watoi64(res[0]["c"]);
+		}
 	}
 
 	Server->Log("Dropping index...", LL_INFO);
@@ -158,17 +204,35 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 
 	Server->Log("Starting creating files index...", LL_INFO);
 
-	IQuery *q_read=db->Prepare("SELECT id, shahash, filesize, clientid, next_entry, prev_entry, pointed_to FROM files ORDER BY shahash ASC, filesize ASC, clientid ASC, created DESC");
-
 	SCallbackData data;
-	data.cur=q_read->Cursor();
+	for (size_t i = 0; i < files_dbs.size(); ++i)
+	{
+		IQuery *q_read = files_dbs[i]->Prepare("SELECT id, shahash, filesize, clientid, next_entry, prev_entry, pointed_to, created FROM files ORDER BY shahash ASC, filesize ASC, clientid ASC, created DESC");
+		IDatabaseCursor* cur = q_read->Cursor();
+		data.curs.push_back(cur);
+		data.rows.push_back(db_single_result());
+		data.has_row.push_back(cur->next(data.rows[i]));
+	}
 	data.pos=0;
 	data.max_pos=n_files;
 	data.status=&status;
 
 	{
 		DBScopedWriteTransaction write_transaction(db_files_new);
+
+		//Link corrections of entries in other shards are written directly to the shard
+		std::vector<DBScopedWriteTransaction*> shard_transactions;
+		for (size_t i = 1; i < files_dbs.size(); ++i)
+		{
+			shard_transactions.push_back(new DBScopedWriteTransaction(files_dbs[i]));
+		}
+
 		fileindex.create(create_callback, &data);
+
+		for (size_t i = 0; i < shard_transactions.size(); ++i)
+		{
+			delete shard_transactions[i];
+		}
 	}
 
 	if(fileindex.has_error())
@@ -177,9 +241,12 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 	}
 	else
 	{
-		if (data.cur->has_error())
+		for (size_t i = 0; i < data.curs.size(); ++i)
 		{
-			return false;
+			if (data.curs[i]->has_error())
+			{
+				return false;
+			}
 		}
 
 		Server->Log("Creating backupid index...", LL_INFO);
@@ -282,6 +282,99 @@ std::vector<ServerBackupDao::SDuration> ServerBackupDao::getLastFullDurations(in
 	return ret;
 }
 
+/**
+* @-SQLGenAccess
+* @func vector<SDuration> ServerBackupDao::getLastImageDurations
+* @return int64 indexing_time_ms, int64 duration 
+* @sql
+*      SELECT 0 AS indexing_time_ms, (strftime('%s',running)-strftime('%s',backuptime)) AS duration
+*		FROM backup_images 
+*		WHERE clientid=:clientid(int) AND letter=:letter(string) AND complete=1 AND (incremental<>0)=:incremental(int)
+*		ORDER BY backuptime DESC LIMIT 10
+*/
+std::vector<ServerBackupDao::SDuration> ServerBackupDao::getLastImageDurations(int clientid, const std::string& letter, int incremental)
+{
+	if(q_getLastImageDurations==NULL)
+	{
+		q_getLastImageDurations=db->Prepare("SELECT 0 AS indexing_time_ms, (strftime('%s',running)-strftime('%s',backuptime)) AS duration FROM backup_images  WHERE clientid=? AND letter=? AND complete=1 AND (incremental<>0)=? ORDER BY backuptime DESC LIMIT 10", false);
+	}
+	q_getLastImageDurations->Bind(clientid);
+	q_getLastImageDurations->Bind(letter);
+	q_getLastImageDurations->Bind(incremental);
+	db_results res=q_getLastImageDurations->Read();
+	q_getLastImageDurations->Reset();
+	std::vector<ServerBackupDao::SDuration> ret;
+	ret.resize(res.size());
+	for(size_t i=0;i<res.size();++i)
+	{
+		ret[i].indexing_time_ms=watoi64(res[i]["indexing_time_ms"]);
+		ret[i].duration=watoi64(res[i]["duration"]);
+	}
+	return ret;
+}
+
+/**
+* @-SQLGenAccess
+* @func SScheduleInfo ServerBackupDao::getFileBackupScheduleInfo
+* @return int64 age, int64 size_bytes
+* @sql
+*      SELECT (strftime('%s','now')-strftime('%s',backuptime)) AS age, size_bytes
+*		FROM backups 
+*		WHERE clientid=:clientid(int) AND tgroup=:tgroup(int) AND done=1 AND complete=1 AND (incremental<>0)=:incremental(int)
+*		ORDER BY backuptime DESC LIMIT 1
+*/
+ServerBackupDao::SScheduleInfo ServerBackupDao::getFileBackupScheduleInfo(int clientid, int tgroup, int incremental)
+{
+	if(q_getFileBackupScheduleInfo==NULL)
+	{
+		q_getFileBackupScheduleInfo=db->Prepare("SELECT (strftime('%s','now')-strftime('%s',backuptime)) AS age, size_bytes FROM backups  WHERE clientid=? AND tgroup=? AND done=1 AND complete=1 AND (incremental<>0)=? ORDER BY backuptime DESC LIMIT 1", false);
+	}
+	q_getFileBackupScheduleInfo->Bind(clientid);
+	q_getFileBackupScheduleInfo->Bind(tgroup);
+	q_getFileBackupScheduleInfo->Bind(incremental);
+	db_results res=q_getFileBackupScheduleInfo->Read();
+	q_getFileBackupScheduleInfo->Reset();
+	SScheduleInfo ret = { false, 0, 0 };
+	if(!res.empty())
+	{
+		ret.exists=true;
+		ret.age=watoi64(res[0]["age"]);
+		ret.size_bytes=watoi64(res[0]["size_bytes"]);
+	}
+	return ret;
+}
+
+/**
+* @-SQLGenAccess
+* @func SScheduleInfo ServerBackupDao::getImageBackupScheduleInfo
+* @return int64 age, int64 size_bytes
+* @sql
+*      SELECT (strftime('%s','now')-strftime('%s',backuptime)) AS age, size_bytes
+*		FROM backup_images 
+*		WHERE clientid=:clientid(int) AND letter=:letter(string) AND complete=1 AND (incremental<>0)=:incremental(int)
+*		ORDER BY backuptime DESC LIMIT 1
+*/
+ServerBackupDao::SScheduleInfo ServerBackupDao::getImageBackupScheduleInfo(int clientid, const std::string& letter, int incremental)
+{
+	if(q_getImageBackupScheduleInfo==NULL)
+	{
+		q_getImageBackupScheduleInfo=db->Prepare("SELECT (strftime('%s','now')-strftime('%s',backuptime)) AS age, size_bytes FROM backup_images  WHERE clientid=? AND letter=? AND complete=1 AND (incremental<>0)=? ORDER BY backuptime DESC LIMIT 1", false);
+	}
+	q_getImageBackupScheduleInfo->Bind(clientid);
+	q_getImageBackupScheduleInfo->Bind(letter);
+	q_getImageBackupScheduleInfo->Bind(incremental);
+	db_results res=q_getImageBackupScheduleInfo->Read();
+	q_getImageBackupScheduleInfo->Reset();
+	SScheduleInfo ret = { false, 0, 0 };
+	if(!res.empty())
+	{
+		ret.exists=true;
+		ret.age=watoi64(res[0]["age"]);
+		ret.size_bytes=watoi64(res[0]["size_bytes"]);
+	}
+	return ret;
+}
+
 
 /**
 * @-SQLGenAccess
@@ -1671,6 +1764,9 @@ void ServerBackupDao::prepareQueries( void )
 	q_getOrigClientSettings=NULL;
 	q_getLastIncrementalDurations=NULL;
 	q_getLastFullDurations=NULL;
+	q_getLastImageDurations=NULL;
+	q_getFileBackupScheduleInfo=NULL;
+	q_getImageBackupScheduleInfo=NULL;
 	q_getClientSetting=NULL;
 	q_getClientIds=NULL;
 	q_getSetting=NULL;
@@ -1747,6 +1843,9 @@ void ServerBackupDao::destroyQueries( void )
 	db->destroyQuery(q_getOrigClientSettings);
 	db->destroyQuery(q_getLastIncrementalDurations);
 	db->destroyQuery(q_getLastFullDurations);
+	db->destroyQuery(q_getLastImageDurations);
+	db->destroyQuery(q_getFileBackupScheduleInfo);
+	db->destroyQuery(q_getImageBackupScheduleInfo);
 	db->destroyQuery(q_getClientSetting);
 	db->destroyQuery(q_getClientIds);
 	db->destroyQuery(q_getSetting);
@@ -85,6 +85,12 @@ public:
 		int report_loglevel;
 		int report_sendonly;
 	};
+	struct SScheduleInfo
+	{
+		bool exists;
+		int64 age;
+		int64 size_bytes;
+	};
 
 
 	void addToOldBackupfolders(const std::string& backupfolder);
@@ -97,6 +103,9 @@ public:
 	CondString getOrigClientSettings(int clientid);
 	std::vector<SDuration> getLastIncrementalDurations(int clientid);
 	std::vector<SDuration> getLastFullDurations(int clientid);
+	std::vector<SDuration> getLastImageDurations(int clientid, const std::string& letter, int incremental);
+	SScheduleInfo getFileBackupScheduleInfo(int clientid, int tgroup, int incremental);
+	SScheduleInfo getImageBackupScheduleInfo(int clientid, const std::string& letter, int incremental);
 	CondString getClientSetting(const std::string& key, int clientid);
 	std::vector<int> getClientIds(void);
 	CondString getSetting(int clientid, const std::string& key);
@@ -180,6 +189,9 @@ private:
 	IQuery* q_getOrigClientSettings;
 	IQuery* q_getLastIncrementalDurations;
 	IQuery* q_getLastFullDurations;
+	IQuery* q_getLastImageDurations;
+	IQuery* q_getFileBackupScheduleInfo;
+	IQuery* q_getImageBackupScheduleInfo;
 	IQuery* q_getClientSetting;
 	IQuery* q_getClientIds;
 	IQuery* q_getSetting;
@@ -18,6 +18,8 @@
 
 #include "ServerFilesDao.h"
 #include "../../stringtools.h"
+#include "../../Interface/Server.h"
+#include "../files_db_shards.h"
 #include <assert.h>
 #include <string.h>
 
@@ -44,15 +46,27 @@ const int ServerFilesDao::c_direction_incoming = 0;
 const int ServerFilesDao::c_direction_outgoing = 1;
 const int ServerFilesDao::c_direction_outgoing_nobackupstat = 2;
 
+namespace
+{
+	const size_t max_delayed_incoming_stats = 10000;
+	const int64 max_incoming_stats_delay_ms = 10000;
+}
+
 ServerFilesDao::ServerFilesDao(IDatabase * db)
-	: db(db)
+	: db(db), shard_parent(NULL), delay_incoming_stats(false), delayed_incoming_stats_starttime(0)
 {
 	prepareQueries();
 }
 
 ServerFilesDao::~ServerFilesDao()
 {
+	flushIncomingStats();
 	destroyQueries();
+
+	for (size_t i = 0; i < shard_daos.size(); ++i)
+	{
+		delete shard_daos[i];
+	}
 }
 
 int64 ServerFilesDao::getLastId()
@@ -445,19 +459,36 @@ void ServerFilesDao::delIncomingStatEntry(int64 id)
 	q_delIncomingStatEntry->Reset();
 }
 
+/**
+* @-SQLGenAccess
+* @func void ServerFilesDao::delIncomingStatEntriesUpTo
+* @sql
+*       DELETE FROM files_incoming_stat WHERE id<=:id(int64)
+*/
+void ServerFilesDao::delIncomingStatEntriesUpTo(int64 id)
+{
+	if(q_delIncomingStatEntriesUpTo==NULL)
+	{
+		q_delIncomingStatEntriesUpTo=db->Prepare("DELETE FROM files_incoming_stat WHERE id<=?", false);
+	}
+	q_delIncomingStatEntriesUpTo->Bind(id);
+	q_delIncomingStatEntriesUpTo->Write();
+	q_delIncomingStatEntriesUpTo->Reset();
+}
+
 /**
 * @-SQLGenAccess
 * @func vector<SIncomingStat> ServerFilesDao::getIncomingStats
 * @return int64 id, int64 filesize, int clientid, int backupid, string existing_clients, int direction, int incremental
 * @sql
 *       SELECT id, filesize, clientid, backupid, existing_clients, direction, incremental
-*       FROM files_incoming_stat LIMIT 10000
+*       FROM files_incoming_stat ORDER BY id LIMIT 10000
 */
 std::vector<ServerFilesDao::SIncomingStat> ServerFilesDao::getIncomingStats(void)
 {
 	if(q_getIncomingStats==NULL)
 	{
-		q_getIncomingStats=db->Prepare("SELECT id, filesize, clientid, backupid, existing_clients, direction, incremental FROM files_incoming_stat LIMIT 10000", false);
+		q_getIncomingStats=db->Prepare("SELECT id, filesize, clientid, backupid, existing_clients, direction, incremental FROM files_incoming_stat ORDER BY id LIMIT 10000", false);
 	}
 	db_results res=q_getIncomingStats->Read();
 	std::vector<ServerFilesDao::SIncomingStat> ret;
@@ -676,6 +707,31 @@ ServerFilesDao::SBackupIdMinMax ServerFilesDao::getBackupIdMinMax(int backupid)
 	return ret;
 }
 
+/**
+* @-SQLGenAccess
+* @func int64 ServerFilesDao::getBackupFileEntryId
+* @return int64 id
+* @sql
+*      SELECT id FROM files WHERE backupid=:backupid(int) LIMIT 1
+*/
+ServerFilesDao::CondInt64 ServerFilesDao::getBackupFileEntryId(int backupid)
+{
+	if(q_getBackupFileEntryId==NULL)
+	{
+		q_getBackupFileEntryId=db->Prepare("SELECT id FROM files WHERE backupid=? LIMIT 1", false);
+	}
+	q_getBackupFileEntryId->Bind(backupid);
+	db_results res=q_getBackupFileEntryId->Read();
+	q_getBackupFileEntryId->Reset();
+	CondInt64 ret = { false, 0 };
+	if(!res.empty())
+	{
+		ret.exists=true;
+		ret.value=watoi64(res[0]["id"]);
+	}
+	return ret;
+}
+
 //@-SQLGenSetup
 void ServerFilesDao::prepareQueries()
 {
@@ -696,6 +752,7 @@ void ServerFilesDao::prepareQueries()
 	q_addIncomingFile=NULL;
 	q_getIncomingStatsCount=NULL;
 	q_delIncomingStatEntry=NULL;
+	q_delIncomingStatEntriesUpTo=NULL;
 	q_getIncomingStats=NULL;
 	q_deleteFiles=NULL;
 	q_removeDanglingFiles=NULL;
@@ -707,6 +764,7 @@ void ServerFilesDao::prepareQueries()
 	q_getFileEntryFromTemporaryTable=NULL;
 	q_getFileEntriesFromTemporaryTableGlob=NULL;
 	q_getBackupIdMinMax=NULL;
+	q_getBackupFileEntryId=NULL;
 }
 
 //@-SQLGenDestruction
@@ -729,6 +787,7 @@ void ServerFilesDao::destroyQueries()
 	db->destroyQuery(q_addIncomingFile);
 	db->destroyQuery(q_getIncomingStatsCount);
 	db->destroyQuery(q_delIncomingStatEntry);
+	db->destroyQuery(q_delIncomingStatEntriesUpTo);
 	db->destroyQuery(q_getIncomingStats);
 	db->destroyQuery(q_deleteFiles);
 	db->destroyQuery(q_removeDanglingFiles);
@@ -740,6 +799,7 @@ void ServerFilesDao::destroyQueries()
 	db->destroyQuery(q_getFileEntryFromTemporaryTable);
 	db->destroyQuery(q_getFileEntriesFromTemporaryTableGlob);
 	db->destroyQuery(q_getBackupIdMinMax);
+	db->destroyQuery(q_getBackupFileEntryId);
 }
 
 int64 ServerFilesDao::addFileEntryExternal(int backupid, const std::string& fullpath, const std::string& hashpath, const std::string& shahash, int64 filesize, int64 rsize, int clientid, int incremental, int64 next_entry, int64 prev_entry, int pointed_to)
@@ -750,13 +810,136 @@ int64 ServerFilesDao::addFileEntryExternal(int backupid, const std::string& full
 
 	if (prev_entry != 0)
 	{
-		setNextEntry(id, prev_entry);
+		forEntry(prev_entry).setNextEntry(id, prev_entry);
 	}
 
 	if (next_entry != 0)
 	{
-		setPrevEntry(id, next_entry);
+		forEntry(next_entry).setPrevEntry(id, next_entry);
 	}
 
 	return id;
+}
+
+ServerFilesDao& ServerFilesDao::forShard(size_t shard)
+{
+	if (shard_parent != NULL)
+	{
+		return shard_parent->forShard(shard);
+	}
+
+	if (shard == 0)
+	{
+		return *this;
+	}
+
+	if (shard >= shard_daos.size())
+	{
+		shard_daos.resize(shard + 1, NULL);
+	}
+
+	if (shard_daos[shard] == NULL)
+	{
+		ServerFilesDao* shard_dao = new ServerFilesDao(Server->getDatabase(Server->getThreadID(), files_db_shard_dbid(shard)));
+		shard_dao->shard_parent = this;
+		shard_daos[shard] = shard_dao;
+	}
+
+	return *shard_daos[shard];
+}
+
+ServerFilesDao& ServerFilesDao::forClient(int clientid)
+{
+	return forShard(files_db_shard_for_client(clientid));
+}
+
+ServerFilesDao& ServerFilesDao::forEntry(int64 id)
+{
+	return forShard(files_db_shard_for_entry(id));
+}
+
+ServerFilesDao& ServerFilesDao::forBackup(int backupid, int clientid)
+{
+	ServerFilesDao& client_dao = forClient(clientid);
+
+	if (files_db_shard_count() == 1
+		|| client_dao.getBackupFileEntryId(backupid).exists)
+	{
+		return client_dao;
+	}
+
+	for (size_t i = 0; i < files_db_shard_count(); ++i)
+	{
+		ServerFilesDao& shard_dao = forShard(i);
+		if (&shard_dao != &client_dao
+			&& shard_dao.getBackupFileEntryId(backupid).exists)
+		{
+			return shard_dao;
+		}
+	}
+
+	return client_dao;
+}
+
+void ServerFilesDao::setDelayIncomingStats(bool b)
+{
+	delay_incoming_stats = b;
+
+	if (!delay_incoming_stats)
+	{
+		flushIncomingStats();
+	}
+}
+
+void ServerFilesDao::addIncomingStat(int64 filesize, int clientid, int backupid, const std::string& existing_clients, int direction, int incremental)
+{
+	if (!delay_incoming_stats)
+	{
+		addIncomingFile(filesize, clientid, backupid, existing_clients, direction, incremental);
+		return;
+	}
+
+	if (delayed_incoming_stats.empty())
+	{
+		delayed_incoming_stats_starttime = Server->getTimeMS();
+	}
+
+	SIncomingStatKey key;
+	key.clientid = clientid;
+	key.backupid = backupid;
+	key.existing_clients = existing_clients;
+	key.direction = direction;
+	key.incremental = incremental;
+
+	delayed_incoming_stats[key] += filesize;
+}
+
+bool ServerFilesDao::needIncomingStatsFlush()
+{
+	if (delayed_incoming_stats.empty())
+	{
+		return false;
+	}
+
+	return delayed_incoming_stats.size() >= max_delayed_incoming_stats
+		|| Server->getTimeMS() - delayed_incoming_stats_starttime >= max_incoming_stats_delay_ms;
+}
+
+void ServerFilesDao::flushIncomingStats()
+{
+	if (delayed_incoming_stats.empty())
+	{
+		return;
+	}
+
+	DBScopedWriteTransaction trans(db);
+
+	for (std::map<SIncomingStatKey, int64>::iterator it = delayed_incoming_stats.begin();
+		it != delayed_incoming_stats.end(); ++it)
+	{
+		addIncomingFile(it->second, it->first.clientid, it->first.backupid, it->first.existing_clients,
+			it->first.direction, it->first.incremental);
+	}
+
+	delayed_incoming_stats.clear();
 }
\ No newline at end of file
@@ -95,6 +95,7 @@ public:
 	void addIncomingFile(int64 filesize, int clientid, int backupid, const std::string& existing_clients, int direction, int incremental);
 	CondInt64 getIncomingStatsCount(void);
 	void delIncomingStatEntry(int64 id);
+	void delIncomingStatEntriesUpTo(int64 id);
 	std::vector<SIncomingStat> getIncomingStats(void);
 	void deleteFiles(int backupid);
 	void removeDanglingFiles(void);
@@ -106,10 +107,26 @@ public:
 	SFileEntry getFileEntryFromTemporaryTable(const std::string& fullpath);
 	std::vector<SFileEntry> getFileEntriesFromTemporaryTableGlob(const std::string& fullpath_glob);
 	SBackupIdMinMax getBackupIdMinMax(int backupid);
+	CondInt64 getBackupFileEntryId(int backupid);
 	//@-SQLGenFunctionsEnd
 
 	int64 addFileEntryExternal(int backupid, const std::string& fullpath, const std::string& hashpath, const std::string& shahash, int64 filesize, int64 rsize, int clientid, int incremental, int64 next_entry, int64 prev_entry, int pointed_to);
 
+	//If delayed, incoming stats with the same clients/backup are summed up in memory
+	//and written as one row by flushIncomingStats()
+	void setDelayIncomingStats(bool b);
+	void addIncomingStat(int64 filesize, int clientid, int backupid, const std::string& existing_clients, int direction, int incremental);
+	bool needIncomingStatsFlush();
+	void flushIncomingStats();
+
+	//Returns the DAO of the files database shard the queries have to be run on.
+	//Incoming stats and temporary tables of this DAO are not sharded.
+	ServerFilesDao& forShard(size_t shard);
+	ServerFilesDao& forClient(int clientid);
+	ServerFilesDao& forEntry(int64 id);
+	//Shard with file entries of backup backupid (or the client's shard if there are none)
+	ServerFilesDao& forBackup(int backupid, int clientid);
+
 private:
 	ServerFilesDao(ServerFilesDao& other) {}
 	void operator=(ServerFilesDao& other) {}
@@ -135,6 +152,7 @@ private:
 	IQuery* q_addIncomingFile;
 	IQuery* q_getIncomingStatsCount;
 	IQuery* q_delIncomingStatEntry;
+	IQuery* q_delIncomingStatEntriesUpTo;
 	IQuery* q_getIncomingStats;
 	IQuery* q_deleteFiles;
 	IQuery* q_removeDanglingFiles;
@@ -146,7 +164,33 @@ private:
 	IQuery* q_getFileEntryFromTemporaryTable;
 	IQuery* q_getFileEntriesFromTemporaryTableGlob;
 	IQuery* q_getBackupIdMinMax;
+	IQuery* q_getBackupFileEntryId;
 	//@-SQLGenVariablesEnd
 
 	IDatabase *db;
+
+	struct SIncomingStatKey
+	{
+		int clientid;
+		int backupid;
+		std::string existing_clients;
+		int direction;
+		int incremental;
+
+		bool operator<(const SIncomingStatKey& other) const
+		{
+			if(clientid!=other.clientid) return clientid<other.clientid;
+			if(backupid!=other.backupid) return backupid<other.backupid;
+			if(direction!=other.direction) return direction<other.direction;
+			if(incremental!=other.incremental) return incremental<other.incremental;
+			return existing_clients<other.existing_clients;
+		}
+	};
+
+	ServerFilesDao* shard_parent;
+	std::vector<ServerFilesDao*> shard_daos;
+
+	bool delay_incoming_stats;
+	std::map<SIncomingStatKey, int64> delayed_incoming_stats;
+	int64 delayed_incoming_stats_starttime;
 };
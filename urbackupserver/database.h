@@ -8,5 +8,7 @@ const DATABASE_ID URBACKUPDB_SERVER_LINKS = 24;
 const DATABASE_ID URBACKUPDB_SERVER_LINK_JOURNAL = 25;
 const DATABASE_ID URBACKUPDB_SERVER_SETTINGS=30;
 const DATABASE_ID URBACKUPDB_SERVER_FILES_NEW = 26;
+//Files database shards 1..files_db_max_shards-1, see files_db_shards.h
+const DATABASE_ID URBACKUPDB_SERVER_FILES_SHARD_BASE = 40;
 
 #endif //DATABASE_H
\ No newline at end of file
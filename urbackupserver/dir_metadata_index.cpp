@@ -0,0 +1,210 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "dir_metadata_index.h"
+#include "../Interface/Server.h"
+#include "../Interface/File.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../common/data.h"
+#include "../stringtools.h"
+#include <memory>
+#include <memory.h>
+
+namespace
+{
+	//Cannot be the start of a metadata file (which starts with the hash data size)
+	const char dir_metadata_index_magic[] = "URBDIDX2";
+	const size_t dir_metadata_index_magic_size = sizeof(dir_metadata_index_magic) - 1;
+	//Common to all index versions
+	const size_t dir_metadata_index_magic_prefix_size = dir_metadata_index_magic_size - 1;
+	const _u32 dir_metadata_index_max_size = 512 * 1024 * 1024;
+
+	bool is_dir_metadata_index(const std::string& index_fn)
+	{
+		std::auto_ptr<IFile> index_f(Server->openFile(os_file_prefix(index_fn), MODE_READ));
+		if (index_f.get() == NULL)
+		{
+			return false;
+		}
+
+		std::string magic = index_f->Read(static_cast<_u32>(dir_metadata_index_magic_prefix_size));
+		return magic.size() == dir_metadata_index_magic_prefix_size
+			&& memcmp(magic.data(), dir_metadata_index_magic, dir_metadata_index_magic_prefix_size) == 0;
+	}
+}
+
+bool DirMetadataIndex::read(const std::string& metadata_dir)
+{
+	entries.clear();
+
+	std::auto_ptr<IFile> index_f(Server->openFile(os_file_prefix(metadata_dir + os_file_sep() + dir_metadata_index_fn), MODE_READ));
+	if (index_f.get() == NULL)
+	{
+		return false;
+	}
+
+	char header[dir_metadata_index_magic_size + sizeof(_u32)];
+	if (index_f->Read(header, sizeof(header)) != sizeof(header)
+		|| memcmp(header, dir_metadata_index_magic, dir_metadata_index_magic_size) != 0)
+	{
+		return false;
+	}
+
+	_u32 data_size;
+	memcpy(&data_size, header + dir_metadata_index_magic_size, sizeof(data_size));
+	data_size = little_endian(data_size);
+
+	if (data_size > dir_metadata_index_max_size
+		|| index_f->Size() != static_cast<int64>(sizeof(header) + data_size))
+	{
+		Server->Log("Directory metadata index in \"" + metadata_dir + "\" has wrong size", LL_WARNING);
+		return false;
+	}
+
+	std::string data = index_f->Read(data_size);
+	if (data.size() != data_size)
+	{
+		Server->Log("Error reading directory metadata index in \"" + metadata_dir + "\". " + os_last_error_str(), LL_WARNING);
+		return false;
+	}
+
+	CRData rdata(data.data(), data.size());
+
+	std::string index_dir;
+	if (!rdata.getStr(&index_dir))
+	{
+		return false;
+	}
+
+	std::string final_dir = os_get_final_path(os_file_prefix(metadata_dir));
+	if (index_dir != final_dir)
+	{
+		//Inherited from the previous backup via a file system snapshot
+		Server->Log("Directory metadata index in \"" + final_dir + "\" was written for \"" + index_dir + "\". Ignoring it.", LL_DEBUG);
+		return false;
+	}
+
+	int64 num_entries;
+	if (!rdata.getVarInt(&num_entries))
+	{
+		return false;
+	}
+
+	for (int64 i = 0; i < num_entries; ++i)
+	{
+		std::string rel_fn;
+		FileMetadata metadata;
+		if (!rdata.getStr(&rel_fn)
+			|| !metadata.read(rdata))
+		{
+			Server->Log("Directory metadata index in \"" + metadata_dir + "\" is malformed", LL_WARNING);
+			entries.clear();
+			return false;
+		}
+		entries[rel_fn] = metadata;
+	}
+
+	return true;
+}
+
+bool DirMetadataIndex::write(const std::string& metadata_dir) const
+{
+	std::string index_fn = metadata_dir + os_file_sep() + dir_metadata_index_fn;
+
+	if (os_get_file_type(os_file_prefix(index_fn)) != 0
+		&& !is_dir_metadata_index(index_fn))
+	{
+		//Metadata of a file with the same name
+		return false;
+	}
+
+	CWData data;
+	data.addString(os_get_final_path(os_file_prefix(metadata_dir)));
+	data.addVarInt(entries.size());
+	for (std::map<std::string, FileMetadata>::const_iterator it = entries.begin();
+		it != entries.end(); ++it)
+	{
+		data.addString(it->first);
+		it->second.serialize(data);
+	}
+
+	_u32 data_size = little_endian(static_cast<_u32>(data.getDataSize()));
+
+	std::string tmp_fn = index_fn + "." + convert(Server->getRandomNumber()) + ".new";
+
+	std::auto_ptr<IFile> tmp_f(Server->openFile(os_file_prefix(tmp_fn), MODE_WRITE));
+	if (tmp_f.get() == NULL)
+	{
+		Server->Log("Error creating directory metadata index \"" + tmp_fn + "\". " + os_last_error_str(), LL_DEBUG);
+		return false;
+	}
+
+	if (tmp_f->Write(dir_metadata_index_magic, static_cast<_u32>(dir_metadata_index_magic_size)) != dir_metadata_index_magic_size
+		|| tmp_f->Write(reinterpret_cast<char*>(&data_size), sizeof(data_size)) != sizeof(data_size)
+		|| tmp_f->Write(data.getDataPtr(), static_cast<_u32>(data.getDataSize())) != data.getDataSize()
+		|| !tmp_f->Sync())
+	{
+		Server->Log("Error writing directory metadata index \"" + tmp_fn + "\". " + os_last_error_str(), LL_WARNING);
+		tmp_f.reset();
+		Server->deleteFile(os_file_prefix(tmp_fn));
+		return false;
+	}
+
+	tmp_f.reset();
+
+	if (!os_rename_file(os_file_prefix(tmp_fn), os_file_prefix(index_fn)))
+	{
+		Server->Log("Error renaming directory metadata index to \"" + index_fn + "\". " + os_last_error_str(), LL_WARNING);
+		Server->deleteFile(os_file_prefix(tmp_fn));
+		return false;
+	}
+
+	return true;
+}
+
+void DirMetadataIndex::add(const std::string& rel_fn, const FileMetadata& metadata)
+{
+	entries[rel_fn] = metadata;
+}
+
+bool DirMetadataIndex::get(const std::string& rel_fn, FileMetadata& metadata) const
+{
+	std::map<std::string, FileMetadata>::const_iterator it = entries.find(rel_fn);
+	if (it == entries.end())
+	{
+		return false;
+	}
+
+	metadata = it->second;
+	return true;
+}
+
+size_t DirMetadataIndex::size() const
+{
+	return entries.size();
+}
+
+bool DirMetadataIndex::readMetadata(const std::string& metadata_dir, const std::string& rel_fn, FileMetadata& metadata) const
+{
+	if (get(rel_fn, metadata))
+	{
+		return true;
+	}
+
+	return read_metadata(metadata_dir + os_file_sep() + rel_fn, metadata);
+}
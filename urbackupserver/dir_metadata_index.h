@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../urbackupcommon/file_metadata.h"
+#include <string>
+#include <map>
+
+const char dir_metadata_index_fn[] = ".dir_metadata_index";
+
+/**
+* Metadata of all entries of one directory in the .hashes tree of a
+* finished file backup, stored in a single file in that directory.
+* Listing a directory then reads one file instead of opening the
+* metadata file of every entry. Entries are keyed by their metadata file
+* name relative to the directory (e.g. "file" or "dir/.dir_metadata").
+* The index records the resolved path of the directory it was written
+* for. Directories in the directory pool are shared by the backups
+* linking to them and keep their index, while an index copied into a
+* new backup by a file system snapshot is not used and gets replaced.
+*/
+class DirMetadataIndex
+{
+public:
+	bool read(const std::string& metadata_dir);
+	bool write(const std::string& metadata_dir) const;
+
+	void add(const std::string& rel_fn, const FileMetadata& metadata);
+	bool get(const std::string& rel_fn, FileMetadata& metadata) const;
+
+	size_t size() const;
+
+	//Reads metadata from the index, falling back to the metadata file
+	bool readMetadata(const std::string& metadata_dir, const std::string& rel_fn, FileMetadata& metadata) const;
+
+private:
+	std::map<std::string, FileMetadata> entries;
+};
@@ -56,6 +56,7 @@ extern IServer* Server;
 #include "../luaplugin/ILuaInterpreter.h"
 
 #include "database.h"
+#include "files_db_shards.h"
 #include "actions.h"
 #include "serverinterface/actions.h"
 #include "serverinterface/helper.h"
@@ -80,7 +81,10 @@ SStartupStatus startup_status;
 #include "apps/export_auth_log.h"
 #include "apps/skiphash_copy.h"
 #include "apps/patch.h"
+#include "apps/benchmark.h"
+#include "BackupScheduler.h"
 #include "create_files_index.h"
+#include "LMDBFileIndex.h"
 #include "server_dir_links.h"
 #include "server_channel.h"
 #include "DataplanDb.h"
@@ -242,6 +246,12 @@ void open_server_database(bool init_db)
 		exit(1);
 	}
 
+	if (!open_files_db_shards(params))
+	{
+		Server->Log("Couldn't open files database shards. Exiting.", LL_ERROR);
+		exit(1);
+	}
+
 	if (!sqlite_mmap_small.empty())
 	{
 		params["mmap_size"] = sqlite_mmap_small;
@@ -336,12 +346,19 @@ void start_wal_checkpoint_threads()
 		"urbackup" + os_file_sep() + "backup_server_files.db", URBACKUPDB_SERVER_FILES);
 	Server->createThread(wal_checkpoint_thread, "files checkpoint");
 
+	for (size_t i = 1; i < files_db_shard_count(); ++i)
+	{
+		wal_checkpoint_thread = new WalCheckpointThread(100 * 1024 * 1024, 1000 * 1024 * 1024,
+			"urbackup" + os_file_sep() + files_db_shard_filename(i), files_db_shard_dbid(i));
+		Server->createThread(wal_checkpoint_thread, "files checkpoint "+convert(i));
+	}
+
 	wal_checkpoint_thread = new WalCheckpointThread(10 * 1024 * 1024, 100 * 1024 * 1024,
 		"urbackup" + os_file_sep() + "backup_server.db", URBACKUPDB_SERVER, "main");
 	Server->createThread(wal_checkpoint_thread, "main checkpoint");
 
 	wal_checkpoint_thread = new WalCheckpointThread(10 * 1024 * 1024, 100 * 1024 * 1024,
-		"urbackup" + os_file_sep() + "backup_server_settings.db", URBACKUPDB_SERVER);
+		"urbackup" + os_file_sep() + "backup_server_settings.db", URBACKUPDB_SERVER, "settings_db");
 	Server->createThread(wal_checkpoint_thread, "settings checkpoint");
 
 	wal_checkpoint_thread = new WalCheckpointThread(10 * 1024 * 1024, 100 * 1024 * 1024,
@@ -453,6 +470,7 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	ServerLogger::init_mutex();
 	init_dir_link_mutex();
 	WalCheckpointThread::init_mutex();
+	LMDBFileIndex::initMetrics();
 
 	std::string app=Server->getServerParameter("app", "");
 
@@ -504,6 +522,10 @@ DLLEXPORT void LoadActions(IServer* pServer)
 		{
 			rc = patch_hash();
 		}
+		else if (app == "benchmark")
+		{
+			rc = benchmark_data_path();
+		}
 		else if (app == "hash")
 		{
 			std::auto_ptr<IFsFile> f(Server->openFile(Server->getServerParameter("hash_file"), MODE_READ_SEQUENTIAL));
@@ -520,7 +542,7 @@ DLLEXPORT void LoadActions(IServer* pServer)
 		else
 		{
 			rc=100;
-			Server->Log("App not found. Available apps: cleanup, remove_unknown, cleanup_database, repair_database, defrag_database, export_auth_log, check_fileindex, skiphash_copy, md5sum_check, hash");
+			Server->Log("App not found. Available apps: cleanup, remove_unknown, cleanup_database, repair_database, defrag_database, export_auth_log, check_fileindex, skiphash_copy, md5sum_check, hash, benchmark");
 		}
 		exit(rc);
 	}
@@ -638,6 +660,7 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	ServerStatus::init_mutex();
 	ServerSettings::init_mutex();
 	ClientMain::init_mutex();
+	BackupScheduler::init_mutex();
 	DataplanDb::init();
 	init_log_report();
 
@@ -805,6 +828,11 @@ DLLEXPORT void LoadActions(IServer* pServer)
 		ADD_ACTION(shutdown);
 	}
 
+	if(Server->getServerParameter("enable_metrics")=="true")
+	{
+		ADD_ACTION(metrics);
+	}
+
 	replay_directory_link_journal();
 
 	Server->Log("Started UrBackup...", LL_INFO);
@@ -945,11 +973,16 @@ DLLEXPORT void UnloadActions(void)
 	if(shutdown_ok)
 	{
 		ClientMain::destroy_mutex();
+		BackupScheduler::destroy_mutex();
 	}
 
 	std::vector<DATABASE_ID> db_ids;
 	db_ids.push_back(URBACKUPDB_SERVER);
 	db_ids.push_back(URBACKUPDB_SERVER_FILES);
+	for (size_t i = 1; i < files_db_shard_count(); ++i)
+	{
+		db_ids.push_back(files_db_shard_dbid(i));
+	}
 	db_ids.push_back(URBACKUPDB_SERVER_LINKS);
 	db_ids.push_back(URBACKUPDB_SERVER_LINK_JOURNAL);
 
@@ -0,0 +1,168 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "files_db_shards.h"
+#include "database.h"
+#include "../Interface/Server.h"
+#include "../Interface/Database.h"
+#include "../stringtools.h"
+#include "../urbackupcommon/os_functions.h"
+#include <algorithm>
+
+namespace
+{
+	size_t shard_count = 1;
+
+	const size_t sqlite_data_allocation_chunk_size = 50 * 1024 * 1024; //50MB
+
+	bool create_shard_tables(IDatabase* db, size_t shard)
+	{
+		db_results res = db->Read("SELECT name FROM sqlite_master WHERE type='table' AND name='files'");
+		if (!res.empty())
+		{
+			return true;
+		}
+
+		Server->Log("Creating files database shard " + convert(shard) + "...", LL_INFO);
+
+		DBScopedWriteTransaction trans(db);
+
+		//AUTOINCREMENT so that ids stay within the range of the shard
+		//even if all entries are deleted
+		if (!db->Write("CREATE TABLE files ("
+			"id INTEGER PRIMARY KEY AUTOINCREMENT,"
+			"backupid INTEGER,"
+			"fullpath TEXT,"
+			"shahash BLOB,"
+			"filesize INTEGER,"
+			"created INTEGER DEFAULT (CAST(strftime('%s','now') as INTEGER)),"
+			"rsize INTEGER, clientid INTEGER, incremental INTEGER, hashpath TEXT, next_entry INTEGER, prev_entry INTEGER, pointed_to INTEGER)"))
+		{
+			return false;
+		}
+
+		if (!db->Write("CREATE INDEX files_backupid ON files (backupid)"))
+		{
+			return false;
+		}
+
+		if (!db->Write("INSERT INTO sqlite_sequence (name, seq) VALUES ('files', "
+			+ convert(static_cast<int64>(shard) << files_db_shard_id_bits) + ")"))
+		{
+			return false;
+		}
+
+		return true;
+	}
+}
+
+bool open_files_db_shards(const str_map& params)
+{
+	size_t n = static_cast<size_t>((std::max)(1, watoi(Server->getServerParameter("files_db_shards", "1"))));
+
+	//Shards cannot be removed once they exist
+	while (n < files_db_max_shards
+		&& FileExists("urbackup/" + files_db_shard_filename(n)))
+	{
+		++n;
+	}
+
+	if (n > files_db_max_shards)
+	{
+		n = files_db_max_shards;
+	}
+
+	for (size_t i = 1; i < n; ++i)
+	{
+		std::string fn = "urbackup/" + files_db_shard_filename(i);
+		DATABASE_ID dbid = files_db_shard_dbid(i);
+
+		if (!Server->openDatabase(fn, dbid, params))
+		{
+			Server->Log("Couldn't open Database " + files_db_shard_filename(i) + ". Expecting database at \"" +
+				Server->getServerWorkingDir() + os_file_sep() + "urbackup" + os_file_sep() + files_db_shard_filename(i) + "\"", LL_ERROR);
+			return false;
+		}
+
+		Server->setDatabaseAllocationChunkSize(dbid, sqlite_data_allocation_chunk_size);
+
+		IDatabase* db = Server->getDatabase(Server->getThreadID(), dbid);
+		if (db == NULL)
+		{
+			Server->Log("Couldn't open files database shard " + convert(i), LL_ERROR);
+			return false;
+		}
+
+		db->Write("PRAGMA journal_mode=WAL");
+
+		if (!create_shard_tables(db, i))
+		{
+			Server->Log("Error creating tables in files database shard " + convert(i), LL_ERROR);
+			return false;
+		}
+	}
+
+	shard_count = n;
+
+	if (shard_count > 1)
+	{
+		Server->Log("Using " + convert(shard_count) + " files database shards", LL_INFO);
+	}
+
+	return true;
+}
+
+size_t files_db_shard_count()
+{
+	return shard_count;
+}
+
+DATABASE_ID files_db_shard_dbid(size_t shard)
+{
+	if (shard == 0)
+	{
+		return URBACKUPDB_SERVER_FILES;
+	}
+
+	return URBACKUPDB_SERVER_FILES_SHARD_BASE + static_cast<DATABASE_ID>(shard);
+}
+
+std::string files_db_shard_filename(size_t shard)
+{
+	if (shard == 0)
+	{
+		return "backup_server_files.db";
+	}
+
+	return "backup_server_files_shard" + convert(shard) + ".db";
+}
+
+size_t files_db_shard_for_client(int clientid)
+{
+	return static_cast<size_t>(clientid) % shard_count;
+}
+
+size_t files_db_shard_for_entry(int64 entryid)
+{
+	size_t shard = static_cast<size_t>(entryid >> files_db_shard_id_bits);
+	if (shard >= shard_count)
+	{
+		return 0;
+	}
+	return shard;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include <string>
+
+/**
+* Optional sharding of the files table. Shard 0 is backup_server_files.db,
+* the other shards are backup_server_files_shard<n>.db. New file entries
+* are stored in the shard of their client. Each shard allocates entry ids
+* from its own range (shard<<files_db_shard_id_bits), so the shard holding
+* an entry can be derived from its id. Entries created before sharding was
+* enabled stay in shard 0.
+*/
+
+const int files_db_shard_id_bits = 48;
+const size_t files_db_max_shards = 64;
+
+bool open_files_db_shards(const str_map& params);
+
+size_t files_db_shard_count();
+
+DATABASE_ID files_db_shard_dbid(size_t shard);
+
+std::string files_db_shard_filename(size_t shard);
+
+size_t files_db_shard_for_client(int clientid);
+
+size_t files_db_shard_for_entry(int64 entryid);
@@ -32,6 +32,7 @@
 #include "dao/ServerBackupDao.h"
 #include "dao/ServerCleanupDao.h"
 #include "server.h"
+#include "dir_metadata_index.h"
 
 extern IFileServ* fileserv;
 
@@ -349,6 +350,9 @@ namespace
 
 			bool ret=true;
 
+			DirMetadataIndex metadata_index;
+			metadata_index.read(hashfoldername);
+
 			for(size_t i=0;i<files.size();++i)
 			{
 				SFile file=files[i];
@@ -388,11 +392,13 @@ namespace
 				}
 				
 				std::string metadatasource;
+				std::string metadata_rel_fn = escape_metadata_fn(file.name);
 				bool recurse_dir = false;
 				if(file.isdir && !file.issym
 					&& os_directory_exists(os_file_prefix(metadataname)) )
 				{
 					metadatasource = metadataname + os_file_sep()+metadata_dir_fn;
+					metadata_rel_fn += os_file_sep()+metadata_dir_fn;
 					single_file = false;
 					recurse_dir = true;
 				}
@@ -404,7 +410,7 @@ namespace
 				bool has_metadata = false;
 
 				FileMetadata metadata;
-				if(!read_metadata(metadatasource, metadata))
+				if(!metadata_index.readMetadata(hashfoldername, metadata_rel_fn, metadata))
 				{
 					ServerLogger::Log(log_id, "Cannot read file metadata of file "+filename+" from "+ metadatasource +". Cannot start restore.", LL_ERROR);
 					return false;
@@ -40,6 +40,7 @@
 
 const int max_offline=5;
 
+IPipeThrottler *BackupServer::global_throttler=NULL;
 IPipeThrottler *BackupServer::global_internet_throttler=NULL;
 IPipeThrottler *BackupServer::global_local_throttler=NULL;
 IMutex *BackupServer::throttle_mutex=NULL;
@@ -630,19 +631,15 @@ size_t BackupServer::throttleSpeedToBps(int speed_bps, bool & percent_max)
 
 IPipeThrottler *BackupServer::getGlobalInternetThrottler(int speed_bps)
 {
-	IScopedLock lock(throttle_mutex);
+	IPipeThrottler* parent_throttler = getGlobalThrottler();
 
-	if(global_internet_throttler==NULL 
-		&& (speed_bps == 0
-			|| speed_bps == -1) )
-	{
-		return NULL;
-	}
+	IScopedLock lock(throttle_mutex);
 
 	if(global_internet_throttler==NULL)
 	{
 		global_internet_throttler=Server->createPipeThrottler(
 			new ThrottleUpdater(-1, ThrottleScope_GlobalInternet));
+		global_internet_throttler->setParent(parent_throttler);
 	}
 	else
 	{
@@ -656,19 +653,15 @@ IPipeThrottler *BackupServer::getGlobalInternetThrottler(int speed_bps)
 
 IPipeThrottler *BackupServer::getGlobalLocalThrottler(int speed_bps)
 {
-	IScopedLock lock(throttle_mutex);
+	IPipeThrottler* parent_throttler = getGlobalThrottler();
 
-	if (global_local_throttler == NULL
-		&& (speed_bps == 0
-			|| speed_bps == -1) )
-	{
-		return NULL;
-	}
+	IScopedLock lock(throttle_mutex);
 
 	if(global_local_throttler==NULL)
 	{
 		global_local_throttler=Server->createPipeThrottler(
 			new ThrottleUpdater(-1, ThrottleScope_GlobalLocal));
+		global_local_throttler->setParent(parent_throttler);
 	}
 	else
 	{
@@ -680,6 +673,19 @@ IPipeThrottler *BackupServer::getGlobalLocalThrottler(int speed_bps)
 	return global_local_throttler;
 }
 
+IPipeThrottler *BackupServer::getGlobalThrottler()
+{
+	IScopedLock lock(throttle_mutex);
+
+	if(global_throttler==NULL)
+	{
+		//There is no limit across network classes. It measures the total rate
+		//and is the root the network class throttlers share.
+		global_throttler=Server->createPipeThrottler(0, false);
+	}
+	return global_throttler;
+}
+
 void BackupServer::cleanupThrottlers(void)
 {
 	if(global_internet_throttler!=NULL)
@@ -690,6 +696,10 @@ void BackupServer::cleanupThrottlers(void)
 	{
 		Server->destroy(global_local_throttler);
 	}
+	if(global_throttler!=NULL)
+	{
+		Server->destroy(global_throttler);
+	}
 }
 
 bool BackupServer::isFileSnapshotsEnabled()
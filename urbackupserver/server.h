@@ -29,6 +29,7 @@ public:
 	void operator()(void);
 
 	static size_t throttleSpeedToBps(int speed_bps, bool& percent_max);
+	static IPipeThrottler *getGlobalThrottler();
 	static IPipeThrottler *getGlobalInternetThrottler(int speed_bps);
 	static IPipeThrottler *getGlobalLocalThrottler(int speed_bps);
 
@@ -86,6 +87,7 @@ private:
 
 	IPipe *exitpipe;
 
+	static IPipeThrottler *global_throttler;
 	static IPipeThrottler *global_internet_throttler;
 	static IPipeThrottler *global_local_throttler;
 	static IMutex *throttle_mutex;
@@ -47,6 +47,19 @@ extern IFileServ* fileserv;
 
 namespace
 {
+	//Size of the image data covered by one entry in the image .hash file
+	const int64 c_image_hash_blocksize = 512 * 1024;
+
+	bool deltaBlockUnchanged(const std::string& delta_bitmap, uint64 pos)
+	{
+		uint64 block = pos / c_image_hash_blocksize;
+		if (block / 8 >= delta_bitmap.size())
+		{
+			return false;
+		}
+		return (delta_bitmap[block / 8] & (1 << (block % 8))) != 0;
+	}
+
 	IDatabase* getDatabase(void)
 	{
 		Helper helper(Server->getThreadID(), NULL, NULL);
@@ -195,7 +208,7 @@ void ServerChannelThread::operator()(void)
 					input=np;
 				}
 				curr_ident = client_main->getIdentity();
-				tcpstack.Send(input, curr_ident +"1CHANNEL capa="+convert(constructCapabilities())+"&token="+server_token+"&restore_version=1&virtual_client="+EscapeParamString(virtual_client));
+				tcpstack.Send(input, curr_ident +"1CHANNEL capa="+convert(constructCapabilities())+"&token="+server_token+"&restore_version=2&virtual_client="+EscapeParamString(virtual_client));
 
 				lasttime=Server->getTimeMS();
 				lastpingtime=lasttime;
@@ -936,9 +949,20 @@ void ServerChannelThread::DOWNLOAD_IMAGE(str_map& params)
 		}
 
 		int img_version=watoi(res[0]["version"]);
-		if(params["mbr"]=="true")
+		bool send_hashes = params["hashes"] == "1";
+		if(params["mbr"]=="true" || send_hashes)
 		{
-			std::auto_ptr<IFile> f(Server->openFile(os_file_prefix(res[0]["path"]+".mbr"), MODE_READ));
+			std::auto_ptr<IFile> f;
+			if (!send_hashes)
+			{
+				f.reset(Server->openFile(os_file_prefix(res[0]["path"] + ".mbr"), MODE_READ));
+			}
+			else if (img_version > 0
+				|| strlower(findextension(res[0]["path"])) == "raw")
+			{
+				f.reset(Server->openFile(os_file_prefix(res[0]["path"] + ".hash"), MODE_READ));
+			}
+
 			if(f.get()==NULL)
 			{
 				_i64 r=little_endian(-1);
@@ -983,6 +1007,14 @@ void ServerChannelThread::DOWNLOAD_IMAGE(str_map& params)
 		if(it1!=params.end())
 			offset=(uint64)os_atoi64(it1->second);
 
+		std::string delta_bitmap;
+		it1 = params.find("delta_bitmap");
+		if (it1 != params.end())
+		{
+			delta_bitmap = base64_decode_dash(it1->second);
+			Server->Log("Delta restore. Skipping blocks unchanged on the restore target.", LL_DEBUG);
+		}
+
 		ServerStatus::updateActive();
 
 		lasttime=Server->getTimeMS();
@@ -1084,7 +1116,10 @@ void ServerChannelThread::DOWNLOAD_IMAGE(str_map& params)
 			bool is_ok=true;
 			do
 			{
-				if(vhdfile->has_sector())
+				bool delta_unchanged = !delta_bitmap.empty()
+					&& deltaBlockUnchanged(delta_bitmap, currpos);
+
+				if(!delta_unchanged && vhdfile->has_sector())
 				{
 					is_ok=vhdfile->Read(buffer, 4096, read);
 					if(read<4096)
@@ -1113,6 +1148,13 @@ void ServerChannelThread::DOWNLOAD_IMAGE(str_map& params)
 					used_transferred_bytes += read;
 					lasttime=Server->getTimeMS();
 				}
+				else if (delta_unchanged)
+				{
+					//Block already has this content on the restore target. Do not
+					//send a keep-alive here, as the client writes it to the target
+					read = static_cast<size_t>(c_image_hash_blocksize - currpos%c_image_hash_blocksize);
+					vhdfile->Seek(skip + currpos + read);
+				}
 				else
 				{
 					if(Server->getTimeMS()-lasttime>30000)
@@ -24,6 +24,7 @@
 #include "../Interface/ThreadPool.h"
 #include "../Interface/DatabaseCursor.h"
 #include "database.h"
+#include "files_db_shards.h"
 #include "../stringtools.h"
 #include "server_settings.h"
 #include "../urbackupcommon/os_functions.h"
@@ -723,30 +724,42 @@ void ServerCleanupThread::do_remove_unknown(void)
 	IDatabaseCursor* cur = q_backup_ids->Cursor();
 	db_single_result res;
 
-	IDatabase* files_db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
-
-	files_db->Write("CREATE TEMPORARY TABLE backups (id INTEGER PRIMARY KEY)");
-
-	IQuery* q_insert = files_db->Prepare("INSERT INTO backups (id) VALUES (?)", false);
+	std::vector<IDatabase*> files_dbs;
+	std::vector<IQuery*> q_inserts;
+	for (size_t shard = 0; shard < files_db_shard_count(); ++shard)
+	{
+		IDatabase* files_db = filesdao->forShard(shard).getDatabase();
+		files_db->Write("CREATE TEMPORARY TABLE backups (id INTEGER PRIMARY KEY)");
+		files_dbs.push_back(files_db);
+		q_inserts.push_back(files_db->Prepare("INSERT INTO backups (id) VALUES (?)", false));
+	}
 
 	bool ok = true;
 	while (cur->next(res))
 	{
-		q_insert->Bind(res["id"]);
-		ok &= q_insert->Write();
-		q_insert->Reset();
+		for (size_t i = 0; i < q_inserts.size(); ++i)
+		{
+			q_inserts[i]->Bind(res["id"]);
+			ok &= q_inserts[i]->Write();
+			q_inserts[i]->Reset();
+		}
 	}
 
 	db->destroyQuery(q_backup_ids);
-	files_db->destroyQuery(q_insert);
 
-	if (ok)
+	for (size_t shard = 0; shard < files_dbs.size(); ++shard)
 	{
-		filesdao->removeDanglingFiles();
-		Server->Log("Deleted " + convert(files_db->getLastChanges()) + " file entries", LL_INFO);
-	}
+		IDatabase* files_db = files_dbs[shard];
+		files_db->destroyQuery(q_inserts[shard]);
 
-	files_db->Write("DROP TABLE backups");
+		if (ok)
+		{
+			filesdao->forShard(shard).removeDanglingFiles();
+			Server->Log("Deleted " + convert(files_db->getLastChanges()) + " file entries", LL_INFO);
+		}
+
+		files_db->Write("DROP TABLE backups");
+	}
 
 	FileIndex::flush();
 }
@@ -1793,12 +1806,23 @@ bool ServerCleanupThread::backup_database(void)
 		copy_backup.push_back("backup_server_links.db");
 		copy_backup.push_back("backup_server_link_journal.db");
 
+		for (size_t i = 1; i < files_db_shard_count(); ++i)
+		{
+			copy_backup_ids.push_back(files_db_shard_dbid(i));
+			copy_backup.push_back(files_db_shard_filename(i));
+		}
+
 		copy_backup.push_back("backup_server.db-wal");
 		copy_backup.push_back("backup_server_settings.db-wal");
 		copy_backup.push_back("backup_server_files.db-wal");
 		copy_backup.push_back("backup_server_links.db-wal");
 		copy_backup.push_back("backup_server_link_journal.db-wal");
 
+		for (size_t i = 1; i < files_db_shard_count(); ++i)
+		{
+			copy_backup.push_back(files_db_shard_filename(i) + "-wal");
+		}
+
 
 		bool integrity_ok = true;
 		{
@@ -2473,17 +2497,33 @@ void ServerCleanupThread::cleanup_other()
 
 void ServerCleanupThread::removeFileBackupSql( int backupid )
 {
-	DBScopedSynchronous synchronous_files(filesdao->getDatabase());
-	filesdao->BeginWriteTransaction();
+	for (size_t shard = 0; shard < files_db_shard_count(); ++shard)
+	{
+		ServerFilesDao& shard_filesdao = filesdao->forShard(shard);
+
+		if (shard == 0
+			|| shard_filesdao.getBackupFileEntryId(backupid).exists)
+		{
+			removeFileBackupSql(shard_filesdao, backupid);
+		}
+	}
+
+	cleanupdao->removeFileBackup(backupid);
+}
+
+void ServerCleanupThread::removeFileBackupSql(ServerFilesDao& shard_filesdao, int backupid)
+{
+	DBScopedSynchronous synchronous_files(shard_filesdao.getDatabase());
+	shard_filesdao.BeginWriteTransaction();
 
 	BackupServerHash::SInMemCorrection correction;
 
-	ServerFilesDao::SBackupIdMinMax minmax = filesdao->getBackupIdMinMax(backupid);
+	ServerFilesDao::SBackupIdMinMax minmax = shard_filesdao.getBackupIdMinMax(backupid);
 
 	correction.max_correct = minmax.tmax;
 	correction.min_correct = minmax.tmin;
 
-	IQuery* q_iterate = filesdao->getDatabase()->Prepare("SELECT id, shahash, filesize, rsize, clientid, backupid, incremental, next_entry, prev_entry, pointed_to FROM files WHERE backupid=?", false);
+	IQuery* q_iterate = shard_filesdao.getDatabase()->Prepare("SELECT id, shahash, filesize, rsize, clientid, backupid, incremental, next_entry, prev_entry, pointed_to FROM files WHERE backupid=?", false);
 	q_iterate->Bind(backupid);
 	IDatabaseCursor* cursor = q_iterate->Cursor();
 
@@ -2550,36 +2590,34 @@ void ServerCleanupThread::removeFileBackupSql( int backupid )
 		BackupServerHash::deleteFileSQL(*filesdao, *fileindex.get(), res["shahash"].c_str(),
 			filesize, rsize, clientid, backupid, incremental, id, prev_entry, next_entry, pointed_to, false, false, false, true, &correction);
 	}
-	filesdao->getDatabase()->destroyQuery(q_iterate);
+	shard_filesdao.getDatabase()->destroyQuery(q_iterate);
 
 	for (std::map<int64, int64>::iterator it_next = correction.next_entries.begin();
 		 it_next != correction.next_entries.end(); ++it_next)
 	{
-		filesdao->setNextEntry(it_next->second, it_next->first);
+		filesdao->forEntry(it_next->first).setNextEntry(it_next->second, it_next->first);
 	}
 
 	for (std::map<int64, int64>::iterator it_prev = correction.prev_entries.begin();
 		 it_prev != correction.prev_entries.end(); ++it_prev)
 	{
-		filesdao->setPrevEntry(it_prev->second, it_prev->first);
+		filesdao->forEntry(it_prev->first).setPrevEntry(it_prev->second, it_prev->first);
 	}
 
 	for (std::map<int64, int>::iterator it_pointed_to = correction.pointed_to.begin();
 		 it_pointed_to != correction.pointed_to.end(); ++it_pointed_to)
 	{
-		filesdao->setPointedTo(it_pointed_to->second, it_pointed_to->first);
+		filesdao->forEntry(it_pointed_to->first).setPointedTo(it_pointed_to->second, it_pointed_to->first);
 	}
 
-	filesdao->deleteFiles(backupid);
+	shard_filesdao.deleteFiles(backupid);
 
 	if (modified_file_entry_index)
 	{
 		FileIndex::flush();
 	}
 
-	filesdao->endTransaction();
-
-	cleanupdao->removeFileBackup(backupid);
+	shard_filesdao.endTransaction();
 }
 
 bool ServerCleanupThread::backup_clientlists()
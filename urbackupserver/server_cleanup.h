@@ -159,6 +159,7 @@ private:
 	bool deleteFileBackup(const std::string &backupfolder, int clientid, int backupid, bool force_remove=false);
 
 	void removeFileBackupSql( int backupid );
+	void removeFileBackupSql(ServerFilesDao& shard_filesdao, int backupid);
 
 	void deletePendingClients(void);
 
@@ -70,7 +70,7 @@ public:
 		: client_main(client_main), collect_only(true), first_compaction(true), stop(false), continuous_path(continuous_path), continuous_hash_path(continuous_hash_path),
 		continuous_path_backup(continuous_path_backup),
 		tmpfile_path(tmpfile_path), use_tmpfiles(use_tmpfiles), clientid(clientid), clientname(clientname), backupid(backupid),
-		use_snapshots(use_snapshots), use_reflink(use_reflink), hashpipe_prepare(hashpipe_prepare), has_fullpath_entryid_mapping_table(false)
+		use_snapshots(use_snapshots), use_reflink(use_reflink), hashpipe_prepare(hashpipe_prepare), has_fullpath_entryid_mapping_table(false), path_lookup_filesdao(NULL)
 	{
 		mutex = Server->createMutex();
 		cond = Server->createCondition();
@@ -90,6 +90,7 @@ public:
 		server_settings.reset(new ServerSettings(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER)));
 		backupdao.reset(new ServerBackupDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER)));
 		filesdao.reset(new ServerFilesDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES)));
+		path_lookup_filesdao = &filesdao->forBackup(backupid, clientid);
 		fileindex.reset(create_lmdb_files_index());
 
 		hashed_transfer_full = true;
@@ -141,9 +142,9 @@ public:
 
 			if(!collect_only && !has_fullpath_entryid_mapping_table)
 			{
-				filesdao->createTemporaryPathLookupTable();
-				filesdao->populateTemporaryPathLookupTable(backupid);
-				filesdao->createTemporaryPathLookupIndex();
+				path_lookup_filesdao->createTemporaryPathLookupTable();
+				path_lookup_filesdao->populateTemporaryPathLookupTable(backupid);
+				path_lookup_filesdao->createTemporaryPathLookupIndex();
 
 				has_fullpath_entryid_mapping_table=true;
 			}
@@ -173,7 +174,7 @@ public:
 
 		if(has_fullpath_entryid_mapping_table)
 		{
-			filesdao->dropTemporaryPathLookupTable();
+			path_lookup_filesdao->dropTemporaryPathLookupTable();
 		}
 
 		delete this;
@@ -717,7 +718,7 @@ private:
 			fileclient_chunked.get(), continuous_path,
 			continuous_hash_path, continuous_path, std::string(), hashed_transfer_full,
 			false, clientid, clientname, std::string(), use_tmpfiles, tmpfile_path, server_token,
-			use_reflink, backupid, true, hashpipe_prepare, client_main, client_main->getProtocolVersions().file_protocol_version,
+			use_reflink, use_snapshots, backupid, true, hashpipe_prepare, client_main, client_main->getProtocolVersions().file_protocol_version,
 			0, logid, true, shares_without_snapshot, true, NULL, false));
 
 		server_download_ticket = Server->getThreadPool()->execute(server_download.get(), "backup download");
@@ -776,10 +777,10 @@ private:
 		}
 
 		{
-			ServerFilesDao::CondInt64 entryid = filesdao->lookupEntryIdByPath(getFullpath(change.fn1));
+			ServerFilesDao::CondInt64 entryid = path_lookup_filesdao->lookupEntryIdByPath(getFullpath(change.fn1));
 			if(entryid.exists)
 			{
-				ServerFilesDao::SFindFileEntry fentry = filesdao->getFileEntry(entryid.value);
+				ServerFilesDao::SFindFileEntry fentry = filesdao->forEntry(entryid.value).getFileEntry(entryid.value);
 				if(fentry.exists)
 				{
 					local_hash->deleteFileSQL(*filesdao, *fileindex, reinterpret_cast<const char*>(fentry.shahash.c_str()),
@@ -950,6 +951,7 @@ private:
 	bool has_fullpath_entryid_mapping_table;
 	std::auto_ptr<ServerBackupDao> backupdao;
 	std::auto_ptr<ServerFilesDao> filesdao;
+	ServerFilesDao* path_lookup_filesdao;
 	std::auto_ptr<FileIndex> fileindex;
 
 	logid_t logid;
@@ -39,6 +39,7 @@
 
 const size_t freespace_mod=50*1024*1024; //50 MB
 const size_t BUFFER_SIZE=64*1024; //64KB
+const int64 clone_range_align=4096; //File system block size required by FICLONERANGE
 
 IMutex * delete_mutex=NULL;
 
@@ -54,8 +55,8 @@ void destroy_mutex1(void)
 
 BackupServerHash::BackupServerHash(IPipe *pPipe, int pClientid, bool use_snapshots, bool use_reflink, bool use_tmpfiles, logid_t logid,
 	bool snapshot_file_inplace)
-	: use_snapshots(use_snapshots), use_reflink(use_reflink), use_tmpfiles(use_tmpfiles), filesdao(NULL), old_backupfolders_loaded(false),
-	  logid(logid), snapshot_file_inplace(snapshot_file_inplace)
+	: filesdao(NULL), use_snapshots(use_snapshots), use_reflink(use_reflink), use_tmpfiles(use_tmpfiles), has_range_clone(false),
+	  range_clone_supported(true), old_backupfolders_loaded(false), logid(logid), snapshot_file_inplace(snapshot_file_inplace)
 {
 	pipe=pPipe;
 	clientid=pClientid;
@@ -65,6 +66,9 @@ BackupServerHash::BackupServerHash(IPipe *pPipe, int pClientid, bool use_snapsho
 	has_error=false;
 	chunk_patcher.setCallback(this);
 	fileindex=NULL;
+	queue_size_metric=Server->getMetric("urbackup_hash_queue_items{stage=\"hash\"}",
+		"Number of files waiting in the server hash pipeline", EMetricType_Gauge);
+	last_queue_size=0;
 
 	if(use_reflink)
 		ServerLogger::Log(logid, "Reflink copying is enabled", LL_DEBUG);
@@ -104,21 +108,35 @@ void BackupServerHash::operator()(void)
 {
 	setupDatabase();
 
+	filesdao->setDelayIncomingStats(true);
+
 	while(true)
 	{
 		working=false;
 		std::string data;
 		size_t rc=pipe->Read(&data, static_cast<int>(60000) );
+
+		int64 queue_size=static_cast<int64>(pipe->getNumElements());
+		queue_size_metric->add(queue_size-last_queue_size);
+		last_queue_size=queue_size;
+
 		if(rc==0)
 		{
 			link_logcnt=0;
 			space_logcnt=0;
+			filesdao->flushIncomingStats();
 			continue;
 		}
+
+		if(filesdao->needIncomingStatsFlush())
+		{
+			filesdao->flushIncomingStats();
+		}
 		
 		working=true;
 		if(data=="exit")
 		{
+			queue_size_metric->add(-last_queue_size);
 			deinitDatabase();
 			Server->Log("server_hash Thread finished - normal");
 			Server->destroyDatabases(Server->getThreadID());
@@ -127,6 +145,7 @@ void BackupServerHash::operator()(void)
 		}
 		else if(data=="flush")
 		{
+			filesdao->flushIncomingStats();
 			continue;
 		}
 
@@ -280,8 +299,8 @@ void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex
 		assert(prev_entry_clientid == 0);
 		assert(prev_entry == 0);
 		assert(next_entry == 0);
-		filesdao.addIncomingFile(filesize, clientid, backupid, std::string(), ServerFilesDao::c_direction_incoming, incremental);
-		filesdao.addFileEntryExternal(backupid, fp, hash_path, shahash, filesize, rsize, clientid, incremental, next_entry, prev_entry, 0);
+		filesdao.addIncomingStat(filesize, clientid, backupid, std::string(), ServerFilesDao::c_direction_incoming, incremental);
+		filesdao.forClient(clientid).addFileEntryExternal(backupid, fp, hash_path, shahash, filesize, rsize, clientid, incremental, next_entry, prev_entry, 0);
 		return;
 	}
 
@@ -325,11 +344,11 @@ void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex
 		
 		if(prev_entry==0)
 		{
-			filesdao.addIncomingFile(filesize, clientid, backupid, clients, ServerFilesDao::c_direction_incoming, incremental);
+			filesdao.addIncomingStat(filesize, clientid, backupid, clients, ServerFilesDao::c_direction_incoming, incremental);
 		}
 		else
 		{
-			ServerFilesDao::SFindFileEntry fentry = filesdao.getFileEntry(prev_entry);
+			ServerFilesDao::SFindFileEntry fentry = filesdao.forEntry(prev_entry).getFileEntry(prev_entry);
 			
 			if(fentry.exists)
 			{
@@ -352,24 +371,24 @@ void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex
 		//and pointed_to does not need to be updated
 		if(prev_entry!=0)
 		{
-			ServerFilesDao::CondInt64 fentry = filesdao.getPointedTo(prev_entry);
+			ServerFilesDao::CondInt64 fentry = filesdao.forEntry(prev_entry).getPointedTo(prev_entry);
 
 			if(fentry.exists && fentry.value!=0)
 			{
-				filesdao.setPointedTo(0, prev_entry);
+				filesdao.forEntry(prev_entry).setPointedTo(0, prev_entry);
 			}
 			else
 			{
 				int64 client_entryid = fileindex.get_with_cache_exact(FileIndex::SIndexKey(shahash.c_str(), filesize, clientid));
 				if(client_entryid!=0)
 				{
-					filesdao.setPointedTo(0, client_entryid);
+					filesdao.forEntry(client_entryid).setPointedTo(0, client_entryid);
 				}
 			}
 		}
 	}
 
-	int64 entryid = filesdao.addFileEntryExternal(backupid, fp, hash_path, shahash, filesize, rsize, clientid, incremental, next_entry, prev_entry, (new_for_client || update_fileindex)?1:0);
+	int64 entryid = filesdao.forClient(clientid).addFileEntryExternal(backupid, fp, hash_path, shahash, filesize, rsize, clientid, incremental, next_entry, prev_entry, (new_for_client || update_fileindex)?1:0);
 
 	if(new_for_client || update_fileindex)
 	{
@@ -382,7 +401,7 @@ void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex
 
 void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int64 id)
 {
-	ServerFilesDao::SFindFileEntry entry = filesdao.getFileEntry(id);
+	ServerFilesDao::SFindFileEntry entry = filesdao.forEntry(id).getFileEntry(id);
 	
 	if(entry.exists)
 	{
@@ -397,7 +416,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 {
 	if(use_transaction)
 	{
-		filesdao.BeginWriteTransaction();
+		filesdao.forEntry(id).BeginWriteTransaction();
 	}
 
 	if(prev_id==0 && next_id==0)
@@ -411,18 +430,18 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 					+ " has pointed_to!=0 but should be zero. The file entry index may be damaged.", LL_WARNING));
 			}
 
-			filesdao.addIncomingFile(filesize, clientid, backupid, convert(clientid),
+			filesdao.addIncomingStat(filesize, clientid, backupid, convert(clientid),
 				with_backupstat ? ServerFilesDao::c_direction_outgoing : ServerFilesDao::c_direction_outgoing_nobackupstat,
 				incremental);
 
 			if (del_entry)
 			{
-				filesdao.delFileEntry(id);
+				filesdao.forEntry(id).delFileEntry(id);
 			}
 
 			if (use_transaction)
 			{
-				filesdao.endTransaction();
+				filesdao.forEntry(id).endTransaction();
 			}
 			return;
 		}
@@ -489,7 +508,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 		}
 		
 
-		filesdao.addIncomingFile(filesize, clientid, backupid, clients,
+		filesdao.addIncomingStat(filesize, clientid, backupid, clients,
 			with_backupstat? ServerFilesDao::c_direction_outgoing : ServerFilesDao::c_direction_outgoing_nobackupstat,
 			incremental);
 
@@ -516,7 +535,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 			}
 			else
 			{
-				filesdao.setPointedTo(1, next_id);
+				filesdao.forEntry(next_id).setPointedTo(1, next_id);
 			}
 
 			fileindex.put_delayed(FileIndex::SIndexKey(pHash, filesize, clientid), next_id);
@@ -537,7 +556,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 			}
 			else
 			{
-				filesdao.setPointedTo(1, prev_id);
+				filesdao.forEntry(prev_id).setPointedTo(1, prev_id);
 			}
 
 			fileindex.put_delayed(FileIndex::SIndexKey(pHash, filesize, clientid), prev_id);
@@ -563,7 +582,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 		}
 		else
 		{
-			filesdao.setPrevEntry(prev_id, next_id);
+			filesdao.forEntry(next_id).setPrevEntry(prev_id, next_id);
 		}
 	}
 
@@ -576,18 +595,18 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 		}
 		else
 		{
-			filesdao.setNextEntry(next_id, prev_id);
+			filesdao.forEntry(prev_id).setNextEntry(next_id, prev_id);
 		}
 	}
 
 	if(del_entry)
 	{
-		filesdao.delFileEntry(id);
+		filesdao.forEntry(id).delFileEntry(id);
 	}
 
 	if(use_transaction)
 	{
-		filesdao.endTransaction();
+		filesdao.forEntry(id).endTransaction();
 	}
 }
 
@@ -1062,6 +1081,14 @@ bool BackupServerHash::freeSpace(int64 fs, const std::string &fp)
 	return b;
 }
 
+void BackupServerHash::findKnownFileHashes(std::map<std::pair<std::string, _i64>, bool>& hashes)
+{
+	for(std::map<std::pair<std::string, _i64>, bool>::iterator it=hashes.begin();it!=hashes.end();++it)
+	{
+		it->second = fileindex->get_with_cache_prefer_client(FileIndex::SIndexKey(it->first.first.c_str(), it->first.second, clientid))!=0;
+	}
+}
+
 ServerFilesDao::SFindFileEntry BackupServerHash::findFileHash(const std::string &pHash, _i64 filesize, int clientid, SFindState& state)
 {
 	int64 entryid;
@@ -1173,7 +1200,7 @@ ServerFilesDao::SFindFileEntry BackupServerHash::findFileHash(const std::string
 		return ret;
 	}
 
-	state.prev = filesdao->getFileEntry(entryid);
+	state.prev = filesdao->forEntry(entryid).getFileEntry(entryid);
 
 	if(!state.prev.exists)
 	{
@@ -1396,6 +1423,28 @@ bool BackupServerHash::handle_not_enough_space(const std::string &path)
 
 void BackupServerHash::next_chunk_patcher_bytes(const char *buf, size_t bsize, bool changed, bool* is_sparse)
 {
+	if(has_range_clone && buf==NULL && !changed
+		&& (is_sparse==NULL || !*is_sparse) )
+	{
+		//Unchanged range. Shared with the source file instead of writing it
+		if(clone_range_size>0
+			&& clone_range_start+clone_range_size!=chunk_patch_pos)
+		{
+			if(!flushCloneRange())
+			{
+				chunk_patcher_has_error = true;
+			}
+		}
+
+		if(clone_range_size==0)
+		{
+			clone_range_start = chunk_patch_pos;
+		}
+		clone_range_size+=bsize;
+		chunk_patch_pos+=bsize;
+		return;
+	}
+
 	if(!has_reflink || changed )
 	{
 		if (buf != NULL) //buf is NULL for sparse extents
@@ -1430,6 +1479,91 @@ void BackupServerHash::next_chunk_patcher_bytes(const char *buf, size_t bsize, b
 	{
 		cow_filesize+=bsize;
 	}
+	else if(has_range_clone && buf!=NULL)
+	{
+		cow_filesize+=bsize;
+	}
+}
+
+bool BackupServerHash::flushCloneRange()
+{
+	if(clone_range_size==0)
+	{
+		return true;
+	}
+
+	int64 start = clone_range_start;
+	int64 size = clone_range_size;
+	clone_range_size = 0;
+
+	if(!range_clone_supported)
+	{
+		return copyUnchangedRange(start, size);
+	}
+
+	if(os_clone_file_range(chunk_source_fn, start, chunk_output_fn, start, size))
+	{
+		return true;
+	}
+
+	//Unaligned ranges can only be cloned at the end of the file. Clone the
+	//aligned part and copy only the unaligned head and tail
+	int64 aligned_start = ((start + clone_range_align - 1)/clone_range_align)*clone_range_align;
+	int64 aligned_end = ((start + size)/clone_range_align)*clone_range_align;
+
+	if(aligned_start!=start
+		|| aligned_end!=start+size)
+	{
+		if(aligned_end<=aligned_start)
+		{
+			return copyUnchangedRange(start, size);
+		}
+
+		if(os_clone_file_range(chunk_source_fn, aligned_start, chunk_output_fn, aligned_start, aligned_end-aligned_start))
+		{
+			return copyUnchangedRange(start, aligned_start-start)
+				&& copyUnchangedRange(aligned_end, start+size-aligned_end);
+		}
+	}
+
+	ServerLogger::Log(logid, "Cloning file ranges from \"" + chunk_source_fn->getFilename() + "\" is not supported. Copying unchanged data instead. "+os_last_error_str(), LL_INFO);
+	range_clone_supported = false;
+
+	return copyUnchangedRange(start, size);
+}
+
+bool BackupServerHash::copyUnchangedRange(int64 start, int64 size)
+{
+	std::vector<char> buf;
+	buf.resize(BUFFER_SIZE);
+	for(int64 copied=0;copied<size;)
+	{
+		_u32 tr = static_cast<_u32>((std::min)(size-copied, static_cast<int64>(BUFFER_SIZE)));
+		bool has_read_error = false;
+		_u32 r = chunk_source_fn->Read(start+copied, buf.data(), tr, &has_read_error);
+		if(r!=tr || has_read_error)
+		{
+			ServerLogger::Log(logid, "Error reading unchanged data from \"" + chunk_source_fn->getFilename() + "\" at offset "+convert(start+copied)+". "+os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		if (!chunk_output_fn->Seek(start+copied))
+		{
+			ServerLogger::Log(logid, "Error seeking to offset "+convert(start+copied)+" in \"" + chunk_output_fn->getFilename() + "\" -4", LL_ERROR);
+			return false;
+		}
+
+		if(!writeRepeatFreeSpace(chunk_output_fn, buf.data(), r, this))
+		{
+			ServerLogger::Log(logid, "Error writing to file \"" + chunk_output_fn->getFilename() + "\" -4. "+os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		copied+=r;
+		cow_filesize+=r;
+	}
+
+	return true;
 }
 
 void BackupServerHash::next_sparse_extent_bytes(const char * buf, size_t bsize)
@@ -1469,7 +1603,7 @@ bool BackupServerHash::patchFile(IFile *patch, const std::string &source, const
 		}
 		ObjectScope dst_s(chunk_output_fn);
 
-		IFile *f_source=openFileRetry(source, MODE_READ, errstr);
+		IFsFile *f_source=openFileRetry(source, MODE_READ, errstr);
 		if (f_source == NULL)
 		{
 			ServerLogger::Log(logid, "Error opening patch source file \"" + source + "\". "+errstr, LL_ERROR);
@@ -1477,12 +1611,23 @@ bool BackupServerHash::patchFile(IFile *patch, const std::string &source, const
 		}
 		ObjectScope f_source_s(f_source);
 
+		chunk_source_fn = f_source;
 		chunk_patch_pos=0;
 		enabled_sparse = false;
 		chunk_patcher_has_error = false;
-		chunk_patcher.setRequireUnchanged(!has_reflink);
+		//Without reflinking the whole file only changed data is written and unchanged ranges are cloned
+		has_range_clone = !has_reflink && range_clone_supported;
+		clone_range_size = 0;
+		chunk_patcher.setRequireUnchanged(!has_reflink && !has_range_clone);
+		chunk_patcher.setUnchangedAlign(has_range_clone ? clone_range_align : 0);
 		bool b=chunk_patcher.ApplyPatch(f_source, patch, extent_iterator);
 
+		if (!flushCloneRange())
+		{
+			chunk_patcher_has_error = true;
+		}
+		has_range_clone = false;
+
 		if (!b)
 		{
 			ServerLogger::Log(logid, "Error applying patch to \"" + dest + "\" with source \"" + source + "\"", LL_ERROR);
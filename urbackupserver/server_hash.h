@@ -67,6 +67,8 @@ public:
 		bool copy_from_hardlink_if_failed, bool &tries_once, std::string &ff_last, bool &hardlink_limit, bool &copied_file, int64& entryid, int& entryclientid, int64& rsize, int64& next_entry,
 		FileMetadata& metadata, bool datch_dbs, ExtentIterator* extent_iterator);
 
+	void findKnownFileHashes(std::map<std::pair<std::string, _i64>, bool>& hashes);
+
 	void addFileSQL(int backupid, int clientid, int incremental, const std::string &fp, const std::string &hash_path,
 		const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex);
 
@@ -132,6 +134,9 @@ private:
 
 	bool punchHoleOrZero(IFile *tf, int64 offset, int64 size);
 
+	bool flushCloneRange();
+	bool copyUnchangedRange(int64 start, int64 size);
+
 	std::map<std::pair<std::string, _i64>, std::vector<STmpFile> > files_tmp;
 
 	ServerFilesDao* filesdao;
@@ -149,7 +154,11 @@ private:
 	volatile bool working;
 	volatile bool has_error;
 
+	IMetric* queue_size_metric;
+	int64 last_queue_size;
+
 	IFsFile *chunk_output_fn;
+	IFsFile *chunk_source_fn;
 	ChunkPatcher chunk_patcher;
 	bool chunk_patcher_has_error;
 
@@ -157,6 +166,10 @@ private:
 	bool use_reflink;
 	bool use_tmpfiles;
 	bool has_reflink;
+	bool has_range_clone;
+	bool range_clone_supported;
+	_i64 clone_range_start;
+	_i64 clone_range_size;
 	_i64 chunk_patch_pos;
 
 	_i64 cow_filesize;
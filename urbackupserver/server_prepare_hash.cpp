@@ -58,6 +58,11 @@ BackupServerPrepareHash::BackupServerPrepareHash(IPipe *pPipe, IPipe *pOutput, i
 	clientid=pClientid;
 	working=false;
 	chunk_patcher.setCallback(this);
+	queue_size_metric=Server->getMetric("urbackup_hash_queue_items{stage=\"prepare\"}",
+		"Number of files waiting in the server hash pipeline", EMetricType_Gauge);
+	last_queue_size=0;
+	hashed_bytes_metric=Server->getMetric("urbackup_hash_bytes_total",
+		"Number of bytes hashed by the server hash pipeline", EMetricType_Counter);
 	chunk_patcher.setWithSparse(true);
 	has_error=false;
 }
@@ -74,8 +79,14 @@ void BackupServerPrepareHash::operator()(void)
 		working=false;
 		std::string data;
 		size_t rc=pipe->Read(&data);
+
+		int64 queue_size=static_cast<int64>(pipe->getNumElements());
+		queue_size_metric->add(queue_size-last_queue_size);
+		last_queue_size=queue_size;
+
 		if(data=="exit")
 		{
+			queue_size_metric->add(-last_queue_size);
 			output->Write("exit");
 			Server->Log("server_prepare_hash Thread finished (exit)");
 			delete this;
@@ -254,6 +265,11 @@ void BackupServerPrepareHash::operator()(void)
 					}
 				}
 
+				if (!h.empty())
+				{
+					hashed_bytes_metric->add(t_filesize);
+				}
+
 				Server->destroy(tf);
 				if(old_file!=NULL)
 				{
@@ -4,6 +4,7 @@
 #include "../Interface/Thread.h"
 #include "../Interface/File.h"
 #include "../Interface/Pipe.h"
+#include "../Interface/Metrics.h"
 
 #include "ChunkPatcher.h"
 #include "../urbackupcommon/sha2/sha2.h"
@@ -86,6 +87,10 @@ private:
 	logid_t logid;
 
 	bool ignore_hash_mismatch;
+
+	IMetric* queue_size_metric;
+	int64 last_queue_size;
+	IMetric* hashed_bytes_metric;
 
 };
 
@@ -27,16 +27,27 @@
 #include "server_settings.h"
 #include "../Interface/Server.h"
 #include "server.h"
+#include "database.h"
+#include "dao/ServerBackupDao.h"
+#include "../common/atomic.h"
 
 IMutex *ServerSettings::g_mutex=NULL;
+IMutex *ServerSettings::g_update_mutex=NULL;
+volatile int64 ServerSettings::g_settings_version=0;
 std::map<int, SSettings*> ServerSettings::g_settings_cache;
 
-//#define CLEAR_SETTINGS_CACHE
+namespace
+{
+	using common::atomic_add;
+	using common::atomic_load;
+}
 
 void ServerSettings::init_mutex(void)
 {
 	if(g_mutex==NULL)
 		g_mutex=Server->createMutex();
+	if(g_update_mutex==NULL)
+		g_update_mutex=Server->createMutex();
 }
 
 void ServerSettings::destroy_mutex(void)
@@ -45,6 +56,10 @@ void ServerSettings::destroy_mutex(void)
 	{
 		Server->destroy(g_mutex);
 	}
+	if(g_update_mutex!=NULL)
+	{
+		Server->destroy(g_update_mutex);
+	}
 }
 
 void ServerSettings::clear_cache()
@@ -52,63 +67,61 @@ void ServerSettings::clear_cache()
 	IScopedLock lock(g_mutex);
 
 	for(std::map<int, SSettings*>::iterator it=g_settings_cache.begin();
-		it!=g_settings_cache.end();)
+		it!=g_settings_cache.end();++it)
 	{
-		if(it->second->refcount==0)
-		{
-			std::map<int, SSettings*>::iterator delit=it++;
-			delete delit->second;
-			g_settings_cache.erase(delit);
-		}
-		else
-		{
-			Server->Log("Refcount for settings for clientid \""+convert(it->second->clientid)+"\" is not 0. Not deleting.", LL_WARNING);
-			++it;
-		}
+		releaseSettings(it->second);
 	}
+
+	g_settings_cache.clear();
+	atomic_add(&g_settings_version, 1);
 }
 
 ServerSettings::ServerSettings(IDatabase *db, int pClientid)
 	: local_settings(NULL), clientid(pClientid), db(db)
 {
-	IScopedLock lock(g_mutex);
-		
-	std::map<int, SSettings*>::iterator iter=g_settings_cache.find(clientid);
-	if(iter!=g_settings_cache.end())
+	while(true)
 	{
-		++iter->second->refcount;
-		local_settings = iter->second;
-	}
-	else
-	{
-		lock.relock(NULL);
-
-		std::auto_ptr<ISettingsReader> settings_client, settings_default, setting_global;
-		createSettingsReaders(settings_default, settings_client, setting_global);
-		local_settings = new SSettings();
-		local_settings->refcount = 1;
-		readSettingsDefault(settings_default.get(), 
-			setting_global.get()!=NULL ? setting_global.get() : settings_default.get());
-		if (settings_client.get() != NULL)
+		local_version = atomic_load(&g_settings_version);
+
 		{
-			readSettingsClient(settings_client.get());
+			IScopedLock lock(g_mutex);
+
+			std::map<int, SSettings*>::iterator iter=g_settings_cache.find(clientid);
+			if(iter!=g_settings_cache.end())
+			{
+				atomic_add(&iter->second->refcount, 1);
+				local_settings = iter->second;
+				return;
+			}
 		}
 
-		lock.relock(g_mutex);
+		SSettings* new_settings = readSettings();
+
+		IScopedLock lock(g_mutex);
 
-		iter = g_settings_cache.find(clientid);
+		std::map<int, SSettings*>::iterator iter = g_settings_cache.find(clientid);
 
 		if (iter != g_settings_cache.end())
 		{
-			delete local_settings;
-			++iter->second->refcount;
+			delete new_settings;
+			atomic_add(&iter->second->refcount, 1);
 			local_settings = iter->second;
+			return;
 		}
-		else
+
+		if (atomic_load(&g_settings_version) != local_version)
 		{
-			g_settings_cache.insert(std::make_pair(clientid, local_settings));
+			//Settings may have changed while reading them
+			delete new_settings;
+			continue;
 		}
-	}	
+
+		//One reference for the cache and one for this instance
+		new_settings->refcount = 2;
+		g_settings_cache.insert(std::make_pair(clientid, new_settings));
+		local_settings = new_settings;
+		return;
+	}
 }
 
 void ServerSettings::createSettingsReaders(std::auto_ptr<ISettingsReader>& settings_default,
@@ -135,185 +148,182 @@ void ServerSettings::createSettingsReaders(std::auto_ptr<ISettingsReader>& setti
 
 ServerSettings::~ServerSettings(void)
 {
+	releaseSettings(local_settings);
+}
+
+void ServerSettings::releaseSettings(SSettings* settings)
+{
+	//The cache holds a reference as long as the snapshot is current, so the last
+	//reference can only be dropped on a snapshot nobody can acquire anymore
+	if (atomic_add(&settings->refcount, -1) == 0)
 	{
-		IScopedLock lock(g_mutex);
+		delete settings;
+	}
+}
 
-		assert(local_settings->refcount > 0);
-		--local_settings->refcount;
+SSettings* ServerSettings::readSettings()
+{
+	std::auto_ptr<ISettingsReader> settings_client, settings_default, settings_global;
+	createSettingsReaders(settings_default, settings_client, settings_global);
 
-		if (local_settings->refcount == 0)
-		{
-#ifdef CLEAR_SETTINGS_CACHE
-			if (!local_settings->needs_update)
-			{
-				std::map<int, SSettings*>::iterator iter = g_settings_cache.find(clientid);
-				assert(iter != g_settings_cache.end());
-				delete iter->second;
-				g_settings_cache.erase(iter);
-			}
-#endif
-			if (local_settings->needs_update)
-			{
-				std::map<int, SSettings*>::iterator iter = g_settings_cache.find(clientid);
-				assert(iter != g_settings_cache.end());
-				if (local_settings == iter->second)
-				{
-					g_settings_cache.erase(iter);
-				}
+	SSettings* settings = new SSettings();
+	readSettingsDefault(settings, settings_default.get(),
+		settings_global.get() != NULL ? settings_global.get() : settings_default.get());
+	if (settings_client.get() != NULL)
+	{
+		readSettingsClient(settings, settings_client.get());
+	}
 
-				delete local_settings;
-			}
+	if (clientid > 0)
+	{
+		//Virtual clients always show their own name
+		ServerBackupDao backup_dao(db);
+		ServerBackupDao::SClientName client_name = backup_dao.getVirtualMainClientname(clientid);
+		if (client_name.exists
+			&& (settings->computername.empty() || !client_name.virtualmain.empty()))
+		{
+			settings->computername = client_name.name;
 		}
 	}
+
+	return settings;
+}
+
+void ServerSettings::publishSettings()
+{
+	SSettings* new_settings = readSettings();
+	new_settings->refcount = 1;
+
+	SSettings* old_settings = NULL;
+	{
+		IScopedLock lock(g_mutex);
+
+		SSettings*& cached = g_settings_cache[clientid];
+		old_settings = cached;
+		cached = new_settings;
+
+		atomic_add(&g_settings_version, 1);
+	}
+
+	if (old_settings != NULL)
+	{
+		releaseSettings(old_settings);
+	}
 }
 
 void ServerSettings::updateAll(void)
 {
-	IScopedLock lock(g_mutex);
+	IScopedLock update_lock(g_update_mutex);
 
-	for(std::map<int, SSettings*>::iterator it=g_settings_cache.begin();
-		it!=g_settings_cache.end();)
+	std::vector<int> clientids;
 	{
-		if(it->second->refcount==0)
-		{
-			std::map<int, SSettings*>::iterator delit=it++;
-			delete delit->second;
-			g_settings_cache.erase(delit);
-		}
-		else
+		IScopedLock lock(g_mutex);
+
+		for(std::map<int, SSettings*>::iterator it=g_settings_cache.begin();
+			it!=g_settings_cache.end();)
 		{
-			it->second->needs_update=true;
-			++it;
+			if(atomic_load(&it->second->refcount)==1)
+			{
+				//Only referenced by the cache. Read again on next use.
+				std::map<int, SSettings*>::iterator delit=it++;
+				releaseSettings(delit->second);
+				g_settings_cache.erase(delit);
+			}
+			else
+			{
+				clientids.push_back(it->first);
+				++it;
+			}
 		}
+
+		atomic_add(&g_settings_version, 1);
+	}
+
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+
+	for (size_t i = 0; i < clientids.size(); ++i)
+	{
+		ServerSettings settings(db, clientids[i]);
+		settings.publishSettings();
 	}
 }
 
 void ServerSettings::updateClient(int clientid)
 {
-	IScopedLock lock(g_mutex);
+	IScopedLock update_lock(g_update_mutex);
 
-	std::map<int, SSettings*>::iterator it = g_settings_cache.find(clientid);
-	if(it!=g_settings_cache.end())
 	{
-		if (it->second->refcount == 0)
+		IScopedLock lock(g_mutex);
+
+		std::map<int, SSettings*>::iterator it = g_settings_cache.find(clientid);
+		if (it == g_settings_cache.end())
 		{
-			delete it->second;
-			g_settings_cache.erase(it);
+			atomic_add(&g_settings_version, 1);
+			return;
 		}
-		else
+
+		if (atomic_load(&it->second->refcount) == 1)
 		{
-			it->second->needs_update = true;
+			releaseSettings(it->second);
+			g_settings_cache.erase(it);
+			atomic_add(&g_settings_version, 1);
+			return;
 		}
 	}
+
+	ServerSettings settings(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER), clientid);
+	settings.publishSettings();
 }
 
 void ServerSettings::update(bool force_update)
 {
-	while(local_settings->needs_update || force_update)
+	if (force_update)
 	{
-		force_update = false;
+		IScopedLock update_lock(g_update_mutex);
+		publishSettings();
+	}
 
-		IScopedLock lock(g_mutex);
+	getSettings();
+}
 
-		local_settings->needs_update = true;
+SSettings *ServerSettings::getSettings(bool *was_updated)
+{
+	bool updated = false;
 
-		assert(local_settings->refcount > 0);
-		--local_settings->refcount;
+	int64 curr_version = atomic_load(&g_settings_version);
+	if (curr_version != local_version)
+	{
+		local_version = curr_version;
 
-		if (local_settings->refcount == 0)
-		{
-			std::map<int, SSettings*>::iterator iter = g_settings_cache.find(clientid);
-			if (iter != g_settings_cache.end()
-				&& iter->second == local_settings)
-			{
-				delete iter->second;
-				g_settings_cache.erase(iter);
-			}
-			else
-			{
-				if (iter != g_settings_cache.end()
-					&& iter->second != local_settings)
-				{
-					delete local_settings;
-					++iter->second->refcount;
-					local_settings = iter->second;
-					continue;
-				}
-				else
-				{
-					delete local_settings;
-				}
-			}
-		}
+		IScopedLock lock(g_mutex);
 
 		std::map<int, SSettings*>::iterator iter = g_settings_cache.find(clientid);
 		if (iter != g_settings_cache.end()
 			&& iter->second != local_settings)
 		{
-			++iter->second->refcount;
+			atomic_add(&iter->second->refcount, 1);
+			SSettings* old_settings = local_settings;
 			local_settings = iter->second;
-			continue;
-		}
 
-		SSettings* old_local_settings = local_settings;
+			lock.relock(NULL);
 
-		lock.relock(NULL);
+			releaseSettings(old_settings);
 
-		local_settings = new SSettings();
-		local_settings->refcount = 1;
-		std::auto_ptr<ISettingsReader> settings_client, settings_default, settings_global;
-		createSettingsReaders(settings_default, settings_client, settings_global);
-		readSettingsDefault(settings_default.get(),
-			settings_global.get() != NULL ? settings_global.get() : settings_default.get());
-		if (settings_client.get() != NULL)
-		{
-			readSettingsClient(settings_client.get());
-		}
-
-		lock.relock(g_mutex);
-
-		iter = g_settings_cache.find(clientid);
-
-		if (iter==g_settings_cache.end()
-			|| iter->second == old_local_settings)
-		{
-			g_settings_cache[clientid] = local_settings;
-		}
-		else
-		{
-			delete local_settings;
-			++iter->second->refcount;
-			local_settings = iter->second;
+			updated = true;
 		}
 	}
-}
 
-void ServerSettings::updateInternal(bool* was_updated)
-{
-	if(local_settings->needs_update)
+	if (was_updated != NULL)
 	{
-		if(was_updated!=NULL)
-			*was_updated=true;
-
-		update(false);
-	}
-	else
-	{
-		if(was_updated!=NULL)
-			*was_updated=false;
+		*was_updated = updated;
 	}
-}
 
-SSettings *ServerSettings::getSettings(bool *was_updated)
-{
-	updateInternal(was_updated);
 	return local_settings;
 }
 
-void ServerSettings::readSettingsDefault(ISettingsReader* settings_default,
+void ServerSettings::readSettingsDefault(SSettings* settings, ISettingsReader* settings_default,
 	ISettingsReader* settings_global)
 {
-	SSettings* settings = local_settings;
 	settings->clientid=clientid;
 	settings->image_file_format=settings_default->getValue("image_file_format", image_file_format_default);
 	settings->update_freq_incr=settings_default->getValue("update_freq_incr", convert(5*60*60) );
@@ -424,9 +434,8 @@ void ServerSettings::readSettingsDefault(ISettingsReader* settings_default,
 	settings->alert_params = settings_default->getValue("alert_params", "");
 }
 
-void ServerSettings::readSettingsClient(ISettingsReader* settings_client)
+void ServerSettings::readSettingsClient(SSettings* settings, ISettingsReader* settings_client)
 {	
-	SSettings* settings = local_settings;
 	std::string stmp=settings_client->getValue("internet_authkey", std::string());
 	if(!stmp.empty())
 	{
@@ -782,26 +791,22 @@ std::string ServerSettings::generateRandomBinaryKey(void)
 
 int ServerSettings::getUpdateFreqImageIncr()
 {
-	updateInternal(NULL);
-	return static_cast<int>(currentTimeSpanValue(local_settings->update_freq_image_incr)+1);
+	return static_cast<int>(currentTimeSpanValue(getSettings()->update_freq_image_incr)+1);
 }
 
 int ServerSettings::getUpdateFreqFileIncr()
 {
-	updateInternal(NULL);
-	return static_cast<int>(currentTimeSpanValue(local_settings->update_freq_incr)+1);
+	return static_cast<int>(currentTimeSpanValue(getSettings()->update_freq_incr)+1);
 }
 
 int ServerSettings::getUpdateFreqImageFull()
 {
-	updateInternal(NULL);
-	return static_cast<int>(currentTimeSpanValue(local_settings->update_freq_image_full)+1);
+	return static_cast<int>(currentTimeSpanValue(getSettings()->update_freq_image_full)+1);
 }
 
 int ServerSettings::getUpdateFreqFileFull()
 {
-	updateInternal(NULL);
-	return static_cast<int>(currentTimeSpanValue(local_settings->update_freq_full)+1);
+	return static_cast<int>(currentTimeSpanValue(getSettings()->update_freq_full)+1);
 }
 
 std::string ServerSettings::getImageFileFormat()
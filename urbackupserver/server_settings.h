@@ -20,14 +20,18 @@ namespace
 	const char* incr_image_style_to_last = "to-last";
 }
 
+/**
+* Settings snapshot. Snapshots are shared between all ServerSettings of a client
+* and replaced as a whole when the settings change, so they must not be modified
+* once they are published.
+*/
 struct SSettings
 {
 	SSettings()
-		: needs_update(false), refcount(0)
+		: refcount(0)
 	{}
 
-	volatile bool needs_update;
-	size_t refcount;
+	volatile int64 refcount;
 
 	int clientid;
 	std::string backupfolder;
@@ -252,24 +256,32 @@ private:
 	float parseTimeDet(std::string t);
 	STimeSpan parseTime(std::string t);
 	int parseDayOfWeek(std::string dow);
-	void readSettingsDefault(ISettingsReader* settings_default, ISettingsReader* settings_global);
-	void readSettingsClient(ISettingsReader* settings_client);
+	void readSettingsDefault(SSettings* settings, ISettingsReader* settings_default, ISettingsReader* settings_global);
+	void readSettingsClient(SSettings* settings, ISettingsReader* settings_client);
 	void readBoolClientSetting(ISettingsReader* settings_client, const std::string &name, bool *output);
 	void readStringClientSetting(ISettingsReader* settings_client, const std::string &name, std::string *output);
 	void readIntClientSetting(ISettingsReader* settings_client, const std::string &name, int *output);
 	void readInt64ClientSetting(ISettingsReader* settings_client, const std::string &name, int64 *output);
 	void readSizeClientSetting(ISettingsReader* settings_client, const std::string &name, size_t *output);
-	void updateInternal(bool* was_updated);
+	SSettings* readSettings();
+	void publishSettings();
+
+	static void releaseSettings(SSettings* settings);
 	std::map<std::string, std::string> parseLdapMap(const std::string& data);
 
 	SSettings* local_settings;
+	int64 local_version;
 
 	IDatabase* db;
 
 	int clientid;
 
 	static std::map<int, SSettings*> g_settings_cache;
+	//Incremented each time a snapshot in g_settings_cache is replaced
+	static volatile int64 g_settings_version;
 	static IMutex *g_mutex;
+	//Serializes reading and publishing of new snapshots
+	static IMutex *g_update_mutex;
 };
 
 
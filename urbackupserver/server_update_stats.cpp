@@ -32,6 +32,12 @@
 #include "dao/ServerFilesDao.h"
 #include <algorithm>
 
+namespace
+{
+	const int64 apply_interval_ms = 60*1000;
+	const size_t max_clients_cache_size = 10000;
+}
+
 ServerUpdateStats::ServerUpdateStats(bool image_repair_mode, bool interruptible)
 	: image_repair_mode(image_repair_mode), interruptible(interruptible)
 {
@@ -230,6 +236,8 @@ void ServerUpdateStats::update_files(void)
 	bool started_transaction = false;
 	
 	std::vector<ServerFilesDao::SIncomingStat> stat_entries;
+	std::map<std::string, std::vector<int> > clients_cache;
+	int64 last_apply_time = Server->getTimeMS();
 
 	int last_pc=0;
 	do
@@ -270,14 +278,7 @@ void ServerUpdateStats::update_files(void)
 
 			ServerFilesDao::SIncomingStat& entry = stat_entries[i];
 
-			std::vector<int> clients;
-			std::vector<std::string> s_clients;
-			Tokenize(entry.existing_clients, s_clients, ",");
-			clients.resize(s_clients.size());
-			for(size_t j=0;j<s_clients.size();++j)
-			{
-				clients[j]=watoi(s_clients[j]);
-			}
+			std::vector<int> clients = parseClients(entry.existing_clients, clients_cache);
 
 			
 			if(entry.direction== ServerFilesDao::c_direction_incoming)
@@ -332,20 +333,64 @@ void ServerUpdateStats::update_files(void)
 				Server->Log("Unknown direction in ServerUpdateStats::update_files " + convert((int)entry.direction), LL_ERROR);
 				assert(false);
 			}
+		}
+
+		if(!stat_entries.empty())
+		{
+			filesdao.delIncomingStatEntriesUpTo(stat_entries[stat_entries.size()-1].id);
+		}
 
-			filesdao.delIncomingStatEntry(entry.id);
+		//Apply what was processed so far, so that the usage numbers
+		//stay current while a large backlog is worked off
+		if(!stat_entries.empty()
+			&& Server->getTimeMS()-last_apply_time>apply_interval_ms)
+		{
+			applySizes(size_data_clients, size_data_backups, del_sizes);
+			files_db_transaction.restart();
+			last_apply_time = Server->getTimeMS();
 		}
 	}
 	while(!stat_entries.empty());
 
+	applySizes(size_data_clients, size_data_backups, del_sizes);
 
+	db->Write("UPDATE backups SET size_calculated=1 WHERE size_calculated=0 AND done=1");
+}
+
+void ServerUpdateStats::applySizes(std::map<int, _i64>& size_data_clients, std::map<int, _i64>& size_data_backups, std::map<int, SDelInfo>& del_sizes)
+{
 	DBScopedWriteTransaction db_transaction(db);
 
 	updateSizes(size_data_clients);
 	updateDels(del_sizes);
 	updateBackups(size_data_backups);
+}
 
-	db->Write("UPDATE backups SET size_calculated=1 WHERE size_calculated=0 AND done=1");
+std::vector<int> ServerUpdateStats::parseClients(const std::string& existing_clients, std::map<std::string, std::vector<int> >& clients_cache)
+{
+	std::map<std::string, std::vector<int> >::iterator it = clients_cache.find(existing_clients);
+	if(it!=clients_cache.end())
+	{
+		return it->second;
+	}
+
+	if(clients_cache.size()>=max_clients_cache_size)
+	{
+		clients_cache.clear();
+	}
+
+	std::vector<int> clients;
+	std::vector<std::string> s_clients;
+	Tokenize(existing_clients, s_clients, ",");
+	clients.resize(s_clients.size());
+	for(size_t j=0;j<s_clients.size();++j)
+	{
+		clients[j]=watoi(s_clients[j]);
+	}
+
+	clients_cache[existing_clients] = clients;
+
+	return clients;
 }
 
 std::map<int, _i64> ServerUpdateStats::getFilebackupSizesClients(void)
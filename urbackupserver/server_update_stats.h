@@ -39,6 +39,8 @@ private:
 	void add_del(std::map<int, SDelInfo> &data, int backupid, _i64 filesize, int clientid, int incremental);
 	void updateBackups(std::map<int, _i64> &data);
 	void updateDels(std::map<int, SDelInfo> &data);
+	void applySizes(std::map<int, _i64>& size_data_clients, std::map<int, _i64>& size_data_backups, std::map<int, SDelInfo>& del_sizes);
+	std::vector<int> parseClients(const std::string& existing_clients, std::map<std::string, std::vector<int> >& clients_cache);
 
 	bool repairImagePath(str_map img);
 
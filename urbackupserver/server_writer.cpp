@@ -27,11 +27,14 @@
 #include "server_cleanup.h"
 #include "ClientMain.h"
 #include "zero_hash.h"
+#include <algorithm>
+#include <memory.h>
 
 extern IFSImageFactory *image_fak;
 const size_t free_space_lim=1000*1024*1024; //1000MB
 const uint64 filebuf_lim=1000*1024*1024; //1000MB
 const unsigned int sha_size=32;
+const unsigned int max_write_coalesce_size=2*1024*1024; //2MB
 
 ServerVHDWriter::ServerVHDWriter(IVHDFile *pVHD, unsigned int blocksize, unsigned int nbufs,
 		int pClientid, bool use_tmpfiles, int64 mbr_offset, IFile* hashfile, int64 vhd_blocksize,
@@ -68,11 +71,14 @@ ServerVHDWriter::ServerVHDWriter(IVHDFile *pVHD, unsigned int blocksize, unsigne
 	exit_now=false;
 	has_error=false;
 	written=free_space_lim;
+
+	write_coalescer=new VHDWriteCoalescer(this, vhd->getBlocksize());
 }
 
 ServerVHDWriter::~ServerVHDWriter(void)
 {
 	delete bufmgr;
+	delete write_coalescer;
 
 	if(filebuffer)
 	{
@@ -95,7 +101,8 @@ void ServerVHDWriter::operator()(void)
 			bool do_exit;
 			{
 				IScopedLock lock(mutex);
-				if(tqueue.empty() && exit==false)
+				if(tqueue.empty() && exit==false
+					&& write_coalescer->empty())
 				{
 					cond->wait(&lock);
 				}
@@ -113,7 +120,7 @@ void ServerVHDWriter::operator()(void)
 				{
 					if(!filebuffer)
 					{
-						writeVHD(item.pos, item.buf, item.bsize);
+						write_coalescer->write(item.pos, item.buf, item.bsize);
 					}
 					else
 					{
@@ -155,9 +162,18 @@ void ServerVHDWriter::operator()(void)
 
 				freeBuffer(item.buf);
 			}
-			else if(do_exit)
+			else
 			{
-				break;
+				//Nothing queued. Write the collected blocks instead of waiting for more
+				if(!has_error)
+				{
+					write_coalescer->flush();
+				}
+
+				if(do_exit)
+				{
+					break;
+				}
 			}
 
 			if(!filebuffer && written>=free_space_lim/2)
@@ -559,6 +575,71 @@ void ServerVHDWriter::setDoMakeFull( bool b )
 	do_make_full=b;
 }
 
+//-------------VHDWriteCoalescer-----------------
+
+VHDWriteCoalescer::VHDWriteCoalescer(ServerVHDWriter *parent, unsigned int max_size)
+	: parent(parent), max_size(max_size), buf_pos(0), buf_size(0)
+{
+	if(this->max_size==0 || this->max_size>max_write_coalesce_size)
+	{
+		this->max_size=max_write_coalesce_size;
+	}
+}
+
+bool VHDWriteCoalescer::write(uint64 pos, const char *data, unsigned int bsize)
+{
+	if(data==NULL)
+	{
+		bool ret=flush();
+		return parent->writeVHD(pos, NULL, bsize) && ret;
+	}
+
+	bool ret=true;
+	if(buf_size>0
+		&& (buf_pos+buf_size!=pos
+			|| buf_pos/max_size!=(pos+bsize-1)/max_size) )
+	{
+		ret=flush();
+	}
+
+	if(buf_size==0)
+	{
+		if(bsize>=max_size)
+		{
+			return parent->writeVHD(pos, const_cast<char*>(data), bsize) && ret;
+		}
+
+		buf_pos=pos;
+	}
+
+	if(buf.size()<buf_size+bsize)
+	{
+		buf.resize((std::max)(static_cast<size_t>(max_size), static_cast<size_t>(buf_size+bsize)));
+	}
+
+	memcpy(&buf[buf_size], data, bsize);
+	buf_size+=bsize;
+
+	return ret;
+}
+
+bool VHDWriteCoalescer::flush(void)
+{
+	if(buf_size==0)
+	{
+		return true;
+	}
+
+	unsigned int tsize=buf_size;
+	buf_size=0;
+	return parent->writeVHD(buf_pos, &buf[0], tsize);
+}
+
+bool VHDWriteCoalescer::empty(void)
+{
+	return buf_size==0;
+}
+
 //-------------FilebufferWriter-----------------
 
 ServerFileBufferWriter::ServerFileBufferWriter(ServerVHDWriter *pParent, unsigned int pBlocksize) : parent(pParent), blocksize(pBlocksize)
@@ -586,6 +667,8 @@ void ServerFileBufferWriter::operator()(void)
 	char *blockbuf=new char[blocksize+sizeof(FileBufferVHDItem)+1];
 	unsigned int blockbuf_size=blocksize+sizeof(FileBufferVHDItem)+1;
 
+	VHDWriteCoalescer write_coalescer(parent, parent->getVHD()->getBlocksize());
+
 	while(!exit_now)
 	{
 		IFile* tmp;
@@ -630,7 +713,7 @@ void ServerFileBufferWriter::operator()(void)
 						FileBufferVHDItem *item=(FileBufferVHDItem*)blockbuf;
 						if(blockbuf_size-1==item->bsize+sizeof(FileBufferVHDItem) )
 						{
-							parent->writeVHD(item->pos, blockbuf+sizeof(FileBufferVHDItem), item->bsize);
+							write_coalescer.write(item->pos, blockbuf+sizeof(FileBufferVHDItem), item->bsize);
 							written+=item->bsize;
 							tpos+=item->bsize+sizeof(FileBufferVHDItem);
 							next_type = blockbuf[blockbuf_size - 1];
@@ -655,7 +738,7 @@ void ServerFileBufferWriter::operator()(void)
 						tpos+=sizeof(FileBufferVHDItem);
 						if (item.type==1)
 						{
-							parent->writeVHD(item.pos, NULL, item.bsize);
+							write_coalescer.write(item.pos, NULL, item.bsize);
 							next_type = -1;
 						}
 						else if(item.type==0)
@@ -692,7 +775,7 @@ void ServerFileBufferWriter::operator()(void)
 								next_type = -1;
 							}
 
-							parent->writeVHD(item.pos, blockbuf, tw);
+							write_coalescer.write(item.pos, blockbuf, tw);
 							written += tw;
 							tpos += item.bsize;
 						}
@@ -716,6 +799,12 @@ void ServerFileBufferWriter::operator()(void)
 					break;
 				}
 			}
+
+			if(!exit_now && !parent->hasError())
+			{
+				write_coalescer.flush();
+			}
+
 			parent->freeFile(tmp);
 		}
 		else if(do_exit)
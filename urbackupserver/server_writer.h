@@ -5,9 +5,34 @@
 #include "../fsimageplugin/IVHDFile.h"
 
 #include <queue>
+#include <vector>
 #include "server_log.h"
 
 class IVHDFile;
+class ServerVHDWriter;
+
+/**
+* Collects writes of adjacent blocks and writes them to the VHD file with
+* one call. A batch does not cross a VHD block boundary, so VHDFile writes
+* it with a single write to the backing file.
+*/
+class VHDWriteCoalescer
+{
+public:
+	VHDWriteCoalescer(ServerVHDWriter *parent, unsigned int max_size);
+
+	//buf is copied. buf==NULL marks the area as unused (after writing collected data)
+	bool write(uint64 pos, const char *buf, unsigned int bsize);
+	bool flush(void);
+	bool empty(void);
+
+private:
+	ServerVHDWriter *parent;
+	unsigned int max_size;
+	std::vector<char> buf;
+	uint64 buf_pos;
+	unsigned int buf_size;
+};
 
 struct BufferVHDItem
 {
@@ -74,6 +99,7 @@ private:
 	CFileBufMgr *filebuf;
 	ServerFileBufferWriter *filebuf_writer;
 	THREADPOOL_TICKET filebuf_writer_ticket;
+	VHDWriteCoalescer *write_coalescer;
 	IFile *currfile;
 	uint64 currfile_size;
 
@@ -35,6 +35,7 @@
 #include "../restore_client.h"
 #include "../dao/ServerBackupDao.h"
 #include "../server_dir_links.h"
+#include "../dir_metadata_index.h"
 #include "../ImageMount.h"
 #include "../server.h"
 #include "../server_cleanup.h"
@@ -63,7 +64,7 @@ namespace backupaccess
 
 bool create_zip_to_output(const std::string& folderbase, const std::string& foldername, const std::string& hashfolderbase, 
 	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
-	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes);
+	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes, int compression_level);
 
 namespace
 {
@@ -98,7 +99,7 @@ namespace
 	}
 
 	bool sendZip(Helper& helper, std::string folderbase, std::string foldername, std::string hashfolderbase, std::string hashfoldername, const std::string& filter, bool token_authentication,
-		const std::vector<backupaccess::SToken>& backup_tokens, const std::vector<std::string>& tokens, bool skip_hashes)
+		const std::vector<backupaccess::SToken>& backup_tokens, const std::vector<std::string>& tokens, bool skip_hashes, const std::string& compression)
 	{
 		std::string zipname=ExtractFileName(foldername)+".zip";
 
@@ -124,11 +125,25 @@ namespace
 			}
 		}
 
+		//Deflate levels: "store" does not compress, "fast" trades ratio for speed
+		int compression_level = 6;
+		if(compression=="store")
+		{
+			compression_level = 0;
+		}
+		else if(compression=="fast")
+		{
+			compression_level = 1;
+		}
+
 		return create_zip_to_output(folderbase, foldername, hashfolderbase, hashfoldername, filter, token_authentication,
-			backup_tokens, tokens, skip_hashes);
+			backup_tokens, tokens, skip_hashes, compression_level);
 	}
 
-	std::vector<FileMetadata> getMetadata(std::string dir, const std::vector<SFile>& files, bool skip_special)
+	//Directories with fewer entries are listed without writing a metadata index
+	const size_t c_min_dir_metadata_index_entries = 32;
+
+	std::vector<FileMetadata> getMetadata(std::string dir, const std::vector<SFile>& files, bool skip_special, bool use_index)
 	{
 		std::vector<FileMetadata> ret;
 		ret.resize(files.size());
@@ -138,6 +153,11 @@ namespace
 			dir+=os_file_sep();
 		}
 
+		std::string metadata_dir = dir.substr(0, dir.size()-1);
+		DirMetadataIndex index;
+		bool has_index = use_index && index.read(metadata_dir);
+		bool write_index = use_index && !has_index && files.size()>=c_min_dir_metadata_index_entries;
+
 		for(size_t i=0;i<files.size();++i)
 		{
 			if(skip_special && (files[i].name==".hashes" || files[i].name=="user_views" || next(files[i].name, 0, ".symlink_") ) )
@@ -153,22 +173,38 @@ namespace
 				file.isspecialf = false;
 			}
 
-			std::string metadata_fn;
+			std::string metadata_rel_fn;
 			if (file.isdir
 				&& !file.issym
 				&& !file.isspecialf)
 			{
-				metadata_fn = dir + escape_metadata_fn(file.name) + os_file_sep() + metadata_dir_fn;
+				metadata_rel_fn = escape_metadata_fn(file.name) + os_file_sep() + metadata_dir_fn;
 			}
 			else
 			{
-				metadata_fn = dir + escape_metadata_fn(file.name);
+				metadata_rel_fn = escape_metadata_fn(file.name);
+			}
+
+			if(has_index
+				&& index.get(metadata_rel_fn, ret[i]))
+			{
+				continue;
 			}
 
-			if(!read_metadata(metadata_fn, ret[i]) )
+			if(!read_metadata(dir + metadata_rel_fn, ret[i]) )
 			{
 				Server->Log("Error reading metadata of file "+dir+os_file_sep()+ file.name, LL_ERROR);
+				write_index = false;
 			}
+			else if(write_index)
+			{
+				index.add(metadata_rel_fn, ret[i]);
+			}
+		}
+
+		if(write_index)
+		{
+			index.write(metadata_dir);
 		}
 
 		return ret;
@@ -630,15 +666,68 @@ namespace backupaccess
 		}
 	}
 
+	JSON::Object file_entry(const SFile& file, const FileMetadata& metadata)
+	{
+		JSON::Object obj;
+		obj.set("name", file.name);
+		obj.set("dir", file.isdir);
+		if(!file.isdir)
+		{
+			obj.set("size", file.size);
+		}
+		obj.set("mod", metadata.last_modified);
+		obj.set("creat", metadata.created);
+		obj.set("access", metadata.accessed);
+		if(!file.isdir && !metadata.shahash.empty())
+		{
+			obj.set("shahash", base64_encode(reinterpret_cast<const unsigned char*>(metadata.shahash.c_str()), static_cast<unsigned int>(metadata.shahash.size())));
+		}
+		return obj;
+	}
+
+	void write_file_listing(JSON::Writer& writer, const SFileListing& listing)
+	{
+		writer.beginArray();
+		for(size_t i=0;i<listing.entries.size();++i)
+		{
+			const SFile& file = listing.files[listing.entries[i]];
+			const FileMetadata& metadata = listing.metadata[listing.entries[i]];
+
+			writer.beginObject();
+			writer.key("name");
+			writer.value(file.name);
+			writer.key("dir");
+			writer.value(file.isdir);
+			if(!file.isdir)
+			{
+				writer.key("size");
+				writer.value(file.size);
+			}
+			writer.key("mod");
+			writer.value(metadata.last_modified);
+			writer.key("creat");
+			writer.value(metadata.created);
+			writer.key("access");
+			writer.value(metadata.accessed);
+			if(!file.isdir && !metadata.shahash.empty())
+			{
+				writer.key("shahash");
+				writer.value(base64_encode(reinterpret_cast<const unsigned char*>(metadata.shahash.c_str()), static_cast<unsigned int>(metadata.shahash.size())));
+			}
+			writer.endObject();
+		}
+		writer.endArray();
+	}
+
     bool get_files_with_tokens(IDatabase* db, int* backupid, int t_clientid, std::string clientname, std::string* fileaccesstokens,
-                               const std::string& u_path, int backupid_offset, JSON::Object& ret)
+                               const std::string& u_path, int backupid_offset, JSON::Object& ret, SFileListing* listing)
 	{
 		Helper helper(Server->getThreadID(), NULL, NULL);
 
 		db_results res;
 		if(backupid)
 		{
-			IQuery* q=db->Prepare("SELECT path,strftime('"+helper.getTimeFormatString()+"', backuptime) AS backuptime FROM backups WHERE id=? AND clientid=?");
+			IQuery* q=db->Prepare("SELECT path,done,strftime('"+helper.getTimeFormatString()+"', backuptime) AS backuptime FROM backups WHERE id=? AND clientid=?");
 			q->Bind(*backupid);
 			q->Bind(t_clientid);
 			res=q->Read();
@@ -747,9 +836,10 @@ namespace backupaccess
 					}
 
 					std::vector<SFile> tfiles=getFiles(os_file_prefix(full_path), NULL);
-					std::vector<FileMetadata> tmetadata=getMetadata(full_metadata_path, tfiles, path.empty());
+					//Only finished backups do not change anymore
+					std::vector<FileMetadata> tmetadata=getMetadata(full_metadata_path, tfiles, path.empty(), res[k]["done"]=="1");
 
-					JSON::Array files;
+					std::vector<size_t> entries;
 					for(size_t i=0;i<tfiles.size();++i)
 					{
 						if(!fn_filter.empty() && tfiles[i].name!=fn_filter)
@@ -768,13 +858,7 @@ namespace backupaccess
 								continue;
 							}
 
-							JSON::Object obj;
-							obj.set("name", tfiles[i].name);
-							obj.set("dir", tfiles[i].isdir);
-							obj.set("mod", tmetadata[i].last_modified);
-							obj.set("creat", tmetadata[i].created);
-							obj.set("access", tmetadata[i].accessed);
-							files.add(obj);
+							entries.push_back(i);
 						}
 					}
 					for(size_t i=0;i<tfiles.size();++i)
@@ -795,22 +879,25 @@ namespace backupaccess
 								continue;
 							}
 
-							JSON::Object obj;
-							obj.set("name", tfiles[i].name);
-							obj.set("dir", tfiles[i].isdir);
-							obj.set("size", tfiles[i].size);
-							obj.set("mod", tmetadata[i].last_modified);
-							obj.set("creat", tmetadata[i].created);
-							obj.set("access", tmetadata[i].accessed);
-							if(!tmetadata[i].shahash.empty())
-							{
-								obj.set("shahash", base64_encode(reinterpret_cast<const unsigned char*>(tmetadata[i].shahash.c_str()), static_cast<unsigned int>(tmetadata[i].shahash.size())));
-							}
-							files.add(obj);
+							entries.push_back(i);
 						}
 					}
 
-					ret.set("files", files);
+					if(listing!=NULL)
+					{
+						listing->files.swap(tfiles);
+						listing->metadata.swap(tmetadata);
+						listing->entries.swap(entries);
+					}
+					else
+					{
+						JSON::Array files;
+						for(size_t i=0;i<entries.size();++i)
+						{
+							files.add(file_entry(tfiles[entries[i]], tmetadata[entries[i]]));
+						}
+						ret.set("files", files);
+					}
 				}
 				else
 				{
@@ -1285,6 +1372,10 @@ ACTION_IMPL(backups)
 	JSON::Object ret;
 	SUser *session=helper.getSession();
 
+	//Large directory listings are streamed instead of being added to ret
+	backupaccess::SFileListing listing;
+	bool has_listing=false;
+
 	bool has_tokens = CURRP.find("tokens0")!=CURRP.end();
 
 	bool token_authentication=false;
@@ -1670,7 +1761,7 @@ ACTION_IMPL(backups)
 							std::string bpath = backupfolder + os_file_sep() + clientname + os_file_sep() + backuppath;
 							sendZip(helper, bpath, path_info.full_path, backupid<0 ? "" : bpath + os_file_sep()+".hashes",
 								path_info.full_metadata_path, CURRP["filter"], token_authentication,
-								path_info.backup_tokens.tokens, tokens, backupid<0 ? false : path_info.rel_path.empty());
+								path_info.backup_tokens.tokens, tokens, backupid<0 ? false : path_info.rel_path.empty(), CURRP["compression"]);
 							return;
 						}
 						else if(sa=="clientdl" && fileserv!=NULL)
@@ -1723,8 +1814,9 @@ ACTION_IMPL(backups)
 						}
 						else
 						{
+							has_listing = has_backupid;
 							if (!backupaccess::get_files_with_tokens(db, has_backupid ? &backupid : NULL, t_clientid, clientname, token_authentication ? &fileaccesstokens : NULL,
-								u_path, 0, ret))
+								u_path, 0, ret, has_listing ? &listing : NULL))
 							{
 								JSON::Object err_ret;
 								err_ret.set("err", "access_denied");
@@ -1747,5 +1839,16 @@ ACTION_IMPL(backups)
 		ret.set("error", 1);
 	}
 
+	if(has_listing)
+	{
+		JSON::Writer writer(tid);
+		writer.beginObject();
+		writer.members(ret);
+		writer.key("files");
+		backupaccess::write_file_listing(writer, listing);
+		writer.endObject();
+		return;
+	}
+
     helper.Write(ret.stringify(false));
 }
@@ -2,6 +2,7 @@
 
 #include "../../urbackupcommon/file_metadata.h"
 #include "../../urbackupcommon/json.h"
+#include "../../urbackupcommon/os_functions.h"
 #include "../../Interface/Database.h"
 #include <string>
 #include <vector>
@@ -59,7 +60,19 @@ namespace backupaccess
 	SPathInfo get_metadata_path_with_tokens(const std::string& u_path, std::string* fileaccesstokens,
 		std::string clientname, std::string backupfolder, int* backupid, std::string backuppath);
 
+	struct SFileListing
+	{
+		std::vector<SFile> files;
+		std::vector<FileMetadata> metadata;
+		//Indices into files in output order
+		std::vector<size_t> entries;
+	};
+
+	//If listing is set the files of a backup are returned there instead of in ret["files"]
 	bool get_files_with_tokens(IDatabase* db, int* backupid, int t_clientid, std::string clientname,
-        std::string* fileaccesstokens, const std::string& u_path, int backupid_offset, JSON::Object& ret);
+        std::string* fileaccesstokens, const std::string& u_path, int backupid_offset, JSON::Object& ret,
+		SFileListing* listing=NULL);
+
+	void write_file_listing(JSON::Writer& writer, const SFileListing& listing);
 }
 
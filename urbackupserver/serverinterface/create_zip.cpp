@@ -21,8 +21,14 @@
 #include "action_header.h"
 #include "../../urbackupcommon/os_functions.h"
 #include "../../Interface/File.h"
+#include "../../Interface/Thread.h"
+#include "../../Interface/ThreadPool.h"
+#include "../../Interface/Mutex.h"
+#include "../../Interface/Condition.h"
 #include "backups.h"
 #include <memory>
+#include <deque>
+#include <math.h>
 #include "../../common/data.h"
 
 #define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
@@ -84,7 +90,451 @@ bool my_miniz_init(mz_zip_archive *pZip, MiniZFileInfo* fileInfo)
 	return true;
 }
 
-bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername, const std::string& folderbase, const std::string& foldername, const std::string& start_foldername,
+//Files up to this size are read and compressed ahead on worker threads
+const int64 c_zip_max_precompress_size = 4 * 1024 * 1024;
+const size_t c_zip_max_pending_entries = 64;
+const int64 c_zip_max_pending_bytes = 32 * 1024 * 1024;
+const int c_zip_max_workers = 4;
+const size_t c_zip_entropy_sample_size = 64 * 1024;
+//Bits per byte above which file data is assumed to be compressed already
+const double c_zip_store_entropy = 7.5;
+
+bool hasCompressedExtension(const std::string& fn)
+{
+	static const char* exts[] = { "7z", "apk", "avi", "bz2", "cab", "docx", "flac", "gif", "gz",
+		"heic", "jar", "jpeg", "jpg", "lz4", "lzma", "m4a", "m4v", "mkv", "mov", "mp3", "mp4",
+		"odp", "ods", "odt", "ogg", "opus", "png", "pptx", "rar", "tgz", "txz", "webm", "webp",
+		"xlsx", "xz", "zip", "zst", NULL };
+
+	std::string ext = strlower(findextension(fn));
+	if (ext.empty())
+	{
+		return false;
+	}
+
+	for (size_t i = 0; exts[i] != NULL; ++i)
+	{
+		if (ext == exts[i])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+double byteEntropy(const unsigned char* buf, size_t bsize)
+{
+	if (bsize == 0)
+	{
+		return 0;
+	}
+
+	size_t counts[256] = {};
+	for (size_t i = 0; i < bsize; ++i)
+	{
+		++counts[buf[i]];
+	}
+
+	double ret = 0;
+	for (size_t i = 0; i < 256; ++i)
+	{
+		if (counts[i] > 0)
+		{
+			double p = static_cast<double>(counts[i]) / bsize;
+			ret -= p*log(p) / log(2.0);
+		}
+	}
+	return ret;
+}
+
+struct SZipEntry
+{
+	SZipEntry()
+		: isdir(false), size(0), has_last_modified(false), last_modified(0),
+		precompress(false), done(false), failed(false), stream(false),
+		compressed(false), uncomp_size(0), crc32(0)
+	{}
+
+	std::string archivename;
+	std::string filename;
+	bool isdir;
+	int64 size;
+	bool has_last_modified;
+	time_t last_modified;
+	std::string extra_local;
+	std::string extra_central;
+
+	bool precompress;
+	bool done;
+	bool failed;
+	std::string errmsg;
+	//File grew too large to compress it in memory
+	bool stream;
+	bool compressed;
+	std::vector<char> data;
+	mz_uint64 uncomp_size;
+	mz_uint32 crc32;
+};
+
+/**
+* Adds entries to the ZIP stream in the order they are added. Small files
+* are read and deflated ahead on a few worker threads, so the HTTP thread
+* mostly writes already compressed data. Already compressed files are
+* stored instead of being deflated again.
+*/
+class ZipEntryWriter
+{
+public:
+	ZipEntryWriter(mz_zip_archive& zip_archive, int compression_level)
+		: zip_archive(zip_archive), compression_level(compression_level),
+		mutex(Server->createMutex()), work_cond(Server->createCondition()), done_cond(Server->createCondition()),
+		pending_bytes(0), do_exit(false)
+	{
+	}
+
+	~ZipEntryWriter()
+	{
+		{
+			IScopedLock lock(mutex.get());
+			do_exit = true;
+			work_cond->notify_all();
+		}
+
+		Server->getThreadPool()->waitFor(worker_tickets);
+
+		for (size_t i = 0; i < workers.size(); ++i)
+		{
+			delete workers[i];
+		}
+
+		for (size_t i = 0; i < pending.size(); ++i)
+		{
+			delete pending[i];
+		}
+	}
+
+	bool add(SZipEntry* entry)
+	{
+		if (!entry->isdir
+			&& entry->size > 0
+			&& entry->size <= c_zip_max_precompress_size)
+		{
+			entry->precompress = true;
+			pending_bytes += entry->size;
+
+			if (workers.empty())
+			{
+				startWorkers();
+			}
+
+			IScopedLock lock(mutex.get());
+			pending.push_back(entry);
+			compress_queue.push_back(entry);
+			work_cond->notify_one();
+		}
+		else
+		{
+			pending.push_back(entry);
+		}
+
+		while (pending.size() > c_zip_max_pending_entries
+			|| pending_bytes > c_zip_max_pending_bytes)
+		{
+			if (!writeFront())
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool finish()
+	{
+		while (!pending.empty())
+		{
+			if (!writeFront())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	class CompressWorker : public IThread
+	{
+	public:
+		CompressWorker(ZipEntryWriter* writer)
+			: writer(writer)
+		{}
+
+		void operator()()
+		{
+			while (true)
+			{
+				SZipEntry* entry;
+				{
+					IScopedLock lock(writer->mutex.get());
+					while (writer->compress_queue.empty()
+						&& !writer->do_exit)
+					{
+						writer->work_cond->wait(&lock);
+					}
+
+					if (writer->do_exit)
+					{
+						return;
+					}
+
+					entry = writer->compress_queue.front();
+					writer->compress_queue.pop_front();
+				}
+
+				writer->compressEntry(entry);
+
+				IScopedLock lock(writer->mutex.get());
+				entry->done = true;
+				writer->done_cond->notify_all();
+			}
+		}
+
+	private:
+		ZipEntryWriter* writer;
+	};
+
+	void startWorkers()
+	{
+		int nworkers = (std::min)(os_get_num_cpus(), c_zip_max_workers);
+		for (int i = 0; i < nworkers; ++i)
+		{
+			workers.push_back(new CompressWorker(this));
+			worker_tickets.push_back(Server->getThreadPool()->execute(workers[i], "zip compress"));
+		}
+	}
+
+	void compressEntry(SZipEntry* entry)
+	{
+		std::auto_ptr<IFile> add_file(Server->openFile(os_file_prefix(entry->filename), MODE_READ_SEQUENTIAL_BACKUP));
+		if (add_file.get() == NULL)
+		{
+			entry->failed = true;
+			entry->errmsg = "Error opening file \"" + entry->filename + "\" for ZIP file download. " + os_last_error_str();
+			return;
+		}
+
+		int64 fsize = add_file->Size();
+		if (fsize > 2 * c_zip_max_precompress_size)
+		{
+			entry->stream = true;
+			return;
+		}
+
+		entry->data.resize(static_cast<size_t>(fsize));
+		size_t read = 0;
+		while (read < entry->data.size())
+		{
+			bool has_error = false;
+			_u32 r = add_file->Read(&entry->data[read], static_cast<_u32>(entry->data.size() - read), &has_error);
+			if (has_error)
+			{
+				entry->failed = true;
+				entry->errmsg = "Error reading file \"" + entry->filename + "\" for ZIP file download. " + os_last_error_str();
+				return;
+			}
+			if (r == 0)
+			{
+				break;
+			}
+			read += r;
+		}
+		entry->data.resize(read);
+		entry->uncomp_size = read;
+
+		if (read == 0
+			|| compression_level == MZ_NO_COMPRESSION
+			|| hasCompressedExtension(entry->archivename))
+		{
+			return;
+		}
+
+		size_t comp_size;
+		void* comp = tdefl_compress_mem_to_heap(&entry->data[0], read, &comp_size,
+			tdefl_create_comp_flags_from_zip_params(compression_level, -15, MZ_DEFAULT_STRATEGY));
+
+		if (comp == NULL)
+		{
+			return;
+		}
+
+		if (comp_size < read)
+		{
+			entry->crc32 = static_cast<mz_uint32>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const unsigned char*>(&entry->data[0]), read));
+			std::vector<char>(reinterpret_cast<char*>(comp), reinterpret_cast<char*>(comp) + comp_size).swap(entry->data);
+			entry->compressed = true;
+		}
+
+		mz_free(comp);
+	}
+
+	bool writeFront()
+	{
+		SZipEntry* entry = pending.front();
+
+		if (entry->precompress)
+		{
+			IScopedLock lock(mutex.get());
+			while (!entry->done)
+			{
+				done_cond->wait(&lock);
+			}
+			pending_bytes -= entry->size;
+		}
+
+		pending.pop_front();
+
+		bool ret = writeEntry(*entry);
+		delete entry;
+		return ret;
+	}
+
+	bool writeEntry(SZipEntry& entry)
+	{
+		time_t* last_modified = entry.has_last_modified ? &entry.last_modified : NULL;
+
+		std::string os_err;
+
+		mz_bool rc;
+		if (entry.isdir)
+		{
+			rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, (entry.archivename + "/").c_str(), NULL, 0, NULL, 0,
+				MZ_DEFAULT_LEVEL | MZ_ZIP_FLAG_UTF8_FILENAME,
+				0, 0, last_modified, entry.extra_local.data(), static_cast<mz_uint>(entry.extra_local.size()),
+				entry.extra_central.data(), static_cast<mz_uint>(entry.extra_central.size()));
+
+			if (rc == MZ_FALSE)
+			{
+				os_err = os_last_error_str();
+			}
+		}
+		else if (entry.precompress && !entry.stream)
+		{
+			if (entry.failed)
+			{
+				Server->Log(entry.errmsg, LL_ERROR);
+				return false;
+			}
+
+			if (entry.compressed)
+			{
+				rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, entry.archivename.c_str(), &entry.data[0], entry.data.size(), NULL, 0,
+					compression_level | MZ_ZIP_FLAG_UTF8_FILENAME | MZ_ZIP_FLAG_COMPRESSED_DATA,
+					entry.uncomp_size, entry.crc32, last_modified, entry.extra_local.data(), static_cast<mz_uint>(entry.extra_local.size()),
+					entry.extra_central.data(), static_cast<mz_uint>(entry.extra_central.size()));
+			}
+			else
+			{
+				rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, entry.archivename.c_str(), entry.data.empty() ? NULL : &entry.data[0], entry.data.size(), NULL, 0,
+					MZ_NO_COMPRESSION | MZ_ZIP_FLAG_UTF8_FILENAME,
+					0, 0, last_modified, entry.extra_local.data(), static_cast<mz_uint>(entry.extra_local.size()),
+					entry.extra_central.data(), static_cast<mz_uint>(entry.extra_central.size()));
+			}
+		}
+		else
+		{
+			std::auto_ptr<IFsFile> add_file(Server->openFile(os_file_prefix(entry.filename), MODE_READ_SEQUENTIAL_BACKUP));
+			if (add_file.get() == NULL)
+			{
+				Server->Log("Error opening file \"" + entry.filename + "\" for ZIP file download. " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+			int64 fsize = add_file->Size();
+#ifndef _WIN32
+			int fd = add_file->getOsHandle(true);
+#else
+			int fd =_open_osfhandle(reinterpret_cast<intptr_t>(add_file->getOsHandle(true)), _O_RDONLY);
+			if (fd == -1)
+			{
+				Server->Log("Error opening file fd for \"" + entry.filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+#endif
+			add_file.reset();
+
+			FILE* file = _fdopen(fd, "r");
+			if (file != NULL)
+			{
+				int level = compression_level;
+				if (level != MZ_NO_COMPRESSION
+					&& hasCompressedExtension(entry.archivename))
+				{
+					level = MZ_NO_COMPRESSION;
+				}
+
+				if (level != MZ_NO_COMPRESSION
+					&& fsize >= static_cast<int64>(c_zip_entropy_sample_size))
+				{
+					std::vector<unsigned char> sample(c_zip_entropy_sample_size);
+					size_t r = fread(&sample[0], 1, sample.size(), file);
+					if (byteEntropy(&sample[0], r) > c_zip_store_entropy)
+					{
+						level = MZ_NO_COMPRESSION;
+					}
+
+					if (fseek(file, 0, SEEK_SET) != 0)
+					{
+						Server->Log("Error seeking in file \"" + entry.filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
+						fclose(file);
+						return false;
+					}
+				}
+
+				rc = mz_zip_writer_add_cfile(&zip_archive, entry.archivename.c_str(), file, fsize, last_modified, NULL, 0,
+					level | MZ_ZIP_FLAG_UTF8_FILENAME,
+					entry.extra_local.data(), static_cast<mz_uint>(entry.extra_local.size()),
+					entry.extra_central.data(), static_cast<mz_uint>(entry.extra_central.size()));
+
+				if (rc == MZ_FALSE)
+				{
+					os_err = os_last_error_str();
+				}
+
+				fclose(file);
+			}
+			else
+			{
+				Server->Log("Error opening FILE handle for \"" + entry.filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
+				_close(fd);
+				return false;
+			}
+		}
+
+		if (rc == MZ_FALSE)
+		{
+			mz_zip_error err = mz_zip_get_last_error(&zip_archive);
+			Server->Log("Error while adding file \"" + entry.filename + "\" to ZIP file. Error: " + mz_zip_get_error_string(err) + (os_err.empty() ? "" : (". OS error: " + os_err)), LL_ERROR);
+			return false;
+		}
+
+		return true;
+	}
+
+	mz_zip_archive& zip_archive;
+	int compression_level;
+
+	std::auto_ptr<IMutex> mutex;
+	std::auto_ptr<ICondition> work_cond;
+	std::auto_ptr<ICondition> done_cond;
+	std::deque<SZipEntry*> compress_queue;
+	std::deque<SZipEntry*> pending;
+	int64 pending_bytes;
+	bool do_exit;
+
+	std::vector<CompressWorker*> workers;
+	std::vector<THREADPOOL_TICKET> worker_tickets;
+};
+
+bool add_dir(ZipEntryWriter& zip_writer, const std::string& archivefoldername, const std::string& folderbase, const std::string& foldername, const std::string& start_foldername,
 	    const std::string& hashfolderbase, const std::string& hashfoldername, const std::string& filter,
 		bool token_authentication, const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_special)
 {
@@ -203,18 +653,22 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 			}
 		}
 
-		time_t* last_modified=NULL;
-		time_t last_modified_wt;
+		std::auto_ptr<SZipEntry> entry(new SZipEntry);
+		entry->archivename = archivename;
+		entry->filename = filename;
+		entry->isdir = file.isdir;
+		entry->size = file.size;
+
 		CWData extra_data_local;
 		CWData extra_data_central;
 		if(has_metadata)
 		{
 #ifdef _WIN32
-			last_modified_wt=static_cast<time_t>(metadata.last_modified);
+			entry->last_modified=static_cast<time_t>(metadata.last_modified);
 #else
-			last_modified_wt=static_cast<time_t>(metadata.last_modified);
+			entry->last_modified=static_cast<time_t>(metadata.last_modified);
 #endif
-			last_modified=&last_modified_wt;
+			entry->has_last_modified=true;
 
 			if (metadata.created > 0)
 			{
@@ -262,69 +716,11 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 		//TODO: ZIP has extensions for NTFS/Unix/MacOS attributes, symbolic links, NTFS ACL, ... use them
 
-		std::string os_err;
+		entry->extra_local.assign(extra_data_local.getDataPtr(), extra_data_local.getDataSize());
+		entry->extra_central.assign(extra_data_central.getDataPtr(), extra_data_central.getDataSize());
 
-		mz_bool rc;
-		if(file.isdir)
+		if(!zip_writer.add(entry.release()))
 		{
-			rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, (archivename + "/").c_str(), NULL, 0, NULL, 0,
-											MZ_DEFAULT_LEVEL|MZ_ZIP_FLAG_UTF8_FILENAME,
-											0, 0, last_modified, extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
-											extra_data_central.getDataPtr(), extra_data_central.getDataSize());
-
-			if (rc == MZ_FALSE)
-			{
-				os_err = os_last_error_str();
-			}
-		}
-		else
-		{	
-			std::auto_ptr<IFsFile> add_file(Server->openFile(os_file_prefix(filename), MODE_READ_SEQUENTIAL_BACKUP));
-			if (add_file.get() == NULL)
-			{
-				Server->Log("Error opening file \"" + filename + "\" for ZIP file download. " + os_last_error_str(), LL_ERROR);
-				return false;
-			}
-			int64 fsize = add_file->Size();
-#ifndef _WIN32
-			int fd = add_file->getOsHandle(true);
-#else
-			int fd =_open_osfhandle(reinterpret_cast<intptr_t>(add_file->getOsHandle(true)), _O_RDONLY);
-			if (fd == -1)
-			{
-				Server->Log("Error opening file fd for \"" + filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
-				return false;
-			}
-#endif
-			add_file.reset();
-
-			FILE* file = _fdopen(fd, "r");
-			if (file != NULL)
-			{
-				rc = mz_zip_writer_add_cfile(&zip_archive, archivename.c_str(), file, fsize, last_modified, NULL, 0,
-					MZ_DEFAULT_LEVEL|MZ_ZIP_FLAG_UTF8_FILENAME,
-					extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
-					extra_data_central.getDataPtr(), extra_data_central.getDataSize());
-
-				if (rc == MZ_FALSE)
-				{
-					os_err = os_last_error_str();
-				}
-
-				fclose(file);
-			}
-			else
-			{
-				Server->Log("Error opening FILE handle for \"" + filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
-				_close(fd);
-				return false;
-			}
-		}
-
-		if(rc==MZ_FALSE)
-		{
-			mz_zip_error err = mz_zip_get_last_error(&zip_archive);
-			Server->Log("Error while adding file \""+filename+"\" to ZIP file. Error: "+mz_zip_get_error_string(err)+ (os_err.empty() ? "" : (". OS error: "+os_err)), LL_ERROR);
 			return false;
 		}
 
@@ -348,7 +744,7 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 			if (!symlink_loop && symlink_outside)
 			{
-				if (!add_dir(zip_archive, archivename, folderbase, filename, start_foldername, hashfolderbase, next_hashfoldername, filter,
+				if (!add_dir(zip_writer, archivename, folderbase, filename, start_foldername, hashfolderbase, next_hashfoldername, filter,
 								token_authentication, backup_tokens, tokens, false))
 				{
 					return false;
@@ -371,7 +767,7 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 bool create_zip_to_output(const std::string& folderbase, const std::string& foldername, const std::string& hashfolderbase,
 	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
-	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes)
+	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes, int compression_level)
 {
 	mz_zip_archive zip_archive;
 	memset(&zip_archive, 0, sizeof(zip_archive));
@@ -387,11 +783,16 @@ bool create_zip_to_output(const std::string& folderbase, const std::string& fold
 		return false;
 	}
 
-	if(!add_dir(zip_archive, "", folderbase, foldername, foldername, hashfolderbase,
-		hashfoldername, filter, token_authentication, backup_tokens, tokens, skip_hashes))
 	{
-		Server->Log("Error while adding files and folders to ZIP archive", LL_ERROR);
-		return false;
+		ZipEntryWriter zip_writer(zip_archive, compression_level);
+
+		if(!add_dir(zip_writer, "", folderbase, foldername, foldername, hashfolderbase,
+			hashfoldername, filter, token_authentication, backup_tokens, tokens, skip_hashes)
+			|| !zip_writer.finish())
+		{
+			Server->Log("Error while adding files and folders to ZIP archive", LL_ERROR);
+			return false;
+		}
 	}
 
 	if(!mz_zip_writer_finalize_archive(&zip_archive))
@@ -25,6 +25,24 @@
 
 extern IUrlFactory *url_fak;
 
+namespace
+{
+	void write_clients(JSON::Writer& writer, db_results& res)
+	{
+		writer.beginArray();
+		for(size_t i=0;i<res.size();++i)
+		{
+			writer.beginObject();
+			writer.key("id");
+			writer.value(watoi(res[i]["id"]));
+			writer.key("name");
+			writer.value(res[i]["name"]);
+			writer.endObject();
+		}
+		writer.endArray();
+	}
+}
+
 ACTION_IMPL(logs)
 {
 	Helper helper(tid, &POST, &PARAMS);
@@ -66,6 +84,9 @@ ACTION_IMPL(logs)
 	}
 	if(session!=NULL && rights!="none")
 	{
+		JSON::Writer writer(tid);
+		writer.beginObject();
+
 		IDatabase *db=helper.getDatabase();
 		std::string qstr="SELECT c.id AS id, c.name AS name FROM clients c WHERE ";
 		if(!clientid.empty()) qstr+=backupaccess::constructFilter(clientid, "c.id")+" AND ";
@@ -74,19 +95,12 @@ ACTION_IMPL(logs)
 		IQuery *q_clients=db->Prepare(qstr);
 		db_results res=q_clients->Read();
 		q_clients->Reset();
-		JSON::Array clients;
-		for(size_t i=0;i<res.size();++i)
-		{
-			JSON::Object obj;
-			obj.set("id", watoi(res[i]["id"]));
-			obj.set("name", res[i]["name"]);
-			clients.add(obj);
-		}
+		writer.key("clients");
+		write_clients(writer, res);
 		if(clientid.empty())
 		{
 			ret.set("all_clients", JSON::Value(true));
 		}
-		ret.set("clients", clients);
 		ret.set("has_user", session->id!=SESSION_ID_TOKEN_AUTH && session->id!=SESSION_ID_ADMIN);
 
 		IQuery *q_log_right_clients=db->Prepare("SELECT id, name FROM clients"+(clientid.empty()?""
@@ -94,15 +108,8 @@ ACTION_IMPL(logs)
 
 		res=q_log_right_clients->Read();
 		q_log_right_clients->Reset();
-		JSON::Array log_right_clients;
-		for(size_t i=0;i<res.size();++i)
-		{
-			JSON::Object obj;
-			obj.set("id", watoi(res[i]["id"]));
-			obj.set("name", res[i]["name"]);
-			log_right_clients.add(obj);
-		}
-		ret.set("log_right_clients", log_right_clients);
+		writer.key("log_right_clients");
+		write_clients(writer, res);
 
 		ret.set("filter", filter);
 		if(s_logid.empty())
@@ -239,14 +246,22 @@ ACTION_IMPL(logs)
 				
 				if(ok)
 				{
-					JSON::Object log;
-					log.set("data", res[0]["logdata"]);
-					log.set("time", watoi64(res[0]["time"]));
-					log.set("clientname", res[0]["name"]);
-					ret.set("log", log);
+					writer.key("log");
+					writer.beginObject();
+					writer.key("data");
+					writer.value(res[0]["logdata"]);
+					writer.key("time");
+					writer.value(watoi64(res[0]["time"]));
+					writer.key("clientname");
+					writer.value(res[0]["name"]);
+					writer.endObject();
 				}
 			}
 		}
+
+		writer.members(ret);
+		writer.endObject();
+		return;
 	}
 	else
 	{
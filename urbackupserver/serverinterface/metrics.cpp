@@ -0,0 +1,33 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef CLIENT_ONLY
+
+#include "action_header.h"
+
+/**
+* Prometheus text exposition of the metrics registered via IServer::getMetric().
+* Only registered if the server is started with "--enable_metrics true", as it does not require a session.
+*/
+ACTION_IMPL(metrics)
+{
+	Server->setContentType(tid, "text/plain; version=0.0.4");
+	Server->Write(tid, Server->getMetricsText());
+}
+
+#endif //CLIENT_ONLY
@@ -28,6 +28,8 @@
 
 #include <algorithm>
 #include <memory>
+#include <set>
+#include <map>
 
 extern ICryptoFactory *crypto_fak;
 
@@ -616,7 +618,11 @@ ACTION_IMPL(status)
 			BackupServer::updateDeletePending();
 		}
 
-		JSON::Array status;
+		JSON::Writer writer(tid);
+		writer.beginObject();
+		writer.key("status");
+		writer.beginArray();
+
 		IDatabase *db=helper.getDatabase();
 		std::string filter;
 		if(!clientids.empty())
@@ -649,6 +655,14 @@ ACTION_IMPL(status)
 
 		std::vector<SStatus> client_status=ServerStatus::getStatus();
 
+		std::map<std::string, std::vector<size_t> > client_status_idx;
+		for(size_t j=0;j<client_status.size();++j)
+		{
+			client_status_idx[client_status[j].client].push_back(j);
+		}
+
+		std::set<std::string> db_clientnames;
+
 		for(size_t i=0;i<res.size();++i)
 		{
 			JSON::Object stat;
@@ -674,50 +688,51 @@ ACTION_IMPL(status)
 			JSON::Array processes;
 			int64 lastseen = watoi64(res[i]["lastseen"]);
 
-			for(size_t j=0;j<client_status.size();++j)
+			db_clientnames.insert(clientname);
+
+			std::map<std::string, std::vector<size_t> >::iterator it_idx = client_status_idx.find(clientname);
+			for(size_t l=0;it_idx!=client_status_idx.end() && l<it_idx->second.size();++l)
 			{
-				if(client_status[j].client==clientname)
+				size_t j = it_idx->second[l];
+				if(client_status[j].r_online==true)
 				{
-					if(client_status[j].r_online==true)
-					{
-						curr_status=&client_status[j];
-						online=true;
-					}
+					curr_status=&client_status[j];
+					online=true;
+				}
 
-					unsigned char *ips=(unsigned char*)&client_status[j].ip_addr;
-					ip=convert(ips[0])+"."+convert(ips[1])+"."+convert(ips[2])+"."+convert(ips[3]);
+				unsigned char *ips=(unsigned char*)&client_status[j].ip_addr;
+				ip=convert(ips[0])+"."+convert(ips[1])+"."+convert(ips[2])+"."+convert(ips[3]);
 
-					client_version_string=client_status[j].client_version_string;
-					os_version_string=client_status[j].os_version_string;
+				client_version_string=client_status[j].client_version_string;
+				os_version_string=client_status[j].os_version_string;
 
-					if (client_status[j].lastseen > lastseen)
-					{
-						lastseen = client_status[j].lastseen;
-					}
+				if (client_status[j].lastseen > lastseen)
+				{
+					lastseen = client_status[j].lastseen;
+				}
 
-					switch(client_status[j].status_error)
+				switch(client_status[j].status_error)
+				{
+				case se_ident_error:
+					i_status=11; break;
+				case se_too_many_clients:
+					i_status=12; break;
+				case se_authentication_error:
+					i_status=13; break;
+				default:
+					if(!client_status[j].processes.empty())
 					{
-					case se_ident_error:
-						i_status=11; break;
-					case se_too_many_clients:
-						i_status=12; break;
-					case se_authentication_error:
-						i_status=13; break;
-					default:
-						if(!client_status[j].processes.empty())
-						{
-							i_status = client_status[j].processes[0].action;
-						}
+						i_status = client_status[j].processes[0].action;
 					}
+				}
 
-					for(size_t k=0;k<client_status[j].processes.size();++k)
-					{
-						SProcess& process = client_status[j].processes[k];
-						JSON::Object proc;
-						proc.set("action", process.action);
-						proc.set("pcdone", process.pcdone);
-						processes.add(proc);
-					}
+				for(size_t k=0;k<client_status[j].processes.size();++k)
+				{
+					SProcess& process = client_status[j].processes[k];
+					JSON::Object proc;
+					proc.set("action", process.action);
+					proc.set("pcdone", process.pcdone);
+					processes.add(proc);
 				}
 			}
 
@@ -730,7 +745,7 @@ ACTION_IMPL(status)
 			stat.set("processes", processes);
 			stat.set("lastseen", lastseen);
 
-			status.add(stat);
+			writer.value(stat);
 		}
 
 		if(rights=="all")
@@ -738,15 +753,7 @@ ACTION_IMPL(status)
 			bool has_ident_error_clients = false;
 			for(size_t i=0;i<client_status.size();++i)
 			{
-				bool found=false;
-				for(size_t j=0;j<res.size();++j)
-				{
-					if(res[j]["name"]==client_status[i].client)
-					{
-						found=true;
-						break;
-					}
-				}
+				bool found=db_clientnames.find(client_status[i].client)!=db_clientnames.end();
 
 				if(found || client_status[i].client.empty()) continue;
 
@@ -781,7 +788,7 @@ ACTION_IMPL(status)
 				stat.set("image_ok", false);
 				stat.set("rejected", true);
 
-				status.add(stat);
+				writer.value(stat);
 			}
 
 			if (has_ident_error_clients)
@@ -794,6 +801,8 @@ ACTION_IMPL(status)
 				}
 			}
 		}
+		writer.endArray();
+
 		JSON::Array extra_clients;
 
 		if(rights=="all")
@@ -825,7 +834,6 @@ ACTION_IMPL(status)
 			ret.set("allow_modify_clients", true);
 		}
 
-		ret.set("status", status);
 		ret.set("extra_clients", extra_clients);
 		ret.set("server_identity", helper.getStrippedServerIdentity());
 
@@ -865,6 +873,10 @@ ACTION_IMPL(status)
 		{
 			ret.set("big_endian", true);
 		}
+
+		writer.members(ret);
+		writer.endObject();
+		return;
 	}
 	else
 	{
@@ -77,7 +77,7 @@ namespace
 
 				if(!entries.empty())
 				{
-					ServerFilesDao::SStatFileEntry fentry = filesdao.getStatFileEntry(entries.begin()->second);
+					ServerFilesDao::SStatFileEntry fentry = filesdao.forEntry(entries.begin()->second).getStatFileEntry(entries.begin()->second);
 
 					if(fentry.exists)
 					{
@@ -19,6 +19,45 @@
 #include "TreeDiff.h"
 #include "TreeReader.h"
 #include <algorithm>
+#include <string.h>
+
+/**
+* Diffs two file lists by walking both of them in parallel. Entries within a
+* directory are sorted (files before directories, then by name), so each
+* directory level is a merge of two sorted lists and only the path from the
+* root to the current entry is kept in memory.
+*/
+
+namespace
+{
+	//Unchanged subtrees with more entries than this are reported as large
+	const size_t large_subtree_size=10;
+
+	void add_treesize(size_t& treesize, size_t add)
+	{
+		treesize=(std::min)(treesize+add, large_subtree_size+1);
+	}
+}
+
+struct TreeDiff::SDiffContext
+{
+	std::vector<size_t>* diffs;
+	std::vector<size_t>* deleted_ids;
+	std::vector<size_t>* large_unchanged_subtrees;
+	std::vector<size_t>* modified_inplace_ids;
+	std::vector<size_t>* dir_diffs;
+	std::vector<size_t>* deleted_inplace_ids;
+	bool has_symbit;
+	bool is_windows;
+};
+
+struct TreeDiff::SRootEntry
+{
+	STreeEntry entry;
+	int64 children_pos;
+	size_t children_line;
+	bool mapped;
+};
 
 std::vector<size_t> TreeDiff::diffTrees(const std::string &t1, const std::string &t2, bool &error,
 	std::vector<size_t> *deleted_ids, std::vector<size_t>* large_unchanged_subtrees,
@@ -28,29 +67,44 @@ std::vector<size_t> TreeDiff::diffTrees(const std::string &t1, const std::string
 	std::vector<size_t> ret;
 
 	TreeReader r1;
-	if(!r1.readTree(t1))
+	if(!r1.open(t1))
 	{
 		error=true;
 		return ret;
 	}
 
 	TreeReader r2;
-	if(!r2.readTree(t2))
+	if(!r2.open(t2))
 	{
 		error=true;
 		return ret;
 	}
 
-	gatherDiffs(&(*r1.getNodes())[0], &(*r2.getNodes())[0], 0, ret, modified_inplace_ids, 
-		dir_diffs, deleted_inplace_ids, has_symbit, is_windows);
+	SDiffContext ctx;
+	ctx.diffs=&ret;
+	ctx.deleted_ids=deleted_ids;
+	ctx.large_unchanged_subtrees=large_unchanged_subtrees;
+	ctx.modified_inplace_ids=modified_inplace_ids;
+	ctx.dir_diffs=&dir_diffs;
+	ctx.deleted_inplace_ids=deleted_inplace_ids;
+	ctx.has_symbit=has_symbit;
+	ctx.is_windows=is_windows;
+
+	if(!diffRoot(r1, r2, ctx))
+	{
+		error=true;
+		ret.clear();
+		return ret;
+	}
+
 	if(deleted_ids!=NULL)
 	{
-		gatherDeletes(&(*r1.getNodes())[0], *deleted_ids);
 		std::sort(deleted_ids->begin(), deleted_ids->end());
+		//A root directory can be matched more than once if names are duplicated
+		deleted_ids->erase(std::unique(deleted_ids->begin(), deleted_ids->end()), deleted_ids->end());
 	}
 	if(large_unchanged_subtrees!=NULL)
 	{
-		gatherLargeUnchangedSubtrees(&(*r2.getNodes())[0], *large_unchanged_subtrees);
 		std::sort(large_unchanged_subtrees->begin(), large_unchanged_subtrees->end());
 	}
 
@@ -70,207 +124,411 @@ std::vector<size_t> TreeDiff::diffTrees(const std::string &t1, const std::string
 	return ret;
 }
 
-void TreeDiff::gatherDiffs(TreeNode *t1, TreeNode *t2, size_t depth, std::vector<size_t> &diffs,
-	std::vector<size_t> *modified_inplace_ids, std::vector<size_t> &dir_diffs,
-	std::vector<size_t> *deleted_inplace_ids, bool has_symbit, bool is_windows)
+bool TreeDiff::diffRoot(TreeReader& r1, TreeReader& r2, SDiffContext& ctx)
 {
-	size_t nc_2=t2->getNumChildren();
-	size_t nc_1=t1->getNumChildren();
-	TreeNode *c2=t2->getFirstChild();
-	TreeNode *c1=t1->getFirstChild();
-	bool did_subtree_change=false;
-	while(c2!=NULL)
-	{		
-		int cmp = 1;
-		if(c1!=NULL)
+	//The root may be unsorted, so entries in the root of the first list are
+	//looked up by name. Remember where their children start.
+	std::vector<SRootEntry> roots1;
+	STreeEntry entry;
+	size_t depth=0;
+	while(r1.next(entry))
+	{
+		if(entry.type=='u')
 		{
-			if (c1->getType() == 'f'
-				&& c2->getType() == 'd')
+			if(depth==0)
 			{
-				cmp = -1;
+				break;
 			}
-			else if (c1->getType() == 'd'
-				&& c2->getType() == 'f')
+			--depth;
+		}
+		else
+		{
+			if(depth==0)
 			{
-				cmp = 1;
+				SRootEntry root_entry;
+				root_entry.entry=entry;
+				root_entry.children_pos=r1.getPos();
+				root_entry.children_line=r1.getLine();
+				root_entry.mapped=false;
+				roots1.push_back(root_entry);
 			}
-			else
+
+			if(entry.type=='d')
 			{
-				cmp = c1->nameCompare(*c2);
+				++depth;
 			}
 		}
+	}
 
-		//root may be unsorted
-		if (cmp != 0
-			&& depth == 0)
+	if(r1.hasError())
+	{
+		return false;
+	}
+
+	bool subtree_changed=false;
+	size_t treesize=1;
+
+	STreeEntry c2;
+	bool has_c2;
+	if(!readChild(r2, c2, has_c2))
+	{
+		return false;
+	}
+
+	size_t i1=0;
+	while(has_c2)
+	{
+		int cmp=1;
+		if(i1<roots1.size())
+		{
+			cmp=compareEntries(roots1[i1].entry, c2);
+		}
+
+		if(cmp!=0)
 		{
-			TreeNode* sn = t1->getFirstChild();
-			while (sn != NULL)
+			for(size_t j=0;j<roots1.size();++j)
 			{
-				if (c2->getType() == sn->getType()
-					&& c2->nameEquals(*sn)
-					&& sn->getMappedNode()==NULL)
+				if(roots1[j].entry.type==c2.type
+					&& roots1[j].entry.name==c2.name
+					&& !roots1[j].mapped)
 				{
-					cmp = 0;
-					c1 = sn;
+					cmp=0;
+					i1=j;
 					break;
 				}
-				sn = sn->getNextSibling();
 			}
 		}
 
 		if(cmp==0)
 		{
-			bool equal_dir = (c1->getType()=='d' && c2->getType()=='d');
-			bool data_equals = c1->dataEquals(*c2);
+			SRootEntry& c1=roots1[i1];
+			if(c1.entry.type=='d'
+				&& !r1.seek(c1.children_pos, c1.children_line))
+			{
+				return false;
+			}
 
-			if(equal_dir && !data_equals)
+			bool mapped;
+			if(!diffMatched(r1, r2, c1.entry, c2, ctx, subtree_changed, treesize, mapped))
 			{
-				dir_diffs.push_back(c2->getId());
-				subtreeChanged(c2);
+				return false;
 			}
 
-			if( equal_dir
-				|| data_equals )
+			if(mapped)
 			{
-				gatherDiffs(c1, c2, depth+1, diffs, modified_inplace_ids, 
-					dir_diffs, deleted_inplace_ids, has_symbit, is_windows);
-				c2->setMappedNode(c1);
-				c1->setMappedNode(c2);
+				c1.mapped=true;
 			}
-			else
+
+			++i1;
+			if(!readChild(r2, c2, has_c2))
 			{
-				if( modified_inplace_ids!=NULL
-					&& c1->getType() == c2->getType() )
-				{
-					modified_inplace_ids->push_back(c2->getId());
-				}
+				return false;
+			}
+		}
+		else if(cmp<0)
+		{
+			++i1;
+		}
+		else
+		{
+			if(!addEntry(r2, c2, ctx, subtree_changed, treesize)
+				|| !readChild(r2, c2, has_c2))
+			{
+				return false;
+			}
+		}
+	}
 
-				if (deleted_inplace_ids != NULL
-					&& c1->getType() == c2->getType()
-					&& isSymlink(c1, has_symbit, is_windows) == isSymlink(c2, has_symbit, is_windows) )
-				{
-					deleted_inplace_ids->push_back(c1->getId());
-				}
-				
-				diffs.push_back(c2->getId());
-				subtreeChanged(c2);				
+	for(size_t i=0;i<roots1.size();++i)
+	{
+		if(!roots1[i].mapped
+			&& ctx.deleted_ids!=NULL)
+		{
+			if(roots1[i].entry.type=='d'
+				&& !r1.seek(roots1[i].children_pos, roots1[i].children_line))
+			{
+				return false;
 			}
 
-#ifndef _WIN32
-			/**
-			* Stop it from moving directories above symlinks to the directory link
-			* pool on Linux/FreeBSD, as then symbolic links within that directory
-			* would not be able to point to the current backup (symbolic links
-			* are relative to the symbolic link location)
-			* On Windows this works. Could be because it uses junctions for the
-			* symlinks to the directory pool.
-			**/
-			if (isSymlink(c2, has_symbit, is_windows))
+			if(!deleteEntry(r1, roots1[i].entry, ctx))
 			{
-				subtreeChanged(c2);
+				return false;
 			}
-#endif
+		}
+	}
+
+	return true;
+}
+
+bool TreeDiff::diffLevel(TreeReader& r1, TreeReader& r2, SDiffContext& ctx,
+	bool& subtree_changed, size_t& treesize)
+{
+	STreeEntry c1;
+	STreeEntry c2;
+	bool has_c1;
+	bool has_c2;
+	if(!readChild(r1, c1, has_c1)
+		|| !readChild(r2, c2, has_c2))
+	{
+		return false;
+	}
 
-			c1=c1->getNextSibling();
-			c2=c2->getNextSibling();
+	while(has_c2)
+	{
+		int cmp=1;
+		if(has_c1)
+		{
+			cmp=compareEntries(c1, c2);
+		}
+
+		if(cmp==0)
+		{
+			bool mapped;
+			if(!diffMatched(r1, r2, c1, c2, ctx, subtree_changed, treesize, mapped))
+			{
+				return false;
+			}
+
+			if(!mapped
+				&& !deleteEntry(r1, c1, ctx))
+			{
+				return false;
+			}
+
+			if(!readChild(r1, c1, has_c1)
+				|| !readChild(r2, c2, has_c2))
+			{
+				return false;
+			}
 		}
 		else if(cmp<0)
 		{
-			c1=c1->getNextSibling();
+			if(!deleteEntry(r1, c1, ctx)
+				|| !readChild(r1, c1, has_c1))
+			{
+				return false;
+			}
 		}
 		else
 		{
-			diffs.push_back(c2->getId());
-			subtreeChanged(c2);
+			if(!addEntry(r2, c2, ctx, subtree_changed, treesize)
+				|| !readChild(r2, c2, has_c2))
+			{
+				return false;
+			}
+		}
+	}
 
-			c2=c2->getNextSibling();
+	while(has_c1)
+	{
+		if(!deleteEntry(r1, c1, ctx)
+			|| !readChild(r1, c1, has_c1))
+		{
+			return false;
 		}
 	}
+
+	return true;
 }
 
-void TreeDiff::gatherDeletes(TreeNode *t1, std::vector<size_t> &deleted_ids)
+bool TreeDiff::diffMatched(TreeReader& r1, TreeReader& r2, const STreeEntry& c1, const STreeEntry& c2,
+	SDiffContext& ctx, bool& subtree_changed, size_t& treesize, bool& mapped)
 {
-	TreeNode *c1=t1->getFirstChild();
-	while(c1!=NULL)
+	bool equal_dir = (c1.type=='d' && c2.type=='d');
+	bool data_equals = dataEquals(c1, c2);
+
+	if(equal_dir && !data_equals)
 	{
-		if(c1->getMappedNode()==NULL)
+		ctx.dir_diffs->push_back(c2.id);
+		subtree_changed=true;
+	}
+
+	if(equal_dir)
+	{
+		size_t large_start = ctx.large_unchanged_subtrees!=NULL ? ctx.large_unchanged_subtrees->size() : 0;
+		bool child_changed=false;
+		size_t child_treesize=1;
+
+		if(!diffLevel(r1, r2, ctx, child_changed, child_treesize))
 		{
-			deleted_ids.push_back(c1->getId());
+			return false;
 		}
-		gatherDeletes(c1, deleted_ids);
-		c1=c1->getNextSibling();
+
+		if(ctx.large_unchanged_subtrees!=NULL
+			&& !child_changed
+			&& child_treesize>large_subtree_size)
+		{
+			//Replaces large unchanged subtrees found below
+			ctx.large_unchanged_subtrees->resize(large_start);
+			ctx.large_unchanged_subtrees->push_back(c2.id);
+		}
+
+		if(child_changed)
+		{
+			subtree_changed=true;
+		}
+		add_treesize(treesize, child_treesize);
+		mapped=true;
+	}
+	else if(data_equals)
+	{
+		add_treesize(treesize, 1);
+		mapped=true;
+	}
+	else
+	{
+		if( ctx.modified_inplace_ids!=NULL
+			&& c1.type == c2.type )
+		{
+			ctx.modified_inplace_ids->push_back(c2.id);
+		}
+
+		if (ctx.deleted_inplace_ids != NULL
+			&& c1.type == c2.type
+			&& isSymlink(c1, ctx.has_symbit, ctx.is_windows) == isSymlink(c2, ctx.has_symbit, ctx.is_windows) )
+		{
+			ctx.deleted_inplace_ids->push_back(c1.id);
+		}
+
+		ctx.diffs->push_back(c2.id);
+		subtree_changed=true;
+		add_treesize(treesize, 1);
+		mapped=false;
+	}
+
+#ifndef _WIN32
+	/**
+	* Stop it from moving directories above symlinks to the directory link
+	* pool on Linux/FreeBSD, as then symbolic links within that directory
+	* would not be able to point to the current backup (symbolic links
+	* are relative to the symbolic link location)
+	* On Windows this works. Could be because it uses junctions for the
+	* symlinks to the directory pool.
+	**/
+	if (isSymlink(c2, ctx.has_symbit, ctx.is_windows))
+	{
+		subtree_changed=true;
 	}
+#endif
+
+	return true;
 }
 
-void TreeDiff::subtreeChanged(TreeNode* t2)
+bool TreeDiff::addEntry(TreeReader& r2, const STreeEntry& c2, SDiffContext& ctx,
+	bool& subtree_changed, size_t& treesize)
 {
-	TreeNode* p = t2->getParent();
-	if(p==NULL) return;
+	ctx.diffs->push_back(c2.id);
+	subtree_changed=true;
 
-	do
+	size_t entry_treesize=1;
+	if(c2.type=='d'
+		&& !skipSubtree(r2, NULL, entry_treesize))
 	{
-		if(p->getSubtreeChanged())
-		{
-			return;
-		}
+		return false;
+	}
+
+	add_treesize(treesize, entry_treesize);
+	return true;
+}
 
-		p->setSubtreeChanged(true);
-		p = p->getParent();
+bool TreeDiff::deleteEntry(TreeReader& r1, const STreeEntry& c1, SDiffContext& ctx)
+{
+	if(ctx.deleted_ids!=NULL)
+	{
+		ctx.deleted_ids->push_back(c1.id);
 	}
-	while(p!=NULL);
+
+	size_t treesize=1;
+	if(c1.type=='d')
+	{
+		return skipSubtree(r1, ctx.deleted_ids, treesize);
+	}
+
+	return true;
 }
 
-void TreeDiff::gatherLargeUnchangedSubtrees( TreeNode *t2, std::vector<size_t> &large_unchanged_subtrees )
+bool TreeDiff::readChild(TreeReader& r, STreeEntry& entry, bool& has_entry)
 {
-	TreeNode *c2=t2->getFirstChild();
-	while(c2!=NULL)
+	if(!r.next(entry))
 	{
-		if(!c2->getSubtreeChanged()
-			&& c2->getMappedNode()!=NULL
-			&& getTreesize(c2,10)>10)
+		has_entry=false;
+		return !r.hasError();
+	}
+
+	has_entry = entry.type!='u';
+	return true;
+}
+
+bool TreeDiff::skipSubtree(TreeReader& r, std::vector<size_t>* ids, size_t& treesize)
+{
+	STreeEntry entry;
+	size_t depth=1;
+	while(depth>0
+		&& r.next(entry))
+	{
+		if(entry.type=='u')
 		{
-			large_unchanged_subtrees.push_back(c2->getId());
+			--depth;
 		}
 		else
 		{
-			gatherLargeUnchangedSubtrees(c2, large_unchanged_subtrees);
+			if(ids!=NULL)
+			{
+				ids->push_back(entry.id);
+			}
+
+			add_treesize(treesize, 1);
+
+			if(entry.type=='d')
+			{
+				++depth;
+			}
 		}
-		c2=c2->getNextSibling();
 	}
+
+	return !r.hasError();
 }
 
-size_t TreeDiff::getTreesize( TreeNode* t, size_t limit )
+int TreeDiff::compareEntries(const STreeEntry& c1, const STreeEntry& c2)
 {
-	size_t treesize=1;
-	TreeNode *c=t->getFirstChild();
-	while(c!=NULL)
+	//Files are sorted before directories
+	if (c1.type == 'f'
+		&& c2.type == 'd')
 	{
-		treesize+=getTreesize(c, limit);
-		if(treesize>limit)
-		{
-			return treesize;
-		}
-		c=c->getNextSibling();
+		return -1;
+	}
+	else if (c1.type == 'd'
+		&& c2.type == 'f')
+	{
+		return 1;
+	}
+	else
+	{
+		return strcmp(c1.name.c_str(), c2.name.c_str());
+	}
+}
+
+bool TreeDiff::dataEquals(const STreeEntry& c1, const STreeEntry& c2)
+{
+	if(c1.data[0]!=c2.data[0])
+	{
+		return false;
 	}
-	return treesize;
+
+	return c1.type!='f' || c1.data[1]==c2.data[1];
 }
 
-bool TreeDiff::isSymlink(TreeNode * n, bool has_symbit, bool is_windows)
+bool TreeDiff::isSymlink(const STreeEntry& n, bool has_symbit, bool is_windows)
 {
-	const uint64* dataptr = reinterpret_cast<const uint64*>(n->getDataPtr());
-	uint64 change_indicator = 0;
-	if (n->getType() == 'd'
-		&& n->getDataSize() == sizeof(uint64))
+	uint64 change_indicator;
+	if (n.type == 'f')
 	{
-		change_indicator = *dataptr;
+		change_indicator = static_cast<uint64>(n.data[1]);
 	}
-	else if (n->getType() == 'f'
-		&& n->getDataSize() == 2 * sizeof(uint64))
+	else
 	{
-		change_indicator = *(dataptr + 1);
+		change_indicator = static_cast<uint64>(n.data[0]);
 	}
-
 	if (has_symbit)
 	{
 		const uint64 symlink_bit = 0x4000000000000000ULL;
@@ -289,7 +547,7 @@ bool TreeDiff::isSymlink(TreeNode * n, bool has_symbit, bool is_windows)
 
 		if (is_windows)
 		{
-			if ((!(change_indicator & neg_bit) || n->getType() == 'd')
+			if ((!(change_indicator & neg_bit) || n.type == 'd')
 				&& (change_indicator & symlink_mask) > 0)
 			{
 				return true;
@@ -1,7 +1,8 @@
 #include <string>
 #include <vector>
 
-class TreeNode;
+class TreeReader;
+struct STreeEntry;
 
 class TreeDiff
 {
@@ -12,12 +13,20 @@ public:
 		std::vector<size_t> *deleted_inplace_ids, bool has_symbit, bool is_windows);
 
 private:
-	static void gatherDiffs(TreeNode *t1, TreeNode *t2, size_t depth, std::vector<size_t> &diffs,
-		std::vector<size_t> *modified_inplace_ids, std::vector<size_t> &dir_diffs,
-		std::vector<size_t> *deleted_inplace_ids, bool has_symbit, bool is_window);
-	static void gatherDeletes(TreeNode *t1, std::vector<size_t> &deleted_ids);
-	static void gatherLargeUnchangedSubtrees(TreeNode *t2, std::vector<size_t> &changed_subtrees);
-	static void subtreeChanged(TreeNode* t2);
-	static size_t getTreesize(TreeNode* t, size_t limit);
-	static bool isSymlink(TreeNode* n, bool has_symbit, bool is_window);
-};
\ No newline at end of file
+	struct SDiffContext;
+	struct SRootEntry;
+
+	static bool diffRoot(TreeReader& r1, TreeReader& r2, SDiffContext& ctx);
+	static bool diffLevel(TreeReader& r1, TreeReader& r2, SDiffContext& ctx,
+		bool& subtree_changed, size_t& treesize);
+	static bool diffMatched(TreeReader& r1, TreeReader& r2, const STreeEntry& c1, const STreeEntry& c2,
+		SDiffContext& ctx, bool& subtree_changed, size_t& treesize, bool& mapped);
+	static bool addEntry(TreeReader& r2, const STreeEntry& c2, SDiffContext& ctx,
+		bool& subtree_changed, size_t& treesize);
+	static bool deleteEntry(TreeReader& r1, const STreeEntry& c1, SDiffContext& ctx);
+	static bool readChild(TreeReader& r, STreeEntry& entry, bool& has_entry);
+	static bool skipSubtree(TreeReader& r, std::vector<size_t>* ids, size_t& treesize);
+	static int compareEntries(const STreeEntry& c1, const STreeEntry& c2);
+	static bool dataEquals(const STreeEntry& c1, const STreeEntry& c2);
+	static bool isSymlink(const STreeEntry& n, bool has_symbit, bool is_windows);
+};
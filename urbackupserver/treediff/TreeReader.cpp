@@ -17,348 +17,298 @@
 **************************************************************************/
 
 #include "TreeReader.h"
-#include <fstream>
-#include <iostream>
-#include <memory.h>
-#include <stack>
 #include "../../stringtools.h"
 #include "../../urbackupcommon/os_functions.h"
 #include "../../Interface/Server.h"
-#include <assert.h>
+#include "../../urbackupcommon/filelist_utils.h"
+#include <string.h>
+#include <algorithm>
 
-const size_t buffer_size=4096;
+const size_t buffer_size=32768;
 
-bool TreeReader::readTree(const std::string &fn)
+TreeReader::TreeReader()
+	: buffer_pos(0), buffer_offset(0), eof(false), line(0), error(false), binary(false)
 {
-	std::fstream in;
+}
+
+bool TreeReader::open(const std::string &fn)
+{
+	this->fn = fn;
 	in.open(fn.c_str(), std::ios::in | std::ios::binary );
 	if (!in.is_open())
 	{
 		Log("Cannot read file tree from file \"" + fn + "\"");
+		error = true;
 		return false;
 	}
 
-	size_t read;
-	char buffer[buffer_size];
+	char header[filelist_binary_magic_size+1];
+	in.read(header, sizeof(header));
+	if(in.gcount()==sizeof(header)
+		&& memcmp(header, filelist_binary_magic, filelist_binary_magic_size)==0)
+	{
+		if(header[filelist_binary_magic_size]!=filelist_binary_version)
+		{
+			Log("Unknown binary file list version in \"" + fn + "\"");
+			error = true;
+			return false;
+		}
+
+		binary = true;
+		buffer_offset = sizeof(header);
+	}
+
+	in.clear();
+	in.seekg(buffer_offset, std::ios::beg);
+
+	return true;
+}
+
+bool TreeReader::next(STreeEntry& entry)
+{
+	if(binary)
+	{
+		return nextBinary(entry);
+	}
+
 	int state=0;
-	size_t lines=0;
-	size_t stringbuffer_size=0;
-	std::string name;
 	char ltype=0;
-	do
+	entry.name.clear();
+	data.clear();
+
+	while(true)
 	{
-		in.read(buffer, buffer_size);
-		read=(size_t)in.gcount();
-		
-		for(size_t i=0;i<read;++i)
+		if(buffer_pos>=buffer.size())
 		{
-			const char ch=buffer[i];
-			switch(state)
+			if(eof)
 			{
-			case 0:
-				if(ch=='f' || ch=='d')
-				{
-					ltype = ch;
-					state = 1;
-				}
-				else if(ch=='u')
-				{
-					state = 10;
-					ltype = 'd';
-					name = "..";
-				}
-				else
-				{
-					Log("Error parsing file readTree - 0. Expected 'f', 'd', or 'u'. Got '"+std::string(1, ch)+"' at line "+convert(lines)+" while reading "+fn);
-					return false;
-				}
-				break;
-			case 1:
-				//"
-				state=2;
+				//Incomplete last line is ignored
+				return false;
+			}
+
+			buffer_offset+=buffer.size();
+			buffer.resize(buffer_size);
+			in.read(&buffer[0], buffer_size);
+			size_t read=(size_t)in.gcount();
+			buffer.resize(read);
+			buffer_pos=0;
+
+			if(read<buffer_size)
+			{
+				eof=true;
+			}
+
+			continue;
+		}
+
+		const char ch=buffer[buffer_pos++];
+		switch(state)
+		{
+		case 0:
+			if(ch=='f' || ch=='d')
+			{
+				ltype=ch;
+				state=1;
+			}
+			else if(ch=='u')
+			{
+				entry.name="..";
+				state=10;
+			}
+			else
+			{
+				Log("Error parsing file readTree - 1. Expected 'f', 'd', or 'u'. Got '" + std::string(1, ch) + "' at line " + convert(line)+" while reading "+fn);
+				error=true;
+				return false;
+			}
+			break;
+		case 1:
+			//"
+			state=2;
+			break;
+		case 2:
+			if(ch=='"')
+			{
+				state=3;
+			}
+			else if(ch=='\\')
+			{
+				state=5;
+			}
+			else
+			{
+				entry.name+=ch;
+			}
+			break;
+		case 5:
+			if(ch!='\"' && ch!='\\')
+			{
+				entry.name+='\\';
+			}
+			entry.name+=ch;
+			state=2;
+			break;
+		case 3:
+			if(ch==' ')
+			{
+				state=4;
 				break;
-			case 2:
-				if(ch=='"')
-				{
-					state=3;
-				}
-				else if(ch=='\\')
-				{
-					state=5;
-				}
-				else
+			}
+			else
+			{
+				state=10;
+			}
+		case 4:
+			if(state==4)
+			{
+				if(ch!='\n')
 				{
-					name+=ch;
+					data+=ch;
+					break;
 				}
-				break;
-			case 5:
-				if(ch!='\"' && ch!='\\')
+			}
+		case 10:
+			if(ch=='\n')
+			{
+				entry.id=line;
+				++line;
+
+				if(entry.name=="..")
 				{
-					name+='\\';
+					entry.type='u';
 				}
-				name+=ch;
-				state=2;
-				break;
-			case 3:
-				if(ch==' ')
+				else if(ltype=='f')
 				{
-					state=4;
-					break;
+					entry.type='f';
+					entry.data[0]=os_atoi64(getuntil(" ", data));
+					entry.data[1]=os_atoi64(getafter(" ", data));
 				}
 				else
 				{
-					state=10;
-				}
-			case 4:
-				if(state==4)
-				{
-					if(ch!='\n')
-					{
-						break;
-					}
+					entry.type='d';
+					entry.data[0]=os_atoi64(getafter(" ", data));
+					entry.data[1]=0;
 				}
-			case 10:
-				if(ch=='\n')
-				{
-					state=0;
-					if(ltype=='f')
-					{
-						stringbuffer_size+=2*sizeof(int64);
-					}
-					if(ltype!='d' || name!="..")
-					{
-						if(ltype=='d')
-						{
-							stringbuffer_size+=sizeof(int64);
-						}
 
-						++lines;
-						stringbuffer_size+=name.size()+1;
-					}
-					name.clear();
-					ltype=0;
-				}
-			}		
+				return true;
+			}
 		}
 	}
-	while(read>0);
-
-	in.clear();
-	name.clear();
-	in.seekg(0, std::ios::beg);
-
-
-	size_t stringbuffer_pos=0;
-	stringbuffer.resize(stringbuffer_size+5);
-	
-	
-	state=0;
-	bool isdir=false;
-	std::string data;
-	std::stack<TreeNode*> parents;
-	std::stack<TreeNode*> lastNodes;
-	bool firstChild=true;
-
-	size_t idx=1;
-	nodes.resize(lines+1);
-
-	std::string root_str = "root";
-	memcpy(&stringbuffer[0], root_str.c_str(), root_str.size()+1);
-	stringbuffer_pos+=root_str.size()+1;
-
-	nodes[0].setName(&stringbuffer[0]);
-
-	parents.push(&nodes[0]);
-	lastNodes.push(&nodes[0]);
-
-	lines=0;
-
+}
 
-	do
+bool TreeReader::nextBinary(STreeEntry& entry)
+{
+	size_t needed=1;
+	while(true)
 	{
-		in.read(buffer, buffer_size);
-		read=(size_t)in.gcount();
-		
-		for(size_t i=0;i<read;++i)
+		if(buffer.size()-buffer_pos>=needed)
 		{
-			const char ch=buffer[i];
-			switch(state)
-			{
-				case 0:
-					if(ch=='f')
-					{
-						data+='f';
-						state=1;
-					}
-					else if(ch=='d')
-					{
-						data+='d';
-						state=1;
-					}
-					else if(ch=='u')
-					{
-						name="..";
-						state=10;
-					}
-					else
-					{
-						Log("Error parsing file readTree - 1. Expected 'f', 'd', or 'u'. Got '" + std::string(1, ch) + "' at line " + convert(lines)+" while reading "+fn);
-						return false;
-					}					
-					break;
-				case 1:
-					//"
-					state=2;
-					break;
-				case 2:
-					if(ch=='"')
-					{
-						state=3;
-					}
-					else if(ch=='\\')
-					{
-						state=5;
-					}
-					else
-					{
-						name+=ch;
-					}
-					break;
-				case 5:
-					if(ch!='\"' && ch!='\\')
-					{
-						name+='\\';
-					}
-					name+=ch;
-					state=2;
-					break;
-				case 3:
-					if(ch==' ')
-					{
-						state=4;
-						break;
-					}
-					else
-					{
-						state=10;
-					}
-				case 4:
-					if(state==4)
-					{
-						if(ch!='\n')
-						{
-							data+=ch;
-							break;
-						}
-					}
-				case 10:
-					if(ch=='\n')
-					{
-						if(name!="..")
-						{
-							memcpy(&stringbuffer[stringbuffer_pos], name.c_str(), name.size()+1);
-							nodes[idx].setName(&stringbuffer[stringbuffer_pos]);
-							stringbuffer_pos+=name.size()+1;
-							nodes[idx].setId(lines);
-
-							char ch=data[0];
-							nodes[idx].setType(ch);
-							if(ch=='f')
-							{
-								std::string sdata=data.substr(1);
-								std::string filesize=getuntil(" ", sdata);
-								std::string last_mod=getafter(" ", sdata);
-
-								_i64 ifilesize=os_atoi64(filesize);
-								_i64 ilast_mod=os_atoi64(last_mod);
+			size_t consumed;
+			EBinaryRecord rc=decodeBinaryFileListRecord(&buffer[buffer_pos], buffer.size()-buffer_pos,
+				consumed, needed, bin_data, NULL);
 
-								char* ndata=&stringbuffer[stringbuffer_pos];
-								memcpy(&stringbuffer[stringbuffer_pos], &ifilesize, sizeof(_i64));
-								stringbuffer_pos+=sizeof(_i64);
-								memcpy(&stringbuffer[stringbuffer_pos], &ilast_mod, sizeof(_i64));
-								stringbuffer_pos+=sizeof(_i64);
+			if(rc==EBinaryRecord_Entry)
+			{
+				buffer_pos+=consumed;
+				entry.id=line;
+				++line;
 
-								nodes[idx].setData(ndata);
-							}
-							else
-							{
-								std::string sdata=data.substr(1);
-								std::string last_mod=getafter(" ", sdata);
+				if(bin_data.isdir && bin_data.name=="..")
+				{
+					entry.type='u';
+				}
+				else if(bin_data.isdir)
+				{
+					entry.type='d';
+					entry.data[0]=bin_data.last_modified;
+					entry.data[1]=0;
+				}
+				else
+				{
+					entry.type='f';
+					entry.data[0]=bin_data.size;
+					entry.data[1]=bin_data.last_modified;
+				}
+				entry.name=bin_data.name;
+				return true;
+			}
+			else if(rc==EBinaryRecord_End)
+			{
+				return false;
+			}
+			else if(rc==EBinaryRecord_Error)
+			{
+				Log("Error parsing binary file list at entry "+convert(line)+" while reading "+fn);
+				error=true;
+				return false;
+			}
+		}
 
-								_i64 ilast_mod=os_atoi64(last_mod);
-								char* ndata=&stringbuffer[stringbuffer_pos];
+		if(eof)
+		{
+			Log("Binary file list \"" + fn + "\" is truncated at entry "+convert(line));
+			error=true;
+			return false;
+		}
 
-								memcpy(&stringbuffer[stringbuffer_pos], &ilast_mod, sizeof(_i64));
-								stringbuffer_pos+=sizeof(_i64);
+		//Keep the incomplete record and append the next block
+		buffer_offset+=buffer_pos;
+		buffer.erase(0, buffer_pos);
+		buffer_pos=0;
 
-								nodes[idx].setData(ndata);
-							}
+		size_t old_size=buffer.size();
+		size_t to_read=(std::max)(buffer_size, needed);
+		buffer.resize(old_size+to_read);
+		in.read(&buffer[old_size], to_read);
+		size_t read=(size_t)in.gcount();
+		buffer.resize(old_size+read);
 
-							if(firstChild)
-							{
-								lastNodes.push(&nodes[idx]);
-								firstChild=false;
-							}
-							else
-							{
-								lastNodes.top()->setNextSibling(&nodes[idx]);
-								lastNodes.pop();
-								lastNodes.push(&nodes[idx]);
-							}
+		if(read<to_read)
+		{
+			eof=true;
+		}
+	}
+}
 
-							if(!parents.empty())
-							{
-								parents.top()->incrementNumChildren();
-								nodes[idx].setParent(parents.top());
-							}
+bool TreeReader::hasError()
+{
+	return error;
+}
 
-							if(ch=='d')
-							{
-								parents.push(&nodes[idx]);
-								firstChild=true;
-							}
+int64 TreeReader::getPos()
+{
+	return buffer_offset+buffer_pos;
+}
 
-							++idx;
-						}
-						else
-						{
-							if(!parents.empty())
-							{
-								parents.pop();
-							}
-							else
-							{
-								Log("TreeReader: parents empty");
-								return false;
-							}
-							if(!firstChild)
-							{
-								if(lastNodes.empty())
-								{
-									Log("TreeReader: lastNodes empty");
-									return false;
-								}
-								lastNodes.top()->setNextSibling(NULL);
-								lastNodes.pop();
-							}
-							firstChild=false;
-						}
+size_t TreeReader::getLine()
+{
+	return line;
+}
 
-						name.clear();
-						data.clear();
-						state=0;
-						++lines;
-					}
-			}		
-		}
+bool TreeReader::seek(int64 pos, size_t pline)
+{
+	if(pos>=buffer_offset
+		&& pos<=buffer_offset+static_cast<int64>(buffer.size()))
+	{
+		buffer_pos=static_cast<size_t>(pos-buffer_offset);
+		line=pline;
+		return true;
 	}
-	while(read==buffer_size);
-
-	assert(idx == nodes.size());
-	assert(stringbuffer_pos == stringbuffer.size());
 
-	nodes[0].setNextSibling(NULL);
+	in.clear();
+	in.seekg(pos, std::ios::beg);
+	if(!in.good())
+	{
+		Log("Error seeking in file tree \""+fn+"\"");
+		error=true;
+		return false;
+	}
 
+	buffer.clear();
+	buffer_pos=0;
+	buffer_offset=pos;
+	eof=false;
+	line=pline;
 	return true;
 }
 
@@ -366,8 +316,3 @@ void TreeReader::Log(const std::string &str)
 {
 	Server->Log(str, LL_ERROR);
 }
-
-std::vector<TreeNode> * TreeReader::getNodes(void)
-{
-	return &nodes;
-}
\ No newline at end of file
@@ -1,15 +1,69 @@
-#include "TreeNode.h"
+#pragma once
+#include "../../Interface/Types.h"
+#include "../../urbackupcommon/os_functions.h"
+#include <string>
+#include <fstream>
 
+/**
+* Entry of a file list. Type is 'f' (file), 'd' (directory) or 'u' (end of directory).
+* The id is the line number of the entry.
+*/
+struct STreeEntry
+{
+	STreeEntry()
+		: type(0), id(0)
+	{
+		data[0] = 0;
+		data[1] = 0;
+	}
+
+	char type;
+	std::string name;
+	//File: size and last modification. Directory: last modification.
+	int64 data[2];
+	size_t id;
+};
+
+/**
+* Reads a file list (text or binary format) entry by entry without keeping
+* it in memory
+*/
 class TreeReader
 {
 public:
-	bool readTree(const std::string &fn);
+	TreeReader();
+
+	bool open(const std::string &fn);
+
+	//Returns false at the end of the file or on error
+	bool next(STreeEntry& entry);
+
+	bool hasError();
+
+	//Position and line number of the next entry
+	int64 getPos();
+	size_t getLine();
+
+	bool seek(int64 pos, size_t line);
 
-	std::vector<TreeNode> * getNodes(void);
 private:
 
 	void Log(const std::string &str);
 
-	std::vector<TreeNode> nodes;
-	std::vector<char> stringbuffer;
-};
\ No newline at end of file
+	bool nextBinary(STreeEntry& entry);
+
+	std::string fn;
+	std::fstream in;
+
+	std::string buffer;
+	size_t buffer_pos;
+	int64 buffer_offset;
+	bool eof;
+
+	size_t line;
+	bool error;
+	bool binary;
+
+	std::string data;
+	SFile bin_data;
+};
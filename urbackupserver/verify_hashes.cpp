@@ -21,6 +21,7 @@
 #include "../Interface/File.h"
 #include "../Interface/DatabaseCursor.h"
 #include "database.h"
+#include "files_db_shards.h"
 #include "../stringtools.h"
 #include <iostream>
 #include <fstream>
@@ -245,6 +246,12 @@ bool verify_hashes(std::string arg)
 
 	IDatabase *files_db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
 
+	std::vector<IDatabase*> files_dbs;
+	for (size_t i = 0; i < files_db_shard_count(); ++i)
+	{
+		files_dbs.push_back(Server->getDatabase(Server->getThreadID(), files_db_shard_dbid(i)));
+	}
+
 	if(!clientname.empty())
 	{
 		if(clientname!="*")
@@ -329,22 +336,32 @@ bool verify_hashes(std::string arg)
 
 			if (!temp_create_query.empty())
 			{
-				files_db->Write("CREATE TEMPORARY TABLE backups (id INTEGER PRIMARY KEY)");
+				std::vector<IQuery*> q_inserts;
+				for (size_t i = 0; i < files_dbs.size(); ++i)
+				{
+					files_dbs[i]->Write("CREATE TEMPORARY TABLE backups (id INTEGER PRIMARY KEY)");
+					q_inserts.push_back(files_dbs[i]->Prepare("INSERT INTO backups (id) VALUES (?)", false));
+				}
 
-				IQuery* q_insert = files_db->Prepare("INSERT INTO backups (id) VALUES (?)", false);
 				IQuery* q_backup_ids = db->Prepare(temp_create_query, false);
 				IDatabaseCursor* cur = q_backup_ids->Cursor();
 
 				db_single_result res;
 				while (cur->next(res))
 				{
-					q_insert->Bind(res["id"]);
-					q_insert->Write();
-					q_insert->Reset();
+					for (size_t i = 0; i < q_inserts.size(); ++i)
+					{
+						q_inserts[i]->Bind(res["id"]);
+						q_inserts[i]->Write();
+						q_inserts[i]->Reset();
+					}
 				}
 
 				db->destroyQuery(q_backup_ids);
-				files_db->destroyQuery(q_insert);
+				for (size_t i = 0; i < q_inserts.size(); ++i)
+				{
+					files_dbs[i]->destroyQuery(q_inserts[i]);
+				}
 			}
 		}
 	}
@@ -355,72 +372,81 @@ bool verify_hashes(std::string arg)
 
 	
 	std::cout << "Calculating filesize..." << std::endl;
-	IQuery *q_num_files = files_db->Prepare("SELECT SUM(filesize) AS c FROM files WHERE filesize>0 AND "+filter);
-	db_results res=q_num_files->Read();
-	if(res.empty())
+	_i64 verify_size=0;
+	for (size_t i = 0; i < files_dbs.size(); ++i)
 	{
-		Server->Log("Error during filesize calculation.", LL_ERROR);
-		return false;
-	}
+		IQuery *q_num_files = files_dbs[i]->Prepare("SELECT SUM(filesize) AS c FROM files WHERE filesize>0 AND "+filter);
+		db_results res=q_num_files->Read();
+		if(res.empty())
+		{
+			Server->Log("Error during filesize calculation.", LL_ERROR);
+			return false;
+		}
 
-	_i64 verify_size=watoi64(res[0]["c"]);
+		verify_size+=watoi64(res[0]["c"]);
+	}
 	_i64 curr_verified=0;
 
 	std::cout << "To be verified: " << PrettyPrintBytes(verify_size) << " of files" << std::endl;
 
 	_i64 crowid=0;
 
-	IQuery *q_get_files = files_db->Prepare("SELECT id, fullpath, shahash, filesize, backupid FROM files WHERE "+filter, false);
 	IQuery* q_get_backuppath = db->Prepare("SELECT path FROM backups WHERE id=?", false);
 
 	bool is_okay=true;
 
-	IDatabaseCursor* cursor = q_get_files->Cursor();
-
 	std::vector<int64> todelete;
 	std::vector<int64> missing_files;
 	std::map<int, std::string> backuppaths;
 
-	db_single_result res_single;
-	while(cursor->next(res_single))
+	for (size_t shard = 0; shard < files_dbs.size(); ++shard)
 	{
-		int backupid = watoi(res_single["backupid"]);
-		std::string backuppath;
-		std::map<int, std::string>::iterator it_backuppath = backuppaths.find(backupid);
-		if (it_backuppath == backuppaths.end())
-		{
-			q_get_backuppath->Bind(backupid);
-			db_results res_backuppath = q_get_backuppath->Read();
-			q_get_backuppath->Reset();
-			if (!res_backuppath.empty())
-			{
-				backuppath = res_backuppath[0]["path"];
-				backuppaths.insert(std::make_pair(backupid, backuppath));
-			}
-		}
-		else
-		{
-			backuppath = it_backuppath->second;
-		}
+		IQuery *q_get_files = files_dbs[shard]->Prepare("SELECT id, fullpath, shahash, filesize, backupid FROM files WHERE "+filter, false);
+		IDatabaseCursor* cursor = q_get_files->Cursor();
 
-		bool is_missing=false;
-		if(! verify_file( res_single, curr_verified, verify_size, is_missing, backuppath) )
+		db_single_result res_single;
+		while(cursor->next(res_single))
 		{
-			if(!is_missing)
+			int backupid = watoi(res_single["backupid"]);
+			std::string backuppath;
+			std::map<int, std::string>::iterator it_backuppath = backuppaths.find(backupid);
+			if (it_backuppath == backuppaths.end())
 			{
-				v_failure << "Verification of \"" << (res_single["fullpath"]) << "\" failed\r\n";
-				is_okay=false;
-
-				if(delete_failed)
+				q_get_backuppath->Bind(backupid);
+				db_results res_backuppath = q_get_backuppath->Read();
+				q_get_backuppath->Reset();
+				if (!res_backuppath.empty())
 				{
-					todelete.push_back(watoi64(res_single["id"]));
+					backuppath = res_backuppath[0]["path"];
+					backuppaths.insert(std::make_pair(backupid, backuppath));
 				}
 			}
 			else
 			{
-				missing_files.push_back(watoi64(res_single["id"]));
-			}			
+				backuppath = it_backuppath->second;
+			}
+
+			bool is_missing=false;
+			if(! verify_file( res_single, curr_verified, verify_size, is_missing, backuppath) )
+			{
+				if(!is_missing)
+				{
+					v_failure << "Verification of \"" << (res_single["fullpath"]) << "\" failed\r\n";
+					is_okay=false;
+
+					if(delete_failed)
+					{
+						todelete.push_back(watoi64(res_single["id"]));
+					}
+				}
+				else
+				{
+					missing_files.push_back(watoi64(res_single["id"]));
+				}			
+			}
 		}
+
+		files_dbs[shard]->destroyQuery(q_get_files);
 	}
 
 	std::cout << std::endl;
@@ -431,17 +457,21 @@ bool verify_hashes(std::string arg)
 		Server->deleteFile(v_output_fn);
 	}
 
-	files_db->destroyQuery(q_get_files);
 	db->destroyQuery(q_get_backuppath);
 
-	IQuery* q_get_file = files_db->Prepare("SELECT id, fullpath, shahash, filesize, backupid FROM files WHERE id=?");
-
 	if (missing_files.size() > 0)
 	{
 		std::cout << missing_files.size() << " could not be opened during verification. Checking now if they have been deleted from the database..." << std::endl;
 
+		std::vector<IQuery*> q_get_file_shards;
+		for (size_t shard = 0; shard < files_dbs.size(); ++shard)
+		{
+			q_get_file_shards.push_back(files_dbs[shard]->Prepare("SELECT id, fullpath, shahash, filesize, backupid FROM files WHERE id=?"));
+		}
+
 		for (size_t i = 0; i < missing_files.size(); ++i)
 		{
+			IQuery* q_get_file = q_get_file_shards[files_db_shard_for_entry(missing_files[i])];
 			q_get_file->Bind(missing_files[i]);
 			db_results res = q_get_file->Read();
 			q_get_file->Reset();